@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "guac_cost_model.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Fits the line best describing the given weighted sums, as produced by
+ * least squares.
+ *
+ * @param model The cost model containing the sums of areas.
+ * @param sum The weighted sum of the measured values.
+ * @param sum_product The weighted sum of the product of area and measured
+ *                    value.
+ * @param intercept Storage for the value at an area of zero.
+ * @param slope Storage for the increase in value per pixel.
+ */
+static void __guac_common_cost_model_fit_line(guac_common_cost_model* model,
+        double sum, double sum_product, double* intercept, double* slope) {
+
+    double mean_area = model->sum_area / model->weight;
+    double mean = sum / model->weight;
+    double variance = model->sum_area_squared / model->weight
+                    - mean_area * mean_area;
+
+    *slope = (sum_product / model->weight - mean_area * mean) / variance;
+    *intercept = mean - *slope * mean_area;
+
+}
+
+/**
+ * Recalculates the state of the given cost model from its pinned costs and
+ * the measurements recorded so far. The lock of the model must be held.
+ *
+ * @param model The cost model to recalculate.
+ */
+static void __guac_common_cost_model_fit(guac_common_cost_model* model) {
+
+    guac_common_cost_model_stats* stats = &(model->stats);
+
+    double update_cost = 0;
+    double pixel_cost = 0;
+    int fitted = 0;
+
+    /* Fit costs only if updates of several sizes have been measured */
+    if (stats->samples >= GUAC_COMMON_COST_MODEL_MIN_SAMPLES) {
+
+        double mean_area = model->sum_area / model->weight;
+        double variance = model->sum_area_squared / model->weight
+                        - mean_area * mean_area;
+
+        if (variance >= 1.0) {
+
+            double time_intercept, time_slope;
+            double bytes_intercept, bytes_slope;
+
+            /* Convert encoded size to the time needed to send it */
+            double byte_cost = 1000000000.0 / model->bandwidth;
+
+            __guac_common_cost_model_fit_line(model, model->sum_time,
+                    model->sum_area_time, &time_intercept, &time_slope);
+
+            __guac_common_cost_model_fit_line(model, model->sum_bytes,
+                    model->sum_area_bytes, &bytes_intercept, &bytes_slope);
+
+            update_cost = time_intercept * 1000.0 + bytes_intercept * byte_cost;
+            pixel_cost  = time_slope     * 1000.0 + bytes_slope     * byte_cost;
+
+            /* Ignore fits which make no physical sense */
+            if (pixel_cost > 0) {
+                if (update_cost < 0)
+                    update_cost = 0;
+                fitted = 1;
+            }
+
+        }
+
+    }
+
+    /* Pinned costs always take priority */
+    if (model->pinned_update_cost > 0)
+        update_cost = model->pinned_update_cost;
+
+    if (model->pinned_pixel_cost > 0)
+        pixel_cost = model->pinned_pixel_cost;
+
+    stats->calibrated = fitted || (model->pinned_update_cost > 0
+                                && model->pinned_pixel_cost > 0);
+    stats->update_cost = update_cost;
+    stats->pixel_cost = pixel_cost;
+
+    /* Express update cost in pixels, within sane bounds */
+    if (stats->calibrated) {
+
+        double base_cost = update_cost / pixel_cost;
+
+        if (base_cost < GUAC_COMMON_COST_MODEL_MIN_BASE_COST)
+            base_cost = GUAC_COMMON_COST_MODEL_MIN_BASE_COST;
+        else if (base_cost > GUAC_COMMON_COST_MODEL_MAX_BASE_COST)
+            base_cost = GUAC_COMMON_COST_MODEL_MAX_BASE_COST;
+
+        stats->base_cost = (int) base_cost;
+
+    }
+
+    else
+        stats->base_cost = GUAC_COMMON_COST_MODEL_DEFAULT_BASE_COST;
+
+}
+
+guac_common_cost_model* guac_common_cost_model_alloc() {
+
+    guac_common_cost_model* model = calloc(1, sizeof(guac_common_cost_model));
+    if (model == NULL)
+        return NULL;
+
+    model->bandwidth = GUAC_COMMON_COST_MODEL_DEFAULT_BANDWIDTH;
+    model->stats.base_cost = GUAC_COMMON_COST_MODEL_DEFAULT_BASE_COST;
+    pthread_mutex_init(&(model->lock), NULL);
+
+    return model;
+
+}
+
+void guac_common_cost_model_free(guac_common_cost_model* model) {
+    pthread_mutex_destroy(&(model->lock));
+    free(model);
+}
+
+void guac_common_cost_model_pin(guac_common_cost_model* model,
+        double update_cost, double pixel_cost) {
+
+    pthread_mutex_lock(&(model->lock));
+
+    model->pinned_update_cost = update_cost > 0 ? update_cost : 0;
+    model->pinned_pixel_cost  = pixel_cost  > 0 ? pixel_cost  : 0;
+    __guac_common_cost_model_fit(model);
+
+    pthread_mutex_unlock(&(model->lock));
+
+}
+
+void guac_common_cost_model_set_bandwidth(guac_common_cost_model* model,
+        int bandwidth) {
+
+    if (bandwidth <= 0)
+        return;
+
+    pthread_mutex_lock(&(model->lock));
+
+    model->bandwidth = bandwidth;
+    __guac_common_cost_model_fit(model);
+
+    pthread_mutex_unlock(&(model->lock));
+
+}
+
+void guac_common_cost_model_record(guac_common_cost_model* model,
+        int area, uint64_t bytes, uint64_t time) {
+
+    double x = area;
+
+    pthread_mutex_lock(&(model->lock));
+
+    /* Age all previous measurements */
+    model->weight           *= GUAC_COMMON_COST_MODEL_DECAY;
+    model->sum_area         *= GUAC_COMMON_COST_MODEL_DECAY;
+    model->sum_area_squared *= GUAC_COMMON_COST_MODEL_DECAY;
+    model->sum_time         *= GUAC_COMMON_COST_MODEL_DECAY;
+    model->sum_area_time    *= GUAC_COMMON_COST_MODEL_DECAY;
+    model->sum_bytes        *= GUAC_COMMON_COST_MODEL_DECAY;
+    model->sum_area_bytes   *= GUAC_COMMON_COST_MODEL_DECAY;
+
+    /* Add new measurement at full weight */
+    model->weight           += 1;
+    model->sum_area         += x;
+    model->sum_area_squared += x * x;
+    model->sum_time         += time;
+    model->sum_area_time    += x * time;
+    model->sum_bytes        += bytes;
+    model->sum_area_bytes   += x * bytes;
+
+    model->stats.samples++;
+    __guac_common_cost_model_fit(model);
+
+    pthread_mutex_unlock(&(model->lock));
+
+}
+
+int guac_common_cost_model_get_base_cost(guac_common_cost_model* model) {
+
+    int base_cost;
+
+    pthread_mutex_lock(&(model->lock));
+    base_cost = model->stats.base_cost;
+    pthread_mutex_unlock(&(model->lock));
+
+    return base_cost;
+
+}
+
+void guac_common_cost_model_get_stats(guac_common_cost_model* model,
+        guac_common_cost_model_stats* stats) {
+
+    pthread_mutex_lock(&(model->lock));
+    *stats = model->stats;
+    pthread_mutex_unlock(&(model->lock));
+
+}
+
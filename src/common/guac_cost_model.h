@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_COST_MODEL_H
+#define __GUAC_COST_MODEL_H
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The fixed cost of each update, in units of the cost of a single pixel,
+ * used until enough measurements have been recorded to fit the actual cost.
+ */
+#define GUAC_COMMON_COST_MODEL_DEFAULT_BASE_COST 4096
+
+/**
+ * The smallest fixed cost of each update, in units of the cost of a single
+ * pixel, which will be derived from measurements. Lower values would allow
+ * updates to be split into arbitrarily many tiny updates.
+ */
+#define GUAC_COMMON_COST_MODEL_MIN_BASE_COST 64
+
+/**
+ * The largest fixed cost of each update, in units of the cost of a single
+ * pixel, which will be derived from measurements. Higher values would allow
+ * all updates to be combined into one, however large.
+ */
+#define GUAC_COMMON_COST_MODEL_MAX_BASE_COST 1048576
+
+/**
+ * The number of updates which must be recorded before costs are fitted to
+ * measurements.
+ */
+#define GUAC_COMMON_COST_MODEL_MIN_SAMPLES 16
+
+/**
+ * The factor by which the weight of all previously-recorded measurements is
+ * reduced each time a new measurement is recorded, such that the fitted
+ * costs follow changes in conditions.
+ */
+#define GUAC_COMMON_COST_MODEL_DECAY 0.98
+
+/**
+ * The assumed bandwidth available to the client, in bytes per second, used
+ * to convert the size of updates into time unless a different bandwidth is
+ * given with guac_common_cost_model_set_bandwidth().
+ */
+#define GUAC_COMMON_COST_MODEL_DEFAULT_BANDWIDTH 1250000
+
+/**
+ * The current state of a cost model.
+ */
+typedef struct guac_common_cost_model_stats {
+
+    /**
+     * The number of updates measured.
+     */
+    uint64_t samples;
+
+    /**
+     * Non-zero if update_cost and pixel_cost are known, either because both
+     * have been pinned, or because they have been fitted to measurements,
+     * zero if the default base cost is in use.
+     */
+    int calibrated;
+
+    /**
+     * The fixed cost of each update, regardless of its size, in
+     * nanoseconds.
+     */
+    double update_cost;
+
+    /**
+     * The cost of each pixel within an update, in nanoseconds.
+     */
+    double pixel_cost;
+
+    /**
+     * The fixed cost of each update in units of the cost of a single pixel,
+     * as used when deciding whether updates should be combined.
+     */
+    int base_cost;
+
+} guac_common_cost_model_stats;
+
+/**
+ * Model of the cost of sending an image update, as a fixed cost per update
+ * plus a cost per pixel. Both costs are fitted, using exponentially-weighted
+ * least squares, to the measured encoding time and encoded size of each
+ * update sent, with size converted to time using the available bandwidth.
+ * Either cost may instead be pinned to a given value. A single model may be
+ * shared by all surfaces of a connection.
+ */
+typedef struct guac_common_cost_model {
+
+    /**
+     * The bandwidth available to the client, in bytes per second.
+     */
+    int bandwidth;
+
+    /**
+     * The pinned cost of each update, in nanoseconds, or zero if this cost
+     * should be fitted.
+     */
+    double pinned_update_cost;
+
+    /**
+     * The pinned cost of each pixel, in nanoseconds, or zero if this cost
+     * should be fitted.
+     */
+    double pinned_pixel_cost;
+
+    /**
+     * The total weight of all measurements.
+     */
+    double weight;
+
+    /**
+     * The weighted sum of the area of each update, in pixels.
+     */
+    double sum_area;
+
+    /**
+     * The weighted sum of the square of the area of each update.
+     */
+    double sum_area_squared;
+
+    /**
+     * The weighted sum of the encoding time of each update, in
+     * microseconds.
+     */
+    double sum_time;
+
+    /**
+     * The weighted sum of the product of the area and encoding time of each
+     * update.
+     */
+    double sum_area_time;
+
+    /**
+     * The weighted sum of the encoded size of each update, in bytes.
+     */
+    double sum_bytes;
+
+    /**
+     * The weighted sum of the product of the area and encoded size of each
+     * update.
+     */
+    double sum_area_bytes;
+
+    /**
+     * The current state of this model.
+     */
+    guac_common_cost_model_stats stats;
+
+    /**
+     * Lock which must be held while the model is read or modified.
+     */
+    pthread_mutex_t lock;
+
+} guac_common_cost_model;
+
+/**
+ * Allocates a new cost model which has no measurements and no pinned costs,
+ * and thus initially uses GUAC_COMMON_COST_MODEL_DEFAULT_BASE_COST.
+ *
+ * @return A newly-allocated cost model, or NULL if the cost model could not
+ *         be allocated.
+ */
+guac_common_cost_model* guac_common_cost_model_alloc();
+
+/**
+ * Frees the given cost model.
+ *
+ * @param model The cost model to free.
+ */
+void guac_common_cost_model_free(guac_common_cost_model* model);
+
+/**
+ * Pins the fixed cost of each update and the cost of each pixel of the given
+ * model to the given values, which are otherwise fitted to measurements.
+ *
+ * @param model The cost model to modify.
+ * @param update_cost The fixed cost of each update, in nanoseconds, or zero
+ *                    to fit this cost to measurements.
+ * @param pixel_cost The cost of each pixel, in nanoseconds, or zero to fit
+ *                   this cost to measurements.
+ */
+void guac_common_cost_model_pin(guac_common_cost_model* model,
+        double update_cost, double pixel_cost);
+
+/**
+ * Sets the bandwidth available to the client, used to convert the encoded
+ * size of updates into time. Costs are refitted immediately.
+ *
+ * @param model The cost model to modify.
+ * @param bandwidth The bandwidth available, in bytes per second.
+ */
+void guac_common_cost_model_set_bandwidth(guac_common_cost_model* model,
+        int bandwidth);
+
+/**
+ * Records the measured cost of a single update, refitting the costs of the
+ * given model. This function is threadsafe.
+ *
+ * @param model The cost model to update.
+ * @param area The number of pixels within the update.
+ * @param bytes The encoded size of the update, in bytes.
+ * @param time The time taken to encode and send the update, in
+ *             microseconds.
+ */
+void guac_common_cost_model_record(guac_common_cost_model* model,
+        int area, uint64_t bytes, uint64_t time);
+
+/**
+ * Returns the fixed cost of each update in units of the cost of a single
+ * pixel, for use when deciding whether updates should be combined.
+ *
+ * @param model The cost model to query.
+ * @return The fixed cost of each update, in pixels.
+ */
+int guac_common_cost_model_get_base_cost(guac_common_cost_model* model);
+
+/**
+ * Copies the current state of the given cost model into the given structure.
+ *
+ * @param model The cost model to query.
+ * @param stats The structure to copy the state of the model into.
+ */
+void guac_common_cost_model_get_stats(guac_common_cost_model* model,
+        guac_common_cost_model_stats* stats);
+
+#endif
+
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "guac_image_cache.h"
+
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/hash.h>
+#include <guacamole/layer.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Returns the number of bytes charged against the budget of a cache for an
+ * image of the given size.
+ *
+ * @param width The width of the image, in pixels.
+ * @param height The height of the image, in pixels.
+ * @return The number of bytes charged for the image.
+ */
+static size_t __guac_common_image_cache_size(int width, int height) {
+    return (size_t) width * height * 4;
+}
+
+/**
+ * Removes the given entry from the recently-used list of the given cache.
+ *
+ * @param cache The cache containing the entry.
+ * @param entry The entry to remove.
+ */
+static void __guac_common_image_cache_unlink(guac_common_image_cache* cache,
+        guac_common_image_cache_entry* entry) {
+
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        cache->newest = entry->older;
+
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        cache->oldest = entry->newer;
+
+    entry->newer = NULL;
+    entry->older = NULL;
+
+}
+
+/**
+ * Adds the given entry to the recently-used list of the given cache as the
+ * most recently used entry. The entry must not already be in the list.
+ *
+ * @param cache The cache to add the entry to.
+ * @param entry The entry to add.
+ */
+static void __guac_common_image_cache_link(guac_common_image_cache* cache,
+        guac_common_image_cache_entry* entry) {
+
+    entry->newer = NULL;
+    entry->older = cache->newest;
+
+    if (cache->newest != NULL)
+        cache->newest->newer = entry;
+    else
+        cache->oldest = entry;
+
+    cache->newest = entry;
+
+}
+
+/**
+ * Searches the given cache for an entry holding an image identical to the
+ * given image. The cache lock must be held.
+ *
+ * @param cache The cache to search.
+ * @param image The image to search for.
+ * @param hash The hash of the image.
+ * @return The matching entry, or NULL if no such entry exists.
+ */
+static guac_common_image_cache_entry* __guac_common_image_cache_find(
+        guac_common_image_cache* cache, cairo_surface_t* image,
+        unsigned int hash) {
+
+    guac_common_image_cache_entry* entry =
+        cache->buckets[hash % GUAC_COMMON_IMAGE_CACHE_BUCKETS];
+
+    for (; entry != NULL; entry = entry->next_in_bucket) {
+        if (entry->hash == hash && guac_surface_cmp(entry->image, image) == 0)
+            return entry;
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Removes the given entry from the given cache and frees it, returning its
+ * buffer to the client. The cache lock must be held.
+ *
+ * @param cache The cache containing the entry.
+ * @param entry The entry to free.
+ */
+static void __guac_common_image_cache_remove(guac_common_image_cache* cache,
+        guac_common_image_cache_entry* entry) {
+
+    guac_common_image_cache_entry** current =
+        &cache->buckets[entry->hash % GUAC_COMMON_IMAGE_CACHE_BUCKETS];
+
+    /* Remove from bucket */
+    while (*current != entry)
+        current = &(*current)->next_in_bucket;
+    *current = entry->next_in_bucket;
+
+    __guac_common_image_cache_unlink(cache, entry);
+
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->size;
+
+    guac_client_free_buffer(cache->client, entry->buffer);
+    cairo_surface_destroy(entry->image);
+    free(entry);
+
+}
+
+guac_common_image_cache* guac_common_image_cache_alloc(guac_client* client,
+        size_t max_bytes) {
+
+    guac_common_image_cache* cache = calloc(1, sizeof(guac_common_image_cache));
+    if (cache == NULL)
+        return NULL;
+
+    cache->client = client;
+    cache->max_bytes = max_bytes;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+
+}
+
+void guac_common_image_cache_free(guac_common_image_cache* cache) {
+
+    while (cache->oldest != NULL)
+        __guac_common_image_cache_remove(cache, cache->oldest);
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+
+}
+
+int guac_common_image_cache_accepts(guac_common_image_cache* cache,
+        int width, int height) {
+
+    /* Allow no single image more than a quarter of the budget */
+    return width * height >= GUAC_COMMON_IMAGE_CACHE_MIN_AREA
+        && __guac_common_image_cache_size(width, height) <= cache->max_bytes / 4;
+
+}
+
+guac_common_image_cache_entry* guac_common_image_cache_lookup(
+        guac_common_image_cache* cache, cairo_surface_t* image,
+        unsigned int hash) {
+
+    guac_common_image_cache_entry* entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = __guac_common_image_cache_find(cache, image, hash);
+
+    /* Pin and mark as most recently used */
+    if (entry != NULL) {
+        __guac_common_image_cache_unlink(cache, entry);
+        __guac_common_image_cache_link(cache, entry);
+        entry->pins++;
+        cache->stats.hits++;
+    }
+    else
+        cache->stats.misses++;
+
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+
+}
+
+void guac_common_image_cache_send(guac_common_image_cache* cache,
+        guac_common_image_cache_entry* entry, guac_socket* socket,
+        const guac_layer* layer, int x, int y) {
+
+    guac_protocol_send_copy(socket, entry->buffer, 0, 0,
+            cairo_image_surface_get_width(entry->image),
+            cairo_image_surface_get_height(entry->image),
+            GUAC_COMP_OVER, layer, x, y);
+
+    pthread_mutex_lock(&cache->lock);
+    entry->pins--;
+    pthread_mutex_unlock(&cache->lock);
+
+}
+
+void guac_common_image_cache_store(guac_common_image_cache* cache,
+        guac_socket* socket, const guac_layer* layer, int x, int y,
+        cairo_surface_t* image, unsigned int hash) {
+
+    guac_common_image_cache_entry* entry;
+    guac_common_image_cache_entry* victim;
+
+    int width = cairo_image_surface_get_width(image);
+    int height = cairo_image_surface_get_height(image);
+    size_t size = __guac_common_image_cache_size(width, height);
+
+    unsigned char* src;
+    unsigned char* dst;
+    int src_stride, dst_stride;
+    int row;
+
+    pthread_mutex_lock(&cache->lock);
+
+    /* Do not store duplicates */
+    if (__guac_common_image_cache_find(cache, image, hash) != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    /* Evict least recently used entries until the image fits, skipping any
+     * entries which are pinned */
+    victim = cache->oldest;
+    while (victim != NULL && cache->stats.bytes + size > cache->max_bytes) {
+
+        guac_common_image_cache_entry* newer = victim->newer;
+
+        if (victim->pins == 0) {
+            guac_protocol_send_dispose(socket, victim->buffer);
+            __guac_common_image_cache_remove(cache, victim);
+            cache->stats.evictions++;
+        }
+
+        victim = newer;
+
+    }
+
+    /* Give up if everything remaining is pinned */
+    if (cache->stats.bytes + size > cache->max_bytes) {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    entry = malloc(sizeof(guac_common_image_cache_entry));
+    if (entry == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    /* Keep server-side copy for verifying future matches */
+    entry->image = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    if (cairo_surface_status(entry->image) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(entry->image);
+        free(entry);
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    entry->hash = hash;
+    entry->size = size;
+    entry->pins = 0;
+    entry->buffer = guac_client_alloc_buffer(cache->client);
+
+    src = cairo_image_surface_get_data(image);
+    dst = cairo_image_surface_get_data(entry->image);
+    src_stride = cairo_image_surface_get_stride(image);
+    dst_stride = cairo_image_surface_get_stride(entry->image);
+
+    cairo_surface_flush(entry->image);
+    for (row = 0; row < height; row++) {
+        memcpy(dst, src, width * 4);
+        src += src_stride;
+        dst += dst_stride;
+    }
+    cairo_surface_mark_dirty(entry->image);
+
+    /* Copy image from where it was just drawn into the new buffer */
+    guac_protocol_send_copy(socket, layer, x, y, width, height,
+            GUAC_COMP_OVER, entry->buffer, 0, 0);
+
+    /* Add to bucket and mark as most recently used */
+    entry->next_in_bucket = cache->buckets[hash % GUAC_COMMON_IMAGE_CACHE_BUCKETS];
+    cache->buckets[hash % GUAC_COMMON_IMAGE_CACHE_BUCKETS] = entry;
+    __guac_common_image_cache_link(cache, entry);
+
+    cache->stats.entries++;
+    cache->stats.bytes += size;
+
+    pthread_mutex_unlock(&cache->lock);
+
+}
+
+void guac_common_image_cache_get_stats(guac_common_image_cache* cache,
+        guac_common_image_cache_stats* stats) {
+
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+
+}
+
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __GUAC_IMAGE_CACHE_H
+#define __GUAC_IMAGE_CACHE_H
+
+#include "config.h"
+
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of hash buckets within each image cache.
+ */
+#define GUAC_COMMON_IMAGE_CACHE_BUCKETS 1024
+
+/**
+ * The minimum number of pixels an image must contain to be cached. Smaller
+ * images cost little to resend, and would only displace larger images.
+ */
+#define GUAC_COMMON_IMAGE_CACHE_MIN_AREA 256
+
+/**
+ * A single image known to be held within an off-screen buffer of the client.
+ */
+typedef struct guac_common_image_cache_entry {
+
+    /**
+     * The hash of the image, as returned by guac_hash_surface().
+     */
+    unsigned int hash;
+
+    /**
+     * A copy of the image, used to verify that a matching hash is not a
+     * collision.
+     */
+    cairo_surface_t* image;
+
+    /**
+     * The client-side buffer containing the image at its upper-left corner.
+     */
+    guac_layer* buffer;
+
+    /**
+     * The number of bytes charged against the cache budget for this entry.
+     */
+    size_t size;
+
+    /**
+     * The number of lookups which have returned this entry but have not yet
+     * sent it. Pinned entries are never evicted.
+     */
+    int pins;
+
+    /**
+     * The next entry within the same hash bucket, or NULL if this is the
+     * last.
+     */
+    struct guac_common_image_cache_entry* next_in_bucket;
+
+    /**
+     * The entry used more recently than this entry, or NULL if this entry is
+     * the most recently used.
+     */
+    struct guac_common_image_cache_entry* newer;
+
+    /**
+     * The entry used less recently than this entry, or NULL if this entry is
+     * the least recently used.
+     */
+    struct guac_common_image_cache_entry* older;
+
+} guac_common_image_cache_entry;
+
+/**
+ * Counters describing the effectiveness of an image cache.
+ */
+typedef struct guac_common_image_cache_stats {
+
+    /**
+     * The number of lookups which found a cached image.
+     */
+    uint64_t hits;
+
+    /**
+     * The number of lookups which found no cached image.
+     */
+    uint64_t misses;
+
+    /**
+     * The number of images evicted to make room for others.
+     */
+    uint64_t evictions;
+
+    /**
+     * The number of images currently cached.
+     */
+    int entries;
+
+    /**
+     * The number of bytes currently charged against the cache budget.
+     */
+    size_t bytes;
+
+} guac_common_image_cache_stats;
+
+/**
+ * Cache of images recently sent to a client, retained within off-screen
+ * buffers of that client such that any repeat can be drawn with a "copy"
+ * instruction rather than sent again. Images are looked up by content, and
+ * the least recently used images are evicted once the byte budget of the
+ * cache is reached. A single cache may be shared by all surfaces of a
+ * connection.
+ */
+typedef struct guac_common_image_cache {
+
+    /**
+     * The client owning the buffers used by this cache.
+     */
+    guac_client* client;
+
+    /**
+     * The maximum number of bytes of image data which may be cached, both
+     * server-side and within the buffers of the client.
+     */
+    size_t max_bytes;
+
+    /**
+     * Current counters, including the number of bytes cached.
+     */
+    guac_common_image_cache_stats stats;
+
+    /**
+     * All entries, indexed by hash.
+     */
+    guac_common_image_cache_entry* buckets[GUAC_COMMON_IMAGE_CACHE_BUCKETS];
+
+    /**
+     * The most recently used entry, or NULL if the cache is empty.
+     */
+    guac_common_image_cache_entry* newest;
+
+    /**
+     * The least recently used entry, or NULL if the cache is empty.
+     */
+    guac_common_image_cache_entry* oldest;
+
+    /**
+     * Lock which must be held while the cache is read or modified.
+     */
+    pthread_mutex_t lock;
+
+} guac_common_image_cache;
+
+/**
+ * Allocates a new, empty image cache whose buffers are allocated from the
+ * given client.
+ *
+ * @param client The client whose buffers should hold cached images.
+ * @param max_bytes The maximum number of bytes of image data to cache.
+ * @return A newly-allocated image cache, or NULL if the cache could not be
+ *         allocated.
+ */
+guac_common_image_cache* guac_common_image_cache_alloc(guac_client* client,
+        size_t max_bytes);
+
+/**
+ * Frees the given image cache, returning all of its buffers to the client.
+ * No instructions are sent.
+ *
+ * @param cache The image cache to free.
+ */
+void guac_common_image_cache_free(guac_common_image_cache* cache);
+
+/**
+ * Returns whether an image of the given size would be considered for
+ * caching. Images which are too small to be worth caching, or too large to
+ * fit within a reasonable portion of the budget, are never looked up or
+ * stored, and do not count as misses.
+ *
+ * @param cache The image cache to check.
+ * @param width The width of the image, in pixels.
+ * @param height The height of the image, in pixels.
+ * @return Non-zero if images of the given size may be cached, zero
+ *         otherwise.
+ */
+int guac_common_image_cache_accepts(guac_common_image_cache* cache,
+        int width, int height);
+
+/**
+ * Searches the given cache for an image identical to the given image. If
+ * found, the entry is marked as most recently used, and is pinned such that
+ * it cannot be evicted until guac_common_image_cache_send() is called.
+ *
+ * @param cache The image cache to search.
+ * @param image The image to search for.
+ * @param hash The hash of the image, as returned by guac_hash_surface().
+ * @return The cache entry holding an identical image, or NULL if no such
+ *         entry exists.
+ */
+guac_common_image_cache_entry* guac_common_image_cache_lookup(
+        guac_common_image_cache* cache, cairo_surface_t* image,
+        unsigned int hash);
+
+/**
+ * Draws the image held by the given entry at the given location, unpinning
+ * the entry.
+ *
+ * @param cache The image cache containing the entry.
+ * @param entry The entry to draw, as returned by
+ *              guac_common_image_cache_lookup().
+ * @param socket The socket to send the "copy" instruction on.
+ * @param layer The layer to draw the image within.
+ * @param x The X coordinate of the upper-left corner of the image.
+ * @param y The Y coordinate of the upper-left corner of the image.
+ */
+void guac_common_image_cache_send(guac_common_image_cache* cache,
+        guac_common_image_cache_entry* entry, guac_socket* socket,
+        const guac_layer* layer, int x, int y);
+
+/**
+ * Adds the given image, which has just been sent to the given location of
+ * the given layer, to the cache, copying it into a new buffer. The least
+ * recently used unpinned entries are evicted as necessary to remain within
+ * budget. If room cannot be made, an identical image is already cached, or
+ * the copy of the image cannot be allocated, nothing is stored.
+ *
+ * @param cache The image cache to add the image to.
+ * @param socket The socket to send instructions on.
+ * @param layer The layer containing the image.
+ * @param x The X coordinate of the upper-left corner of the image.
+ * @param y The Y coordinate of the upper-left corner of the image.
+ * @param image The image which was sent.
+ * @param hash The hash of the image, as returned by guac_hash_surface().
+ */
+void guac_common_image_cache_store(guac_common_image_cache* cache,
+        guac_socket* socket, const guac_layer* layer, int x, int y,
+        cairo_surface_t* image, unsigned int hash);
+
+/**
+ * Copies the current counters of the given cache into the given structure.
+ *
+ * @param cache The image cache to read counters from.
+ * @param stats The structure to populate.
+ */
+void guac_common_image_cache_get_stats(guac_common_image_cache* cache,
+        guac_common_image_cache_stats* stats);
+
+#endif
+
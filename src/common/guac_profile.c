@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "guac_profile.h"
+
+#include <guacamole/client.h>
+#include <guacamole/timestamp.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+guac_common_profile* guac_common_profile_alloc() {
+
+    guac_common_profile* profile = calloc(1, sizeof(guac_common_profile));
+    if (profile == NULL)
+        return NULL;
+
+    profile->level = GUAC_COMMON_PROFILE_LOSSLESS;
+    pthread_mutex_init(&(profile->lock), NULL);
+    return profile;
+
+}
+
+void guac_common_profile_free(guac_common_profile* profile) {
+    pthread_mutex_destroy(&(profile->lock));
+    free(profile);
+}
+
+void guac_common_profile_set_thresholds(guac_common_profile* profile,
+        int reduced_color, int lossy, int reduced_rate) {
+
+    pthread_mutex_lock(&(profile->lock));
+    profile->reduced_color_bandwidth = reduced_color;
+    profile->lossy_bandwidth = lossy;
+    profile->reduced_rate_bandwidth = reduced_rate;
+    pthread_mutex_unlock(&(profile->lock));
+
+}
+
+/**
+ * Returns the bandwidth threshold below which the given level applies. The
+ * lock of the profile must be held.
+ *
+ * @param profile The profile to query.
+ * @param level The level whose threshold should be returned.
+ * @return The threshold of the level, in bytes per second, or zero if the
+ *         level is disabled.
+ */
+static int __guac_common_profile_threshold(guac_common_profile* profile,
+        guac_common_profile_level level) {
+
+    switch (level) {
+
+        case GUAC_COMMON_PROFILE_REDUCED_COLOR:
+            return profile->reduced_color_bandwidth;
+
+        case GUAC_COMMON_PROFILE_LOSSY:
+            return profile->lossy_bandwidth;
+
+        case GUAC_COMMON_PROFILE_REDUCED_RATE:
+            return profile->reduced_rate_bandwidth;
+
+        default:
+            return 0;
+
+    }
+
+}
+
+int guac_common_profile_select(guac_common_profile* profile,
+        const guac_client_link_stats* stats, guac_timestamp now) {
+
+    guac_common_profile_level target = GUAC_COMMON_PROFILE_LOSSLESS;
+    guac_common_profile_level level;
+    int changed = 0;
+
+    /* Do not guess until bandwidth has been measured */
+    if (stats->bandwidth == 0)
+        return 0;
+
+    pthread_mutex_lock(&(profile->lock));
+
+    /* Find lowest quality level whose threshold bandwidth exceeds */
+    for (level = GUAC_COMMON_PROFILE_REDUCED_COLOR;
+            level <= GUAC_COMMON_PROFILE_REDUCED_RATE; level++) {
+
+        int threshold = __guac_common_profile_threshold(profile, level);
+        if (threshold > 0 && stats->bandwidth < threshold)
+            target = level;
+
+    }
+
+    /* Reduce quality immediately */
+    if (target > profile->level)
+        changed = 1;
+
+    /* Raise quality one level at a time, only once bandwidth comfortably
+     * exceeds the threshold of the current level and has held steady */
+    else if (target < profile->level
+            && now - profile->last_change >= GUAC_COMMON_PROFILE_HOLD_TIME
+            && (int64_t) stats->bandwidth * 100 >=
+               (int64_t) __guac_common_profile_threshold(profile,
+                   profile->level) * GUAC_COMMON_PROFILE_HYSTERESIS) {
+        target = profile->level - 1;
+        changed = 1;
+    }
+
+    if (changed) {
+        profile->level = target;
+        profile->last_change = now;
+    }
+
+    pthread_mutex_unlock(&(profile->lock));
+    return changed;
+
+}
+
+void guac_common_profile_update(guac_common_profile* profile,
+        guac_client* client) {
+
+    guac_client_link_stats stats;
+    guac_client_get_link_stats(client, &stats);
+
+    if (guac_common_profile_select(profile, &stats, guac_timestamp_current()))
+        guac_client_log(client, GUAC_LOG_INFO, "Estimated bandwidth "
+                "%i kbit/s (round trip %i ms): encoding %s.",
+                stats.bandwidth / 125, stats.rtt,
+                guac_common_profile_name(
+                    guac_common_profile_get_level(profile)));
+
+}
+
+guac_common_profile_level guac_common_profile_get_level(
+        guac_common_profile* profile) {
+
+    guac_common_profile_level level;
+
+    pthread_mutex_lock(&(profile->lock));
+    level = profile->level;
+    pthread_mutex_unlock(&(profile->lock));
+
+    return level;
+
+}
+
+const char* guac_common_profile_name(guac_common_profile_level level) {
+
+    switch (level) {
+
+        case GUAC_COMMON_PROFILE_LOSSLESS:
+            return "lossless";
+
+        case GUAC_COMMON_PROFILE_REDUCED_COLOR:
+            return "reduced color";
+
+        case GUAC_COMMON_PROFILE_LOSSY:
+            return "lossy";
+
+        case GUAC_COMMON_PROFILE_REDUCED_RATE:
+            return "lossy at reduced frame rate";
+
+        default:
+            return "unknown";
+
+    }
+
+}
+
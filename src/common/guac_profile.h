@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_PROFILE_H
+#define __GUAC_PROFILE_H
+
+#include "config.h"
+
+#include <guacamole/client.h>
+#include <guacamole/timestamp.h>
+
+#include <pthread.h>
+
+/**
+ * The factor, as a percentage, by which the estimated bandwidth must exceed
+ * the threshold of a level before that level is left for a higher-quality
+ * level. This prevents rapid oscillation when bandwidth hovers around a
+ * threshold.
+ */
+#define GUAC_COMMON_PROFILE_HYSTERESIS 125
+
+/**
+ * The minimum time, in milliseconds, which must pass after the level of a
+ * profile changes before quality will be raised again.
+ */
+#define GUAC_COMMON_PROFILE_HOLD_TIME 2000
+
+/**
+ * The default bandwidth, in bytes per second, below which colors are
+ * reduced (10 Mbit/s).
+ */
+#define GUAC_COMMON_PROFILE_DEFAULT_REDUCED_COLOR_BANDWIDTH 1250000
+
+/**
+ * The default bandwidth, in bytes per second, below which lossy compression
+ * is used (4 Mbit/s).
+ */
+#define GUAC_COMMON_PROFILE_DEFAULT_LOSSY_BANDWIDTH 500000
+
+/**
+ * The default bandwidth, in bytes per second, below which the frame rate is
+ * reduced (1 Mbit/s).
+ */
+#define GUAC_COMMON_PROFILE_DEFAULT_REDUCED_RATE_BANDWIDTH 125000
+
+/**
+ * The quality of the updates sent by surfaces using a profile. Each level
+ * includes the reductions of all levels before it.
+ */
+typedef enum guac_common_profile_level {
+
+    /**
+     * Updates are sent at full quality.
+     */
+    GUAC_COMMON_PROFILE_LOSSLESS,
+
+    /**
+     * Updates are sent losslessly but with colors reduced such that each
+     * fits within a single byte, allowing palette-based encoding.
+     */
+    GUAC_COMMON_PROFILE_REDUCED_COLOR,
+
+    /**
+     * All but the smallest updates are sent using lossy compression.
+     */
+    GUAC_COMMON_PROFILE_LOSSY,
+
+    /**
+     * Updates are additionally sent less frequently, with changes
+     * accumulating between frames.
+     */
+    GUAC_COMMON_PROFILE_REDUCED_RATE
+
+} guac_common_profile_level;
+
+/**
+ * Encoding profile which selects the quality of updates based on the
+ * bandwidth estimated for a connection. Quality is reduced as soon as
+ * bandwidth falls below the threshold of a level, and is raised one level
+ * at a time once bandwidth has comfortably recovered. A single profile may be
+ * shared by all surfaces of a connection.
+ */
+typedef struct guac_common_profile {
+
+    /**
+     * The bandwidth, in bytes per second, below which colors are reduced,
+     * or zero if colors should never be reduced.
+     */
+    int reduced_color_bandwidth;
+
+    /**
+     * The bandwidth, in bytes per second, below which lossy compression is
+     * used, or zero if lossy compression should never be used.
+     */
+    int lossy_bandwidth;
+
+    /**
+     * The bandwidth, in bytes per second, below which the frame rate is
+     * reduced, or zero if the frame rate should never be reduced.
+     */
+    int reduced_rate_bandwidth;
+
+    /**
+     * The current level of this profile.
+     */
+    guac_common_profile_level level;
+
+    /**
+     * The time at which the level of this profile last changed.
+     */
+    guac_timestamp last_change;
+
+    /**
+     * Lock which must be held while the profile is read or modified.
+     */
+    pthread_mutex_t lock;
+
+} guac_common_profile;
+
+/**
+ * Allocates a new profile at GUAC_COMMON_PROFILE_LOSSLESS, with all
+ * reductions in quality disabled until thresholds are set.
+ *
+ * @return A newly-allocated profile, or NULL if the profile could not be
+ *         allocated.
+ */
+guac_common_profile* guac_common_profile_alloc();
+
+/**
+ * Frees the given profile.
+ *
+ * @param profile The profile to free.
+ */
+void guac_common_profile_free(guac_common_profile* profile);
+
+/**
+ * Sets the bandwidth thresholds below which each reduction in quality is
+ * applied. A threshold of zero disables the corresponding reduction.
+ *
+ * @param profile The profile to modify.
+ * @param reduced_color The bandwidth, in bytes per second, below which
+ *                      colors are reduced.
+ * @param lossy The bandwidth, in bytes per second, below which lossy
+ *              compression is used.
+ * @param reduced_rate The bandwidth, in bytes per second, below which the
+ *                     frame rate is reduced.
+ */
+void guac_common_profile_set_thresholds(guac_common_profile* profile,
+        int reduced_color, int lossy, int reduced_rate);
+
+/**
+ * Selects the level of the given profile based on the given link
+ * statistics. The level is unchanged while bandwidth is unknown.
+ *
+ * @param profile The profile to update.
+ * @param stats The current statistics of the connection.
+ * @param now The current time.
+ * @return Non-zero if the level of the profile changed, zero otherwise.
+ */
+int guac_common_profile_select(guac_common_profile* profile,
+        const guac_client_link_stats* stats, guac_timestamp now);
+
+/**
+ * Selects the level of the given profile based on the current link
+ * statistics of the given client, logging any change in level.
+ *
+ * @param profile The profile to update.
+ * @param client The client whose connection the profile describes.
+ */
+void guac_common_profile_update(guac_common_profile* profile,
+        guac_client* client);
+
+/**
+ * Returns the current level of the given profile.
+ *
+ * @param profile The profile to query.
+ * @return The current level of the profile.
+ */
+guac_common_profile_level guac_common_profile_get_level(
+        guac_common_profile* profile);
+
+/**
+ * Returns a human-readable name for the given level, for logging.
+ *
+ * @param level The level to name.
+ * @return The name of the level.
+ */
+const char* guac_common_profile_name(guac_common_profile_level level);
+
+#endif
+
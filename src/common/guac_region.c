@@ -0,0 +1,629 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "guac_rect.h"
+#include "guac_region.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+guac_common_region* guac_common_region_alloc() {
+
+    guac_common_region* region = malloc(sizeof(guac_common_region));
+    if (region == NULL)
+        return NULL;
+
+    region->rects = malloc(sizeof(guac_common_rect)
+            * GUAC_COMMON_REGION_INITIAL_SIZE);
+    if (region->rects == NULL) {
+        free(region);
+        return NULL;
+    }
+
+    region->count = 0;
+    region->size = GUAC_COMMON_REGION_INITIAL_SIZE;
+
+    region->scratch = NULL;
+    region->scratch_size = 0;
+
+    return region;
+
+}
+
+void guac_common_region_free(guac_common_region* region) {
+    free(region->rects);
+    free(region->scratch);
+    free(region);
+}
+
+/**
+ * Comparator for rectangles which orders rectangles top to bottom, then left
+ * to right.
+ *
+ * @see qsort
+ */
+static int __guac_common_region_compare(const void* a, const void* b) {
+
+    const guac_common_rect* ra = (const guac_common_rect*) a;
+    const guac_common_rect* rb = (const guac_common_rect*) b;
+
+    if (ra->y != rb->y)
+        return ra->y - rb->y;
+
+    return ra->x - rb->x;
+
+}
+
+/**
+ * Returns the cost of sending the given rectangle, being the given base cost
+ * plus the area of the rectangle.
+ *
+ * @param rect The rectangle to determine the cost of.
+ * @param base_cost The cost of sending any rectangle, in addition to the cost
+ *                  of its area.
+ * @return The cost of sending the given rectangle.
+ */
+static int __guac_common_region_cost(const guac_common_rect* rect,
+        int base_cost) {
+    return base_cost + rect->width * rect->height;
+}
+
+/**
+ * Returns whether the given rectangles overlap.
+ *
+ * @param a The first rectangle.
+ * @param b The second rectangle.
+ * @return Non-zero if the rectangles overlap, zero otherwise.
+ */
+static int __guac_common_region_intersects(const guac_common_rect* a,
+        const guac_common_rect* b) {
+    return a->x < b->x + b->width  && b->x < a->x + a->width
+        && a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+/**
+ * Returns the index of the first of the given clusters, which must be sorted
+ * by left edge, whose left edge is at or right of the given X coordinate.
+ *
+ * @param clusters The clusters to search.
+ * @param count The number of clusters given.
+ * @param x The X coordinate to search for.
+ * @return The index of the first cluster whose left edge is at or right of
+ *         the given X coordinate, or the number of clusters if there is no
+ *         such cluster.
+ */
+static int __guac_common_region_search(const guac_common_rect* clusters,
+        int count, int x) {
+
+    int low = 0;
+    int high = count;
+
+    while (low < high) {
+
+        int middle = low + (high - low) / 2;
+
+        if (clusters[middle].x < x)
+            low = middle + 1;
+        else
+            high = middle;
+
+    }
+
+    return low;
+
+}
+
+/**
+ * Inserts the given cluster into the given list of clusters, which must be
+ * sorted by left edge and have room for the cluster, such that the list
+ * remains sorted.
+ *
+ * @param clusters The clusters to insert the cluster into.
+ * @param count The number of clusters within the list, which will be
+ *              incremented.
+ * @param cluster The cluster to insert.
+ */
+static void __guac_common_region_insert(guac_common_rect* clusters,
+        int* count, const guac_common_rect* cluster) {
+
+    int index = __guac_common_region_search(clusters, *count, cluster->x);
+
+    memmove(&clusters[index + 1], &clusters[index],
+            sizeof(guac_common_rect) * (*count - index));
+
+    clusters[index] = *cluster;
+    (*count)++;
+
+}
+
+/**
+ * Returns the index of the open cluster whose join with the given rectangle
+ * saves the most cost, or -1 if no join is worthwhile. A join is also
+ * worthwhile if the rectangle follows a fill pattern beneath the cluster, as
+ * described by GUAC_COMMON_REGION_FILL_PATTERN_FACTOR. Only clusters within
+ * reach of the rectangle are considered, as any cluster separated from the
+ * rectangle by a horizontal gap would waste that gap for each row of the
+ * rectangle, and such a join saves nothing once the waste exceeds the base
+ * cost.
+ *
+ * @param open The open clusters, sorted by left edge.
+ * @param open_count The number of open clusters.
+ * @param max_width The width of the widest open cluster, or any greater
+ *                  width.
+ * @param rect The rectangle to join.
+ * @param base_cost The cost of sending any rectangle, in addition to the cost
+ *                  of its area.
+ * @return The index of the cluster to join, or -1 if no join is worthwhile.
+ */
+static int __guac_common_region_find_join(const guac_common_rect* open,
+        int open_count, int max_width, const guac_common_rect* rect,
+        int base_cost) {
+
+    int reach = base_cost / rect->height;
+    int rect_cost = __guac_common_region_cost(rect, base_cost);
+    int best_index = -1;
+    int best_saving = 0;
+    int i;
+
+    i = __guac_common_region_search(open, open_count,
+            rect->x - reach - max_width);
+
+    for (; i < open_count && open[i].x < rect->x + rect->width + reach; i++) {
+
+        const guac_common_rect* cluster = &open[i];
+        guac_common_rect joined = *cluster;
+        int cluster_cost, joined_cost, saving;
+
+        if (cluster->x + cluster->width + reach <= rect->x)
+            continue;
+
+        guac_common_rect_extend(&joined, rect);
+
+        cluster_cost = __guac_common_region_cost(cluster, base_cost);
+        joined_cost = __guac_common_region_cost(&joined, base_cost);
+        saving = cluster_cost + rect_cost - joined_cost;
+
+        /* Join lines of a fill pattern if not excessively costly */
+        if (saving < 0 && rect->x == cluster->x
+                && rect->y == cluster->y + cluster->height
+                && joined_cost <= (cluster_cost + rect_cost)
+                                * GUAC_COMMON_REGION_FILL_PATTERN_FACTOR)
+            saving = 0;
+
+        if (saving >= best_saving) {
+            best_index = i;
+            best_saving = saving;
+        }
+
+    }
+
+    return best_index;
+
+}
+
+/**
+ * Joins each of the given rectangles, which must be sorted top to bottom,
+ * into clusters, sweeping downward one band of rectangles sharing a top edge
+ * at a time. Open clusters are kept sorted by left edge. Each rectangle joins
+ * whichever open cluster within reach saves the most cost, after which the
+ * joined cluster may itself join further open clusters, or becomes a new
+ * cluster if no join is worthwhile. Clusters so far above the current band
+ * that any join would waste more than the base cost are closed.
+ *
+ * @param rects The rectangles to join into clusters.
+ * @param count The number of rectangles given.
+ * @param open Storage for the open clusters, which must have room for as
+ *             many clusters as there are rectangles.
+ * @param closed Storage for the resulting clusters, which must have room
+ *               for as many clusters as there are rectangles.
+ * @param base_cost The cost of sending any rectangle, in addition to the cost
+ *                  of its area.
+ * @return The number of resulting clusters.
+ */
+static int __guac_common_region_sweep(const guac_common_rect* rects,
+        int count, guac_common_rect* open, guac_common_rect* closed,
+        int base_cost) {
+
+    int open_count = 0;
+    int closed_count = 0;
+    int max_width = 0;
+    int next_close = 0;
+    int i, j, k;
+
+    for (i = 0; i < count; i++) {
+
+        guac_common_rect cluster = rects[i];
+        int index;
+
+        /* Close clusters which can no longer be joined, checking only once
+         * the sweep passes the first point at which any may close */
+        if (open_count > 0 && cluster.y > next_close) {
+
+            next_close = INT_MAX;
+
+            for (j = 0, k = 0; j < open_count; j++) {
+
+                int limit = open[j].y + open[j].height
+                          + base_cost / open[j].width;
+
+                if (cluster.y > limit)
+                    closed[closed_count++] = open[j];
+
+                else {
+                    open[k++] = open[j];
+                    if (limit < next_close)
+                        next_close = limit;
+                }
+
+            }
+
+            open_count = k;
+
+        }
+
+        /* Join rectangle with open clusters for as long as worthwhile */
+        while ((index = __guac_common_region_find_join(open, open_count,
+                        max_width, &cluster, base_cost)) >= 0) {
+
+            guac_common_rect_extend(&cluster, &open[index]);
+
+            open_count--;
+            memmove(&open[index], &open[index + 1],
+                    sizeof(guac_common_rect) * (open_count - index));
+
+        }
+
+        __guac_common_region_insert(open, &open_count, &cluster);
+
+        if (cluster.width > max_width)
+            max_width = cluster.width;
+
+        /* Track the first point at which the new cluster may close */
+        j = cluster.y + cluster.height + base_cost / cluster.width;
+        if (open_count == 1 || j < next_close)
+            next_close = j;
+
+    }
+
+    /* All clusters still open are now complete */
+    for (i = 0; i < open_count; i++)
+        closed[closed_count++] = open[i];
+
+    return closed_count;
+
+}
+
+/**
+ * Appends the given rectangle to the given region, growing the space
+ * allocated for rectangles as necessary.
+ *
+ * @param region The region to append the rectangle to.
+ * @param x The X coordinate of the upper-left corner of the rectangle.
+ * @param y The Y coordinate of the upper-left corner of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @return Zero if the rectangle was appended, non-zero if space for the
+ *         rectangle could not be allocated.
+ */
+static int __guac_common_region_append(guac_common_region* region,
+        int x, int y, int width, int height) {
+
+    /* Grow if out of space */
+    if (region->count == region->size) {
+
+        int size = region->size * 2;
+        guac_common_rect* rects = realloc(region->rects,
+                sizeof(guac_common_rect) * size);
+
+        if (rects == NULL)
+            return 1;
+
+        region->rects = rects;
+        region->size = size;
+
+    }
+
+    guac_common_rect_init(&region->rects[region->count++],
+            x, y, width, height);
+
+    return 0;
+
+}
+
+/**
+ * Removes the area of the given hole from all rectangles of the given region
+ * at or after the given index, splitting each overlapping rectangle into as
+ * many as four rectangles.
+ *
+ * @param region The region to remove the hole from.
+ * @param start The index of the first rectangle which should be affected.
+ * @param hole The area to remove.
+ * @return Zero if the hole was removed, non-zero if space for the resulting
+ *         rectangles could not be allocated.
+ */
+static int __guac_common_region_subtract(guac_common_region* region,
+        int start, const guac_common_rect* hole) {
+
+    int end = region->count;
+    int i = start;
+
+    while (i < end) {
+
+        guac_common_rect rect = region->rects[i];
+        int top, bottom;
+
+        if (!__guac_common_region_intersects(&rect, hole)) {
+            i++;
+            continue;
+        }
+
+        /* Remove rectangle, keeping only unchecked rectangles before end */
+        region->rects[i] = region->rects[--end];
+        region->rects[end] = region->rects[--region->count];
+
+        top = rect.y > hole->y ? rect.y : hole->y;
+        bottom = rect.y + rect.height < hole->y + hole->height
+            ? rect.y + rect.height : hole->y + hole->height;
+
+        /* Add remaining parts above and below hole */
+        if (top > rect.y && __guac_common_region_append(region,
+                    rect.x, rect.y, rect.width, top - rect.y))
+            return 1;
+
+        if (bottom < rect.y + rect.height && __guac_common_region_append(
+                    region, rect.x, bottom, rect.width,
+                    rect.y + rect.height - bottom))
+            return 1;
+
+        /* Add remaining parts left and right of hole */
+        if (hole->x > rect.x && __guac_common_region_append(region,
+                    rect.x, top, hole->x - rect.x, bottom - top))
+            return 1;
+
+        if (hole->x + hole->width < rect.x + rect.width
+                && __guac_common_region_append(region,
+                    hole->x + hole->width, top,
+                    rect.x + rect.width - hole->x - hole->width,
+                    bottom - top))
+            return 1;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Returns whether the area shared by the given clusters should be removed
+ * from the first cluster, rather than sent as part of both. Removing the
+ * area splits the first cluster into as many as four rectangles, and is
+ * worthwhile only if the base cost of each resulting rectangle is no more
+ * than the cost of sending the shared area twice. Merely trimming an edge
+ * from a cluster thus still requires the shared area to exceed the base
+ * cost, as a narrower rectangle is rarely much cheaper to encode.
+ *
+ * @param cluster The cluster from which the shared area would be removed.
+ * @param hole The cluster which would retain the shared area.
+ * @param base_cost The cost of sending any rectangle, in addition to the cost
+ *                  of its area.
+ * @return Non-zero if the shared area should be removed from the first
+ *         cluster, zero otherwise.
+ */
+static int __guac_common_region_should_subtract(const guac_common_rect* cluster,
+        const guac_common_rect* hole, int base_cost) {
+
+    guac_common_rect shared = *cluster;
+    int pieces = 0;
+
+    if (!__guac_common_region_intersects(cluster, hole))
+        return 0;
+
+    guac_common_rect_constrain(&shared, hole);
+
+    /* Count remaining pieces, as split by __guac_common_region_subtract() */
+    if (shared.y > cluster->y) pieces++;
+    if (shared.y + shared.height < cluster->y + cluster->height) pieces++;
+    if (shared.x > cluster->x) pieces++;
+    if (shared.x + shared.width < cluster->x + cluster->width) pieces++;
+
+    return pieces * base_cost <= shared.width * shared.height;
+
+}
+
+/**
+ * Appends each of the given clusters, which must be sorted top to bottom, to
+ * the given region, removing from each any area shared with the clusters
+ * above it unless sending that area twice is cheaper. The clusters above
+ * which may still overlap are kept sorted by left edge, such that only those
+ * which may overlap each cluster are compared with it.
+ *
+ * @param region The region to append the clusters to.
+ * @param clusters The clusters to append.
+ * @param count The number of clusters given.
+ * @param above Storage for the clusters above, which must have room for as
+ *              many clusters as are given.
+ * @param base_cost The cost of sending any rectangle, in addition to the cost
+ *                  of its area.
+ * @return Zero if all clusters were appended, non-zero if space for the
+ *         resulting rectangles could not be allocated.
+ */
+static int __guac_common_region_split(guac_common_region* region,
+        const guac_common_rect* clusters, int count, guac_common_rect* above,
+        int base_cost) {
+
+    int above_count = 0;
+    int max_width = 0;
+    int next_expire = INT_MAX;
+    int i, j, k;
+
+    for (i = 0; i < count; i++) {
+
+        const guac_common_rect* cluster = &clusters[i];
+        int start = region->count;
+
+        /* Forget clusters which end above this cluster, checking only once
+         * the sweep passes the first point at which any may end */
+        if (cluster->y >= next_expire) {
+
+            next_expire = INT_MAX;
+
+            for (j = 0, k = 0; j < above_count; j++) {
+
+                int bottom = above[j].y + above[j].height;
+
+                if (bottom > cluster->y) {
+                    above[k++] = above[j];
+                    if (bottom < next_expire)
+                        next_expire = bottom;
+                }
+
+            }
+
+            above_count = k;
+
+        }
+
+        if (__guac_common_region_append(region, cluster->x, cluster->y,
+                    cluster->width, cluster->height))
+            return 1;
+
+        /* Remove area shared with each overlapping cluster above */
+        j = __guac_common_region_search(above, above_count,
+                cluster->x - max_width);
+
+        for (; j < above_count && above[j].x < cluster->x + cluster->width;
+                j++) {
+            if (__guac_common_region_should_subtract(cluster, &above[j],
+                        base_cost)
+                    && __guac_common_region_subtract(region, start, &above[j]))
+                return 1;
+        }
+
+        __guac_common_region_insert(above, &above_count, cluster);
+
+        if (cluster->width > max_width)
+            max_width = cluster->width;
+
+        if (cluster->y + cluster->height < next_expire)
+            next_expire = cluster->y + cluster->height;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Replaces the contents of the given region with the bounding rectangle of
+ * all given rectangles having any area.
+ *
+ * @param region The region to replace the contents of.
+ * @param rects The rectangles which the region should cover.
+ * @param count The number of rectangles given.
+ */
+static void __guac_common_region_set_bounds(guac_common_region* region,
+        const guac_common_rect* rects, int count) {
+
+    int i;
+
+    region->count = 0;
+
+    for (i = 0; i < count; i++) {
+
+        if (rects[i].width <= 0 || rects[i].height <= 0)
+            continue;
+
+        if (region->count == 0)
+            region->rects[region->count++] = rects[i];
+        else
+            guac_common_rect_extend(&region->rects[0], &rects[i]);
+
+    }
+
+}
+
+int guac_common_region_set_rects(guac_common_region* region,
+        const guac_common_rect* rects, int count, int base_cost) {
+
+    guac_common_rect* sorted;
+    guac_common_rect* open;
+    guac_common_rect* clusters;
+    int sorted_count = 0;
+    int clusters_count;
+    int i;
+
+    region->count = 0;
+
+    /* Grow scratch space such that all rectangles and clusters will fit */
+    if (region->scratch_size < count) {
+
+        guac_common_rect* scratch = realloc(region->scratch,
+                sizeof(guac_common_rect) * count
+                * GUAC_COMMON_REGION_SCRATCH_ARRAYS);
+
+        /* Fall back to the bounding rectangle if there is no room */
+        if (scratch == NULL) {
+            __guac_common_region_set_bounds(region, rects, count);
+            return 1;
+        }
+
+        region->scratch = scratch;
+        region->scratch_size = count;
+
+    }
+
+    sorted = region->scratch;
+    open = sorted + region->scratch_size;
+    clusters = open + region->scratch_size;
+
+    /* Sweep non-empty rectangles top to bottom, joining into clusters */
+    for (i = 0; i < count; i++) {
+        if (rects[i].width > 0 && rects[i].height > 0)
+            sorted[sorted_count++] = rects[i];
+    }
+
+    qsort(sorted, sorted_count, sizeof(guac_common_rect),
+            __guac_common_region_compare);
+
+    clusters_count = __guac_common_region_sweep(sorted, sorted_count,
+            open, clusters, base_cost);
+
+    /* Remove area shared with clusters above from each cluster, unless
+     * sending that area twice is cheaper */
+    qsort(clusters, clusters_count, sizeof(guac_common_rect),
+            __guac_common_region_compare);
+
+    if (__guac_common_region_split(region, clusters, clusters_count, open,
+                base_cost)) {
+        __guac_common_region_set_bounds(region, rects, count);
+        return 1;
+    }
+
+    qsort(region->rects, region->count, sizeof(guac_common_rect),
+            __guac_common_region_compare);
+
+    return 0;
+
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_COMMON_REGION_H
+#define __GUAC_COMMON_REGION_H
+
+#include "config.h"
+
+#include "guac_rect.h"
+
+/**
+ * The number of arrays of rectangles held within the scratch space of each
+ * region.
+ */
+#define GUAC_COMMON_REGION_SCRATCH_ARRAYS 3
+
+/**
+ * The number of rectangles for which space is initially allocated within
+ * each region.
+ */
+#define GUAC_COMMON_REGION_INITIAL_SIZE 64
+
+/**
+ * If a rectangle lies directly beneath a cluster and shares its left edge,
+ * as when consecutive lines of text are drawn, the two are joined if the
+ * result costs no more than GUAC_COMMON_REGION_FILL_PATTERN_FACTOR times
+ * sending each separately, in anticipation of further lines.
+ */
+#define GUAC_COMMON_REGION_FILL_PATTERN_FACTOR 3
+
+/**
+ * The area of a surface requiring update, stored as a list of rectangles.
+ * Each rectangle may include pixels which do not actually require update,
+ * where sending those pixels is cheaper than sending another rectangle.
+ * Rectangles overlap only where sending the shared pixels twice is cheaper
+ * than splitting a rectangle to avoid them.
+ */
+typedef struct guac_common_region {
+
+    /**
+     * The rectangles making up this region, sorted top to bottom.
+     */
+    guac_common_rect* rects;
+
+    /**
+     * The number of rectangles making up this region.
+     */
+    int count;
+
+    /**
+     * The number of rectangles for which space has been allocated. This is
+     * always at least one, such that the bounding rectangle of any area
+     * can be stored.
+     */
+    int size;
+
+    /**
+     * Scratch space for the sweep from which this region is built, holding
+     * GUAC_COMMON_REGION_SCRATCH_ARRAYS arrays of scratch_size rectangles.
+     */
+    guac_common_rect* scratch;
+
+    /**
+     * The number of rectangles for which space has been allocated within
+     * each array of scratch space.
+     */
+    int scratch_size;
+
+} guac_common_region;
+
+/**
+ * Allocates a new, empty region.
+ *
+ * @return A newly-allocated, empty region, or NULL if allocation fails.
+ */
+guac_common_region* guac_common_region_alloc();
+
+/**
+ * Frees the given region.
+ *
+ * @param region The region to free.
+ */
+void guac_common_region_free(guac_common_region* region);
+
+/**
+ * Replaces the contents of the given region with a cheap set of rectangles
+ * covering all of the given rectangles, which may overlap arbitrarily. The
+ * cost of sending a rectangle is taken to be the given base cost plus its
+ * area. Rectangles having no area are ignored.
+ *
+ * The given rectangles are sorted and swept top to bottom in a single pass,
+ * one band of rectangles sharing a top edge at a time. The clusters of
+ * rectangles still open above the sweep line are kept sorted by left edge,
+ * such that each rectangle is compared only with the clusters within reach,
+ * located by binary search. A rectangle joins whichever of those clusters
+ * saves the most cost, and the joined cluster is then tested again against
+ * its new neighbours until no further join saves anything. Clusters are
+ * closed once the sweep has passed so far below them that any join would
+ * waste more than the base cost.
+ *
+ * Finally, the closed clusters are swept top to bottom in the same way, and
+ * any area a cluster shares with the clusters above it is removed from that
+ * cluster, unless the rectangles which result would cost more than sending
+ * the shared area twice. With a base cost of zero, the resulting rectangles
+ * therefore never overlap.
+ *
+ * If space for the sweep cannot be allocated, the region is instead set to
+ * the bounding rectangle of all rectangles given.
+ *
+ * @param region The region to replace the contents of.
+ * @param rects The rectangles which the region should cover.
+ * @param count The number of rectangles given.
+ * @param base_cost The cost of sending any rectangle, in addition to the cost
+ *                  of its area, in units of the cost of a single pixel.
+ * @return Zero if the region was built as described, non-zero if space
+ *         could not be allocated and the region is instead the bounding
+ *         rectangle of all rectangles given.
+ */
+int guac_common_region_set_rects(guac_common_region* region,
+        const guac_common_rect* rects, int count, int base_cost);
+
+#endif
+
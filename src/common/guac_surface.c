@@ -21,16 +21,27 @@
  */
 
 #include "config.h"
+#include "guac_image_cache.h"
+#include "guac_profile.h"
 #include "guac_rect.h"
 #include "guac_surface.h"
+#include "guac_surface_kernels.h"
+#include "guac_surface_trace.h"
+#include "guac_worker_pool.h"
 
 #include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/error.h>
+#include <guacamole/hash.h>
 #include <guacamole/layer.h>
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
 
+#include <math.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 /**
  * The width of an update which should be considered negible and thus
@@ -54,7 +65,8 @@
 /**
  * The base cost of every update. Each update should be considered to have
  * this starting cost, plus any additional cost estimated from its
- * content.
+ * content. Surfaces with a cost model use the base cost fitted by that model
+ * instead.
  */
 #define GUAC_SURFACE_BASE_COST 4096
 
@@ -71,11 +83,145 @@
  */
 #define GUAC_SURFACE_FILL_PATTERN_FACTOR 3
 
+/**
+ * The minimum area of an update, in pixels, before JPEG will be considered.
+ * Smaller updates gain little from lossy compression and are more likely to
+ * be text or UI elements, where artifacts are most visible.
+ */
+#define GUAC_SURFACE_JPEG_MIN_AREA 4096
+
+/**
+ * The JPEG quality used for updates which the profile of a surface requires
+ * be sent lossily, if no JPEG quality has been set for that surface.
+ */
+#define GUAC_SURFACE_PROFILE_JPEG_QUALITY 60
+
+/**
+ * The minimum time between frames, in milliseconds, while the profile of a
+ * surface requires a reduced frame rate.
+ */
+#define GUAC_SURFACE_REDUCED_RATE_INTERVAL 250
+
+/**
+ * The maximum number of pixels sampled when classifying an update as
+ * photographic. Larger updates are sampled on a uniform grid.
+ */
+#define GUAC_SURFACE_JPEG_MAX_SAMPLES 4096
+
+/**
+ * The number of bits in the hashed bitmap used to estimate the number of
+ * distinct colors within an update.
+ */
+#define GUAC_SURFACE_JPEG_COLOR_BITS 8192
+
+/**
+ * The minimum fraction of sampled pixels, expressed as 1/N, which must have
+ * distinct colors for an update to be considered photographic.
+ */
+#define GUAC_SURFACE_JPEG_COLOR_RATIO 4
+
+/**
+ * The minimum number of distinct colors an update must contain to be
+ * considered photographic. Anything with fewer colors will be written as a
+ * palette PNG, which is both smaller and lossless.
+ */
+#define GUAC_SURFACE_JPEG_MIN_COLORS 256
+
+/**
+ * The number of bins in the luminance histogram used to calculate the
+ * entropy of an update.
+ */
+#define GUAC_SURFACE_JPEG_LUMA_BINS 64
+
+/**
+ * The minimum entropy of the luminance histogram, in bits, for an update to
+ * be considered photographic. The maximum possible entropy is
+ * log2(GUAC_SURFACE_JPEG_LUMA_BINS).
+ */
+#define GUAC_SURFACE_JPEG_MIN_ENTROPY 4.5
+
+/**
+ * The minimum width and height of an update, in pixels, for it to be checked
+ * for moved content.
+ */
+#define GUAC_SURFACE_MOTION_MIN_SIZE 64
+
+/**
+ * The minimum number of consecutive rows or columns which must be explained
+ * by moved content for that content to be copied rather than redrawn.
+ */
+#define GUAC_SURFACE_MOTION_MIN_LINES 16
+
+/**
+ * The inverse of the minimum proportion of the rows or columns of an update
+ * which must be explained by moved content for that content to be copied
+ * rather than redrawn.
+ */
+#define GUAC_SURFACE_MOTION_MIN_FRACTION 4
+
+/**
+ * The offset basis of the 64-bit FNV-1a hash used to compare rows and columns
+ * when detecting moved content.
+ */
+#define GUAC_SURFACE_MOTION_HASH_BASIS 0xCBF29CE484222325ULL
+
+/**
+ * The prime of the 64-bit FNV-1a hash used to compare rows and columns when
+ * detecting moved content.
+ */
+#define GUAC_SURFACE_MOTION_HASH_PRIME 0x100000001B3ULL
+
+/**
+ * The width and height of each shadow tile, in pixels. Updates may only be
+ * sent as deltas if every shadow tile they touch matches the client, and
+ * only tiles entirely covered by an update are known to match the client
+ * once it is sent, so shadow tiles are considerably smaller than damage
+ * tiles.
+ */
+#define GUAC_SURFACE_DELTA_TILE_SIZE 16
+
+/**
+ * The proportional cost of each changed pixel within a delta update,
+ * relative to the cost of each pixel of an update sent in full. Changed
+ * pixels of an XOR image are typically noisier than the content itself.
+ */
+#define GUAC_SURFACE_DELTA_CHANGED_FACTOR 2
+
+/**
+ * The inverse of the proportional cost of each unchanged pixel within a delta
+ * update, relative to the cost of each pixel of an update sent in full. Runs
+ * of zeroes compress to almost nothing.
+ */
+#define GUAC_SURFACE_DELTA_UNCHANGED_FACTOR 16
+
 /* Define cairo_format_stride_for_width() if missing */
 #ifndef HAVE_CAIRO_FORMAT_STRIDE_FOR_WIDTH
 #define cairo_format_stride_for_width(format, width) (width*4)
 #endif
 
+/* Untraced internal versions of public operations, defined below */
+static void __guac_common_surface_flush(guac_common_surface* surface);
+static void __guac_common_surface_copy(guac_common_surface* src, int sx, int sy,
+        int w, int h, guac_common_surface* dst, int dx, int dy);
+
+/**
+ * Records an operation without image data in the trace of the given surface,
+ * if any.
+ *
+ * @param surface The surface whose trace should receive the record.
+ * @param opcode The operation being recorded.
+ * @param argv The integer arguments of the operation.
+ * @param argc The number of integer arguments.
+ */
+static void __guac_common_surface_trace(guac_common_surface* surface,
+        guac_common_surface_trace_opcode opcode, const int* argv, int argc) {
+
+    if (surface->trace != NULL)
+        guac_common_surface_trace_write(surface->trace, opcode, argv, argc,
+                NULL, 0, 0, 0);
+
+}
+
 /**
  * Updates the coordinates of the given rectangle to be within the bounds of
  * the given surface.
@@ -150,6 +296,12 @@ static void __guac_common_clip_rect(guac_common_surface* surface,
  */
 static int __guac_common_should_combine(guac_common_surface* surface, const guac_common_rect* rect, int rect_only) {
 
+    /* With tiles, defer everything but large operations which require no
+     * image data */
+    if (surface->damage_model == GUAC_COMMON_SURFACE_DAMAGE_TILES)
+        return !rect_only || rect->width * rect->height
+            < GUAC_COMMON_SURFACE_TILE_SIZE * GUAC_COMMON_SURFACE_TILE_SIZE;
+
     if (surface->dirty) {
 
         int combined_cost, dirty_cost, update_cost;
@@ -163,9 +315,9 @@ static int __guac_common_should_combine(guac_common_surface* surface, const guac
             return 1;
 
         /* Estimate costs of the existing update, new update, and both combined */
-        combined_cost = GUAC_SURFACE_BASE_COST + combined.width * combined.height;
-        dirty_cost    = GUAC_SURFACE_BASE_COST + surface->dirty_rect.width * surface->dirty_rect.height;
-        update_cost   = GUAC_SURFACE_BASE_COST + rect->width * rect->height;
+        combined_cost = surface->base_cost + combined.width * combined.height;
+        dirty_cost    = surface->base_cost + surface->dirty_rect.width * surface->dirty_rect.height;
+        update_cost   = surface->base_cost + rect->width * rect->height;
 
         /* Reduce cost if no image data */
         if (rect_only)
@@ -195,6 +347,232 @@ static int __guac_common_should_combine(guac_common_surface* surface, const guac
 
 }
 
+/**
+ * Updates the flags of all tiles of the given surface which intersect the
+ * given rectangle, setting the given flags and clearing all others given.
+ * Tiles are only tracked if the surface uses
+ * GUAC_COMMON_SURFACE_DAMAGE_TILES. Otherwise, this function has no effect.
+ *
+ * @param surface The surface whose tiles should be updated.
+ * @param rect The rectangle whose tiles should be updated, which must lie
+ *             within the surface.
+ * @param set The flags to set.
+ * @param clear The flags to clear.
+ */
+static void __guac_common_surface_update_tiles(guac_common_surface* surface,
+        const guac_common_rect* rect, int set, int clear) {
+
+    int row, column;
+    int min_column, max_column, min_row, max_row;
+
+    if (surface->damage_model != GUAC_COMMON_SURFACE_DAMAGE_TILES
+            || rect->width <= 0 || rect->height <= 0)
+        return;
+
+    min_column = rect->x / GUAC_COMMON_SURFACE_TILE_SIZE;
+    min_row    = rect->y / GUAC_COMMON_SURFACE_TILE_SIZE;
+    max_column = (rect->x + rect->width  - 1) / GUAC_COMMON_SURFACE_TILE_SIZE;
+    max_row    = (rect->y + rect->height - 1) / GUAC_COMMON_SURFACE_TILE_SIZE;
+
+    for (row = min_row; row <= max_row && row < surface->tile_rows; row++) {
+
+        unsigned char* flags = surface->tile_flags + row * surface->tile_columns;
+
+        for (column = min_column; column <= max_column
+                && column < surface->tile_columns; column++)
+            flags[column] = (flags[column] & ~clear) | set;
+
+    }
+
+}
+
+/**
+ * Allocates the tile state of the given surface for its current dimensions,
+ * preserving the state of any tiles present within the given previous tile
+ * state. The previous tile state is freed.
+ *
+ * @param surface The surface to allocate tile state for.
+ * @param old_flags The previous tile flags, or NULL if none.
+ * @param old_hashes The previous tile hashes, or NULL if none.
+ * @param old_columns The number of columns of the previous tile state.
+ * @param old_rows The number of rows of the previous tile state.
+ */
+static void __guac_common_surface_alloc_tiles(guac_common_surface* surface,
+        unsigned char* old_flags, uint64_t* old_hashes,
+        int old_columns, int old_rows) {
+
+    int row;
+    int columns = (surface->width  + GUAC_COMMON_SURFACE_TILE_SIZE - 1)
+                / GUAC_COMMON_SURFACE_TILE_SIZE;
+    int rows    = (surface->height + GUAC_COMMON_SURFACE_TILE_SIZE - 1)
+                / GUAC_COMMON_SURFACE_TILE_SIZE;
+
+    surface->tile_columns = columns;
+    surface->tile_rows = rows;
+    surface->tile_flags = calloc(columns * rows + 1, sizeof(unsigned char));
+    surface->tile_hashes = calloc(columns * rows + 1, sizeof(uint64_t));
+
+    /* Copy state of tiles which still exist */
+    if (old_flags != NULL) {
+
+        int copy_columns = columns < old_columns ? columns : old_columns;
+
+        for (row = 0; row < rows && row < old_rows; row++) {
+            memcpy(surface->tile_flags + row * columns,
+                    old_flags + row * old_columns, copy_columns);
+            memcpy(surface->tile_hashes + row * columns,
+                    old_hashes + row * old_columns,
+                    copy_columns * sizeof(uint64_t));
+        }
+
+    }
+
+    free(old_flags);
+    free(old_hashes);
+
+}
+
+/**
+ * Allocates the shadow copy and shadow tiles of the given surface for its
+ * current dimensions, freeing any previous shadow state. As the new shadow
+ * is blank, no shadow tile initially matches the client.
+ *
+ * @param surface The surface to allocate shadow state for.
+ */
+static void __guac_common_surface_alloc_shadow(guac_common_surface* surface) {
+
+    int columns = (surface->width  + GUAC_SURFACE_DELTA_TILE_SIZE - 1)
+                / GUAC_SURFACE_DELTA_TILE_SIZE;
+    int rows    = (surface->height + GUAC_SURFACE_DELTA_TILE_SIZE - 1)
+                / GUAC_SURFACE_DELTA_TILE_SIZE;
+
+    free(surface->shadow);
+    free(surface->shadow_valid);
+
+    surface->shadow_columns = columns;
+    surface->shadow_rows = rows;
+    surface->shadow = calloc(surface->height + 1, surface->stride);
+    surface->shadow_valid = calloc(columns * rows + 1, sizeof(unsigned char));
+
+}
+
+/**
+ * Marks all shadow tiles of the given surface which intersect the given
+ * rectangle as no longer matching the client, as when content which differs
+ * from the surface has been drawn there. If delta updates are disabled, this
+ * function has no effect.
+ *
+ * @param surface The surface whose shadow tiles should be invalidated.
+ * @param rect The rectangle whose shadow tiles should be invalidated, which
+ *             must lie within the surface.
+ */
+static void __guac_common_surface_invalidate_shadow(
+        guac_common_surface* surface, const guac_common_rect* rect) {
+
+    int row;
+    int min_column, max_column, min_row, max_row;
+
+    if (surface->shadow == NULL || rect->width <= 0 || rect->height <= 0)
+        return;
+
+    min_column = rect->x / GUAC_SURFACE_DELTA_TILE_SIZE;
+    min_row    = rect->y / GUAC_SURFACE_DELTA_TILE_SIZE;
+    max_column = (rect->x + rect->width  - 1) / GUAC_SURFACE_DELTA_TILE_SIZE;
+    max_row    = (rect->y + rect->height - 1) / GUAC_SURFACE_DELTA_TILE_SIZE;
+
+    for (row = min_row; row <= max_row && row < surface->shadow_rows; row++)
+        memset(surface->shadow_valid + row * surface->shadow_columns
+                + min_column, 0, max_column - min_column + 1);
+
+}
+
+/**
+ * Copies the given rectangle of the given surface into its shadow, as the
+ * rectangle has just been sent losslessly, marking all shadow tiles entirely
+ * within the rectangle as matching the client. Shadow tiles only partly
+ * within the rectangle keep their current state. If delta updates are
+ * disabled, this function has no effect.
+ *
+ * @param surface The surface whose shadow should be updated.
+ * @param rect The rectangle which was sent, which must lie within the
+ *             surface.
+ */
+static void __guac_common_surface_update_shadow(guac_common_surface* surface,
+        const guac_common_rect* rect) {
+
+    int y, row;
+    int min_column, max_column, min_row, max_row;
+
+    if (surface->shadow == NULL)
+        return;
+
+    for (y = rect->y; y < rect->y + rect->height; y++) {
+        int offset = y * surface->stride + rect->x * 4;
+        memcpy(surface->shadow + offset, surface->buffer + offset,
+                rect->width * 4);
+    }
+
+    /* Tiles at the right or bottom edge of the surface need only be covered
+     * up to that edge */
+    min_column = (rect->x + GUAC_SURFACE_DELTA_TILE_SIZE - 1)
+               / GUAC_SURFACE_DELTA_TILE_SIZE;
+    min_row    = (rect->y + GUAC_SURFACE_DELTA_TILE_SIZE - 1)
+               / GUAC_SURFACE_DELTA_TILE_SIZE;
+
+    if (rect->x + rect->width == surface->width)
+        max_column = surface->shadow_columns - 1;
+    else
+        max_column = (rect->x + rect->width) / GUAC_SURFACE_DELTA_TILE_SIZE - 1;
+
+    if (rect->y + rect->height == surface->height)
+        max_row = surface->shadow_rows - 1;
+    else
+        max_row = (rect->y + rect->height) / GUAC_SURFACE_DELTA_TILE_SIZE - 1;
+
+    for (row = min_row; row <= max_row; row++) {
+        if (max_column >= min_column)
+            memset(surface->shadow_valid + row * surface->shadow_columns
+                    + min_column, 1, max_column - min_column + 1);
+    }
+
+}
+
+/**
+ * Returns whether every shadow tile of the given surface which intersects the
+ * given rectangle matches the client.
+ *
+ * @param surface The surface to check.
+ * @param rect The rectangle to check, which must lie within the surface.
+ * @return Non-zero if the shadow of the given rectangle matches the client,
+ *         zero otherwise.
+ */
+static int __guac_common_surface_shadow_valid(guac_common_surface* surface,
+        const guac_common_rect* rect) {
+
+    int row, column;
+    int min_column, max_column, min_row, max_row;
+
+    min_column = rect->x / GUAC_SURFACE_DELTA_TILE_SIZE;
+    min_row    = rect->y / GUAC_SURFACE_DELTA_TILE_SIZE;
+    max_column = (rect->x + rect->width  - 1) / GUAC_SURFACE_DELTA_TILE_SIZE;
+    max_row    = (rect->y + rect->height - 1) / GUAC_SURFACE_DELTA_TILE_SIZE;
+
+    for (row = min_row; row <= max_row; row++) {
+
+        unsigned char* valid = surface->shadow_valid
+                             + row * surface->shadow_columns;
+
+        for (column = min_column; column <= max_column; column++) {
+            if (!valid[column])
+                return 0;
+        }
+
+    }
+
+    return 1;
+
+}
+
 /**
  * Expands the dirty rect of the given surface to contain the rect described by the given
  * coordinates.
@@ -218,6 +596,10 @@ static void __guac_common_mark_dirty(guac_common_surface* surface, const guac_co
         surface->dirty = 1;
     }
 
+    /* Track damage per tile, if enabled */
+    __guac_common_surface_update_tiles(surface, rect,
+            GUAC_COMMON_SURFACE_TILE_DIRTY, 0);
+
 }
 
 /**
@@ -245,103 +627,150 @@ static void __guac_common_surface_flush_to_queue(guac_common_surface* surface) {
 
 }
 
-void guac_common_surface_flush_deferred(guac_common_surface* surface) {
+/**
+ * Merges the updates within the PNG queue of the given surface into fewer
+ * non-overlapping updates covering the same area, making space within the
+ * queue without sending anything. If the queued updates cannot be merged
+ * into fewer than half as many updates as the queue can hold, they are
+ * replaced with their bounding rectangle.
+ *
+ * @param surface The surface whose PNG queue should be coalesced.
+ */
+static void __guac_common_surface_coalesce_queue(guac_common_surface* surface) {
 
-    /* Do not flush if not dirty */
-    if (!surface->dirty)
-        return;
+    guac_common_rect rects[GUAC_COMMON_SURFACE_QUEUE_SIZE];
+    guac_common_region* region = surface->png_region;
+    int count = 0;
+    int i;
 
-    /* Flush if queue size has reached maximum (space is reserved for the final dirty rect,
-     * as guac_common_surface_flush() MAY add an additional rect to the queue */
-    if (surface->png_queue_length == GUAC_COMMON_SURFACE_QUEUE_SIZE-1)
-        guac_common_surface_flush(surface);
+    /* Clip all queued updates within current bounds */
+    for (i = 0; i < surface->png_queue_length; i++) {
 
-    /* Append dirty rect to queue */
-    __guac_common_surface_flush_to_queue(surface);
+        rects[count] = surface->png_queue[i].rect;
+        __guac_common_bound_rect(surface, &rects[count], NULL, NULL);
 
-}
+        if (rects[count].width > 0 && rects[count].height > 0)
+            count++;
 
-/**
- * Transfers a single uint32_t using the given transfer function.
- *
- * @param op The transfer function to use.
- * @param src The source of the uint32_t value.
- * @param dst THe destination which will hold the result of the transfer.
- * @return Non-zero if the destination value was changed, zero otherwise.
- */
-static int __guac_common_surface_transfer_int(guac_transfer_function op, uint32_t* src, uint32_t* dst) {
+    }
 
-    uint32_t orig = *dst;
+    /* Nothing to merge if all updates lie outside the surface */
+    if (count == 0) {
+        surface->png_queue_length = 0;
+        return;
+    }
 
-    switch (op) {
+    /* Merge, falling back to the bounding rectangle if out of space */
+    guac_common_region_set_rects(region, rects, count, surface->base_cost);
+
+    /* Replace queue with merged updates if they are few enough */
+    if (region->count < GUAC_COMMON_SURFACE_QUEUE_SIZE / 2) {
+        for (i = 0; i < region->count; i++) {
+            surface->png_queue[i].rect = region->rects[i];
+            surface->png_queue[i].flushed = 0;
+        }
+        surface->png_queue_length = region->count;
+    }
 
-        case GUAC_TRANSFER_BINARY_BLACK:
-            *dst = 0xFF000000;
-            break;
+    /* Otherwise, fall back to a single update covering everything */
+    else {
+        for (i = 1; i < count; i++)
+            guac_common_rect_extend(&rects[0], &rects[i]);
+        surface->png_queue[0].rect = rects[0];
+        surface->png_queue[0].flushed = 0;
+        surface->png_queue_length = 1;
+    }
 
-        case GUAC_TRANSFER_BINARY_WHITE:
-            *dst = 0xFFFFFFFF;
-            break;
+}
 
-        case GUAC_TRANSFER_BINARY_SRC:
-            *dst = *src;
-            break;
+/**
+ * Adds the dirty rectangle of the given surface to its PNG queue, coalescing
+ * the queue first if full, such that damage accumulates until the surface is
+ * next flushed. Unlike guac_common_surface_flush_deferred(), this is not
+ * recorded in any trace of the surface.
+ *
+ * @param surface The surface to flush.
+ */
+static void __guac_common_surface_flush_deferred(guac_common_surface* surface) {
 
-        case GUAC_TRANSFER_BINARY_DEST:
-            /* NOP */
-            break;
+    /* Do not flush if not dirty, or if damage is already tracked by tile */
+    if (!surface->dirty
+            || surface->damage_model == GUAC_COMMON_SURFACE_DAMAGE_TILES)
+        return;
 
-        case GUAC_TRANSFER_BINARY_NSRC:
-            *dst = ~(*src);
-            break;
+    /* Coalesce if queue size has reached maximum (space is reserved for the
+     * final dirty rect, as guac_common_surface_flush() MAY add an additional
+     * rect to the queue */
+    if (surface->png_queue_length == GUAC_COMMON_SURFACE_QUEUE_SIZE-1)
+        __guac_common_surface_coalesce_queue(surface);
 
-        case GUAC_TRANSFER_BINARY_NDEST:
-            *dst = ~(*dst);
-            break;
+    /* Append dirty rect to queue */
+    __guac_common_surface_flush_to_queue(surface);
 
-        case GUAC_TRANSFER_BINARY_AND:
-            *dst = (*dst) & (*src);
-            break;
+}
 
-        case GUAC_TRANSFER_BINARY_NAND:
-            *dst = ~((*dst) & (*src));
-            break;
+void guac_common_surface_flush_deferred(guac_common_surface* surface) {
 
-        case GUAC_TRANSFER_BINARY_OR:
-            *dst = (*dst) | (*src);
-            break;
+    int argv[] = { surface->layer->index };
+    __guac_common_surface_trace(surface,
+            GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED, argv, 1);
 
-        case GUAC_TRANSFER_BINARY_NOR:
-            *dst = ~((*dst) | (*src));
-            break;
+    __guac_common_surface_flush_deferred(surface);
 
-        case GUAC_TRANSFER_BINARY_XOR:
-            *dst = (*dst) ^ (*src);
-            break;
+}
 
-        case GUAC_TRANSFER_BINARY_XNOR:
-            *dst = ~((*dst) ^ (*src));
-            break;
+/**
+ * Updates the given bounds of changed pixels to include the given changed
+ * portion of a row.
+ *
+ * @param first The index of the first changed pixel within the row, or -1 if
+ *              no pixels within the row changed.
+ * @param last The index of the last changed pixel within the row.
+ * @param y The index of the row.
+ * @param min_x The minimum X coordinate of all changed pixels.
+ * @param min_y The minimum Y coordinate of all changed pixels.
+ * @param max_x The maximum X coordinate of all changed pixels.
+ * @param max_y The maximum Y coordinate of all changed pixels.
+ */
+static void __guac_common_surface_bound_row(int first, int last, int y,
+        int* min_x, int* min_y, int* max_x, int* max_y) {
 
-        case GUAC_TRANSFER_BINARY_NSRC_AND:
-            *dst = (*dst) & ~(*src);
-            break;
+    /* Ignore unchanged rows */
+    if (first < 0)
+        return;
 
-        case GUAC_TRANSFER_BINARY_NSRC_NAND:
-            *dst = ~((*dst) & ~(*src));
-            break;
+    if (first < *min_x) *min_x = first;
+    if (last  > *max_x) *max_x = last;
+    if (y < *min_y) *min_y = y;
+    if (y > *max_y) *max_y = y;
 
-        case GUAC_TRANSFER_BINARY_NSRC_OR:
-            *dst = (*dst) | ~(*src);
-            break;
+}
 
-        case GUAC_TRANSFER_BINARY_NSRC_NOR:
-            *dst = ~((*dst) | ~(*src));
-            break;
+/**
+ * Restricts the given rectangle to the given bounds of changed pixels,
+ * relative to the rectangle. If the bounds are empty, the rectangle is
+ * reduced to zero size.
+ *
+ * @param rect The rectangle to restrict.
+ * @param min_x The minimum X coordinate of all changed pixels.
+ * @param min_y The minimum Y coordinate of all changed pixels.
+ * @param max_x The maximum X coordinate of all changed pixels.
+ * @param max_y The maximum Y coordinate of all changed pixels.
+ */
+static void __guac_common_surface_restrict_rect(guac_common_rect* rect,
+        int min_x, int min_y, int max_x, int max_y) {
 
+    /* Restrict destination rect to only updated pixels */
+    if (max_x >= min_x && max_y >= min_y) {
+        rect->x += min_x;
+        rect->y += min_y;
+        rect->width = max_x - min_x + 1;
+        rect->height = max_y - min_y + 1;
+    }
+    else {
+        rect->width = 0;
+        rect->height = 0;
     }
-
-    return *dst != orig;
 
 }
 
@@ -358,7 +787,9 @@ static int __guac_common_surface_transfer_int(guac_transfer_function op, uint32_
 static void __guac_common_surface_rect(guac_common_surface* dst, guac_common_rect* rect,
                                        int red, int green, int blue) {
 
-    int x, y;
+    const guac_common_surface_kernels* kernels = guac_common_surface_get_kernels();
+
+    int y;
 
     int dst_stride;
     unsigned char* dst_buffer;
@@ -376,40 +807,17 @@ static void __guac_common_surface_rect(guac_common_surface* dst, guac_common_rec
     /* For each row */
     for (y=0; y < rect->height; y++) {
 
-        uint32_t* dst_current = (uint32_t*) dst_buffer;
-
         /* Set row */
-        for (x=0; x < rect->width; x++) {
-
-            uint32_t old_color = *dst_current;
-
-            if (old_color != color) {
-                if (x < min_x) min_x = x;
-                if (y < min_y) min_y = y;
-                if (x > max_x) max_x = x;
-                if (y > max_y) max_y = y;
-                *dst_current = color;
-            }
-
-            dst_current++;
-        }
+        int last;
+        int first = kernels->rect((uint32_t*) dst_buffer, rect->width, color, &last);
+        __guac_common_surface_bound_row(first, last, y, &min_x, &min_y, &max_x, &max_y);
 
         /* Next row */
         dst_buffer += dst_stride;
 
     }
 
-    /* Restrict destination rect to only updated pixels */
-    if (max_x >= min_x && max_y >= min_y) {
-        rect->x += min_x;
-        rect->y += min_y;
-        rect->width = max_x - min_x + 1;
-        rect->height = max_y - min_y + 1;
-    }
-    else {
-        rect->width = 0;
-        rect->height = 0;
-    }
+    __guac_common_surface_restrict_rect(rect, min_x, min_y, max_x, max_y);
 
 }
 
@@ -432,10 +840,12 @@ static void __guac_common_surface_put(unsigned char* src_buffer, int src_stride,
                                       guac_common_surface* dst, guac_common_rect* rect,
                                       int opaque) {
 
+    const guac_common_surface_kernels* kernels = guac_common_surface_get_kernels();
+
     unsigned char* dst_buffer = dst->buffer;
     int dst_stride = dst->stride;
 
-    int x, y;
+    int y;
 
     int min_x = rect->width - 1;
     int min_y = rect->height - 1;
@@ -451,29 +861,11 @@ static void __guac_common_surface_put(unsigned char* src_buffer, int src_stride,
     /* For each row */
     for (y=0; y < rect->height; y++) {
 
-        uint32_t* src_current = (uint32_t*) src_buffer;
-        uint32_t* dst_current = (uint32_t*) dst_buffer;
-
         /* Copy row */
-        for (x=0; x < rect->width; x++) {
-
-            if (opaque || (*src_current & 0xFF000000)) {
-
-                uint32_t new_color = *src_current | 0xFF000000;
-                uint32_t old_color = *dst_current;
-
-                if (old_color != new_color) {
-                    if (x < min_x) min_x = x;
-                    if (y < min_y) min_y = y;
-                    if (x > max_x) max_x = x;
-                    if (y > max_y) max_y = y;
-                    *dst_current = new_color;
-                }
-            }
-
-            src_current++;
-            dst_current++;
-        }
+        int last;
+        int first = kernels->put((uint32_t*) dst_buffer, (uint32_t*) src_buffer,
+                rect->width, opaque, &last);
+        __guac_common_surface_bound_row(first, last, y, &min_x, &min_y, &max_x, &max_y);
 
         /* Next row */
         src_buffer += src_stride;
@@ -481,17 +873,7 @@ static void __guac_common_surface_put(unsigned char* src_buffer, int src_stride,
 
     }
 
-    /* Restrict destination rect to only updated pixels */
-    if (max_x >= min_x && max_y >= min_y) {
-        rect->x += min_x;
-        rect->y += min_y;
-        rect->width = max_x - min_x + 1;
-        rect->height = max_y - min_y + 1;
-    }
-    else {
-        rect->width = 0;
-        rect->height = 0;
-    }
+    __guac_common_surface_restrict_rect(rect, min_x, min_y, max_x, max_y);
 
     /* Update source X/Y */
     *sx += rect->x - orig_x;
@@ -519,11 +901,13 @@ static void __guac_common_surface_fill_mask(unsigned char* src_buffer, int src_s
                                             guac_common_surface* dst, guac_common_rect* rect,
                                             int red, int green, int blue) {
 
+    const guac_common_surface_kernels* kernels = guac_common_surface_get_kernels();
+
     unsigned char* dst_buffer = dst->buffer;
     int dst_stride = dst->stride;
 
     uint32_t color = 0xFF000000 | (red << 16) | (green << 8) | blue;
-    int x, y;
+    int y;
 
     src_buffer += src_stride*sy + 4*sx;
     dst_buffer += (dst_stride * rect->y) + (4 * rect->x);
@@ -531,19 +915,9 @@ static void __guac_common_surface_fill_mask(unsigned char* src_buffer, int src_s
     /* For each row */
     for (y=0; y < rect->height; y++) {
 
-        uint32_t* src_current = (uint32_t*) src_buffer;
-        uint32_t* dst_current = (uint32_t*) dst_buffer;
-
         /* Stencil row */
-        for (x=0; x < rect->width; x++) {
-
-            /* Fill with color if opaque */
-            if (*src_current & 0xFF000000)
-                *dst_current = color;
-
-            src_current++;
-            dst_current++;
-        }
+        kernels->fill_mask((uint32_t*) dst_buffer, (uint32_t*) src_buffer,
+                rect->width, color);
 
         /* Next row */
         src_buffer += src_stride;
@@ -553,6 +927,52 @@ static void __guac_common_surface_fill_mask(unsigned char* src_buffer, int src_s
 
 }
 
+/**
+ * Transfers a row of pixels to a later position within the same row, without
+ * an intermediate copy of the source pixels. The row is processed from right
+ * to left in chunks no wider than the distance between source and
+ * destination, such that no source pixel is overwritten before it is read.
+ *
+ * @param kernel The transfer kernel to use.
+ * @param dst The first pixel of the destination row.
+ * @param src The first pixel of the source row, which must precede dst within
+ *            the same row.
+ * @param width The number of pixels in the row.
+ * @param last Storage for the index of the last pixel changed, which is
+ *             updated only if at least one pixel changed.
+ * @return The index of the first pixel changed, or -1 if no pixels changed.
+ */
+static int __guac_common_surface_transfer_row_backwards(
+        guac_common_surface_transfer_kernel* kernel, uint32_t* dst,
+        const uint32_t* src, int width, int* last) {
+
+    int shift = dst - src;
+    int first = -1;
+    int end = width;
+
+    while (end > 0) {
+
+        int start = end > shift ? end - shift : 0;
+        int chunk_last;
+        int chunk_first = kernel(dst + start, src + start, end - start,
+                &chunk_last);
+
+        /* Chunks are visited right to left, thus the first changed chunk
+         * contains the last changed pixel */
+        if (chunk_first >= 0) {
+            if (first < 0)
+                *last = start + chunk_last;
+            first = start + chunk_first;
+        }
+
+        end = start;
+
+    }
+
+    return first;
+
+}
+
 /**
  * Copies data from the given surface to the given destination surface using
  * the specified transfer function.
@@ -569,12 +989,17 @@ static void __guac_common_surface_transfer(guac_common_surface* src, int* sx, in
                                            guac_transfer_function op,
                                            guac_common_surface* dst, guac_common_rect* rect) {
 
+    guac_common_surface_transfer_kernel* kernel =
+        guac_common_surface_get_kernels()->transfer[op & 0xF];
+
     unsigned char* src_buffer = src->buffer;
     unsigned char* dst_buffer = dst->buffer;
+    uint32_t* row = NULL;
 
-    int x, y;
+    int y;
     int src_stride, dst_stride;
-    int step = 1;
+    int y_start, y_step;
+    int overlap = 0;
 
     int min_x = rect->width - 1;
     int min_y = rect->height - 1;
@@ -584,43 +1009,58 @@ static void __guac_common_surface_transfer(guac_common_surface* src, int* sx, in
     int orig_x = rect->x;
     int orig_y = rect->y;
 
-    /* Copy forwards only if destination is in a different surface or is before source */
+    src_buffer += src->stride * (*sy) + 4 * (*sx);
+    dst_buffer += (dst->stride * rect->y) + (4 * rect->x);
+
+    /* Copy rows forwards only if destination is in a different surface or is
+     * before source */
     if (src != dst || rect->y < *sy || (rect->y == *sy && rect->x < *sx)) {
-        src_buffer += src->stride * (*sy) + 4 * (*sx);
-        dst_buffer += (dst->stride * rect->y) + (4 * rect->x);
         src_stride = src->stride;
         dst_stride = dst->stride;
-        step = 1;
+        y_start = 0;
+        y_step = 1;
     }
 
-    /* Otherwise, copy backwards */
+    /* Otherwise, copy rows backwards */
     else {
-        src_buffer += src->stride * (*sy + rect->height - 1) + 4 * (*sx + rect->width - 1);
-        dst_buffer += dst->stride * (rect->y + rect->height - 1) + 4 * (rect->x + rect->width - 1);
+
+        src_buffer += src->stride * (rect->height - 1);
+        dst_buffer += dst->stride * (rect->height - 1);
         src_stride = -src->stride;
         dst_stride = -dst->stride;
-        step = -1;
+        y_start = rect->height - 1;
+        y_step = -1;
+
+        /* Kernels process each row forwards, thus overlapping source pixels
+         * within the same row must be read before being overwritten */
+        overlap = (rect->y == *sy && rect->x != *sx);
+        if (overlap)
+            row = malloc(rect->width * sizeof(uint32_t));
+
     }
 
     /* For each row */
-    for (y=0; y < rect->height; y++) {
+    for (y = y_start; y >= 0 && y < rect->height; y += y_step) {
 
         uint32_t* src_current = (uint32_t*) src_buffer;
-        uint32_t* dst_current = (uint32_t*) dst_buffer;
+        int last;
+        int first;
 
-        /* Transfer each pixel in row */
-        for (x=0; x < rect->width; x++) {
+        if (row != NULL) {
+            memcpy(row, src_current, rect->width * sizeof(uint32_t));
+            src_current = row;
+        }
 
-            if (__guac_common_surface_transfer_int(op, src_current, dst_current)) {
-                if (x < min_x) min_x = x;
-                if (y < min_y) min_y = y;
-                if (x > max_x) max_x = x;
-                if (y > max_y) max_y = y;
-            }
+        /* Without room for a copy, transfer overlapping pixels in safe order */
+        if (overlap && row == NULL)
+            first = __guac_common_surface_transfer_row_backwards(kernel,
+                    (uint32_t*) dst_buffer, src_current, rect->width, &last);
 
-            src_current += step;
-            dst_current += step;
-        }
+        /* Transfer each pixel in row */
+        else
+            first = kernel((uint32_t*) dst_buffer, src_current, rect->width,
+                    &last);
+        __guac_common_surface_bound_row(first, last, y, &min_x, &min_y, &max_x, &max_y);
 
         /* Next row */
         src_buffer += src_stride;
@@ -628,48 +1068,427 @@ static void __guac_common_surface_transfer(guac_common_surface* src, int* sx, in
 
     }
 
-    /* Translate X coordinate space of moving backwards */
-    if (step < 0) {
-        int old_max_x = max_x;
-        max_x = rect->width - 1 - min_x;
-        min_x = rect->width - 1 - old_max_x;
+    free(row);
+
+    __guac_common_surface_restrict_rect(rect, min_x, min_y, max_x, max_y);
+
+    /* Update source X/Y */
+    *sx += rect->x - orig_x;
+    *sy += rect->y - orig_y;
+
+}
+
+/**
+ * Returns the hash of the given line of pixels, ignoring the unused high byte
+ * of each pixel.
+ *
+ * @param line The first pixel of the line.
+ * @param length The number of pixels in the line.
+ * @return The hash of the given line of pixels.
+ */
+static uint64_t __guac_common_surface_hash_line(const uint32_t* line,
+        int length) {
+
+    uint64_t hash = GUAC_SURFACE_MOTION_HASH_BASIS;
+    int i;
+
+    for (i = 0; i < length; i++)
+        hash = (hash ^ (line[i] & 0xFFFFFF)) * GUAC_SURFACE_MOTION_HASH_PRIME;
+
+    return hash;
+
+}
+
+/**
+ * Returns whether the given rectangles of pixel data are identical, ignoring
+ * the unused high byte of each pixel.
+ *
+ * @param a The first pixel of the first rectangle.
+ * @param a_stride The number of bytes in each row of the first rectangle.
+ * @param b The first pixel of the second rectangle.
+ * @param b_stride The number of bytes in each row of the second rectangle.
+ * @param width The width of both rectangles, in pixels.
+ * @param height The height of both rectangles, in pixels.
+ * @return Non-zero if the rectangles are identical, zero otherwise.
+ */
+static int __guac_common_surface_rects_match(const unsigned char* a,
+        int a_stride, const unsigned char* b, int b_stride,
+        int width, int height) {
+
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+
+        const uint32_t* a_row = (const uint32_t*) a;
+        const uint32_t* b_row = (const uint32_t*) b;
+
+        for (x = 0; x < width; x++) {
+            if ((a_row[x] ^ b_row[x]) & 0xFFFFFF)
+                return 0;
+        }
+
+        a += a_stride;
+        b += b_stride;
+
     }
 
-    /* Translate Y coordinate space of moving backwards */
-    if (dst_stride < 0) {
-        int old_max_y = max_y;
-        max_y = rect->height - 1 - min_y;
-        min_y = rect->height - 1 - old_max_y;
+    return 1;
+
+}
+
+/**
+ * Given the hashes of each line (row or column) of an update and of the
+ * content it replaces, finds the shift which best explains the update as
+ * moved content. Lines whose hash is unique within the replaced content each
+ * vote for the shift that would place them, and the winning shift is then
+ * accepted only if it explains a long enough run of consecutive lines.
+ *
+ * @param src The hash of each line of the update.
+ * @param dst The hash of each line of the content being replaced.
+ * @param count The number of lines.
+ * @param start Storage for the index of the first line of the run explained
+ *              by the shift.
+ * @param length Storage for the number of lines within the run.
+ * @return The offset from each line of the update to the line of replaced
+ *         content having the same content, or 0 if no such shift was found
+ *         or memory for the search could not be allocated.
+ */
+static int __guac_common_surface_find_shift(const uint64_t* src,
+        const uint64_t* dst, int count, int* start, int* length) {
+
+    int size = 1;
+    int* table_index;
+    uint64_t* table_hash;
+    int* votes;
+
+    int best_shift = 0;
+    int best_votes = 1;
+    int best_start = 0;
+    int best_length = 0;
+    int i, shift;
+
+    /* Hash table of replaced lines, large enough to stay sparse */
+    while (size < count * 2)
+        size <<= 1;
+
+    table_index = malloc(sizeof(int) * (size + count * 2 + 1));
+    table_hash = malloc(sizeof(uint64_t) * size);
+
+    /* Without room for the table, there is no motion to be found */
+    if (table_index == NULL || table_hash == NULL) {
+        free(table_hash);
+        free(table_index);
+        return 0;
     }
 
-    /* Restrict destination rect to only updated pixels */
-    if (max_x >= min_x && max_y >= min_y) {
-        rect->x += min_x;
-        rect->y += min_y;
-        rect->width = max_x - min_x + 1;
-        rect->height = max_y - min_y + 1;
+    votes = table_index + size;
+
+    for (i = 0; i < size; i++)
+        table_index[i] = -1;
+
+    for (i = 0; i < count * 2 + 1; i++)
+        votes[i] = 0;
+
+    /* Index replaced lines by hash, marking repeated lines as ambiguous */
+    for (i = 0; i < count; i++) {
+
+        int slot = dst[i] & (size - 1);
+        while (table_index[slot] != -1 && table_hash[slot] != dst[i])
+            slot = (slot + 1) & (size - 1);
+
+        if (table_index[slot] == -1) {
+            table_index[slot] = i;
+            table_hash[slot] = dst[i];
+        }
+        else
+            table_index[slot] = -2;
+
     }
-    else {
-        rect->width = 0;
-        rect->height = 0;
+
+    /* Vote for shifts using lines unique to the replaced content, ignoring
+     * repeated lines of the update */
+    for (i = 0; i < count; i++) {
+
+        int slot;
+
+        if (i > 0 && src[i] == src[i-1])
+            continue;
+
+        slot = src[i] & (size - 1);
+        while (table_index[slot] != -1 && table_hash[slot] != src[i])
+            slot = (slot + 1) & (size - 1);
+
+        if (table_index[slot] >= 0)
+            votes[table_index[slot] - i + count]++;
+
     }
 
-    /* Update source X/Y */
-    *sx += rect->x - orig_x;
-    *sy += rect->y - orig_y;
+    /* Choose the most popular shift, preferring shorter shifts */
+    for (shift = 1; shift < count; shift++) {
+
+        if (votes[count + shift] > best_votes) {
+            best_votes = votes[count + shift];
+            best_shift = shift;
+        }
+
+        if (votes[count - shift] > best_votes) {
+            best_votes = votes[count - shift];
+            best_shift = -shift;
+        }
+
+    }
+
+    free(table_hash);
+    free(table_index);
+
+    if (best_shift == 0)
+        return 0;
+
+    /* Find longest run of lines explained by that shift */
+    for (i = 0; i < count; i++) {
+
+        int run = 0;
+        while (i + run < count && i + run + best_shift >= 0
+                && i + run + best_shift < count
+                && src[i + run] == dst[i + run + best_shift])
+            run++;
+
+        if (run > best_length) {
+            best_start = i;
+            best_length = run;
+        }
+
+        i += run;
+
+    }
+
+    /* Moving only a small portion is not worth a separate copy */
+    if (best_length < GUAC_SURFACE_MOTION_MIN_LINES
+            || best_length < count / GUAC_SURFACE_MOTION_MIN_FRACTION)
+        return 0;
+
+    *start = best_start;
+    *length = best_length;
+    return best_shift;
+
+}
+
+/**
+ * Updates the backing surface with the given image data and marks the
+ * changed region dirty, flushing deferred updates first if the change should
+ * not be combined with them.
+ *
+ * @param surface The surface to draw to.
+ * @param buffer The image data to draw.
+ * @param stride The number of bytes in each row of the image data.
+ * @param sx The X coordinate of the source rectangle within the image data.
+ * @param sy The Y coordinate of the source rectangle within the image data.
+ * @param rect The destination rectangle, which must lie within the surface.
+ * @param opaque Non-zero if the alpha channel of the image data should be
+ *               ignored, zero otherwise.
+ */
+static void __guac_common_surface_draw_rect(guac_common_surface* surface,
+        unsigned char* buffer, int stride, int sx, int sy,
+        guac_common_rect rect, int opaque) {
+
+    if (rect.width <= 0 || rect.height <= 0)
+        return;
+
+    /* Update backing surface */
+    __guac_common_surface_put(buffer, stride, &sx, &sy, surface, &rect, opaque);
+    if (rect.width <= 0 || rect.height <= 0)
+        return;
+
+    /* Flush if not combining */
+    if (!__guac_common_should_combine(surface, &rect, 0))
+        __guac_common_surface_flush_deferred(surface);
+
+    /* Always defer draws */
+    __guac_common_mark_dirty(surface, &rect);
+
+}
+
+/**
+ * Attempts to draw the given opaque image data as content which has merely
+ * moved vertically or horizontally within the given rectangle of the
+ * surface. If such motion is found, the moved content is copied client-side
+ * and only the remaining portions of the image data are drawn.
+ *
+ * @param surface The surface to draw to.
+ * @param buffer The image data to draw.
+ * @param stride The number of bytes in each row of the image data.
+ * @param sx The X coordinate of the source rectangle within the image data.
+ * @param sy The Y coordinate of the source rectangle within the image data.
+ * @param rect The destination rectangle, which must lie within the surface.
+ * @return Non-zero if motion was found and the image data has been drawn,
+ *         zero if the image data must be drawn normally.
+ */
+static int __guac_common_surface_draw_motion(guac_common_surface* surface,
+        unsigned char* buffer, int stride, int sx, int sy,
+        const guac_common_rect* rect) {
+
+    int width = rect->width;
+    int height = rect->height;
+    int lines = width > height ? width : height;
+
+    unsigned char* src = buffer + sy * stride + sx * 4;
+    unsigned char* dst = surface->buffer + rect->y * surface->stride + rect->x * 4;
+
+    uint64_t* src_hashes;
+    uint64_t* dst_hashes;
+    guac_common_rect part;
+    int start, length, shift;
+    int x, y;
+
+    /* Ignore updates too small to contain significant motion */
+    if (width < GUAC_SURFACE_MOTION_MIN_SIZE
+            || height < GUAC_SURFACE_MOTION_MIN_SIZE)
+        return 0;
+
+    src_hashes = malloc(sizeof(uint64_t) * lines * 2);
+    if (src_hashes == NULL)
+        return 0;
+
+    dst_hashes = src_hashes + lines;
+
+    /* Look for vertical motion using the hash of each row */
+    for (y = 0; y < height; y++) {
+        src_hashes[y] = __guac_common_surface_hash_line(
+                (uint32_t*) (src + y * stride), width);
+        dst_hashes[y] = __guac_common_surface_hash_line(
+                (uint32_t*) (dst + y * surface->stride), width);
+    }
+
+    shift = __guac_common_surface_find_shift(src_hashes, dst_hashes, height,
+            &start, &length);
+
+    if (shift != 0 && __guac_common_surface_rects_match(
+                src + start * stride, stride,
+                dst + (start + shift) * surface->stride, surface->stride,
+                width, length)) {
+
+        free(src_hashes);
+
+        __guac_common_surface_copy(surface, rect->x, rect->y + start + shift,
+                width, length, surface, rect->x, rect->y + start);
+
+        /* Draw rows above, within, and below the moved region */
+        guac_common_rect_init(&part, rect->x, rect->y, width, start);
+        __guac_common_surface_draw_rect(surface, buffer, stride, sx, sy, part, 1);
+
+        guac_common_rect_init(&part, rect->x, rect->y + start, width, length);
+        __guac_common_surface_draw_rect(surface, buffer, stride,
+                sx, sy + start, part, 1);
+
+        guac_common_rect_init(&part, rect->x, rect->y + start + length,
+                width, height - start - length);
+        __guac_common_surface_draw_rect(surface, buffer, stride,
+                sx, sy + start + length, part, 1);
+
+        return 1;
+
+    }
+
+    /* Otherwise, look for horizontal motion using the hash of each column */
+    for (x = 0; x < width; x++) {
+        src_hashes[x] = GUAC_SURFACE_MOTION_HASH_BASIS;
+        dst_hashes[x] = GUAC_SURFACE_MOTION_HASH_BASIS;
+    }
+
+    for (y = 0; y < height; y++) {
+
+        uint32_t* src_row = (uint32_t*) (src + y * stride);
+        uint32_t* dst_row = (uint32_t*) (dst + y * surface->stride);
+
+        for (x = 0; x < width; x++) {
+            src_hashes[x] = (src_hashes[x] ^ (src_row[x] & 0xFFFFFF))
+                * GUAC_SURFACE_MOTION_HASH_PRIME;
+            dst_hashes[x] = (dst_hashes[x] ^ (dst_row[x] & 0xFFFFFF))
+                * GUAC_SURFACE_MOTION_HASH_PRIME;
+        }
+
+    }
+
+    shift = __guac_common_surface_find_shift(src_hashes, dst_hashes, width,
+            &start, &length);
+
+    free(src_hashes);
+
+    if (shift != 0 && __guac_common_surface_rects_match(
+                src + start * 4, stride,
+                dst + (start + shift) * 4, surface->stride,
+                length, height)) {
+
+        __guac_common_surface_copy(surface, rect->x + start + shift, rect->y,
+                length, height, surface, rect->x + start, rect->y);
+
+        /* Draw columns left of, within, and right of the moved region */
+        guac_common_rect_init(&part, rect->x, rect->y, start, height);
+        __guac_common_surface_draw_rect(surface, buffer, stride, sx, sy, part, 1);
+
+        guac_common_rect_init(&part, rect->x + start, rect->y, length, height);
+        __guac_common_surface_draw_rect(surface, buffer, stride,
+                sx + start, sy, part, 1);
+
+        guac_common_rect_init(&part, rect->x + start + length, rect->y,
+                width - start - length, height);
+        __guac_common_surface_draw_rect(surface, buffer, stride,
+                sx + start + length, sy, part, 1);
+
+        return 1;
+
+    }
+
+    return 0;
 
 }
 
-guac_common_surface* guac_common_surface_alloc(guac_socket* socket, const guac_layer* layer, int w, int h) {
+guac_common_surface* guac_common_surface_alloc(guac_client* client, guac_socket* socket,
+        const guac_layer* layer, int w, int h) {
 
     /* Init surface */
     guac_common_surface* surface = malloc(sizeof(guac_common_surface));
+    if (surface == NULL)
+        return NULL;
+
+    /* Allocate space for merging updates */
+    surface->png_region = guac_common_region_alloc();
+    if (surface->png_region == NULL) {
+        free(surface);
+        return NULL;
+    }
+
+    surface->client = client;
     surface->layer = layer;
     surface->socket = socket;
     surface->width = w;
     surface->height = h;
     surface->dirty = 0;
     surface->png_queue_length = 0;
+    surface->image_streams = 0;
+    surface->jpeg_quality = 0;
+    surface->encoder_pool = NULL;
+    surface->image_cache = NULL;
+    surface->cost_model = NULL;
+    surface->base_cost = GUAC_SURFACE_BASE_COST;
+    surface->motion_detection = 0;
+    surface->damage_model = GUAC_COMMON_SURFACE_DAMAGE_QUEUE;
+    surface->tile_columns = 0;
+    surface->tile_rows = 0;
+    surface->tile_flags = NULL;
+    surface->tile_hashes = NULL;
+    surface->delta_updates = 0;
+    surface->shadow = NULL;
+    surface->shadow_columns = 0;
+    surface->shadow_rows = 0;
+    surface->shadow_valid = NULL;
+    surface->delta_buffer = NULL;
+    surface->trace = NULL;
+    surface->profile = NULL;
+    surface->profile_level = GUAC_COMMON_PROFILE_LOSSLESS;
+    surface->jpeg_unsupported = 0;
+    surface->last_flush = 0;
+    surface->flush_pending = 0;
 
     /* Create corresponding Cairo surface */
     surface->stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, w);
@@ -693,10 +1512,25 @@ guac_common_surface* guac_common_surface_alloc(guac_socket* socket, const guac_l
 
 void guac_common_surface_free(guac_common_surface* surface) {
 
+    int argv[] = { surface->layer->index };
+    __guac_common_surface_trace(surface, GUAC_COMMON_SURFACE_TRACE_FREE,
+            argv, 1);
+
     /* Only dispose of surface if it exists */
     if (surface->realized)
         guac_protocol_send_dispose(surface->socket, surface->layer);
 
+    /* Free scratch buffer of delta updates, if ever used */
+    if (surface->delta_buffer != NULL) {
+        guac_protocol_send_dispose(surface->socket, surface->delta_buffer);
+        guac_client_free_buffer(surface->client, surface->delta_buffer);
+    }
+
+    guac_common_region_free(surface->png_region);
+    free(surface->shadow);
+    free(surface->shadow_valid);
+    free(surface->tile_flags);
+    free(surface->tile_hashes);
     free(surface->buffer);
     free(surface);
 
@@ -714,6 +1548,10 @@ void guac_common_surface_resize(guac_common_surface* surface, int w, int h) {
     int sx = 0;
     int sy = 0;
 
+    int argv[] = { layer->index, w, h };
+    __guac_common_surface_trace(surface, GUAC_COMMON_SURFACE_TRACE_RESIZE,
+            argv, 3);
+
     /* Copy old surface data */
     old_buffer = surface->buffer;
     old_stride = surface->stride;
@@ -740,6 +1578,17 @@ void guac_common_surface_resize(guac_common_surface* surface, int w, int h) {
             surface->dirty = 0;
     }
 
+    /* Resize tile grid, preserving tiles which remain */
+    if (surface->damage_model == GUAC_COMMON_SURFACE_DAMAGE_TILES)
+        __guac_common_surface_alloc_tiles(surface, surface->tile_flags,
+                surface->tile_hashes, surface->tile_columns,
+                surface->tile_rows);
+
+    /* Start over with a blank shadow, as nothing is assumed of the content
+     * of a resized layer */
+    if (surface->delta_updates)
+        __guac_common_surface_alloc_shadow(surface);
+
     /* Update Guacamole layer */
     if (surface->realized)
         guac_protocol_send_size(socket, layer, w, h);
@@ -753,6 +1602,7 @@ void guac_common_surface_draw(guac_common_surface* surface, int x, int y, cairo_
     int stride = cairo_image_surface_get_stride(src);
     int w = cairo_image_surface_get_width(src);
     int h = cairo_image_surface_get_height(src);
+    int opaque = format != CAIRO_FORMAT_ARGB32;
 
     int sx = 0;
     int sy = 0;
@@ -760,22 +1610,25 @@ void guac_common_surface_draw(guac_common_surface* surface, int x, int y, cairo_
     guac_common_rect rect;
     guac_common_rect_init(&rect, x, y, w, h);
 
+    /* Record image exactly as given */
+    if (surface->trace != NULL) {
+        int argv[] = { surface->layer->index, x, y, w, h, !opaque };
+        guac_common_surface_trace_write(surface->trace,
+                GUAC_COMMON_SURFACE_TRACE_DRAW, argv, 6, buffer, w, h, stride);
+    }
+
     /* Clip operation */
     __guac_common_clip_rect(surface, &rect, &sx, &sy);
     if (rect.width <= 0 || rect.height <= 0)
         return;
 
-    /* Update backing surface */
-    __guac_common_surface_put(buffer, stride, &sx, &sy, surface, &rect, format != CAIRO_FORMAT_ARGB32);
-    if (rect.width <= 0 || rect.height <= 0)
+    /* Copy content which has merely moved, if possible */
+    if (surface->motion_detection && opaque
+            && __guac_common_surface_draw_motion(surface, buffer, stride,
+                sx, sy, &rect))
         return;
 
-    /* Flush if not combining */
-    if (!__guac_common_should_combine(surface, &rect, 0))
-        guac_common_surface_flush_deferred(surface);
-
-    /* Always defer draws */
-    __guac_common_mark_dirty(surface, &rect);
+    __guac_common_surface_draw_rect(surface, buffer, stride, sx, sy, rect, opaque);
 
 }
 
@@ -793,6 +1646,13 @@ void guac_common_surface_paint(guac_common_surface* surface, int x, int y, cairo
     guac_common_rect rect;
     guac_common_rect_init(&rect, x, y, w, h);
 
+    /* Record mask exactly as given */
+    if (surface->trace != NULL) {
+        int argv[] = { surface->layer->index, x, y, w, h, red, green, blue };
+        guac_common_surface_trace_write(surface->trace,
+                GUAC_COMMON_SURFACE_TRACE_PAINT, argv, 8, buffer, w, h, stride);
+    }
+
     /* Clip operation */
     __guac_common_clip_rect(surface, &rect, &sx, &sy);
     if (rect.width <= 0 || rect.height <= 0)
@@ -803,15 +1663,29 @@ void guac_common_surface_paint(guac_common_surface* surface, int x, int y, cairo
 
     /* Flush if not combining */
     if (!__guac_common_should_combine(surface, &rect, 0))
-        guac_common_surface_flush_deferred(surface);
+        __guac_common_surface_flush_deferred(surface);
 
     /* Always defer draws */
     __guac_common_mark_dirty(surface, &rect);
 
 }
 
-void guac_common_surface_copy(guac_common_surface* src, int sx, int sy, int w, int h,
-                              guac_common_surface* dst, int dx, int dy) {
+/**
+ * Copies a rectangle of image data from one surface to another, exactly as
+ * guac_common_surface_copy(), but without recording the copy in any trace of
+ * the destination surface.
+ *
+ * @param src The source surface.
+ * @param sx The X coordinate of the upper-left corner of the source rect.
+ * @param sy The Y coordinate of the upper-left corner of the source rect.
+ * @param w The width of the source rect.
+ * @param h The height of the source rect.
+ * @param dst The destination surface.
+ * @param dx The X coordinate of the upper-left corner of the destination rect.
+ * @param dy The Y coordinate of the upper-left corner of the destination rect.
+ */
+static void __guac_common_surface_copy(guac_common_surface* src, int sx, int sy,
+        int w, int h, guac_common_surface* dst, int dx, int dy) {
 
     guac_socket* socket = dst->socket;
     const guac_layer* src_layer = src->layer;
@@ -838,10 +1712,13 @@ void guac_common_surface_copy(guac_common_surface* src, int sx, int sy, int w, i
 
     /* Otherwise, flush and draw immediately */
     else {
-        guac_common_surface_flush(dst);
-        guac_common_surface_flush(src);
+        __guac_common_surface_flush(dst);
+        __guac_common_surface_flush(src);
         guac_protocol_send_copy(socket, src_layer, sx, sy, rect.width, rect.height,
                                 GUAC_COMP_OVER, dst_layer, rect.x, rect.y);
+        __guac_common_surface_update_tiles(dst, &rect, 0,
+                GUAC_COMMON_SURFACE_TILE_HASHED);
+        __guac_common_surface_invalidate_shadow(dst, &rect);
         dst->realized = 1;
     }
 
@@ -851,6 +1728,16 @@ void guac_common_surface_copy(guac_common_surface* src, int sx, int sy, int w, i
 
 }
 
+void guac_common_surface_copy(guac_common_surface* src, int sx, int sy, int w, int h,
+                              guac_common_surface* dst, int dx, int dy) {
+
+    int argv[] = { src->layer->index, sx, sy, w, h, dst->layer->index, dx, dy };
+    __guac_common_surface_trace(dst, GUAC_COMMON_SURFACE_TRACE_COPY, argv, 8);
+
+    __guac_common_surface_copy(src, sx, sy, w, h, dst, dx, dy);
+
+}
+
 void guac_common_surface_transfer(guac_common_surface* src, int sx, int sy, int w, int h,
                                   guac_transfer_function op, guac_common_surface* dst, int dx, int dy) {
 
@@ -861,6 +1748,11 @@ void guac_common_surface_transfer(guac_common_surface* src, int sx, int sy, int
     guac_common_rect rect;
     guac_common_rect_init(&rect, dx, dy, w, h);
 
+    int argv[] = { src_layer->index, sx, sy, w, h, op,
+                   dst_layer->index, dx, dy };
+    __guac_common_surface_trace(dst, GUAC_COMMON_SURFACE_TRACE_TRANSFER,
+            argv, 9);
+
     /* Clip operation */
     __guac_common_clip_rect(dst, &rect, &sx, &sy);
     if (rect.width <= 0 || rect.height <= 0)
@@ -879,9 +1771,12 @@ void guac_common_surface_transfer(guac_common_surface* src, int sx, int sy, int
 
     /* Otherwise, flush and draw immediately */
     else {
-        guac_common_surface_flush(dst);
-        guac_common_surface_flush(src);
+        __guac_common_surface_flush(dst);
+        __guac_common_surface_flush(src);
         guac_protocol_send_transfer(socket, src_layer, sx, sy, rect.width, rect.height, op, dst_layer, rect.x, rect.y);
+        __guac_common_surface_update_tiles(dst, &rect, 0,
+                GUAC_COMMON_SURFACE_TILE_HASHED);
+        __guac_common_surface_invalidate_shadow(dst, &rect);
         dst->realized = 1;
     }
 
@@ -901,6 +1796,10 @@ void guac_common_surface_rect(guac_common_surface* surface,
     guac_common_rect rect;
     guac_common_rect_init(&rect, x, y, w, h);
 
+    int argv[] = { layer->index, x, y, w, h, red, green, blue };
+    __guac_common_surface_trace(surface, GUAC_COMMON_SURFACE_TRACE_RECT,
+            argv, 8);
+
     /* Clip operation */
     __guac_common_clip_rect(surface, &rect, NULL, NULL);
     if (rect.width <= 0 || rect.height <= 0)
@@ -917,9 +1816,12 @@ void guac_common_surface_rect(guac_common_surface* surface,
 
     /* Otherwise, flush and draw immediately */
     else {
-        guac_common_surface_flush(surface);
+        __guac_common_surface_flush(surface);
         guac_protocol_send_rect(socket, layer, rect.x, rect.y, rect.width, rect.height);
         guac_protocol_send_cfill(socket, GUAC_COMP_OVER, layer, red, green, blue, 0xFF);
+        __guac_common_surface_update_tiles(surface, &rect, 0,
+                GUAC_COMMON_SURFACE_TILE_HASHED);
+        __guac_common_surface_invalidate_shadow(surface, &rect);
         surface->realized = 1;
     }
 
@@ -929,6 +1831,10 @@ void guac_common_surface_clip(guac_common_surface* surface, int x, int y, int w,
 
     guac_common_rect clip;
 
+    int argv[] = { surface->layer->index, x, y, w, h };
+    __guac_common_surface_trace(surface, GUAC_COMMON_SURFACE_TRACE_CLIP,
+            argv, 5);
+
     /* Init clipping rectangle if clipping not already applied */
     if (!surface->clipped) {
         guac_common_rect_init(&surface->clip_rect, 0, 0, surface->width, surface->height);
@@ -941,132 +1847,1126 @@ void guac_common_surface_clip(guac_common_surface* surface, int x, int y, int w,
 }
 
 void guac_common_surface_reset_clip(guac_common_surface* surface) {
+
+    int argv[] = { surface->layer->index };
+    __guac_common_surface_trace(surface,
+            GUAC_COMMON_SURFACE_TRACE_RESET_CLIP, argv, 1);
+
     surface->clipped = 0;
+
 }
 
 /**
- * Flushes the PNG update currently described by the dirty rectangle within the
- * given surface directly to a "png" instruction, which is sent on the socket
- * associated with the surface.
+ * Returns the JPEG quality to use for updates of the given surface, taking
+ * into account its profile and whether JPEG is supported at all.
  *
- * @param surface The surface to flush.
+ * @param surface The surface whose JPEG quality should be returned.
+ * @return The JPEG quality to use, from 1 to 100, or 0 if updates must not
+ *         be sent as JPEG.
  */
-static void __guac_common_surface_flush_to_png(guac_common_surface* surface) {
+static int __guac_common_surface_jpeg_quality(guac_common_surface* surface) {
 
-    if (surface->dirty) {
+    if (surface->jpeg_unsupported)
+        return 0;
 
-        guac_socket* socket = surface->socket;
-        const guac_layer* layer = surface->layer;
+    /* Lossy profile levels imply JPEG even if not otherwise enabled */
+    if (surface->jpeg_quality == 0
+            && surface->profile_level >= GUAC_COMMON_PROFILE_LOSSY)
+        return GUAC_SURFACE_PROFILE_JPEG_QUALITY;
 
-        /* Get Cairo surface for specified rect */
-        unsigned char* buffer = surface->buffer + surface->dirty_rect.y * surface->stride + surface->dirty_rect.x * 4;
-        cairo_surface_t* rect = cairo_image_surface_create_for_data(buffer, CAIRO_FORMAT_RGB24,
-                                                                    surface->dirty_rect.width,
-                                                                    surface->dirty_rect.height,
-                                                                    surface->stride);
+    return surface->jpeg_quality;
 
-        /* Send PNG for rect */
-        guac_protocol_send_png(socket, GUAC_COMP_OVER, layer, surface->dirty_rect.x, surface->dirty_rect.y, rect);
-        cairo_surface_destroy(rect);
-        surface->realized = 1;
+}
+
+/**
+ * Returns a copy of the given image with each color reduced to 3 bits of red,
+ * 3 bits of green and 2 bits of blue, such that the image contains at most
+ * 256 distinct colors and can be encoded as a palette PNG. Reduced
+ * components are expanded back to 8 bits by replicating their bits, such
+ * that black and white are preserved exactly.
+ *
+ * @param buffer The first pixel of the image to copy.
+ * @param stride The number of bytes in each row of the image.
+ * @param width The width of the image, in pixels.
+ * @param height The height of the image, in pixels.
+ * @return A newly-allocated image of the given dimensions, with rows of
+ *         exactly width * 4 bytes, which must eventually be freed with
+ *         free().
+ */
+static unsigned char* __guac_common_surface_reduce_color(
+        const unsigned char* buffer, int stride, int width, int height) {
+
+    unsigned char* reduced = malloc(width * height * 4);
+    uint32_t* dst = (uint32_t*) reduced;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
 
-        /* Surface is no longer dirty */
-        surface->dirty = 0;
+        const uint32_t* src = (const uint32_t*) (buffer + y * stride);
+
+        for (x = 0; x < width; x++) {
+
+            uint32_t color = *(src++);
+            int red   = (color >> 16) & 0xE0;
+            int green = (color >> 8)  & 0xE0;
+            int blue  =  color        & 0xC0;
+
+            red   |= (red   >> 3) | (red   >> 6);
+            green |= (green >> 3) | (green >> 6);
+            blue  |= (blue  >> 2) | (blue  >> 4) | (blue >> 6);
+
+            *(dst++) = 0xFF000000 | (red << 16) | (green << 8) | blue;
+
+        }
 
     }
 
+    return reduced;
+
 }
 
 /**
- * Comparator for instances of guac_common_surface_png_rect, the elements
- * which make up a surface's PNG buffer.
+ * Returns whether the given rectangle of the given surface appears
+ * photographic, and would thus be better sent as JPEG than PNG. The
+ * rectangle is sampled on a uniform grid, estimating both the number of
+ * distinct colors (using a hashed bitmap) and the entropy of the luminance
+ * histogram. Only rectangles with many colors and high entropy qualify.
  *
- * @see qsort
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle to classify, which must lie within the surface.
+ * @return Non-zero if the rectangle appears photographic, zero otherwise.
  */
-static int __guac_common_surface_png_rect_compare(const void* a, const void* b) {
+static int __guac_common_surface_should_use_jpeg(guac_common_surface* surface,
+        const guac_common_rect* rect) {
 
-    guac_common_surface_png_rect* ra = (guac_common_surface_png_rect*) a;
-    guac_common_surface_png_rect* rb = (guac_common_surface_png_rect*) b;
+    unsigned char colors[GUAC_SURFACE_JPEG_COLOR_BITS / 8];
+    int histogram[GUAC_SURFACE_JPEG_LUMA_BINS];
 
-    /* Order roughly top to bottom, left to right */
-    if (ra->rect.y != rb->rect.y) return ra->rect.y - rb->rect.y;
-    if (ra->rect.x != rb->rect.x) return ra->rect.x - rb->rect.x;
+    int area = rect->width * rect->height;
+    int step = 1;
+    int samples = 0;
+    int distinct = 0;
+    double entropy = 0;
+    int x, y, i;
 
-    /* Wider updates should come first (more likely to intersect later) */
-    if (ra->rect.width != rb->rect.width) return rb->rect.width - ra->rect.width;
+    /* Ignore small updates */
+    if (area < GUAC_SURFACE_JPEG_MIN_AREA)
+        return 0;
 
-    /* Shorter updates should come first (less likely to increase cost) */
-    return ra->rect.height - rb->rect.height;
+    /* Choose grid spacing such that samples are bounded */
+    while (area / (step * step) > GUAC_SURFACE_JPEG_MAX_SAMPLES)
+        step++;
 
-}
+    memset(colors, 0, sizeof(colors));
+    memset(histogram, 0, sizeof(histogram));
 
-void guac_common_surface_flush(guac_common_surface* surface) {
+    for (y = rect->y; y < rect->y + rect->height; y += step) {
 
-    guac_common_surface_png_rect* current = surface->png_queue;
+        uint32_t* row = (uint32_t*) (surface->buffer + y * surface->stride);
 
-    int i, j;
-    int original_queue_length;
-    int flushed = 0;
+        for (x = rect->x; x < rect->x + rect->width; x += step) {
 
-    /* Flush final dirty rect to queue */
-    __guac_common_surface_flush_to_queue(surface);
-    original_queue_length = surface->png_queue_length;
+            uint32_t color = row[x] & 0xFFFFFF;
+            int red   = (color >> 16) & 0xFF;
+            int green = (color >> 8)  & 0xFF;
+            int blue  =  color        & 0xFF;
 
-    /* Sort updates to make combination less costly */
-    qsort(surface->png_queue, surface->png_queue_length, sizeof(guac_common_surface_png_rect),
-          __guac_common_surface_png_rect_compare);
+            /* Count color if not yet seen */
+            uint32_t hash = (color * 2654435761u) % GUAC_SURFACE_JPEG_COLOR_BITS;
+            unsigned char bit = 1 << (hash & 0x7);
+            if (!(colors[hash >> 3] & bit)) {
+                colors[hash >> 3] |= bit;
+                distinct++;
+            }
 
-    /* Flush all rects in queue */
-    for (i=0; i < surface->png_queue_length; i++) {
+            /* Add to luminance histogram */
+            histogram[((red * 77 + green * 150 + blue * 29) >> 8)
+                * GUAC_SURFACE_JPEG_LUMA_BINS / 256]++;
 
-        /* Get next unflushed candidate */
-        guac_common_surface_png_rect* candidate = current;
-        if (!candidate->flushed) {
+            samples++;
 
-            int combined = 0;
+        }
 
-            /* Build up rect as much as possible */
-            for (j=i; j < surface->png_queue_length; j++) {
+    }
 
-                if (!candidate->flushed) {
+    /* Require many distinct colors */
+    if (distinct < GUAC_SURFACE_JPEG_MIN_COLORS
+            || distinct < samples / GUAC_SURFACE_JPEG_COLOR_RATIO)
+        return 0;
 
-                    /* Clip candidate within current bounds */
-                    __guac_common_bound_rect(surface, &candidate->rect, NULL, NULL);
-                    if (candidate->rect.width <= 0 || candidate->rect.height <= 0)
-                        candidate->flushed = 1;
+    /* Require high luminance entropy */
+    for (i = 0; i < GUAC_SURFACE_JPEG_LUMA_BINS; i++) {
+        if (histogram[i] > 0) {
+            double p = (double) histogram[i] / samples;
+            entropy -= p * log2(p);
+        }
+    }
 
-                    /* Combine if reasonable */
-                    else if (__guac_common_should_combine(surface, &candidate->rect, 0) || !surface->dirty) {
-                        __guac_common_mark_dirty(surface, &candidate->rect);
-                        candidate->flushed = 1;
-                        combined++;
-                    }
+    return entropy >= GUAC_SURFACE_JPEG_MIN_ENTROPY;
 
-                }
+}
 
-                candidate++;
+/**
+ * Returns the XOR of the content of the given rectangle of the given surface
+ * and the content last sent for that rectangle, if the rectangle would be
+ * cheaper to send as that XOR image than in full. The cost of each encoding
+ * is estimated from the number of pixels which have changed.
+ *
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle to be sent, which must lie within the surface.
+ * @return A newly-allocated RGB24 image having the dimensions of the given
+ *         rectangle and a stride of four bytes per pixel, which must
+ *         eventually be freed with free(), or NULL if the rectangle should be
+ *         sent in full.
+ */
+static unsigned char* __guac_common_surface_prepare_delta(
+        guac_common_surface* surface, const guac_common_rect* rect) {
+
+    unsigned char* delta;
+    uint32_t* current;
+    int area = rect->width * rect->height;
+    int full_cost = surface->base_cost + area;
+    int delta_cost;
+    int changed = 0;
+    int x, y;
 
-            }
+    /* Delta updates require the content last sent, and cost an extra
+     * instruction which carries no image data */
+    delta_cost = surface->base_cost
+               + surface->base_cost / GUAC_SURFACE_DATA_FACTOR
+               + area / GUAC_SURFACE_DELTA_UNCHANGED_FACTOR;
 
-            /* Re-add to queue if there's room and this update was modified or we expect others might be */
-            if ((combined > 1 || i < original_queue_length)
-                    && surface->png_queue_length < GUAC_COMMON_SURFACE_QUEUE_SIZE)
-                __guac_common_surface_flush_to_queue(surface);
+    if (delta_cost >= full_cost
+            || !__guac_common_surface_shadow_valid(surface, rect))
+        return NULL;
 
-            /* Flush as PNG otherwise */
-            else {
-                if (surface->dirty) flushed++;
-                __guac_common_surface_flush_to_png(surface);
-            }
+    delta = malloc(area * 4);
+    current = (uint32_t*) delta;
+
+    for (y = rect->y; y < rect->y + rect->height; y++) {
+
+        int offset = y * surface->stride + rect->x * 4;
+        const uint32_t* new_row = (uint32_t*) (surface->buffer + offset);
+        const uint32_t* old_row = (uint32_t*) (surface->shadow + offset);
+
+        for (x = 0; x < rect->width; x++) {
+
+            /* The unused high byte of each pixel is ignored */
+            uint32_t difference = (new_row[x] ^ old_row[x]) & 0xFFFFFF;
+            if (difference != 0)
+                changed++;
+
+            *(current++) = difference;
 
         }
 
-        current++;
+        /* Give up as soon as too much has changed */
+        if (delta_cost + changed * GUAC_SURFACE_DELTA_CHANGED_FACTOR
+                >= full_cost) {
+            free(delta);
+            return NULL;
+        }
 
     }
 
-    /* Flush complete */
-    surface->png_queue_length = 0;
+    return delta;
+
+}
+
+/**
+ * Sends the given XOR image for the given rectangle of the given surface on
+ * the given socket. The image is drawn to the scratch buffer of the surface
+ * as a "png" instruction (or an "img" stream, if image streams are enabled),
+ * and then applied to the rectangle with an XOR "transfer".
+ *
+ * @param surface The surface containing the rectangle.
+ * @param socket The socket to send instructions on.
+ * @param rect The rectangle to send, which must lie within the surface.
+ * @param delta The XOR image to send, as produced by
+ *              __guac_common_surface_prepare_delta().
+ */
+static void __guac_common_surface_send_delta(guac_common_surface* surface,
+        guac_socket* socket, const guac_common_rect* rect,
+        unsigned char* delta) {
+
+    cairo_surface_t* image = cairo_image_surface_create_for_data(delta,
+            CAIRO_FORMAT_RGB24, rect->width, rect->height, rect->width * 4);
+
+    if (surface->image_streams)
+        guac_client_stream_png(surface->client, socket, GUAC_COMP_OVER,
+                surface->delta_buffer, 0, 0, image);
+    else
+        guac_protocol_send_png(socket, GUAC_COMP_OVER,
+                surface->delta_buffer, 0, 0, image);
+
+    guac_protocol_send_transfer(socket, surface->delta_buffer, 0, 0,
+            rect->width, rect->height, GUAC_TRANSFER_BINARY_XOR,
+            surface->layer, rect->x, rect->y);
+
+    cairo_surface_destroy(image);
+
+}
+
+/**
+ * Decides how the given rectangle of the given surface, which could not be
+ * drawn from cache, will be encoded, updating the shadow of the surface to
+ * reflect the content the client will hold once the rectangle is sent. As
+ * this depends on all prior updates, this must be called in the order that
+ * updates are sent.
+ *
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle to be sent, which must lie within the surface.
+ * @param jpeg Storage for whether the rectangle should be sent as JPEG.
+ * @return The XOR image to send in place of the rectangle, which must
+ *         eventually be freed with free(), or NULL if the rectangle should be
+ *         sent in full.
+ */
+static unsigned char* __guac_common_surface_prepare_update(
+        guac_common_surface* surface, const guac_common_rect* rect,
+        int* jpeg) {
+
+    unsigned char* delta = NULL;
+    int quality = __guac_common_surface_jpeg_quality(surface);
+
+    /* Send all but small updates as JPEG if the profile requires */
+    if (surface->profile_level >= GUAC_COMMON_PROFILE_LOSSY)
+        *jpeg = quality > 0
+            && rect->width * rect->height >= GUAC_SURFACE_JPEG_MIN_AREA;
+
+    /* Otherwise, only those which appear photographic */
+    else
+        *jpeg = quality > 0
+            && __guac_common_surface_should_use_jpeg(surface, rect);
+
+    if (surface->shadow == NULL)
+        return NULL;
+
+    /* Content sent as JPEG or with reduced color will not match the
+     * shadow */
+    if (*jpeg || surface->profile_level >= GUAC_COMMON_PROFILE_REDUCED_COLOR) {
+        __guac_common_surface_invalidate_shadow(surface, rect);
+        return NULL;
+    }
+
+    delta = __guac_common_surface_prepare_delta(surface, rect);
+    __guac_common_surface_update_shadow(surface, rect);
+
+    /* Allocate scratch buffer upon first use */
+    if (delta != NULL && surface->delta_buffer == NULL)
+        surface->delta_buffer = guac_client_alloc_buffer(surface->client);
+
+    return delta;
+
+}
+
+/**
+ * Sends the given rectangle of the given surface on the given socket, as
+ * decided by __guac_common_surface_prepare_update(). Unless sent as a delta,
+ * the rectangle is sent as a "png" instruction (or an "img" stream, if image
+ * streams are enabled), or as JPEG if so decided. This function only reads
+ * the surface, and may be called by several threads at once for the same
+ * surface.
+ *
+ * @param surface The surface containing the rectangle.
+ * @param socket The socket to send instructions on.
+ * @param rect The rectangle to send, which must lie within the surface.
+ * @param jpeg Non-zero if the rectangle should be sent as JPEG.
+ * @param delta The XOR image to send in place of the rectangle, or NULL if
+ *              the rectangle should be sent in full.
+ * @return Non-zero if JPEG could not be used because this build of libguac
+ *         does not support it, in which case the rectangle was sent as PNG,
+ *         zero otherwise.
+ */
+static int __guac_common_surface_send_rect(guac_common_surface* surface,
+        guac_socket* socket, const guac_common_rect* rect, int jpeg,
+        unsigned char* delta) {
+
+    const guac_layer* layer = surface->layer;
+    int x = rect->x;
+    int y = rect->y;
+    int jpeg_unsupported = 0;
+    int sent = 0;
+
+    guac_socket_image_stats before;
+    unsigned char* buffer;
+    unsigned char* reduced = NULL;
+    cairo_surface_t* image;
+
+    /* Send only differences, if decided */
+    if (delta != NULL) {
+        __guac_common_surface_send_delta(surface, socket, rect, delta);
+        return 0;
+    }
+
+    /* Note image statistics prior to encoding, if measuring cost */
+    if (surface->cost_model != NULL)
+        guac_socket_get_image_stats(socket, &before);
+
+    /* Get Cairo surface for specified rect */
+    buffer = surface->buffer + y * surface->stride + x * 4;
+    image = cairo_image_surface_create_for_data(buffer, CAIRO_FORMAT_RGB24,
+                                                rect->width, rect->height,
+                                                surface->stride);
+
+    /* Send JPEG for photographic rects, if decided */
+    if (jpeg) {
+
+        int result;
+
+        int quality = __guac_common_surface_jpeg_quality(surface);
+
+        if (surface->image_streams)
+            result = guac_client_stream_jpeg(surface->client, socket, GUAC_COMP_OVER,
+                                             layer, x, y, image, quality);
+        else
+            result = guac_protocol_send_jpeg(socket, GUAC_COMP_OVER, layer,
+                                             x, y, image, quality);
+
+        /* If this build cannot encode JPEG, nothing was sent. Fall back
+         * to PNG. */
+        if (result && guac_error == GUAC_STATUS_NOT_SUPPORTED)
+            jpeg_unsupported = 1;
+        else
+            sent = 1;
+
+    }
+
+    /* Otherwise send PNG for rect, streaming if supported */
+    if (!sent) {
+
+        /* Reduce colors if the profile requires */
+        if (surface->profile_level >= GUAC_COMMON_PROFILE_REDUCED_COLOR) {
+            reduced = __guac_common_surface_reduce_color(buffer,
+                    surface->stride, rect->width, rect->height);
+            cairo_surface_destroy(image);
+            image = cairo_image_surface_create_for_data(reduced,
+                    CAIRO_FORMAT_RGB24, rect->width, rect->height,
+                    rect->width * 4);
+        }
+
+        if (surface->image_streams)
+            guac_client_stream_png(surface->client, socket, GUAC_COMP_OVER, layer, x, y, image);
+        else
+            guac_protocol_send_png(socket, GUAC_COMP_OVER, layer, x, y, image);
+
+    }
+
+    cairo_surface_destroy(image);
+    free(reduced);
+
+    /* Record encoded size and encoding time of update */
+    if (surface->cost_model != NULL) {
+
+        guac_socket_image_stats after;
+        guac_socket_get_image_stats(socket, &after);
+
+        guac_common_cost_model_record(surface->cost_model,
+                rect->width * rect->height,
+                (after.png_bytes + after.jpeg_bytes)
+                    - (before.png_bytes + before.jpeg_bytes),
+                (after.png_time + after.jpeg_time)
+                    - (before.png_time + before.jpeg_time));
+
+    }
+
+    return jpeg_unsupported;
+
+}
+
+/**
+ * Searches the image cache of the given surface, if any, for the current
+ * content of the given rectangle. A matching entry is pinned until sent with
+ * guac_common_image_cache_send().
+ *
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle to search for, which must lie within the surface.
+ * @param hash Storage for the hash of the content of the rectangle, for use
+ *             by __guac_common_surface_cache_store() if no entry is found.
+ * @return The matching cache entry, or NULL if the surface has no cache, the
+ *         rectangle cannot be cached, or no entry matches.
+ */
+static guac_common_image_cache_entry* __guac_common_surface_cache_lookup(
+        guac_common_surface* surface, const guac_common_rect* rect,
+        unsigned int* hash) {
+
+    guac_common_image_cache_entry* entry;
+    cairo_surface_t* image;
+
+    if (surface->image_cache == NULL
+            || !guac_common_image_cache_accepts(surface->image_cache,
+                rect->width, rect->height))
+        return NULL;
+
+    image = cairo_image_surface_create_for_data(
+            surface->buffer + rect->y * surface->stride + rect->x * 4,
+            CAIRO_FORMAT_RGB24, rect->width, rect->height, surface->stride);
+
+    *hash = guac_hash_surface(image);
+    entry = guac_common_image_cache_lookup(surface->image_cache, image, *hash);
+
+    cairo_surface_destroy(image);
+    return entry;
+
+}
+
+/**
+ * Adds the current content of the given rectangle, which has just been sent,
+ * to the image cache of the given surface, if any.
+ *
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle which was sent.
+ * @param hash The hash of the content of the rectangle, as produced by
+ *             __guac_common_surface_cache_lookup().
+ */
+static void __guac_common_surface_cache_store(guac_common_surface* surface,
+        const guac_common_rect* rect, unsigned int hash) {
+
+    cairo_surface_t* image;
+
+    /* Content sent at reduced quality is not worth reusing */
+    if (surface->image_cache == NULL
+            || surface->profile_level >= GUAC_COMMON_PROFILE_REDUCED_COLOR
+            || !guac_common_image_cache_accepts(surface->image_cache,
+                rect->width, rect->height))
+        return;
+
+    image = cairo_image_surface_create_for_data(
+            surface->buffer + rect->y * surface->stride + rect->x * 4,
+            CAIRO_FORMAT_RGB24, rect->width, rect->height, surface->stride);
+
+    guac_common_image_cache_store(surface->image_cache, surface->socket,
+            surface->layer, rect->x, rect->y, image, hash);
+
+    cairo_surface_destroy(image);
+
+}
+
+/**
+ * Updates the shadow of the given surface to reflect that the given rectangle
+ * is about to be drawn from the image cache. The cached image matches the
+ * surface exactly only if it cannot have been sent as JPEG or with reduced
+ * color.
+ *
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle being drawn from cache.
+ */
+static void __guac_common_surface_cache_sent(guac_common_surface* surface,
+        const guac_common_rect* rect) {
+
+    if (__guac_common_surface_jpeg_quality(surface) > 0
+            || surface->profile_level >= GUAC_COMMON_PROFILE_REDUCED_COLOR)
+        __guac_common_surface_invalidate_shadow(surface, rect);
+    else
+        __guac_common_surface_update_shadow(surface, rect);
+
+}
+
+/**
+ * Sends the given rectangle of the given surface on the socket associated
+ * with the surface, drawing it from the image cache of the surface if the
+ * client already holds identical content, and otherwise encoding it and
+ * adding it to the cache.
+ *
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle to send, which must lie within the surface.
+ */
+static void __guac_common_surface_send_update(guac_common_surface* surface,
+        const guac_common_rect* rect) {
+
+    unsigned int hash = 0;
+    guac_common_image_cache_entry* entry =
+        __guac_common_surface_cache_lookup(surface, rect, &hash);
+
+    unsigned char* delta;
+    int jpeg;
+
+    /* Draw from cache if possible */
+    if (entry != NULL) {
+        __guac_common_surface_cache_sent(surface, rect);
+        guac_common_image_cache_send(surface->image_cache, entry,
+                surface->socket, surface->layer, rect->x, rect->y);
+        return;
+    }
+
+    delta = __guac_common_surface_prepare_update(surface, rect, &jpeg);
+
+    /* Stop attempting JPEG if this build cannot encode it */
+    if (__guac_common_surface_send_rect(surface, surface->socket, rect,
+                jpeg, delta))
+        surface->jpeg_unsupported = 1;
+
+    free(delta);
+    __guac_common_surface_cache_store(surface, rect, hash);
+
+}
+
+/**
+ * An update which is being encoded by a thread of a worker pool.
+ */
+typedef struct guac_common_surface_encode_job {
+
+    /**
+     * The surface being flushed.
+     */
+    guac_common_surface* surface;
+
+    /**
+     * The rectangle of the surface to send.
+     */
+    guac_common_rect rect;
+
+    /**
+     * Buffer socket holding the encoded update until it can be sent in
+     * order.
+     */
+    guac_socket* socket;
+
+    /**
+     * Non-zero if this update should be sent as JPEG.
+     */
+    int jpeg;
+
+    /**
+     * The XOR image to send in place of this update, or NULL if this update
+     * should be sent in full.
+     */
+    unsigned char* delta;
+
+    /**
+     * Non-zero if JPEG could not be used for this update because this build
+     * of libguac does not support it.
+     */
+    int jpeg_unsupported;
+
+    /**
+     * The cache entry holding identical content, in which case the update is
+     * drawn from cache rather than encoded, or NULL if the update must be
+     * encoded.
+     */
+    guac_common_image_cache_entry* entry;
+
+    /**
+     * The hash of the content of the update, for adding it to the image
+     * cache once sent.
+     */
+    unsigned int hash;
+
+} guac_common_surface_encode_job;
+
+/**
+ * Worker pool task which encodes a single update into the buffer socket of
+ * the given guac_common_surface_encode_job.
+ *
+ * @param data The guac_common_surface_encode_job to run.
+ */
+static void __guac_common_surface_encode_task(void* data) {
+
+    guac_common_surface_encode_job* job = (guac_common_surface_encode_job*) data;
+
+    job->jpeg_unsupported = __guac_common_surface_send_rect(job->surface,
+            job->socket, &job->rect, job->jpeg, job->delta);
+
+}
+
+/**
+ * Encodes the given updates concurrently using the worker pool of the given
+ * surface, then sends each on the socket associated with the surface in the
+ * order given. The surface must not be modified until this function returns.
+ * No more than GUAC_COMMON_SURFACE_QUEUE_SIZE updates may be given.
+ *
+ * @param surface The surface being flushed.
+ * @param pending The updates to send.
+ * @param count The number of updates to send.
+ */
+static void __guac_common_surface_flush_pending(guac_common_surface* surface,
+        const guac_common_rect* pending, int count) {
+
+    guac_common_surface_encode_job jobs[GUAC_COMMON_SURFACE_QUEUE_SIZE];
+    void* tasks[GUAC_COMMON_SURFACE_QUEUE_SIZE];
+    int encoded = 0;
+    int i;
+
+    /* Nothing to gain from the pool for a single update */
+    if (count == 1) {
+        __guac_common_surface_send_update(surface, &pending[0]);
+        return;
+    }
+
+    /* Encode only those updates which cannot be drawn from cache */
+    for (i = 0; i < count; i++) {
+
+        jobs[i].surface = surface;
+        jobs[i].rect = pending[i];
+        jobs[i].socket = NULL;
+        jobs[i].jpeg = 0;
+        jobs[i].delta = NULL;
+        jobs[i].jpeg_unsupported = 0;
+        jobs[i].hash = 0;
+        jobs[i].entry = __guac_common_surface_cache_lookup(surface,
+                &pending[i], &jobs[i].hash);
+
+        if (jobs[i].entry != NULL)
+            __guac_common_surface_cache_sent(surface, &pending[i]);
+
+        else {
+            jobs[i].delta = __guac_common_surface_prepare_update(surface,
+                    &pending[i], &jobs[i].jpeg);
+            jobs[i].socket = guac_socket_buffer(surface->socket);
+
+            /* Updates without a buffer are sent inline, below */
+            if (jobs[i].socket != NULL)
+                tasks[encoded++] = &jobs[i];
+
+        }
+
+    }
+
+    if (encoded > 0)
+        guac_common_worker_pool_run(surface->encoder_pool,
+                __guac_common_surface_encode_task, tasks, encoded);
+
+    /* Send updates in their original order */
+    for (i = 0; i < count; i++) {
+
+        /* Draw from cache if possible */
+        if (jobs[i].entry != NULL) {
+            guac_common_image_cache_send(surface->image_cache, jobs[i].entry,
+                    surface->socket, surface->layer,
+                    jobs[i].rect.x, jobs[i].rect.y);
+            continue;
+        }
+
+        /* Encode directly if no buffer could be allocated */
+        if (jobs[i].socket == NULL)
+            jobs[i].jpeg_unsupported = __guac_common_surface_send_rect(
+                    surface, surface->socket, &jobs[i].rect, jobs[i].jpeg,
+                    jobs[i].delta);
+
+        else {
+            guac_socket_buffer_commit(jobs[i].socket);
+            guac_socket_free(jobs[i].socket);
+        }
+
+        if (jobs[i].jpeg_unsupported)
+            surface->jpeg_unsupported = 1;
+
+        free(jobs[i].delta);
+
+        __guac_common_surface_cache_store(surface, &jobs[i].rect, jobs[i].hash);
+
+    }
+
+}
+
+/**
+ * Sends the given updates on the socket associated with the given surface,
+ * encoding them concurrently if the surface has a worker pool.
+ *
+ * @param surface The surface being flushed.
+ * @param pending The updates to send.
+ * @param count The number of updates to send.
+ */
+static void __guac_common_surface_send_pending(guac_common_surface* surface,
+        const guac_common_rect* pending, int count) {
+
+    int i;
+
+    if (count == 0)
+        return;
+
+    surface->realized = 1;
+
+    /* Encode concurrently if possible, as many updates at a time as the
+     * pool can accept */
+    if (surface->encoder_pool != NULL) {
+
+        for (i = 0; i < count; i += GUAC_COMMON_SURFACE_QUEUE_SIZE) {
+
+            int chunk = count - i;
+            if (chunk > GUAC_COMMON_SURFACE_QUEUE_SIZE)
+                chunk = GUAC_COMMON_SURFACE_QUEUE_SIZE;
+
+            __guac_common_surface_flush_pending(surface, &pending[i], chunk);
+
+        }
+
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        __guac_common_surface_send_update(surface, &pending[i]);
+
+}
+
+/**
+ * Returns the hash of the content of the given rectangle of the given
+ * surface, ignoring the unused high byte of each pixel.
+ *
+ * @param surface The surface containing the rectangle.
+ * @param rect The rectangle to hash, which must lie within the surface.
+ * @return The hash of the content of the given rectangle.
+ */
+static uint64_t __guac_common_surface_hash_rect(guac_common_surface* surface,
+        const guac_common_rect* rect) {
+
+    /* 64-bit FNV-1a, one pixel at a time */
+    uint64_t hash = 14695981039346656037ULL;
+    int x, y;
+
+    for (y = rect->y; y < rect->y + rect->height; y++) {
+
+        uint32_t* row = (uint32_t*) (surface->buffer + y * surface->stride);
+
+        for (x = rect->x; x < rect->x + rect->width; x++)
+            hash = (hash ^ (row[x] & 0xFFFFFF)) * 1099511628211ULL;
+
+    }
+
+    return hash;
+
+}
+
+/**
+ * Initializes the given rectangle to the area covered by the given range of
+ * tiles, constrained within the bounds of the given surface.
+ *
+ * @param surface The surface containing the tiles.
+ * @param rect The rectangle to initialize.
+ * @param column The column of the upper-left tile.
+ * @param row The row of the upper-left tile.
+ * @param columns The number of columns of tiles covered.
+ * @param rows The number of rows of tiles covered.
+ */
+static void __guac_common_surface_tile_rect(guac_common_surface* surface,
+        guac_common_rect* rect, int column, int row, int columns, int rows) {
+
+    guac_common_rect_init(rect,
+            column  * GUAC_COMMON_SURFACE_TILE_SIZE,
+            row     * GUAC_COMMON_SURFACE_TILE_SIZE,
+            columns * GUAC_COMMON_SURFACE_TILE_SIZE,
+            rows    * GUAC_COMMON_SURFACE_TILE_SIZE);
+
+    __guac_common_bound_rect(surface, rect, NULL, NULL);
+
+}
+
+/**
+ * Flushes all dirty tiles of the given surface, which must track damage using
+ * GUAC_COMMON_SURFACE_DAMAGE_TILES. Dirty tiles whose content hash matches
+ * the hash of the content last sent are skipped. Each remaining run of
+ * horizontally-adjacent dirty tiles is extended downward through each
+ * following row in which the same run is entirely dirty, and sent as a
+ * single rectangle.
+ *
+ * @param surface The surface to flush.
+ */
+static void __guac_common_surface_flush_tiles(guac_common_surface* surface) {
+
+    guac_common_rect pending[GUAC_COMMON_SURFACE_QUEUE_SIZE];
+    int pending_count = 0;
+
+    int columns = surface->tile_columns;
+    int rows = surface->tile_rows;
+    int row, column, i;
+
+    if (!surface->dirty)
+        return;
+
+    /* Skip dirty tiles whose content has not actually changed */
+    for (row = 0; row < rows; row++) {
+        for (column = 0; column < columns; column++) {
+
+            unsigned char* flags = &(surface->tile_flags[row * columns + column]);
+            uint64_t* hash = &(surface->tile_hashes[row * columns + column]);
+            uint64_t current_hash;
+            guac_common_rect rect;
+
+            if (!(*flags & GUAC_COMMON_SURFACE_TILE_DIRTY))
+                continue;
+
+            __guac_common_surface_tile_rect(surface, &rect, column, row, 1, 1);
+            current_hash = __guac_common_surface_hash_rect(surface, &rect);
+
+            if ((*flags & GUAC_COMMON_SURFACE_TILE_HASHED) && *hash == current_hash)
+                *flags &= ~GUAC_COMMON_SURFACE_TILE_DIRTY;
+
+            /* Content will be sent, and thus will match the new hash */
+            else {
+                *hash = current_hash;
+                *flags |= GUAC_COMMON_SURFACE_TILE_HASHED;
+            }
+
+        }
+    }
+
+    /* Coalesce remaining dirty tiles into rectangles */
+    for (row = 0; row < rows; row++) {
+
+        unsigned char* flags = surface->tile_flags + row * columns;
+
+        column = 0;
+        while (column < columns) {
+
+            int run_columns = 0;
+            int run_rows = 1;
+
+            /* Find next run of dirty tiles */
+            if (!(flags[column] & GUAC_COMMON_SURFACE_TILE_DIRTY)) {
+                column++;
+                continue;
+            }
+
+            while (column + run_columns < columns
+                    && (flags[column + run_columns] & GUAC_COMMON_SURFACE_TILE_DIRTY))
+                flags[column + run_columns++] &= ~GUAC_COMMON_SURFACE_TILE_DIRTY;
+
+            /* Extend downward while the same run is entirely dirty */
+            while (row + run_rows < rows) {
+
+                unsigned char* next = flags + run_rows * columns + column;
+
+                for (i = 0; i < run_columns; i++) {
+                    if (!(next[i] & GUAC_COMMON_SURFACE_TILE_DIRTY))
+                        break;
+                }
+
+                if (i < run_columns)
+                    break;
+
+                for (i = 0; i < run_columns; i++)
+                    next[i] &= ~GUAC_COMMON_SURFACE_TILE_DIRTY;
+
+                run_rows++;
+
+            }
+
+            /* Send pending updates if no room remains */
+            if (pending_count == GUAC_COMMON_SURFACE_QUEUE_SIZE) {
+                __guac_common_surface_send_pending(surface, pending, pending_count);
+                pending_count = 0;
+            }
+
+            __guac_common_surface_tile_rect(surface, &pending[pending_count++],
+                    column, row, run_columns, run_rows);
+
+            column += run_columns;
+
+        }
+
+    }
+
+    __guac_common_surface_send_pending(surface, pending, pending_count);
+
+    /* Surface is no longer dirty */
+    surface->dirty = 0;
+
+}
+
+/**
+ * Flushes all pending updates of the given surface, exactly as
+ * guac_common_surface_flush(), but without recording the flush in any trace
+ * of the surface.
+ *
+ * @param surface The surface to flush.
+ */
+static void __guac_common_surface_flush(guac_common_surface* surface) {
+
+    guac_common_rect rects[GUAC_COMMON_SURFACE_QUEUE_SIZE];
+    guac_common_region* region = surface->png_region;
+    int count = 0;
+    int i;
+
+    /* Use the cost of updates as measured thus far */
+    if (surface->cost_model != NULL)
+        surface->base_cost =
+            guac_common_cost_model_get_base_cost(surface->cost_model);
+
+    /* Send all updates of this frame at the quality currently required */
+    if (surface->profile != NULL)
+        surface->profile_level =
+            guac_common_profile_get_level(surface->profile);
+
+    /* Tiles are flushed independently of the queue */
+    if (surface->damage_model == GUAC_COMMON_SURFACE_DAMAGE_TILES) {
+        __guac_common_surface_flush_tiles(surface);
+        return;
+    }
+
+    /* Flush final dirty rect to queue */
+    __guac_common_surface_flush_to_queue(surface);
+
+    /* Clip all queued updates within current bounds */
+    for (i = 0; i < surface->png_queue_length; i++) {
+
+        rects[count] = surface->png_queue[i].rect;
+        __guac_common_bound_rect(surface, &rects[count], NULL, NULL);
+
+        if (rects[count].width > 0 && rects[count].height > 0)
+            count++;
+
+    }
+
+    /* Merge queued updates into a cheap set of rectangles covering
+     * everything queued, or into their bounding rectangle if there is no
+     * space to do otherwise */
+    guac_common_region_set_rects(region, rects, count, surface->base_cost);
+
+    __guac_common_surface_send_pending(surface, region->rects, region->count);
+
+    /* Flush complete */
+    surface->png_queue_length = 0;
+
+}
+
+void guac_common_surface_flush(guac_common_surface* surface) {
+
+    int argv[] = { surface->layer->index };
+    guac_timestamp now = guac_timestamp_current();
+
+    /* Leave updates pending if sent too recently at a reduced frame rate */
+    if (surface->profile != NULL
+            && guac_common_profile_get_level(surface->profile)
+                   >= GUAC_COMMON_PROFILE_REDUCED_RATE
+            && now - surface->last_flush < GUAC_SURFACE_REDUCED_RATE_INTERVAL) {
+        surface->flush_pending = 1;
+        return;
+    }
+
+    /* Record only flushes which actually took place */
+    __guac_common_surface_trace(surface, GUAC_COMMON_SURFACE_TRACE_FLUSH,
+            argv, 1);
+
+    surface->last_flush = now;
+    surface->flush_pending = 0;
+    __guac_common_surface_flush(surface);
+
+}
+
+int guac_common_surface_get_flush_delay(guac_common_surface* surface) {
+
+    int remaining;
+
+    if (!surface->flush_pending)
+        return -1;
+
+    remaining = surface->last_flush + GUAC_SURFACE_REDUCED_RATE_INTERVAL
+              - guac_timestamp_current();
+
+    if (remaining < 0)
+        return 0;
+
+    return remaining;
+
+}
+
+void guac_common_surface_set_image_streams(guac_common_surface* surface,
+        int enabled) {
+    surface->image_streams = enabled;
+}
+
+void guac_common_surface_set_jpeg_quality(guac_common_surface* surface,
+        int quality) {
+    surface->jpeg_quality = quality;
+}
+
+void guac_common_surface_set_encoder_pool(guac_common_surface* surface,
+        guac_common_worker_pool* pool) {
+    surface->encoder_pool = pool;
+}
+
+void guac_common_surface_set_image_cache(guac_common_surface* surface,
+        guac_common_image_cache* cache) {
+    surface->image_cache = cache;
+}
+
+void guac_common_surface_set_cost_model(guac_common_surface* surface,
+        guac_common_cost_model* model) {
+
+    surface->cost_model = model;
+
+    if (model != NULL)
+        surface->base_cost = guac_common_cost_model_get_base_cost(model);
+    else
+        surface->base_cost = GUAC_SURFACE_BASE_COST;
+
+}
+
+void guac_common_surface_set_motion_detection(guac_common_surface* surface,
+        int enabled) {
+    surface->motion_detection = enabled;
+}
+
+void guac_common_surface_set_delta_updates(guac_common_surface* surface,
+        int enabled) {
+
+    enabled = (enabled != 0);
+    if (enabled == surface->delta_updates)
+        return;
+
+    surface->delta_updates = enabled;
+
+    /* The shadow is needed only while delta updates are allowed */
+    if (enabled)
+        __guac_common_surface_alloc_shadow(surface);
+
+    else {
+        free(surface->shadow);
+        free(surface->shadow_valid);
+        surface->shadow = NULL;
+        surface->shadow_valid = NULL;
+        surface->shadow_columns = 0;
+        surface->shadow_rows = 0;
+    }
+
+}
+
+void guac_common_surface_set_damage_model(guac_common_surface* surface,
+        guac_common_surface_damage_model model) {
+
+    if (model == surface->damage_model)
+        return;
+
+    /* Send all damage tracked by previous model */
+    __guac_common_surface_flush(surface);
+
+    /* Tile state is needed only while tracking tiles */
+    if (model == GUAC_COMMON_SURFACE_DAMAGE_TILES) {
+        surface->damage_model = model;
+        __guac_common_surface_alloc_tiles(surface, NULL, NULL, 0, 0);
+    }
+
+    else {
+        free(surface->tile_flags);
+        free(surface->tile_hashes);
+        surface->tile_flags = NULL;
+        surface->tile_hashes = NULL;
+        surface->tile_columns = 0;
+        surface->tile_rows = 0;
+        surface->damage_model = model;
+    }
+
+}
+
+void guac_common_surface_set_profile(guac_common_surface* surface,
+        guac_common_profile* profile) {
+
+    surface->profile = profile;
+
+    if (profile != NULL)
+        surface->profile_level = guac_common_profile_get_level(profile);
+    else
+        surface->profile_level = GUAC_COMMON_PROFILE_LOSSLESS;
+
+}
+
+void guac_common_surface_set_trace(guac_common_surface* surface,
+        guac_common_surface_trace* trace) {
+
+    int argv[] = { surface->layer->index, surface->width, surface->height };
+
+    surface->trace = trace;
+    __guac_common_surface_trace(surface, GUAC_COMMON_SURFACE_TRACE_SURFACE,
+            argv, 3);
 
 }
 
@@ -24,18 +24,72 @@
 #define __GUAC_COMMON_SURFACE_H
 
 #include "config.h"
+#include "guac_cost_model.h"
+#include "guac_image_cache.h"
+#include "guac_profile.h"
 #include "guac_rect.h"
+#include "guac_region.h"
+#include "guac_surface_trace.h"
+#include "guac_worker_pool.h"
 
 #include <cairo/cairo.h>
+#include <guacamole/client.h>
 #include <guacamole/layer.h>
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+
+#include <stdint.h>
 
 /**
  * The maximum number of updates to allow within the PNG queue.
  */
 #define GUAC_COMMON_SURFACE_QUEUE_SIZE 256
 
+/**
+ * The width and height of each tile, in pixels, when damage is tracked using
+ * GUAC_COMMON_SURFACE_DAMAGE_TILES.
+ */
+#define GUAC_COMMON_SURFACE_TILE_SIZE 64
+
+/**
+ * Tile flag which is set if the tile has been modified since the surface was
+ * last flushed.
+ */
+#define GUAC_COMMON_SURFACE_TILE_DIRTY 0x01
+
+/**
+ * Tile flag which is set if the hash of the content last sent for the tile
+ * is known. Drawing operations sent directly to the client, such as copies,
+ * clear this flag, as the client-side content no longer matches the hash.
+ */
+#define GUAC_COMMON_SURFACE_TILE_HASHED 0x02
+
+/**
+ * The means by which a surface tracks the regions which have changed and must
+ * be sent when the surface is flushed.
+ */
+typedef enum guac_common_surface_damage_model {
+
+    /**
+     * Damage is tracked as a single dirty rectangle, which is flushed to a
+     * queue of deferred updates whenever cost heuristics suggest that further
+     * combination would be wasteful. Queued updates are combined again when
+     * the surface is flushed. This is the default.
+     */
+    GUAC_COMMON_SURFACE_DAMAGE_QUEUE,
+
+    /**
+     * Damage is tracked per tile of a fixed grid of
+     * GUAC_COMMON_SURFACE_TILE_SIZE square tiles. When the surface is
+     * flushed, dirty tiles whose content hash matches that of the content
+     * last sent are skipped, and the remaining dirty tiles are coalesced into
+     * rectangles.
+     */
+    GUAC_COMMON_SURFACE_DAMAGE_TILES
+
+} guac_common_surface_damage_model;
+
 /**
  * Representation of a PNG update, having a rectangle of image data (stored
  * elsewhere) and a flushed/not-flushed state.
@@ -65,6 +119,12 @@ typedef struct guac_common_surface {
      */
     const guac_layer* layer;
 
+    /**
+     * The client associated with this surface, from which any streams
+     * required when flushing are allocated.
+     */
+    guac_client* client;
+
     /**
      * The socket to send instructions on when flushing.
      */
@@ -126,18 +186,179 @@ typedef struct guac_common_surface {
      */
     guac_common_surface_png_rect png_queue[GUAC_COMMON_SURFACE_QUEUE_SIZE];
 
+    /**
+     * The region into which queued PNG updates are merged when flushing,
+     * retained between flushes to avoid reallocating its storage.
+     */
+    guac_common_region* png_region;
+
+    /**
+     * Whether updates should be streamed to the client using "img"
+     * instructions, rather than sent as complete "png" instructions.
+     */
+    int image_streams;
+
+    /**
+     * The quality to use when sending updates which appear photographic as
+     * JPEG images, from 1 to 100, or 0 if all updates should be sent as PNG.
+     */
+    int jpeg_quality;
+
+    /**
+     * The worker pool used to encode queued updates concurrently when
+     * flushing, or NULL if updates should be encoded one at a time by the
+     * flushing thread.
+     */
+    guac_common_worker_pool* encoder_pool;
+
+    /**
+     * The cache of images retained by the client, consulted before each
+     * update is encoded and sent, or NULL if updates are always sent.
+     */
+    guac_common_image_cache* image_cache;
+
+    /**
+     * The model which receives the measured cost of each update sent, and
+     * from which the fixed cost of each update is taken, or NULL if that
+     * cost is fixed at a default value.
+     */
+    guac_common_cost_model* cost_model;
+
+    /**
+     * The fixed cost of each update in units of the cost of a single pixel,
+     * as last taken from the cost model of this surface.
+     */
+    int base_cost;
+
+    /**
+     * Non-zero if opaque images drawn to this surface should be checked for
+     * content which has merely moved within the area drawn, such as scrolled
+     * content, zero otherwise.
+     */
+    int motion_detection;
+
+    /**
+     * The means by which this surface tracks changed regions.
+     */
+    guac_common_surface_damage_model damage_model;
+
+    /**
+     * The number of columns of tiles covering this surface, if damage is
+     * tracked using tiles.
+     */
+    int tile_columns;
+
+    /**
+     * The number of rows of tiles covering this surface, if damage is
+     * tracked using tiles.
+     */
+    int tile_rows;
+
+    /**
+     * The state of each tile, in row-major order, as a combination of the
+     * GUAC_COMMON_SURFACE_TILE_* flags, or NULL if damage is not tracked using
+     * tiles.
+     */
+    unsigned char* tile_flags;
+
+    /**
+     * The hash of the content of each tile as last sent, in row-major order,
+     * or NULL if damage is not tracked using tiles. Each hash is meaningful
+     * only if the corresponding tile has GUAC_COMMON_SURFACE_TILE_HASHED set.
+     */
+    uint64_t* tile_hashes;
+
+    /**
+     * Non-zero if updates which differ only slightly from the content last
+     * sent should be sent as the XOR of old and new content, zero otherwise.
+     */
+    int delta_updates;
+
+    /**
+     * A copy of this surface as last sent losslessly to the client, having
+     * the same dimensions and stride as the surface, or NULL if delta updates
+     * are disabled. Only those parts of the shadow covered by valid shadow
+     * tiles are known to match the client.
+     */
+    unsigned char* shadow;
+
+    /**
+     * The number of columns of shadow tiles covering this surface.
+     */
+    int shadow_columns;
+
+    /**
+     * The number of rows of shadow tiles covering this surface.
+     */
+    int shadow_rows;
+
+    /**
+     * Whether each shadow tile, in row-major order, matches the content of
+     * the client, or NULL if delta updates are disabled.
+     */
+    unsigned char* shadow_valid;
+
+    /**
+     * The buffer which receives the XOR image of each delta update before
+     * that image is applied to this surface, or NULL if no delta update has
+     * yet been sent.
+     */
+    guac_layer* delta_buffer;
+
+    /**
+     * The trace recording all operations performed on this surface, or NULL
+     * if operations are not being recorded.
+     */
+    guac_common_surface_trace* trace;
+
+    /**
+     * The profile selecting the quality of updates based on the bandwidth
+     * of the connection, or NULL if updates are always sent at full
+     * quality.
+     */
+    guac_common_profile* profile;
+
+    /**
+     * The level of the profile of this surface as of the start of the
+     * current flush, such that all updates of a frame are sent alike.
+     */
+    guac_common_profile_level profile_level;
+
+    /**
+     * Non-zero if an attempt to send JPEG has failed because this build of
+     * libguac cannot encode JPEG, in which case JPEG is no longer attempted.
+     */
+    int jpeg_unsupported;
+
+    /**
+     * The time at which this surface was last flushed by
+     * guac_common_surface_flush().
+     */
+    guac_timestamp last_flush;
+
+    /**
+     * Non-zero if guac_common_surface_flush() has left updates pending due
+     * to the reduced frame rate required by the profile of this surface,
+     * such that the surface must be flushed again once that frame rate
+     * allows.
+     */
+    int flush_pending;
+
 } guac_common_surface;
 
 /**
  * Allocates a new guac_common_surface, assigning it to the given layer.
  *
+ * @param client The client associated with the surface.
  * @param socket The socket to send instructions on when flushing.
  * @param layer The layer to associate with the new surface.
  * @param w The width of the surface.
  * @param h The height of the surface.
- * @return A newly-allocated guac_common_surface.
+ * @return A newly-allocated guac_common_surface, or NULL if allocation
+ *         fails.
  */
-guac_common_surface* guac_common_surface_alloc(guac_socket* socket, const guac_layer* layer, int w, int h);
+guac_common_surface* guac_common_surface_alloc(guac_client* client, guac_socket* socket,
+        const guac_layer* layer, int w, int h);
 
 /**
  * Frees the given guac_common_surface. Beware that this will NOT free any
@@ -257,6 +478,20 @@ void guac_common_surface_reset_clip(guac_common_surface* surface);
  */
 void guac_common_surface_flush(guac_common_surface* surface);
 
+/**
+ * Returns the number of milliseconds until updates left pending by
+ * guac_common_surface_flush(), due to the reduced frame rate required by the
+ * profile of the given surface, may be sent. The surface must be flushed
+ * again once this time has elapsed, even if nothing further is drawn, or
+ * those updates will remain pending indefinitely.
+ *
+ * @param surface The surface to check.
+ * @return The number of milliseconds until the surface should be flushed
+ *         again, zero if the surface should be flushed now, or -1 if no
+ *         updates have been left pending.
+ */
+int guac_common_surface_get_flush_delay(guac_common_surface* surface);
+
 /**
  * Schedules a deferred flush of the given surface. This will not immediately
  * flush the surface to the client. Instead, the result of the flush is
@@ -267,5 +502,145 @@ void guac_common_surface_flush(guac_common_surface* surface);
  */
 void guac_common_surface_flush_deferred(guac_common_surface* surface);
 
+/**
+ * Sets whether updates to the given surface are streamed to the client using
+ * "img" instructions. When enabled, image data is sent in bounded blobs as it
+ * is encoded, rather than being encoded in its entirety before sending. This
+ * requires a client which supports the "img" instruction, and is disabled by
+ * default.
+ *
+ * @param surface The surface to modify.
+ * @param enabled Non-zero to stream updates using "img" instructions, zero
+ *                to send updates as "png" instructions.
+ */
+void guac_common_surface_set_image_streams(guac_common_surface* surface,
+        int enabled);
+
+/**
+ * Sets the quality at which updates to the given surface which appear
+ * photographic (many distinct colors and high luminance entropy) are sent as
+ * lossy JPEG images. All other updates continue to be sent as PNG. JPEG is
+ * disabled by default, and requires a client which supports the "jpeg"
+ * instruction (or the "image/jpeg" mimetype, if image streams are enabled).
+ *
+ * @param surface The surface to modify.
+ * @param quality The JPEG quality to use, from 1 to 100, or 0 to send all
+ *                updates as PNG.
+ */
+void guac_common_surface_set_jpeg_quality(guac_common_surface* surface,
+        int quality);
+
+/**
+ * Sets the worker pool used to encode updates to the given surface when it
+ * is flushed. With a pool, all updates sent by a single flush are encoded
+ * concurrently, and then sent in the same order they would have been sent
+ * without a pool. The pool may be shared by several surfaces, as long as no
+ * two of those surfaces are flushed at the same time. Updates are encoded by
+ * the flushing thread alone by default.
+ *
+ * @param surface The surface to modify.
+ * @param pool The worker pool to encode updates with, or NULL to encode
+ *             updates using only the flushing thread.
+ */
+void guac_common_surface_set_encoder_pool(guac_common_surface* surface,
+        guac_common_worker_pool* pool);
+
+/**
+ * Sets the image cache consulted when flushing the given surface. With a
+ * cache, each update identical to an image still held by the client is drawn
+ * with a "copy" from the buffer holding that image, and each update which is
+ * sent is added to the cache. The cache may be shared by all surfaces of a
+ * connection. No cache is used by default.
+ *
+ * @param surface The surface to modify.
+ * @param cache The image cache to use, or NULL to always send updates.
+ */
+void guac_common_surface_set_image_cache(guac_common_surface* surface,
+        guac_common_image_cache* cache);
+
+/**
+ * Sets the cost model used when deciding whether updates to the given
+ * surface should be combined. With a model, the encoded size and encoding
+ * time of each update sent are recorded within the model, and the fixed cost
+ * of each update relative to the cost of each pixel is taken from the model
+ * whenever the surface is flushed. The model may be shared by all surfaces of
+ * a connection. Without a model, a fixed cost guessed in advance is used,
+ * which is the default.
+ *
+ * @param surface The surface to modify.
+ * @param model The cost model to use, or NULL to use the default fixed cost.
+ */
+void guac_common_surface_set_cost_model(guac_common_surface* surface,
+        guac_common_cost_model* model);
+
+/**
+ * Sets whether opaque images drawn to the given surface are checked for
+ * content which has merely moved within the area being drawn, as when a
+ * remote desktop scrolls without sending any copy hint. If a large enough
+ * part of an image matches existing content shifted vertically or
+ * horizontally, that part is drawn with a "copy", and only the remainder of
+ * the image is sent. Motion detection is disabled by default.
+ *
+ * @param surface The surface to modify.
+ * @param enabled Non-zero to detect moved content, zero otherwise.
+ */
+void guac_common_surface_set_motion_detection(guac_common_surface* surface,
+        int enabled);
+
+/**
+ * Sets whether updates to the given surface may be sent as deltas. With delta
+ * updates, the content last sent losslessly is retained, and each update
+ * which changes few pixels of that content is sent as the XOR of old and new
+ * content, drawn to a scratch buffer and applied with an XOR "transfer". As
+ * unchanged pixels become zero, such images compress far better than the
+ * update itself. Whether each update is sent as a delta is decided by
+ * estimating the cost of both encodings. Delta updates are disabled by
+ * default.
+ *
+ * @param surface The surface to modify.
+ * @param enabled Non-zero to allow delta updates, zero otherwise.
+ */
+void guac_common_surface_set_delta_updates(guac_common_surface* surface,
+        int enabled);
+
+/**
+ * Sets the means by which the given surface tracks changed regions, flushing
+ * the surface first if the model changes. This allows the tile-based model to
+ * be compared against the default queue of combined updates in terms of
+ * bandwidth and processing time.
+ *
+ * @param surface The surface to modify.
+ * @param model The damage model to use.
+ */
+void guac_common_surface_set_damage_model(guac_common_surface* surface,
+        guac_common_surface_damage_model model);
+
+/**
+ * Records all further operations performed on the given surface within the
+ * given trace, which may be shared between several surfaces. Image data is
+ * recorded in full, such that the trace can later be replayed to reproduce
+ * the same updates. The trace is not freed with the surface.
+ *
+ * @param surface The surface to record.
+ * @param trace The trace to record operations within, or NULL to stop
+ *              recording.
+ */
+void guac_common_surface_set_trace(guac_common_surface* surface,
+        guac_common_surface_trace* trace);
+
+/**
+ * Sets the profile which selects the quality of updates sent by the given
+ * surface. As the estimated bandwidth of the connection falls, updates are
+ * sent with reduced color, then as JPEG, and then less frequently, with
+ * changes accumulating until the next frame is sent. The profile may be
+ * shared by all surfaces of a connection.
+ *
+ * @param surface The surface to modify.
+ * @param profile The profile to use, or NULL to always send updates at full
+ *                quality.
+ */
+void guac_common_surface_set_profile(guac_common_surface* surface,
+        guac_common_profile* profile);
+
 #endif
 
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "guac_surface_kernels.h"
+
+#include <guacamole/protocol-types.h>
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * SIMD kernels are built only for x86 compilers which understand per-function
+ * target attributes and generic vector types, such that the library as a
+ * whole need not be compiled for a newer CPU than it will actually run on.
+ */
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define GUAC_SURFACE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Alpha channel of a 32-bit ARGB pixel.
+ */
+#define GUAC_SURFACE_ALPHA 0xFF000000
+
+/*
+ * Each transfer function, expressed in terms of the current destination
+ * pixels "d" and source pixels "s". Every expression is valid both for
+ * uint32_t and for the vector types below, such that all instruction sets
+ * share exactly the same definition of each function.
+ */
+#define GUAC_SURFACE_TRANSFER_FUNCTIONS(KERNEL, isa)             \
+    KERNEL(isa, BLACK,      (d ^ d) | GUAC_SURFACE_ALPHA)        \
+    KERNEL(isa, WHITE,      d | 0xFFFFFFFF)                      \
+    KERNEL(isa, SRC,        s)                                   \
+    KERNEL(isa, DEST,       d)                                   \
+    KERNEL(isa, NSRC,       ~s)                                  \
+    KERNEL(isa, NDEST,      ~d)                                  \
+    KERNEL(isa, AND,        d & s)                               \
+    KERNEL(isa, NAND,       ~(d & s))                            \
+    KERNEL(isa, OR,         d | s)                               \
+    KERNEL(isa, NOR,        ~(d | s))                            \
+    KERNEL(isa, XOR,        d ^ s)                               \
+    KERNEL(isa, XNOR,       ~(d ^ s))                            \
+    KERNEL(isa, NSRC_AND,   d & ~s)                              \
+    KERNEL(isa, NSRC_NAND,  ~(d & ~s))                           \
+    KERNEL(isa, NSRC_OR,    d | ~s)                              \
+    KERNEL(isa, NSRC_NOR,   ~(d | ~s))
+
+/**
+ * Records the given pixel index as changed, updating the first and last
+ * changed indices of the current row.
+ */
+#define GUAC_SURFACE_CHANGED_PIXEL(first, last, x) \
+    do {                                           \
+        if ((first) < 0) (first) = (x);            \
+        *(last) = (x);                             \
+    } while (0)
+
+/**
+ * Records the pixels corresponding to the set bits of the given lane mask as
+ * changed, where bit 0 corresponds to the pixel at the given index.
+ */
+#define GUAC_SURFACE_CHANGED_LANES(first, last, x, mask)               \
+    do {                                                               \
+        if ((first) < 0) (first) = (x) + __builtin_ctz(mask);          \
+        *(last) = (x) + 31 - __builtin_clz(mask);                      \
+    } while (0)
+
+/*
+ * Portable scalar kernels, which define the expected behavior of all other
+ * kernels, and also process the pixels remaining after the last full vector
+ * of each row.
+ */
+
+static int __guac_common_surface_put_scalar(uint32_t* dst,
+        const uint32_t* src, int width, int opaque, int* last) {
+
+    int first = -1;
+    int x;
+
+    for (x = 0; x < width; x++) {
+
+        uint32_t s = src[x];
+        uint32_t d = dst[x];
+        uint32_t n = s | GUAC_SURFACE_ALPHA;
+
+        /* Transparent source pixels are skipped unless opaque */
+        if (!opaque && !(s & GUAC_SURFACE_ALPHA))
+            continue;
+
+        if (n != d) {
+            dst[x] = n;
+            GUAC_SURFACE_CHANGED_PIXEL(first, last, x);
+        }
+
+    }
+
+    return first;
+
+}
+
+static int __guac_common_surface_rect_scalar(uint32_t* dst, int width,
+        uint32_t color, int* last) {
+
+    int first = -1;
+    int x;
+
+    for (x = 0; x < width; x++) {
+        if (dst[x] != color) {
+            dst[x] = color;
+            GUAC_SURFACE_CHANGED_PIXEL(first, last, x);
+        }
+    }
+
+    return first;
+
+}
+
+static void __guac_common_surface_fill_mask_scalar(uint32_t* dst,
+        const uint32_t* src, int width, uint32_t color) {
+
+    int x;
+
+    for (x = 0; x < width; x++) {
+        if (src[x] & GUAC_SURFACE_ALPHA)
+            dst[x] = color;
+    }
+
+}
+
+/**
+ * Defines the scalar kernel for the given transfer function.
+ */
+#define GUAC_SURFACE_TRANSFER_SCALAR(isa, name, op)                         \
+static int __guac_common_surface_transfer_##name##_##isa(uint32_t* dst,     \
+        const uint32_t* src, int width, int* last) {                        \
+                                                                            \
+    int first = -1;                                                         \
+    int x;                                                                  \
+                                                                            \
+    for (x = 0; x < width; x++) {                                           \
+        uint32_t s = src[x];                                                \
+        uint32_t d = dst[x];                                                \
+        uint32_t n = (op);                                                  \
+        (void) s;                                                           \
+        if (n != d) {                                                       \
+            dst[x] = n;                                                     \
+            GUAC_SURFACE_CHANGED_PIXEL(first, last, x);                     \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return first;                                                           \
+                                                                            \
+}
+
+GUAC_SURFACE_TRANSFER_FUNCTIONS(GUAC_SURFACE_TRANSFER_SCALAR, scalar)
+
+#ifdef GUAC_SURFACE_X86_SIMD
+
+/*
+ * Primitives for each instruction set. The vector kernels below are written
+ * once in terms of these, using GCC vector types for bitwise operations and
+ * intrinsics only for loads, stores and change detection.
+ */
+
+typedef uint32_t guac_surface_vector_sse2 __attribute__((vector_size(16)));
+#define GUAC_SURFACE_TARGET_sse2 __attribute__((target("sse2")))
+#define GUAC_SURFACE_LANES_sse2 4
+#define GUAC_SURFACE_LOAD_sse2(p) \
+    ((guac_surface_vector_sse2) _mm_loadu_si128((const __m128i*) (p)))
+#define GUAC_SURFACE_STORE_sse2(p, v) \
+    _mm_storeu_si128((__m128i*) (p), (__m128i) (v))
+#define GUAC_SURFACE_SPLAT_sse2(c) \
+    ((guac_surface_vector_sse2) _mm_set1_epi32((int) (c)))
+#define GUAC_SURFACE_DIFFER_sse2(a, b) \
+    (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32( \
+        (__m128i) (a), (__m128i) (b)))) ^ 0xF)
+
+typedef uint32_t guac_surface_vector_avx2 __attribute__((vector_size(32)));
+#define GUAC_SURFACE_TARGET_avx2 __attribute__((target("avx2")))
+#define GUAC_SURFACE_LANES_avx2 8
+#define GUAC_SURFACE_LOAD_avx2(p) \
+    ((guac_surface_vector_avx2) _mm256_loadu_si256((const __m256i*) (p)))
+#define GUAC_SURFACE_STORE_avx2(p, v) \
+    _mm256_storeu_si256((__m256i*) (p), (__m256i) (v))
+#define GUAC_SURFACE_SPLAT_avx2(c) \
+    ((guac_surface_vector_avx2) _mm256_set1_epi32((int) (c)))
+#define GUAC_SURFACE_DIFFER_avx2(a, b) \
+    (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32( \
+        (__m256i) (a), (__m256i) (b)))) ^ 0xFF)
+
+/**
+ * Evaluates to a vector whose lanes are all ones where the corresponding
+ * pixel of the given vector is fully transparent, and zero elsewhere.
+ */
+#define GUAC_SURFACE_TRANSPARENT(isa, v) \
+    ((guac_surface_vector_##isa) (((v) & GUAC_SURFACE_ALPHA) == 0))
+
+/**
+ * Defines the put, rect and fill_mask kernels for the given instruction set.
+ */
+#define GUAC_SURFACE_KERNELS(isa)                                           \
+                                                                            \
+GUAC_SURFACE_TARGET_##isa                                                   \
+static int __guac_common_surface_put_##isa(uint32_t* dst,                   \
+        const uint32_t* src, int width, int opaque, int* last) {            \
+                                                                            \
+    int first = -1;                                                         \
+    int x;                                                                  \
+                                                                            \
+    for (x = 0; x + GUAC_SURFACE_LANES_##isa <= width;                      \
+            x += GUAC_SURFACE_LANES_##isa) {                                \
+                                                                            \
+        guac_surface_vector_##isa s = GUAC_SURFACE_LOAD_##isa(src + x);     \
+        guac_surface_vector_##isa d = GUAC_SURFACE_LOAD_##isa(dst + x);     \
+        guac_surface_vector_##isa n = s | GUAC_SURFACE_ALPHA;               \
+        int mask;                                                           \
+                                                                            \
+        /* Keep destination where source is transparent, unless opaque */  \
+        if (!opaque) {                                                      \
+            guac_surface_vector_##isa m = GUAC_SURFACE_TRANSPARENT(isa, s); \
+            n = (m & d) | (~m & n);                                         \
+        }                                                                   \
+                                                                            \
+        mask = GUAC_SURFACE_DIFFER_##isa(n, d);                             \
+        if (mask) {                                                         \
+            GUAC_SURFACE_STORE_##isa(dst + x, n);                           \
+            GUAC_SURFACE_CHANGED_LANES(first, last, x, mask);               \
+        }                                                                   \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    /* Finish remainder of row */                                           \
+    if (x < width) {                                                        \
+        int tail_last;                                                      \
+        int tail_first = __guac_common_surface_put_scalar(dst + x, src + x, \
+                width - x, opaque, &tail_last);                             \
+        if (tail_first >= 0) {                                              \
+            if (first < 0) first = x + tail_first;                          \
+            *last = x + tail_last;                                          \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return first;                                                           \
+                                                                            \
+}                                                                           \
+                                                                            \
+GUAC_SURFACE_TARGET_##isa                                                   \
+static int __guac_common_surface_rect_##isa(uint32_t* dst, int width,       \
+        uint32_t color, int* last) {                                        \
+                                                                            \
+    guac_surface_vector_##isa c = GUAC_SURFACE_SPLAT_##isa(color);          \
+    int first = -1;                                                         \
+    int x;                                                                  \
+                                                                            \
+    for (x = 0; x + GUAC_SURFACE_LANES_##isa <= width;                      \
+            x += GUAC_SURFACE_LANES_##isa) {                                \
+                                                                            \
+        guac_surface_vector_##isa d = GUAC_SURFACE_LOAD_##isa(dst + x);     \
+        int mask = GUAC_SURFACE_DIFFER_##isa(c, d);                         \
+                                                                            \
+        if (mask) {                                                         \
+            GUAC_SURFACE_STORE_##isa(dst + x, c);                           \
+            GUAC_SURFACE_CHANGED_LANES(first, last, x, mask);               \
+        }                                                                   \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    /* Finish remainder of row */                                           \
+    if (x < width) {                                                        \
+        int tail_last;                                                      \
+        int tail_first = __guac_common_surface_rect_scalar(dst + x,         \
+                width - x, color, &tail_last);                              \
+        if (tail_first >= 0) {                                              \
+            if (first < 0) first = x + tail_first;                          \
+            *last = x + tail_last;                                          \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return first;                                                           \
+                                                                            \
+}                                                                           \
+                                                                            \
+GUAC_SURFACE_TARGET_##isa                                                   \
+static void __guac_common_surface_fill_mask_##isa(uint32_t* dst,            \
+        const uint32_t* src, int width, uint32_t color) {                   \
+                                                                            \
+    guac_surface_vector_##isa c = GUAC_SURFACE_SPLAT_##isa(color);          \
+    int x;                                                                  \
+                                                                            \
+    for (x = 0; x + GUAC_SURFACE_LANES_##isa <= width;                      \
+            x += GUAC_SURFACE_LANES_##isa) {                                \
+                                                                            \
+        guac_surface_vector_##isa s = GUAC_SURFACE_LOAD_##isa(src + x);     \
+        guac_surface_vector_##isa d = GUAC_SURFACE_LOAD_##isa(dst + x);     \
+        guac_surface_vector_##isa m = GUAC_SURFACE_TRANSPARENT(isa, s);     \
+                                                                            \
+        GUAC_SURFACE_STORE_##isa(dst + x, (m & d) | (~m & c));              \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    /* Finish remainder of row */                                           \
+    __guac_common_surface_fill_mask_scalar(dst + x, src + x, width - x,     \
+            color);                                                         \
+                                                                            \
+}
+
+/**
+ * Defines the vector kernel for the given transfer function and instruction
+ * set. The source is loaded before the destination is stored for each
+ * vector, thus rows may overlap if the destination precedes the source.
+ */
+#define GUAC_SURFACE_TRANSFER_VECTOR(isa, name, op)                         \
+GUAC_SURFACE_TARGET_##isa                                                   \
+static int __guac_common_surface_transfer_##name##_##isa(uint32_t* dst,     \
+        const uint32_t* src, int width, int* last) {                        \
+                                                                            \
+    int first = -1;                                                         \
+    int x;                                                                  \
+                                                                            \
+    for (x = 0; x + GUAC_SURFACE_LANES_##isa <= width;                      \
+            x += GUAC_SURFACE_LANES_##isa) {                                \
+                                                                            \
+        guac_surface_vector_##isa s = GUAC_SURFACE_LOAD_##isa(src + x);     \
+        guac_surface_vector_##isa d = GUAC_SURFACE_LOAD_##isa(dst + x);     \
+        guac_surface_vector_##isa n = (op);                                 \
+        int mask = GUAC_SURFACE_DIFFER_##isa(n, d);                         \
+        (void) s;                                                           \
+                                                                            \
+        if (mask) {                                                         \
+            GUAC_SURFACE_STORE_##isa(dst + x, n);                           \
+            GUAC_SURFACE_CHANGED_LANES(first, last, x, mask);               \
+        }                                                                   \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    /* Finish remainder of row */                                           \
+    if (x < width) {                                                        \
+        int tail_last;                                                      \
+        int tail_first = __guac_common_surface_transfer_##name##_scalar(    \
+                dst + x, src + x, width - x, &tail_last);                   \
+        if (tail_first >= 0) {                                              \
+            if (first < 0) first = x + tail_first;                          \
+            *last = x + tail_last;                                          \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return first;                                                           \
+                                                                            \
+}
+
+GUAC_SURFACE_KERNELS(sse2)
+GUAC_SURFACE_TRANSFER_FUNCTIONS(GUAC_SURFACE_TRANSFER_VECTOR, sse2)
+
+GUAC_SURFACE_KERNELS(avx2)
+GUAC_SURFACE_TRANSFER_FUNCTIONS(GUAC_SURFACE_TRANSFER_VECTOR, avx2)
+
+#endif
+
+/**
+ * Initializer entry mapping a transfer function to its kernel.
+ */
+#define GUAC_SURFACE_TRANSFER_ENTRY(isa, name, op) \
+    [GUAC_TRANSFER_BINARY_##name] = __guac_common_surface_transfer_##name##_##isa,
+
+/**
+ * Initializer for the complete set of kernels of the given instruction set.
+ */
+#define GUAC_SURFACE_KERNEL_SET(isa) {                                      \
+    .put       = __guac_common_surface_put_##isa,                           \
+    .rect      = __guac_common_surface_rect_##isa,                          \
+    .fill_mask = __guac_common_surface_fill_mask_##isa,                     \
+    .transfer  = {                                                          \
+        GUAC_SURFACE_TRANSFER_FUNCTIONS(GUAC_SURFACE_TRANSFER_ENTRY, isa)   \
+    }                                                                       \
+}
+
+static const guac_common_surface_kernels __guac_common_surface_kernels_scalar =
+    GUAC_SURFACE_KERNEL_SET(scalar);
+
+#ifdef GUAC_SURFACE_X86_SIMD
+static const guac_common_surface_kernels __guac_common_surface_kernels_sse2 =
+    GUAC_SURFACE_KERNEL_SET(sse2);
+
+static const guac_common_surface_kernels __guac_common_surface_kernels_avx2 =
+    GUAC_SURFACE_KERNEL_SET(avx2);
+#endif
+
+#ifdef GUAC_SURFACE_X86_SIMD
+/**
+ * Whether the current CPU supports SSE2, as determined by
+ * __guac_common_surface_detect_cpu().
+ */
+static int __guac_common_surface_cpu_sse2 = 0;
+
+/**
+ * Whether the current CPU supports AVX2, as determined by
+ * __guac_common_surface_detect_cpu().
+ */
+static int __guac_common_surface_cpu_avx2 = 0;
+
+/**
+ * Guard ensuring CPU features are detected exactly once.
+ */
+static pthread_once_t __guac_common_surface_cpu_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Determines which of the instruction sets used by the kernels are supported
+ * by the current CPU.
+ */
+static void __guac_common_surface_detect_cpu() {
+    __builtin_cpu_init();
+    __guac_common_surface_cpu_sse2 = __builtin_cpu_supports("sse2");
+    __guac_common_surface_cpu_avx2 = __builtin_cpu_supports("avx2");
+}
+#endif
+
+const guac_common_surface_kernels* guac_common_surface_get_kernels_for(
+        guac_common_surface_isa isa) {
+
+#ifdef GUAC_SURFACE_X86_SIMD
+    pthread_once(&__guac_common_surface_cpu_once,
+            __guac_common_surface_detect_cpu);
+#endif
+
+    switch (isa) {
+
+        case GUAC_COMMON_SURFACE_ISA_SCALAR:
+            return &__guac_common_surface_kernels_scalar;
+
+#ifdef GUAC_SURFACE_X86_SIMD
+        case GUAC_COMMON_SURFACE_ISA_SSE2:
+            if (__guac_common_surface_cpu_sse2)
+                return &__guac_common_surface_kernels_sse2;
+            break;
+
+        case GUAC_COMMON_SURFACE_ISA_AVX2:
+            if (__guac_common_surface_cpu_avx2)
+                return &__guac_common_surface_kernels_avx2;
+            break;
+#endif
+
+        default:
+            break;
+
+    }
+
+    /* Instruction set not supported */
+    return NULL;
+
+}
+
+const guac_common_surface_kernels* guac_common_surface_get_kernels() {
+
+    const guac_common_surface_kernels* kernels;
+
+    /* Prefer AVX2, then SSE2 */
+    if ((kernels = guac_common_surface_get_kernels_for(GUAC_COMMON_SURFACE_ISA_AVX2)))
+        return kernels;
+
+    if ((kernels = guac_common_surface_get_kernels_for(GUAC_COMMON_SURFACE_ISA_SSE2)))
+        return kernels;
+
+    /* Fall back to portable implementation */
+    return guac_common_surface_get_kernels_for(GUAC_COMMON_SURFACE_ISA_SCALAR);
+
+}
+
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __GUAC_SURFACE_KERNELS_H
+#define __GUAC_SURFACE_KERNELS_H
+
+#include "config.h"
+
+#include <guacamole/protocol-types.h>
+
+#include <stdint.h>
+
+/**
+ * The number of distinct transfer functions, each of which is identified by
+ * the four-bit truth table used as its guac_transfer_function value.
+ */
+#define GUAC_COMMON_SURFACE_TRANSFER_FUNCTIONS 16
+
+/**
+ * Copies a row of pixels into a row of the backing surface, ignoring
+ * transparent source pixels unless the source is opaque. The alpha channel
+ * of each copied pixel is set.
+ *
+ * @param dst The first pixel of the destination row.
+ * @param src The first pixel of the source row.
+ * @param width The number of pixels in the row.
+ * @param opaque Non-zero if the alpha channel of the source should be
+ *               ignored, zero otherwise.
+ * @param last Storage for the index of the last pixel changed, which is
+ *             updated only if at least one pixel changed.
+ * @return The index of the first pixel changed, or -1 if no pixels changed.
+ */
+typedef int guac_common_surface_put_kernel(uint32_t* dst, const uint32_t* src,
+        int width, int opaque, int* last);
+
+/**
+ * Fills a row of the backing surface with the given color.
+ *
+ * @param dst The first pixel of the destination row.
+ * @param width The number of pixels in the row.
+ * @param color The color to fill with, including its alpha channel.
+ * @param last Storage for the index of the last pixel changed, which is
+ *             updated only if at least one pixel changed.
+ * @return The index of the first pixel changed, or -1 if no pixels changed.
+ */
+typedef int guac_common_surface_rect_kernel(uint32_t* dst, int width,
+        uint32_t color, int* last);
+
+/**
+ * Fills each pixel of a row of the backing surface with the given color if
+ * the corresponding source pixel is not transparent.
+ *
+ * @param dst The first pixel of the destination row.
+ * @param src The first pixel of the source row, used as a mask.
+ * @param width The number of pixels in the row.
+ * @param color The color to fill with, including its alpha channel.
+ */
+typedef void guac_common_surface_fill_mask_kernel(uint32_t* dst,
+        const uint32_t* src, int width, uint32_t color);
+
+/**
+ * Combines a row of source pixels with a row of the backing surface using a
+ * specific transfer function. The source row must not overlap the
+ * destination row, except when both are the same row.
+ *
+ * @param dst The first pixel of the destination row.
+ * @param src The first pixel of the source row.
+ * @param width The number of pixels in the row.
+ * @param last Storage for the index of the last pixel changed, which is
+ *             updated only if at least one pixel changed.
+ * @return The index of the first pixel changed, or -1 if no pixels changed.
+ */
+typedef int guac_common_surface_transfer_kernel(uint32_t* dst,
+        const uint32_t* src, int width, int* last);
+
+/**
+ * The instruction sets for which pixel kernels may be built.
+ */
+typedef enum guac_common_surface_isa {
+
+    /**
+     * Portable C, processing one pixel at a time.
+     */
+    GUAC_COMMON_SURFACE_ISA_SCALAR,
+
+    /**
+     * SSE2, processing four pixels at a time.
+     */
+    GUAC_COMMON_SURFACE_ISA_SSE2,
+
+    /**
+     * AVX2, processing eight pixels at a time.
+     */
+    GUAC_COMMON_SURFACE_ISA_AVX2
+
+} guac_common_surface_isa;
+
+/**
+ * The set of row kernels used to update the backing store of surfaces, all
+ * built for the same instruction set.
+ */
+typedef struct guac_common_surface_kernels {
+
+    /**
+     * Kernel used when drawing images.
+     */
+    guac_common_surface_put_kernel* put;
+
+    /**
+     * Kernel used when drawing solid rectangles.
+     */
+    guac_common_surface_rect_kernel* rect;
+
+    /**
+     * Kernel used when painting with a stencil.
+     */
+    guac_common_surface_fill_mask_kernel* fill_mask;
+
+    /**
+     * Kernels used when transferring between surfaces, indexed by
+     * guac_transfer_function.
+     */
+    guac_common_surface_transfer_kernel*
+        transfer[GUAC_COMMON_SURFACE_TRANSFER_FUNCTIONS];
+
+} guac_common_surface_kernels;
+
+/**
+ * Returns the kernels built for the given instruction set.
+ *
+ * @param isa The instruction set of the kernels to return.
+ * @return The kernels built for the given instruction set, or NULL if this
+ *         build or the current CPU does not support that instruction set.
+ */
+const guac_common_surface_kernels* guac_common_surface_get_kernels_for(
+        guac_common_surface_isa isa);
+
+/**
+ * Returns the fastest kernels supported by the current CPU. Regardless of
+ * instruction set, all kernels produce identical results.
+ *
+ * @return The fastest kernels supported by the current CPU.
+ */
+const guac_common_surface_kernels* guac_common_surface_get_kernels();
+
+#endif
+
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include "config.h"
+
+#include "guac_profile.h"
+#include "guac_surface_options.h"
+#include "guac_worker_pool.h"
+
+#include <guacamole/client.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Parses the given bandwidth threshold, given in kbit/s.
+ *
+ * @param value The value of the connection parameter to parse.
+ * @param default_bandwidth The threshold to use if the parameter is blank,
+ *                          in bytes per second.
+ * @return The parsed threshold, in bytes per second.
+ */
+static int __guac_common_surface_options_parse_bandwidth(const char* value,
+        int default_bandwidth) {
+
+    if (value[0] == '\0')
+        return default_bandwidth;
+
+    return atoi(value) * 125;
+
+}
+
+int guac_common_surface_options_parse(guac_client* client,
+        guac_common_surface_options* options, char** argv) {
+
+    const char* jpeg_quality = argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_JPEG_QUALITY];
+    const char* encoder_threads =
+        argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_ENCODER_THREADS];
+    const char* surface_trace =
+        argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_SURFACE_TRACE];
+
+    /* JPEG quality (JPEG is disabled if unspecified) */
+    options->jpeg_quality = 0;
+    if (jpeg_quality[0] != '\0') {
+
+        int quality = atoi(jpeg_quality);
+
+        /* Leave JPEG disabled if quality is out of range */
+        if (quality < 1 || quality > 100)
+            guac_client_log(client, GUAC_LOG_WARNING,
+                    "Ignoring invalid JPEG quality \"%s\". The quality must "
+                    "be between 1 and 100.", jpeg_quality);
+        else
+            options->jpeg_quality = quality;
+
+    }
+
+    /* Encoder threads (updates encoded serially if unspecified) */
+    options->encoder_threads = 0;
+    if (encoder_threads[0] != '\0') {
+
+        int threads = atoi(encoder_threads);
+
+        /* Encode serially if the thread count is out of range */
+        if (threads < 0 || threads > GUAC_COMMON_WORKER_POOL_MAX_THREADS)
+            guac_client_log(client, GUAC_LOG_WARNING,
+                    "Ignoring invalid number of encoder threads \"%s\". The "
+                    "number of threads must be between 0 and %i.",
+                    encoder_threads, GUAC_COMMON_WORKER_POOL_MAX_THREADS);
+        else
+            options->encoder_threads = threads;
+
+    }
+
+    /* Damage model (queue of combined updates if unspecified) */
+    options->damage_tiles =
+        (strcmp(argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_DAMAGE_TILES],
+                "true") == 0);
+
+    /* Image cache size in kilobytes (images are not cached if unspecified) */
+    options->image_cache_size =
+        atoi(argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_IMAGE_CACHE_SIZE]);
+
+    /* Motion detection (disabled if unspecified) */
+    options->motion_detection =
+        (strcmp(argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_MOTION_DETECTION],
+                "true") == 0);
+
+    /* Delta updates (disabled if unspecified) */
+    options->delta_updates =
+        (strcmp(argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_DELTA_UPDATES],
+                "true") == 0);
+
+    /* Fixed cost of image updates (measured if unspecified) */
+    options->update_cost =
+        atoi(argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_UPDATE_COST]);
+
+    /* Cost of each pixel of image updates (measured if unspecified) */
+    options->pixel_cost =
+        atoi(argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_PIXEL_COST]);
+
+    /* Adaptive encoding (disabled if unspecified) */
+    options->adaptive_encoding =
+        (strcmp(argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_ADAPTIVE_ENCODING],
+                "true") == 0);
+
+    /* Bandwidth thresholds in kbit/s (defaults if unspecified) */
+    options->reduced_color_bandwidth =
+        __guac_common_surface_options_parse_bandwidth(
+                argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_REDUCED_COLOR_BANDWIDTH],
+                GUAC_COMMON_PROFILE_DEFAULT_REDUCED_COLOR_BANDWIDTH);
+
+    options->lossy_bandwidth =
+        __guac_common_surface_options_parse_bandwidth(
+                argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_LOSSY_BANDWIDTH],
+                GUAC_COMMON_PROFILE_DEFAULT_LOSSY_BANDWIDTH);
+
+    options->reduced_rate_bandwidth =
+        __guac_common_surface_options_parse_bandwidth(
+                argv[GUAC_COMMON_SURFACE_OPTIONS_IDX_REDUCED_RATE_BANDWIDTH],
+                GUAC_COMMON_PROFILE_DEFAULT_REDUCED_RATE_BANDWIDTH);
+
+    /* Name of surface trace file (not recorded if unspecified) */
+    options->surface_trace = NULL;
+    if (surface_trace[0] != '\0') {
+        options->surface_trace = strdup(surface_trace);
+        if (options->surface_trace == NULL)
+            return 1;
+    }
+
+    return 0;
+
+}
+
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef __GUAC_SURFACE_OPTIONS_H
+#define __GUAC_SURFACE_OPTIONS_H
+
+#include "config.h"
+
+#include <guacamole/client.h>
+
+/**
+ * The names of all connection parameters parsed by
+ * guac_common_surface_options_parse(), in the order in which they must
+ * appear within the arguments given to that function. Plugins include these
+ * within their own list of accepted arguments.
+ */
+#define GUAC_COMMON_SURFACE_OPTIONS_ARGS \
+    "jpeg-quality",                      \
+    "encoder-threads",                   \
+    "damage-tiles",                      \
+    "image-cache-size",                  \
+    "motion-detection",                  \
+    "delta-updates",                     \
+    "update-cost",                       \
+    "pixel-cost",                        \
+    "surface-trace",                     \
+    "adaptive-encoding",                 \
+    "reduced-color-bandwidth",           \
+    "lossy-bandwidth",                   \
+    "reduced-rate-bandwidth"
+
+/**
+ * The index of each connection parameter within
+ * GUAC_COMMON_SURFACE_OPTIONS_ARGS.
+ */
+enum GUAC_COMMON_SURFACE_OPTIONS_IDX {
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_JPEG_QUALITY,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_ENCODER_THREADS,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_DAMAGE_TILES,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_IMAGE_CACHE_SIZE,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_MOTION_DETECTION,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_DELTA_UPDATES,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_UPDATE_COST,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_PIXEL_COST,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_SURFACE_TRACE,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_ADAPTIVE_ENCODING,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_REDUCED_COLOR_BANDWIDTH,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_LOSSY_BANDWIDTH,
+    GUAC_COMMON_SURFACE_OPTIONS_IDX_REDUCED_RATE_BANDWIDTH,
+    GUAC_COMMON_SURFACE_OPTIONS_ARGS_COUNT
+};
+
+/**
+ * Options controlling how updates to the default surface of a connection
+ * are tracked, encoded, and sent, as given by connection parameters.
+ */
+typedef struct guac_common_surface_options {
+
+    /**
+     * The quality at which photographic updates should be sent as JPEG,
+     * from 1 to 100, or 0 if all updates should be sent as PNG.
+     */
+    int jpeg_quality;
+
+    /**
+     * The number of threads to use when encoding image updates in parallel,
+     * or 0 if image updates should be encoded serially.
+     */
+    int encoder_threads;
+
+    /**
+     * Whether damage to the default surface should be tracked per tile,
+     * rather than as a queue of combined updates.
+     */
+    int damage_tiles;
+
+    /**
+     * The maximum amount of image data to retain within client-side buffers
+     * for reuse, in kilobytes, or 0 if images should not be cached.
+     */
+    int image_cache_size;
+
+    /**
+     * Whether images drawn to the default surface should be checked for
+     * scrolled or otherwise moved content, which is then copied rather than
+     * sent again.
+     */
+    int motion_detection;
+
+    /**
+     * Whether updates to the default surface which change few pixels should
+     * be sent as the XOR of old and new content.
+     */
+    int delta_updates;
+
+    /**
+     * The fixed cost of each image update, in nanoseconds, or 0 if this cost
+     * should be measured.
+     */
+    int update_cost;
+
+    /**
+     * The cost of each pixel of an image update, in nanoseconds, or 0 if
+     * this cost should be measured.
+     */
+    int pixel_cost;
+
+    /**
+     * The name of the file within the trace directory of the client to
+     * record all drawing to, or NULL if drawing should not be recorded. This
+     * is allocated with malloc() and must be freed once no longer needed.
+     */
+    char* surface_trace;
+
+    /**
+     * Whether the quality of updates should be reduced as the estimated
+     * bandwidth of the connection falls.
+     */
+    int adaptive_encoding;
+
+    /**
+     * The bandwidth, in bytes per second, below which colors are reduced if
+     * adaptive encoding is enabled, or 0 if colors are never reduced.
+     */
+    int reduced_color_bandwidth;
+
+    /**
+     * The bandwidth, in bytes per second, below which updates are sent as
+     * JPEG if adaptive encoding is enabled, or 0 if never.
+     */
+    int lossy_bandwidth;
+
+    /**
+     * The bandwidth, in bytes per second, below which the frame rate is
+     * reduced if adaptive encoding is enabled, or 0 if never.
+     */
+    int reduced_rate_bandwidth;
+
+} guac_common_surface_options;
+
+/**
+ * Parses the given connection parameters into the given surface options.
+ * Parameters which are blank are given their defaults, while parameters
+ * which are out of range are logged and ignored.
+ *
+ * @param client The client whose connection parameters are being parsed,
+ *               used for logging.
+ * @param options The surface options to populate.
+ * @param argv The values of the connection parameters, starting with the
+ *             first parameter named by GUAC_COMMON_SURFACE_OPTIONS_ARGS and
+ *             in the same order.
+ * @return Zero if the options were parsed successfully, non-zero if memory
+ *         for the options could not be allocated.
+ */
+int guac_common_surface_options_parse(guac_client* client,
+        guac_common_surface_options* options, char** argv);
+
+#endif
+
@@ -0,0 +1,464 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "guac_surface.h"
+#include "guac_surface_trace.h"
+
+#include <cairo/cairo.h>
+#include <guacamole/protocol.h>
+#include <guacamole/timestamp.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * Writes the given value to the given file as a little-endian 32-bit
+ * integer.
+ *
+ * @param file The file to write to.
+ * @param value The value to write.
+ * @return Zero on success, non-zero if the write fails.
+ */
+static int __guac_common_surface_trace_write_int(FILE* file, uint32_t value) {
+
+    unsigned char bytes[4];
+
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+
+    return fwrite(bytes, sizeof(bytes), 1, file) != 1;
+
+}
+
+/**
+ * Reads a little-endian 32-bit integer from the given file.
+ *
+ * @param file The file to read from.
+ * @param value Storage for the value read.
+ * @return Zero on success, non-zero if the read fails.
+ */
+static int __guac_common_surface_trace_read_int(FILE* file, uint32_t* value) {
+
+    unsigned char bytes[4];
+
+    if (fread(bytes, sizeof(bytes), 1, file) != 1)
+        return 1;
+
+    *value = bytes[0]
+           | (bytes[1] << 8)
+           | (bytes[2] << 16)
+           | ((uint32_t) bytes[3] << 24);
+
+    return 0;
+
+}
+
+guac_common_surface_trace* guac_common_surface_trace_alloc(FILE* file) {
+
+    guac_common_surface_trace* trace = malloc(sizeof(guac_common_surface_trace));
+    if (trace == NULL)
+        return NULL;
+
+    trace->file = file;
+    trace->start = guac_timestamp_current();
+    trace->records = 0;
+    trace->failed = fwrite(GUAC_COMMON_SURFACE_TRACE_MAGIC,
+            GUAC_COMMON_SURFACE_TRACE_MAGIC_LENGTH, 1, file) != 1;
+
+    pthread_mutex_init(&(trace->lock), NULL);
+
+    return trace;
+
+}
+
+guac_common_surface_trace* guac_common_surface_trace_open(
+        const char* directory, const char* name) {
+
+    guac_common_surface_trace* trace;
+    FILE* file;
+    char* path;
+    int fd;
+
+    /* Refuse anything but a plain file name */
+    if (name[0] == '\0' || strchr(name, '/') != NULL
+            || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    path = malloc(strlen(directory) + strlen(name) + 2);
+    if (path == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sprintf(path, "%s/%s", directory, name);
+
+    /* Create a new file only, never following links */
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+            S_IRUSR | S_IWUSR);
+    free(path);
+
+    if (fd == -1)
+        return NULL;
+
+    file = fdopen(fd, "wb");
+    if (file == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    trace = guac_common_surface_trace_alloc(file);
+    if (trace == NULL) {
+        fclose(file);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return trace;
+
+}
+
+void guac_common_surface_trace_free(guac_common_surface_trace* trace) {
+    fclose(trace->file);
+    pthread_mutex_destroy(&(trace->lock));
+    free(trace);
+}
+
+/**
+ * Writes the given image to the given file as little-endian 32-bit ARGB
+ * values, packed without padding.
+ *
+ * @param file The file to write to.
+ * @param pixels The pixels of the image, as 32-bit ARGB values in native
+ *               byte order.
+ * @param width The width of the image, in pixels.
+ * @param height The height of the image, in pixels.
+ * @param stride The number of bytes in each row of the image.
+ * @return Zero on success, non-zero if the write fails.
+ */
+static int __guac_common_surface_trace_write_pixels(FILE* file,
+        const unsigned char* pixels, int width, int height, int stride) {
+
+    unsigned char* row = malloc(width * 4);
+    int failed = 0;
+    int x, y;
+
+    if (row == NULL)
+        return 1;
+
+    for (y = 0; y < height && !failed; y++) {
+
+        const uint32_t* current = (const uint32_t*) (pixels + y * stride);
+
+        for (x = 0; x < width; x++) {
+            uint32_t color = current[x];
+            row[x*4]     = color;
+            row[x*4 + 1] = color >> 8;
+            row[x*4 + 2] = color >> 16;
+            row[x*4 + 3] = color >> 24;
+        }
+
+        failed = fwrite(row, width * 4, 1, file) != 1;
+
+    }
+
+    free(row);
+    return failed;
+
+}
+
+void guac_common_surface_trace_write(guac_common_surface_trace* trace,
+        guac_common_surface_trace_opcode opcode, const int* argv, int argc,
+        const unsigned char* pixels, int width, int height, int stride) {
+
+    FILE* file = trace->file;
+    int length = 0;
+    int failed;
+    int i;
+
+    pthread_mutex_lock(&(trace->lock));
+
+    /* Stop writing once the trace is incomplete */
+    if (trace->failed) {
+        pthread_mutex_unlock(&(trace->lock));
+        return;
+    }
+
+    /* Images too large to be read back end the trace */
+    if (pixels != NULL) {
+
+        if (width > GUAC_COMMON_SURFACE_TRACE_MAX_DIMENSION
+                || height > GUAC_COMMON_SURFACE_TRACE_MAX_DIMENSION) {
+            trace->failed = 1;
+            pthread_mutex_unlock(&(trace->lock));
+            return;
+        }
+
+        length = width * height * 4;
+
+    }
+
+    failed = __guac_common_surface_trace_write_int(file, opcode)
+          || __guac_common_surface_trace_write_int(file,
+                  guac_timestamp_current() - trace->start)
+          || __guac_common_surface_trace_write_int(file, argc);
+
+    for (i = 0; i < argc && !failed; i++)
+        failed = __guac_common_surface_trace_write_int(file, argv[i]);
+
+    if (!failed)
+        failed = __guac_common_surface_trace_write_int(file, length);
+
+    if (!failed && length > 0)
+        failed = __guac_common_surface_trace_write_pixels(file, pixels,
+                width, height, stride);
+
+    if (failed)
+        trace->failed = 1;
+    else
+        trace->records++;
+
+    pthread_mutex_unlock(&(trace->lock));
+
+}
+
+int guac_common_surface_trace_read_header(FILE* file) {
+
+    char magic[GUAC_COMMON_SURFACE_TRACE_MAGIC_LENGTH];
+
+    if (fread(magic, sizeof(magic), 1, file) != 1)
+        return 1;
+
+    return memcmp(magic, GUAC_COMMON_SURFACE_TRACE_MAGIC, sizeof(magic)) != 0;
+
+}
+
+int guac_common_surface_trace_read(FILE* file,
+        guac_common_surface_trace_record* record) {
+
+    uint32_t opcode, timestamp, argc, length, value;
+    uint32_t* pixel;
+    int i;
+
+    /* The trace ends cleanly only between records */
+    if (__guac_common_surface_trace_read_int(file, &opcode))
+        return feof(file) ? 0 : -1;
+
+    if (__guac_common_surface_trace_read_int(file, &timestamp)
+            || __guac_common_surface_trace_read_int(file, &argc)
+            || argc > GUAC_COMMON_SURFACE_TRACE_MAX_ARGS)
+        return -1;
+
+    record->opcode = opcode;
+    record->timestamp = timestamp;
+    record->argc = argc;
+
+    for (i = 0; i < record->argc; i++) {
+        if (__guac_common_surface_trace_read_int(file, &value))
+            return -1;
+        record->argv[i] = (int32_t) value;
+    }
+
+    if (__guac_common_surface_trace_read_int(file, &length)
+            || length % 4 != 0
+            || length > GUAC_COMMON_SURFACE_TRACE_MAX_LENGTH)
+        return -1;
+
+    /* Grow data storage as necessary, keeping the old storage on failure
+     * such that it can still be freed */
+    if (record->size < length) {
+
+        unsigned char* data = realloc(record->data, length);
+        if (data == NULL)
+            return -1;
+
+        record->data = data;
+        record->size = length;
+
+    }
+
+    record->length = length;
+    if (length > 0 && fread(record->data, length, 1, file) != 1)
+        return -1;
+
+    /* Convert pixels to native byte order */
+    for (pixel = (uint32_t*) record->data;
+            pixel < (uint32_t*) (record->data + length); pixel++) {
+        unsigned char* bytes = (unsigned char*) pixel;
+        *pixel = bytes[0]
+               | (bytes[1] << 8)
+               | (bytes[2] << 16)
+               | ((uint32_t) bytes[3] << 24);
+    }
+
+    return 1;
+
+}
+
+/**
+ * The number of arguments of each trace record, indexed by opcode.
+ */
+static const int __guac_common_surface_trace_argc[] = {
+    0, /* Unused */
+    3, /* GUAC_COMMON_SURFACE_TRACE_SURFACE */
+    1, /* GUAC_COMMON_SURFACE_TRACE_FREE */
+    3, /* GUAC_COMMON_SURFACE_TRACE_RESIZE */
+    6, /* GUAC_COMMON_SURFACE_TRACE_DRAW */
+    8, /* GUAC_COMMON_SURFACE_TRACE_PAINT */
+    8, /* GUAC_COMMON_SURFACE_TRACE_COPY */
+    9, /* GUAC_COMMON_SURFACE_TRACE_TRANSFER */
+    8, /* GUAC_COMMON_SURFACE_TRACE_RECT */
+    5, /* GUAC_COMMON_SURFACE_TRACE_CLIP */
+    1, /* GUAC_COMMON_SURFACE_TRACE_RESET_CLIP */
+    1, /* GUAC_COMMON_SURFACE_TRACE_FLUSH */
+    1  /* GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED */
+};
+
+/**
+ * Wraps the image data of the given record, which must describe a draw or
+ * paint operation, in a new Cairo surface.
+ *
+ * @param record The record containing the image.
+ * @param alpha Non-zero if the alpha channel of the image is significant.
+ * @return A new Cairo surface wrapping the image data of the record, or NULL
+ *         if the record does not contain an image of the recorded size.
+ */
+static cairo_surface_t* __guac_common_surface_trace_image(
+        const guac_common_surface_trace_record* record, int alpha) {
+
+    int width = record->argv[3];
+    int height = record->argv[4];
+
+    if (width <= 0 || height <= 0
+            || record->length / 4 / width != height
+            || record->length != width * height * 4)
+        return NULL;
+
+    return cairo_image_surface_create_for_data(record->data,
+            alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+            width, height, width * 4);
+
+}
+
+int guac_common_surface_trace_apply(
+        const guac_common_surface_trace_record* record,
+        guac_common_surface_trace_lookup* lookup, void* data) {
+
+    const int* argv = record->argv;
+    guac_common_surface* surface;
+    guac_common_surface* dst;
+    cairo_surface_t* image;
+
+    /* Verify record is complete */
+    if (record->opcode <= GUAC_COMMON_SURFACE_TRACE_FREE
+            || record->opcode > GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED
+            || record->argc != __guac_common_surface_trace_argc[record->opcode])
+        return 1;
+
+    surface = lookup(argv[0], data);
+    if (surface == NULL)
+        return 1;
+
+    switch (record->opcode) {
+
+        case GUAC_COMMON_SURFACE_TRACE_RESIZE:
+            guac_common_surface_resize(surface, argv[1], argv[2]);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_DRAW:
+            image = __guac_common_surface_trace_image(record, argv[5]);
+            if (image == NULL)
+                return 1;
+            guac_common_surface_draw(surface, argv[1], argv[2], image);
+            cairo_surface_destroy(image);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_PAINT:
+            image = __guac_common_surface_trace_image(record, 1);
+            if (image == NULL)
+                return 1;
+            guac_common_surface_paint(surface, argv[1], argv[2], image,
+                    argv[5], argv[6], argv[7]);
+            cairo_surface_destroy(image);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_COPY:
+            dst = lookup(argv[5], data);
+            if (dst == NULL)
+                return 1;
+            guac_common_surface_copy(surface, argv[1], argv[2], argv[3],
+                    argv[4], dst, argv[6], argv[7]);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_TRANSFER:
+            dst = lookup(argv[6], data);
+            if (dst == NULL)
+                return 1;
+            guac_common_surface_transfer(surface, argv[1], argv[2], argv[3],
+                    argv[4], (guac_transfer_function) argv[5], dst,
+                    argv[7], argv[8]);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_RECT:
+            guac_common_surface_rect(surface, argv[1], argv[2], argv[3],
+                    argv[4], argv[5], argv[6], argv[7]);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_CLIP:
+            guac_common_surface_clip(surface, argv[1], argv[2], argv[3],
+                    argv[4]);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_RESET_CLIP:
+            guac_common_surface_reset_clip(surface);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_FLUSH:
+            guac_common_surface_flush(surface);
+            return 0;
+
+        case GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED:
+            guac_common_surface_flush_deferred(surface);
+            return 0;
+
+        default:
+            return 1;
+
+    }
+
+}
+
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_SURFACE_TRACE_H
+#define __GUAC_SURFACE_TRACE_H
+
+#include "config.h"
+
+#include <guacamole/timestamp.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * The bytes at the beginning of every surface trace, identifying the file
+ * as a trace and the version of its format.
+ */
+#define GUAC_COMMON_SURFACE_TRACE_MAGIC "GUACTRC1"
+
+/**
+ * The number of bytes in GUAC_COMMON_SURFACE_TRACE_MAGIC.
+ */
+#define GUAC_COMMON_SURFACE_TRACE_MAGIC_LENGTH 8
+
+/**
+ * The maximum number of integer arguments of any trace record.
+ */
+#define GUAC_COMMON_SURFACE_TRACE_MAX_ARGS 16
+
+/**
+ * The maximum width or height, in pixels, of any image within a trace. Any
+ * image larger than this cannot be recorded, and ends the trace.
+ */
+#define GUAC_COMMON_SURFACE_TRACE_MAX_DIMENSION 8192
+
+/**
+ * The maximum length of the data of any trace record, in bytes, being the
+ * length of the largest image which may be recorded.
+ */
+#define GUAC_COMMON_SURFACE_TRACE_MAX_LENGTH \
+    (GUAC_COMMON_SURFACE_TRACE_MAX_DIMENSION \
+   * GUAC_COMMON_SURFACE_TRACE_MAX_DIMENSION * 4)
+
+/**
+ * The surface operation described by a trace record. Surfaces are
+ * identified by the index of their layer. The arguments of each record are
+ * those of the corresponding surface function, in the same order, with
+ * surfaces replaced by layer indices and images replaced by their width and
+ * height, the pixels of images following as the data of the record.
+ */
+typedef enum guac_common_surface_trace_opcode {
+
+    /**
+     * A surface began being traced. Arguments: layer, width, height.
+     */
+    GUAC_COMMON_SURFACE_TRACE_SURFACE = 1,
+
+    /**
+     * guac_common_surface_free(). Arguments: layer.
+     */
+    GUAC_COMMON_SURFACE_TRACE_FREE,
+
+    /**
+     * guac_common_surface_resize(). Arguments: layer, width, height.
+     */
+    GUAC_COMMON_SURFACE_TRACE_RESIZE,
+
+    /**
+     * guac_common_surface_draw(). Arguments: layer, x, y, width, height,
+     * and non-zero if the image has an alpha channel. Data: pixels.
+     */
+    GUAC_COMMON_SURFACE_TRACE_DRAW,
+
+    /**
+     * guac_common_surface_paint(). Arguments: layer, x, y, width, height,
+     * red, green, blue. Data: pixels.
+     */
+    GUAC_COMMON_SURFACE_TRACE_PAINT,
+
+    /**
+     * guac_common_surface_copy(). Arguments: source layer, source x,
+     * source y, width, height, destination layer, destination x,
+     * destination y.
+     */
+    GUAC_COMMON_SURFACE_TRACE_COPY,
+
+    /**
+     * guac_common_surface_transfer(). Arguments: source layer, source x,
+     * source y, width, height, transfer function, destination layer,
+     * destination x, destination y.
+     */
+    GUAC_COMMON_SURFACE_TRACE_TRANSFER,
+
+    /**
+     * guac_common_surface_rect(). Arguments: layer, x, y, width, height,
+     * red, green, blue.
+     */
+    GUAC_COMMON_SURFACE_TRACE_RECT,
+
+    /**
+     * guac_common_surface_clip(). Arguments: layer, x, y, width, height.
+     */
+    GUAC_COMMON_SURFACE_TRACE_CLIP,
+
+    /**
+     * guac_common_surface_reset_clip(). Arguments: layer.
+     */
+    GUAC_COMMON_SURFACE_TRACE_RESET_CLIP,
+
+    /**
+     * guac_common_surface_flush(). Arguments: layer.
+     */
+    GUAC_COMMON_SURFACE_TRACE_FLUSH,
+
+    /**
+     * guac_common_surface_flush_deferred(). Arguments: layer.
+     */
+    GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED
+
+} guac_common_surface_trace_opcode;
+
+/**
+ * A single record of a surface trace.
+ */
+typedef struct guac_common_surface_trace_record {
+
+    /**
+     * The operation described by this record.
+     */
+    guac_common_surface_trace_opcode opcode;
+
+    /**
+     * The number of milliseconds between the start of the trace and this
+     * record.
+     */
+    guac_timestamp timestamp;
+
+    /**
+     * The number of arguments of this record.
+     */
+    int argc;
+
+    /**
+     * The arguments of this record.
+     */
+    int argv[GUAC_COMMON_SURFACE_TRACE_MAX_ARGS];
+
+    /**
+     * The pixels of the image associated with this record, as 32-bit
+     * ARGB values in native byte order, packed without padding, or NULL if
+     * there is no such image.
+     */
+    unsigned char* data;
+
+    /**
+     * The number of bytes of data.
+     */
+    int length;
+
+    /**
+     * The number of bytes allocated for data.
+     */
+    int size;
+
+} guac_common_surface_trace_record;
+
+/**
+ * Trace of all operations of one or more surfaces, written to a file such
+ * that those operations can be replayed later without the remote desktop
+ * which produced them. Traces may be shared by any number of surfaces, and
+ * may be written by any number of threads.
+ *
+ * Each record is stored as little-endian 32-bit integers: the opcode, the
+ * timestamp, the number of arguments, each argument, and the length of any
+ * data, followed by the data. Pixels are stored as little-endian 32-bit
+ * ARGB values.
+ */
+typedef struct guac_common_surface_trace {
+
+    /**
+     * The file being written.
+     */
+    FILE* file;
+
+    /**
+     * The time at which this trace began.
+     */
+    guac_timestamp start;
+
+    /**
+     * The number of records written.
+     */
+    int records;
+
+    /**
+     * Non-zero if writing any record has failed, in which case no further
+     * records are written.
+     */
+    int failed;
+
+    /**
+     * Lock which is acquired while any record is written.
+     */
+    pthread_mutex_t lock;
+
+} guac_common_surface_trace;
+
+/**
+ * Allocates a new trace which writes to the given file, writing the
+ * beginning of the trace immediately. The file is closed when the trace is
+ * freed.
+ *
+ * @param file The file to write the trace to.
+ * @return A newly-allocated trace, or NULL if allocation fails, in which
+ *         case the file is left open.
+ */
+guac_common_surface_trace* guac_common_surface_trace_alloc(FILE* file);
+
+/**
+ * Creates a new file having the given name within the given directory, and
+ * allocates a new trace which writes to that file, as with
+ * guac_common_surface_trace_alloc(). The name must be a plain file name,
+ * not a path, and no file having that name may already exist. Symbolic
+ * links are never followed. If the trace cannot be created, errno is set
+ * appropriately.
+ *
+ * @param directory The directory to create the trace within.
+ * @param name The name of the file to create.
+ * @return A newly-allocated trace, or NULL if the trace cannot be created.
+ */
+guac_common_surface_trace* guac_common_surface_trace_open(
+        const char* directory, const char* name);
+
+/**
+ * Frees the given trace, closing its file.
+ *
+ * @param trace The trace to free.
+ */
+void guac_common_surface_trace_free(guac_common_surface_trace* trace);
+
+/**
+ * Writes a single record to the given trace.
+ *
+ * @param trace The trace to write to.
+ * @param opcode The operation being recorded.
+ * @param argv The arguments of the operation.
+ * @param argc The number of arguments, which may not exceed
+ *             GUAC_COMMON_SURFACE_TRACE_MAX_ARGS.
+ * @param pixels The pixels of the image associated with the operation, as
+ *               32-bit ARGB values in native byte order, or NULL if there is
+ *               no such image.
+ * @param width The width of the image, in pixels.
+ * @param height The height of the image, in pixels.
+ * @param stride The number of bytes in each row of the image.
+ */
+void guac_common_surface_trace_write(guac_common_surface_trace* trace,
+        guac_common_surface_trace_opcode opcode, const int* argv, int argc,
+        const unsigned char* pixels, int width, int height, int stride);
+
+/**
+ * Reads and verifies the beginning of a trace from the given file.
+ *
+ * @param file The file to read from.
+ * @return Zero if the file begins with a trace, non-zero otherwise.
+ */
+int guac_common_surface_trace_read_header(FILE* file);
+
+/**
+ * Reads the next record of a trace from the given file, which must be
+ * positioned after the beginning of the trace or after a previous record.
+ * The data of the record is reallocated as needed, and must be freed by the
+ * caller once no further records will be read into the record.
+ *
+ * @param file The file to read from.
+ * @param record The record to read into, which must be zeroed before its
+ *               first use.
+ * @return Positive if a record was read, zero if the end of the trace has
+ *         been reached, or negative if the trace is malformed or space for
+ *         the data of the record cannot be allocated.
+ */
+int guac_common_surface_trace_read(FILE* file,
+        guac_common_surface_trace_record* record);
+
+/**
+ * Returns the surface associated with the given layer index while replaying
+ * a trace.
+ *
+ * @param index The index of the layer of the surface, as recorded.
+ * @param data Arbitrary data given to guac_common_surface_trace_apply().
+ * @return The surface associated with the given layer index, or NULL if
+ *         there is no such surface.
+ */
+typedef struct guac_common_surface* guac_common_surface_trace_lookup(int index,
+        void* data);
+
+/**
+ * Applies the operation described by the given record to the surfaces
+ * returned by the given lookup function. Records describing the beginning
+ * or end of a surface's trace are not applied, as the surfaces involved must
+ * be allocated and freed by the caller.
+ *
+ * @param record The record to apply.
+ * @param lookup The function to call to look up the surfaces involved.
+ * @param data Arbitrary data to pass to the lookup function.
+ * @return Zero if the operation was applied, non-zero if the record is
+ *         malformed, involves unknown surfaces, or describes the beginning
+ *         or end of a surface's trace.
+ */
+int guac_common_surface_trace_apply(
+        const guac_common_surface_trace_record* record,
+        guac_common_surface_trace_lookup* lookup, void* data);
+
+#endif
+
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include "guac_worker_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/**
+ * Claims and runs tasks of the current batch of the given pool until none
+ * remain unclaimed. The pool lock must be held when this function is called,
+ * and will be held when it returns, but is released while each task runs.
+ *
+ * @param pool The worker pool whose current batch should be run.
+ */
+static void __guac_common_worker_pool_drain(guac_common_worker_pool* pool) {
+
+    while (pool->next < pool->count) {
+
+        void* data = pool->data[pool->next++];
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(data);
+        pthread_mutex_lock(&pool->lock);
+
+        /* Wake submitter once the final run is complete */
+        if (++pool->completed == pool->count)
+            pthread_cond_signal(&pool->batch_complete);
+
+    }
+
+}
+
+/**
+ * Thread which runs tasks of each batch submitted to the given pool until
+ * the pool is freed.
+ *
+ * @param data The guac_common_worker_pool this thread belongs to.
+ * @return Always NULL.
+ */
+static void* __guac_common_worker_pool_thread(void* data) {
+
+    guac_common_worker_pool* pool = (guac_common_worker_pool*) data;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (!pool->stopping) {
+        __guac_common_worker_pool_drain(pool);
+        pthread_cond_wait(&pool->batch_ready, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+
+}
+
+guac_common_worker_pool* guac_common_worker_pool_alloc(int threads) {
+
+    guac_common_worker_pool* pool = malloc(sizeof(guac_common_worker_pool));
+    int i;
+
+    if (pool == NULL)
+        return NULL;
+
+    if (threads > GUAC_COMMON_WORKER_POOL_MAX_THREADS)
+        threads = GUAC_COMMON_WORKER_POOL_MAX_THREADS;
+
+    pool->thread_count = 0;
+    pool->task = NULL;
+    pool->data = NULL;
+    pool->count = 0;
+    pool->next = 0;
+    pool->completed = 0;
+    pool->stopping = 0;
+
+    pthread_mutex_init(&pool->submit_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->batch_ready, NULL);
+    pthread_cond_init(&pool->batch_complete, NULL);
+
+    /* Start as many threads as possible */
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL,
+                    __guac_common_worker_pool_thread, pool))
+            break;
+        pool->thread_count++;
+    }
+
+    /* A pool without threads is useless */
+    if (pool->thread_count == 0) {
+        guac_common_worker_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+
+}
+
+void guac_common_worker_pool_free(guac_common_worker_pool* pool) {
+
+    int i;
+
+    /* Signal all threads to stop */
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->batch_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->batch_complete);
+    pthread_cond_destroy(&pool->batch_ready);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->submit_lock);
+    free(pool);
+
+}
+
+void guac_common_worker_pool_run(guac_common_worker_pool* pool,
+        guac_common_worker_task* task, void** data, int count) {
+
+    if (count <= 0)
+        return;
+
+    /* Wait for any batch submitted by another thread */
+    pthread_mutex_lock(&pool->submit_lock);
+    pthread_mutex_lock(&pool->lock);
+
+    /* Publish batch */
+    pool->task = task;
+    pool->data = data;
+    pool->count = count;
+    pool->next = 0;
+    pool->completed = 0;
+    pthread_cond_broadcast(&pool->batch_ready);
+
+    /* Run tasks alongside pool threads */
+    __guac_common_worker_pool_drain(pool);
+
+    /* Wait for runs claimed by other threads */
+    while (pool->completed < pool->count)
+        pthread_cond_wait(&pool->batch_complete, &pool->lock);
+
+    /* Clear batch such that late-waking threads find nothing to claim */
+    pool->count = 0;
+    pool->next = 0;
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->submit_lock);
+
+}
+
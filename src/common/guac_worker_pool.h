@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_WORKER_POOL_H
+#define __GUAC_WORKER_POOL_H
+
+#include "config.h"
+
+#include <pthread.h>
+
+/**
+ * The maximum number of threads within a single worker pool.
+ */
+#define GUAC_COMMON_WORKER_POOL_MAX_THREADS 64
+
+/**
+ * A task which may be run by any thread of a worker pool.
+ *
+ * @param data The arbitrary data given for this particular run of the task.
+ */
+typedef void guac_common_worker_task(void* data);
+
+/**
+ * A fixed set of threads which run batches of independent tasks
+ * concurrently. Only one batch runs at a time, with batches submitted by
+ * different threads running one after the other.
+ */
+typedef struct guac_common_worker_pool {
+
+    /**
+     * The number of threads within the pool, not including the thread
+     * submitting each batch, which participates in running it.
+     */
+    int thread_count;
+
+    /**
+     * All threads within the pool.
+     */
+    pthread_t threads[GUAC_COMMON_WORKER_POOL_MAX_THREADS];
+
+    /**
+     * Lock which is held by the submitting thread for the entire duration of
+     * each batch, from publishing the batch until all of its runs complete.
+     */
+    pthread_mutex_t submit_lock;
+
+    /**
+     * Lock which must be held while the state of the current batch is read
+     * or modified.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Signalled when a new batch is available, or when the pool is being
+     * freed.
+     */
+    pthread_cond_t batch_ready;
+
+    /**
+     * Signalled when the last task of the current batch has completed.
+     */
+    pthread_cond_t batch_complete;
+
+    /**
+     * The task being run by the current batch.
+     */
+    guac_common_worker_task* task;
+
+    /**
+     * The data to pass to each run of the current task.
+     */
+    void** data;
+
+    /**
+     * The number of runs within the current batch.
+     */
+    int count;
+
+    /**
+     * The index of the next run of the current batch not yet claimed by any
+     * thread.
+     */
+    int next;
+
+    /**
+     * The number of runs of the current batch which have completed.
+     */
+    int completed;
+
+    /**
+     * Non-zero if the pool is being freed and all threads should exit.
+     */
+    int stopping;
+
+} guac_common_worker_pool;
+
+/**
+ * Allocates a new worker pool with the given number of threads. The thread
+ * submitting each batch also runs tasks, so a pool of N threads runs up to
+ * N + 1 tasks concurrently.
+ *
+ * @param threads The number of threads to create, which will be reduced to
+ *                GUAC_COMMON_WORKER_POOL_MAX_THREADS if larger.
+ * @return A newly-allocated worker pool, or NULL if the pool could not be
+ *         allocated or no threads could be created.
+ */
+guac_common_worker_pool* guac_common_worker_pool_alloc(int threads);
+
+/**
+ * Stops all threads of the given worker pool and frees the pool. No batch
+ * may be running.
+ *
+ * @param pool The worker pool to free.
+ */
+void guac_common_worker_pool_free(guac_common_worker_pool* pool);
+
+/**
+ * Runs the given task once for each of the given data pointers, spreading
+ * the runs across all threads of the given pool as well as the calling
+ * thread. This function does not return until every run has completed.
+ * Runs may complete in any order. If a batch submitted by another thread is
+ * running, this function first waits for that batch to complete.
+ *
+ * @param pool The worker pool to run the task within.
+ * @param task The task to run.
+ * @param data The data to pass to each run of the task.
+ * @param count The number of times to run the task, and the number of
+ *              entries within the data array.
+ */
+void guac_common_worker_pool_run(guac_common_worker_pool* pool,
+        guac_common_worker_task* task, void** data, int count);
+
+#endif
+
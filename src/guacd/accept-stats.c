@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* TCP_INFO is hidden by strict X/Open mode */
+#define _DEFAULT_SOURCE
+
+#include "config.h"
+#include "accept-stats.h"
+#include "log.h"
+
+#include <guacamole/timestamp.h>
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+/**
+ * The file listing the extended TCP counters of the system, in pairs of
+ * lines giving the names and then the values of each group of counters.
+ */
+#define GUACD_ACCEPT_NETSTAT "/proc/net/netstat"
+
+void guacd_accept_stats_init(guacd_accept_stats* stats) {
+
+    memset(stats, 0, sizeof(guacd_accept_stats));
+    stats->initial_overflows = guacd_accept_overflows();
+
+}
+
+void guacd_accept_stats_record(guacd_accept_stats* stats, int fd) {
+
+    guac_client_log_level level = GUAC_LOG_DEBUG;
+    guac_timestamp second = guac_timestamp_current() / 1000;
+    int index = second % GUACD_ACCEPT_WINDOW;
+
+    int64_t overflows;
+    double rate;
+    int seconds;
+    int queued;
+    int limit;
+
+    if (stats->total++ == 0)
+        stats->first_second = second;
+
+    /* Reuse entries of seconds which have left the window */
+    if (stats->seconds[index] != second) {
+        stats->seconds[index] = second;
+        stats->counts[index] = 0;
+    }
+
+    stats->counts[index]++;
+
+    /* Sample the queue behind the connection just accepted */
+    queued = guacd_accept_queue_length(fd, &limit);
+    if (queued < 0)
+        stats->max_queued = -1;
+
+    else {
+
+        if (stats->max_queued >= 0 && queued > stats->max_queued)
+            stats->max_queued = queued;
+
+        /* Counting the accepted connection, the queue was full */
+        if (queued + 1 > limit)
+            stats->queue_full++;
+
+    }
+
+    /* Periodically summarize at a more visible level */
+    if (stats->total % GUACD_ACCEPT_LOG_INTERVAL == 0)
+        level = GUAC_LOG_INFO;
+
+    /* Skip reading system counters if the summary would not be logged */
+    if (level > guacd_log_level)
+        return;
+
+    rate = guacd_accept_stats_get_rate(stats, &seconds);
+
+    overflows = guacd_accept_overflows();
+    if (overflows >= 0 && stats->initial_overflows >= 0)
+        overflows -= stats->initial_overflows;
+    else
+        overflows = -1;
+
+    guacd_log(level, "Accepted connection %" PRIu64 " (%.2f per second over "
+            "the last %i seconds). Accept queue: %i waiting, peak %i, "
+            "full %" PRIu64 " times; %" PRId64 " connections dropped by the "
+            "system since startup.", stats->total, rate, seconds,
+            queued, stats->max_queued, stats->queue_full, overflows);
+
+}
+
+double guacd_accept_stats_get_rate(guacd_accept_stats* stats, int* seconds) {
+
+    guac_timestamp second = guac_timestamp_current() / 1000;
+    int window = 0;
+    int sum = 0;
+    int i;
+
+    if (stats->total > 0) {
+
+        /* Average only over complete seconds */
+        window = second - stats->first_second;
+        if (window > GUACD_ACCEPT_WINDOW)
+            window = GUACD_ACCEPT_WINDOW;
+
+        for (i = 0; i < GUACD_ACCEPT_WINDOW; i++) {
+            guac_timestamp age = second - stats->seconds[i];
+            if (age >= 1 && age <= window)
+                sum += stats->counts[i];
+        }
+
+    }
+
+    if (seconds != NULL)
+        *seconds = window;
+
+    if (window == 0)
+        return 0;
+
+    return (double) sum / window;
+
+}
+
+int guacd_accept_queue_length(int fd, int* limit) {
+
+#ifdef __linux__
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+
+    /* For listening sockets, Linux reports the current and maximum length
+     * of the accept queue in place of unacknowledged and SACKed segments */
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+
+        if (limit != NULL)
+            *limit = info.tcpi_sacked;
+
+        return info.tcpi_unacked;
+
+    }
+#endif
+
+    return -1;
+
+}
+
+int64_t guacd_accept_overflows() {
+
+    char names[4096];
+    char values[4096];
+    char* name_save;
+    char* value_save;
+    char* name;
+    char* value;
+    int64_t overflows = -1;
+
+    FILE* netstat = fopen(GUACD_ACCEPT_NETSTAT, "r");
+    if (netstat == NULL)
+        return -1;
+
+    /* Find the line of values following the names of the TCP counters */
+    while (fgets(names, sizeof(names), netstat) != NULL
+            && fgets(values, sizeof(values), netstat) != NULL) {
+
+        if (strncmp(names, "TcpExt:", 7) != 0)
+            continue;
+
+        name = strtok_r(names, " \n", &name_save);
+        value = strtok_r(values, " \n", &value_save);
+
+        /* Match the position of the counter within both lines */
+        while (name != NULL && value != NULL) {
+
+            if (strcmp(name, "ListenOverflows") == 0) {
+                overflows = strtoll(value, NULL, 10);
+                break;
+            }
+
+            name = strtok_r(NULL, " \n", &name_save);
+            value = strtok_r(NULL, " \n", &value_save);
+
+        }
+
+        break;
+
+    }
+
+    fclose(netstat);
+    return overflows;
+
+}
+
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef _GUACD_ACCEPT_STATS_H
+#define _GUACD_ACCEPT_STATS_H
+
+#include "config.h"
+
+#include <guacamole/timestamp.h>
+
+#include <stdint.h>
+
+/**
+ * The number of seconds over which the rate of accepted connections is
+ * averaged.
+ */
+#define GUACD_ACCEPT_WINDOW 60
+
+/**
+ * The number of accepted connections between each summary logged at the info
+ * level. Summaries for all other connections are logged at the debug level.
+ */
+#define GUACD_ACCEPT_LOG_INTERVAL 64
+
+/**
+ * Counters describing the connections accepted by a single acceptor process,
+ * and the state of the accept queues it drains.
+ */
+typedef struct guacd_accept_stats {
+
+    /**
+     * The total number of connections accepted.
+     */
+    uint64_t total;
+
+    /**
+     * The second during which the first connection was accepted.
+     */
+    guac_timestamp first_second;
+
+    /**
+     * The number of connections accepted during each of the most recent
+     * seconds, indexed by second modulo GUACD_ACCEPT_WINDOW.
+     */
+    int counts[GUACD_ACCEPT_WINDOW];
+
+    /**
+     * The second which each entry of counts describes.
+     */
+    guac_timestamp seconds[GUACD_ACCEPT_WINDOW];
+
+    /**
+     * The largest number of connections seen waiting in an accept queue, or
+     * -1 if the length of the queue cannot be determined.
+     */
+    int max_queued;
+
+    /**
+     * The number of times a connection was accepted from a queue which was
+     * already full, such that further connections were being refused.
+     */
+    uint64_t queue_full;
+
+    /**
+     * The number of connections dropped by the system due to full accept
+     * queues as of startup, or -1 if this cannot be determined.
+     */
+    int64_t initial_overflows;
+
+} guacd_accept_stats;
+
+/**
+ * Initializes the given stats, noting the number of connections dropped by
+ * the system so far such that only later drops are reported.
+ *
+ * @param stats The guacd_accept_stats to initialize.
+ */
+void guacd_accept_stats_init(guacd_accept_stats* stats);
+
+/**
+ * Records a connection just accepted from the given listening socket,
+ * sampling the length of its accept queue and logging a summary of all
+ * counters.
+ *
+ * @param stats The guacd_accept_stats to update.
+ * @param fd The listening socket the connection was accepted from.
+ */
+void guacd_accept_stats_record(guacd_accept_stats* stats, int fd);
+
+/**
+ * Returns the average number of connections accepted per second over the
+ * most recent complete seconds, up to GUACD_ACCEPT_WINDOW.
+ *
+ * @param stats The guacd_accept_stats to calculate the rate of.
+ * @param seconds If non-NULL, receives the number of seconds averaged over.
+ * @return The average number of connections accepted per second.
+ */
+double guacd_accept_stats_get_rate(guacd_accept_stats* stats, int* seconds);
+
+/**
+ * Returns the number of connections currently waiting to be accepted on the
+ * given listening socket.
+ *
+ * @param fd The listening socket to inspect.
+ * @param limit If non-NULL, receives the maximum length of the queue.
+ * @return The number of connections waiting, or -1 if this cannot be
+ *         determined on this platform.
+ */
+int guacd_accept_queue_length(int fd, int* limit);
+
+/**
+ * Returns the number of connections which the system has dropped because
+ * the accept queue of their listening socket was full. On Linux, this is
+ * the ListenOverflows counter of /proc/net/netstat, which covers all
+ * listening sockets of the network namespace.
+ *
+ * @return The number of connections dropped, or -1 if this cannot be
+ *         determined.
+ */
+int64_t guacd_accept_overflows();
+
+#endif
+
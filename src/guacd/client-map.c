@@ -27,6 +27,7 @@
 
 #include <guacamole/client.h>
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -95,6 +96,9 @@ guacd_client_map* guacd_client_map_alloc() {
         current++;
     }
 
+    map->__count = 0;
+    pthread_mutex_init(&(map->__count_lock), NULL);
+
     return map;
 
 }
@@ -110,9 +114,16 @@ int guacd_client_map_add(guacd_client_map* map, guac_client* client) {
 
     /* If no such element, we can add the new client successfully */
     if (found == NULL) {
+
         guac_common_list_add(bucket, client);
         guac_common_list_unlock(bucket);
+
+        pthread_mutex_lock(&(map->__count_lock));
+        map->__count++;
+        pthread_mutex_unlock(&(map->__count_lock));
+
         return 0;
+
     }
 
     /* Otherwise, fail - already exists */
@@ -166,7 +177,24 @@ guac_client* guacd_client_map_remove(guacd_client_map* map, const char* id) {
     guac_common_list_remove(bucket, found);
 
     guac_common_list_unlock(bucket);
+
+    pthread_mutex_lock(&(map->__count_lock));
+    map->__count--;
+    pthread_mutex_unlock(&(map->__count_lock));
+
     return client;
 
 }
 
+int guacd_client_map_count(guacd_client_map* map) {
+
+    int count;
+
+    pthread_mutex_lock(&(map->__count_lock));
+    count = map->__count;
+    pthread_mutex_unlock(&(map->__count_lock));
+
+    return count;
+
+}
+
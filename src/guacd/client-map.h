@@ -30,10 +30,15 @@
 
 #include <guacamole/client.h>
 
+#include <pthread.h>
+
 #define GUACD_CLIENT_MAP_BUCKETS GUACD_CLIENT_MAX_CONNECTIONS*2
 
 /**
- * Set of all active connections to guacd, indexed by connection ID.
+ * Set of all active connections to guacd, indexed by connection ID. When
+ * connections are handled by threads sharing a single process, the map is
+ * shared by all of those connections, and all functions operating on it are
+ * threadsafe.
  */
 typedef struct guacd_client_map {
 
@@ -43,6 +48,16 @@ typedef struct guacd_client_map {
      */
     guac_common_list* __buckets[GUACD_CLIENT_MAP_BUCKETS];
 
+    /**
+     * The number of clients currently stored.
+     */
+    int __count;
+
+    /**
+     * Lock which must be held while __count is read or modified.
+     */
+    pthread_mutex_t __count_lock;
+
 } guacd_client_map;
 
 /**
@@ -69,5 +84,10 @@ guac_client* guacd_client_map_retrieve(guacd_client_map* map, const char* id);
  */
 guac_client* guacd_client_map_remove(guacd_client_map* map, const char* id);
 
+/**
+ * Returns the number of clients currently stored within the given map.
+ */
+int guacd_client_map_count(guacd_client_map* map);
+
 #endif
 
@@ -31,11 +31,21 @@
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
 #include <guacamole/timestamp.h>
+#include <guacamole/wakeups.h>
 
 #include <pthread.h>
 #include <stdlib.h>
 #include <time.h>
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
 /**
  * Sleep for the given number of milliseconds.
  *
@@ -52,10 +62,101 @@ void __guacdd_sleep(int millis) {
 
 }
 
+/**
+ * Sends a "sync" instruction to the given client and flushes its socket,
+ * noting the time of the sync such that its acknowledgement can be timed.
+ * If sending fails, the client is stopped.
+ *
+ * @param client The client to send the sync to.
+ * @return Zero on success, non-zero if the sync could not be sent.
+ */
+static int __guacd_client_send_sync(guac_client* client) {
+
+    guac_socket* socket = client->socket;
+
+    /* Send sync instruction */
+    client->last_sent_timestamp = guac_timestamp_current();
+    if (guac_protocol_send_sync(socket, client->last_sent_timestamp)) {
+        guacd_client_log_guac_error(client, GUAC_LOG_DEBUG,
+                "Error sending \"sync\" instruction");
+        guac_client_stop(client);
+        return 1;
+    }
+
+    /* Flush */
+    if (guac_socket_flush(socket)) {
+        guacd_client_log_guac_error(client, GUAC_LOG_DEBUG,
+                "Error flushing output");
+        guac_client_stop(client);
+        return 1;
+    }
+
+    /* Time acknowledgement of everything flushed */
+    guac_client_sync_sent(client, client->last_sent_timestamp);
+    return 0;
+
+}
+
+/**
+ * Passes the given instruction, received from the web-client, to the
+ * appropriate handler of the given client. If the handler fails, the client
+ * is stopped.
+ *
+ * @param client The client which received the instruction.
+ * @param instruction The instruction received.
+ * @return Zero on success, non-zero if the handler failed.
+ */
+static int __guacd_client_handle_instruction(guac_client* client,
+        guac_instruction* instruction) {
+
+    /* Reset guac_error and guac_error_message (client handlers are not
+     * guaranteed to set these) */
+    guac_error = GUAC_STATUS_SUCCESS;
+    guac_error_message = NULL;
+
+    /* Call handler, stop on error */
+    if (guac_client_handle_instruction(client, instruction) < 0) {
+
+        /* Log error */
+        guacd_client_log_guac_error(client, GUAC_LOG_WARNING,
+                "Connection aborted");
+
+        /* Log handler details */
+        guac_client_log(client, GUAC_LOG_DEBUG,
+                "Failing instruction handler in client was \"%s\"",
+                instruction->opcode);
+
+        guac_client_stop(client);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Handles the failure of guac_instruction_next() to read an instruction from
+ * the given client, stopping the client with an appropriate status.
+ *
+ * @param client The client whose socket could not be read.
+ */
+static void __guacd_client_read_failed(guac_client* client) {
+
+    if (guac_error == GUAC_STATUS_TIMEOUT)
+        guac_client_abort(client, GUAC_PROTOCOL_STATUS_CLIENT_TIMEOUT, "Client is not responding.");
+
+    else {
+        if (guac_error != GUAC_STATUS_CLOSED)
+            guacd_client_log_guac_error(client, GUAC_LOG_WARNING,
+                    "Guacamole connection failure");
+        guac_client_stop(client);
+    }
+
+}
+
 void* __guacd_client_output_thread(void* data) {
 
     guac_client* client = (guac_client*) data;
-    guac_socket* socket = client->socket;
 
     guac_client_log(client, GUAC_LOG_DEBUG,
             "Starting output thread.");
@@ -63,12 +164,17 @@ void* __guacd_client_output_thread(void* data) {
     /* Guacamole client output loop */
     while (client->state == GUAC_CLIENT_RUNNING) {
 
+        /* Each pass follows a wait for messages, the frame window, or the
+         * next sync ping */
+        guac_wakeups_record();
+
         /* Handle server messages */
         if (client->handle_messages) {
 
-            /* Only handle messages if synced within threshold */
-            if (client->last_sent_timestamp - client->last_received_timestamp
-                    < GUACD_SYNC_THRESHOLD) {
+            /* Only handle messages once the client can accept another
+             * frame */
+            if (guac_client_wait_for_frame_window(client,
+                        GUACD_MESSAGE_HANDLE_FREQUENCY)) {
 
                 int retval = client->handle_messages(client);
                 if (retval) {
@@ -78,29 +184,12 @@ void* __guacd_client_output_thread(void* data) {
                     return NULL;
                 }
 
-                /* Send sync instruction */
-                client->last_sent_timestamp = guac_timestamp_current();
-                if (guac_protocol_send_sync(socket, client->last_sent_timestamp)) {
-                    guacd_client_log_guac_error(client, GUAC_LOG_DEBUG,
-                            "Error sending \"sync\" instruction");
-                    guac_client_stop(client);
-                    return NULL;
-                }
-
-                /* Flush */
-                if (guac_socket_flush(socket)) {
-                    guacd_client_log_guac_error(client, GUAC_LOG_DEBUG,
-                            "Error flushing output");
-                    guac_client_stop(client);
+                /* End frame */
+                if (__guacd_client_send_sync(client))
                     return NULL;
-                }
 
             }
 
-            /* Do not spin while waiting for old sync */
-            else
-                __guacdd_sleep(GUACD_MESSAGE_HANDLE_FREQUENCY);
-
         }
 
         /* If no message handler, just sleep until next sync ping */
@@ -128,64 +217,400 @@ void* __guacd_client_input_thread(void* data) {
     /* Guacamole client input loop */
     while (client->state == GUAC_CLIENT_RUNNING) {
 
-        /* Read instruction */
+        /* Read instruction into the socket's reusable instruction */
         guac_instruction* instruction =
-            guac_instruction_read(socket, GUACD_USEC_TIMEOUT);
+            guac_instruction_next(socket, GUACD_USEC_TIMEOUT);
+        guac_wakeups_record();
 
         /* Stop on error */
+        if (instruction == NULL) {
+            __guacd_client_read_failed(client);
+            return NULL;
+        }
+
+        if (__guacd_client_handle_instruction(client, instruction))
+            return NULL;
+
+    }
+
+    guac_client_log(client, GUAC_LOG_DEBUG,
+            "Input thread terminated.");
+
+    return NULL;
+
+}
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+
+/**
+ * Handles all instructions which can be read from the given client without
+ * blocking.
+ *
+ * @param client The client whose socket is readable.
+ * @param last_input Pointer to the time at which an instruction was last
+ *                   received, which will be updated if any are read.
+ * @return Zero if all available instructions were handled, non-zero if the
+ *         client has been stopped.
+ */
+static int __guacd_client_read_available(guac_client* client,
+        guac_timestamp* last_input) {
+
+    guac_socket* socket = client->socket;
+
+    for (;;) {
+
+        /* Partial instructions are retained until the rest arrives */
+        guac_instruction* instruction = guac_instruction_next(socket, 0);
         if (instruction == NULL) {
 
             if (guac_error == GUAC_STATUS_TIMEOUT)
-                guac_client_abort(client, GUAC_PROTOCOL_STATUS_CLIENT_TIMEOUT, "Client is not responding.");
+                return 0;
 
-            else {
-                if (guac_error != GUAC_STATUS_CLOSED)
-                    guacd_client_log_guac_error(client, GUAC_LOG_WARNING,
-                            "Guacamole connection failure");
-                guac_client_stop(client);
-            }
+            __guacd_client_read_failed(client);
+            return 1;
 
-            return NULL;
         }
 
-        /* Reset guac_error and guac_error_message (client handlers are not
-         * guaranteed to set these) */
-        guac_error = GUAC_STATUS_SUCCESS;
-        guac_error_message = NULL;
+        *last_input = guac_timestamp_current();
 
-        /* Call handler, stop on error */
-        if (guac_client_handle_instruction(client, instruction) < 0) {
+        if (__guacd_client_handle_instruction(client, instruction))
+            return 1;
 
-            /* Log error */
-            guacd_client_log_guac_error(client, GUAC_LOG_WARNING,
-                    "Connection aborted");
+    }
+
+}
+
+/**
+ * Enables or disables notification of readability of each of the given
+ * file descriptors within the given epoll instance. Errors and hangups are
+ * reported regardless.
+ *
+ * @param epoll_fd The epoll instance watching the file descriptors.
+ * @param fds The file descriptors registered by the client.
+ * @param count The number of entries within fds.
+ * @param enabled Non-zero to enable notification, zero to disable.
+ * @return Zero on success, non-zero if epoll_ctl() fails.
+ */
+static int __guacd_client_watch_fds(int epoll_fd, guac_client_fd* fds,
+        int count, int enabled) {
+
+    struct epoll_event event;
+    int i;
+
+    for (i = 0; i < count; i++) {
+
+        event.events = enabled ? EPOLLIN : 0;
+        event.data.u32 = i;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fds[i].fd, &event))
+            return 1;
 
-            /* Log handler details */
-            guac_client_log(client, GUAC_LOG_DEBUG,
-                    "Failing instruction handler in client was \"%s\"",
-                    instruction->opcode);
+    }
+
+    return 0;
 
-            guac_instruction_free(instruction);
+}
+
+/**
+ * Arms the given timer to fire once, after the given number of milliseconds,
+ * or disarms the timer.
+ *
+ * @param timer_fd The timer to arm.
+ * @param msec The number of milliseconds after which the timer should fire,
+ *             zero to fire as soon as possible, or a negative value to
+ *             disarm the timer.
+ * @return Zero on success, non-zero if timerfd_settime() fails.
+ */
+static int __guacd_client_arm_timer(int timer_fd, int msec) {
+
+    struct itimerspec expiry = { { 0, 0 }, { 0, 0 } };
+
+    if (msec < 0)
+        return timerfd_settime(timer_fd, 0, &expiry, NULL);
+
+    expiry.it_value.tv_sec  =  msec / 1000;
+    expiry.it_value.tv_nsec = (msec % 1000) * 1000000L;
+
+    /* An all-zero expiry would disarm the timer */
+    if (msec == 0)
+        expiry.it_value.tv_nsec = 1;
+
+    return timerfd_settime(timer_fd, 0, &expiry, NULL);
+
+}
+
+/**
+ * Handles all I/O of the given client within the current thread, waiting
+ * with epoll for instructions from the web-client, messages on the file
+ * descriptors registered by the client, and two timers. Server messages and
+ * the timer armed by the client itself with guac_client_set_timer() (which
+ * is mirrored by a timerfd) are only watched for while another frame may be
+ * sent. Each batch of server messages completing a frame, and each expiry of
+ * the client timer, is followed by a "sync". Handlers only handle what is
+ * available without blocking, leaving frames which should accumulate further
+ * messages to be completed through the client timer.
+ *
+ * Nothing wakes an idle session other than instructions from the web-client
+ * (which pings periodically) and the timer, which fires only at the
+ * deadline by which the web-client must have sent something. As the
+ * web-client is usually heard from before then, the timer is re-armed
+ * lazily when it fires rather than upon each instruction. Keep-alive pings
+ * are sent by the keep-alive thread shared by all sockets of the process,
+ * and only if nothing else has been sent recently.
+ *
+ * @param client The client to handle.
+ * @param socket_fd The file descriptor of the connection to the web-client.
+ * @param fds The file descriptors registered by the client.
+ * @param fd_count The number of entries within fds.
+ * @return Zero if the client ran until stopped, non-zero if the event loop
+ *         could not be set up.
+ */
+static int __guacd_client_run_events(guac_client* client, int socket_fd,
+        guac_client_fd* fds, int fd_count) {
+
+    struct epoll_event events[GUACD_CLIENT_MAX_EVENTS];
+    struct epoll_event event;
+
+    guac_timestamp last_input = guac_timestamp_current();
+    int watching = 1;
+    int result = -1;
+    int epoll_fd;
+    int timer_fd;
+    int client_timer_fd;
+    int i;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to create epoll instance: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Time out web-client if it sends nothing for too long */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to create timer: %s", strerror(errno));
+        close(epoll_fd);
+        return -1;
+    }
+
+    /* Mirror the timer armed by the client */
+    client_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    if (client_timer_fd < 0) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to create client timer: %s", strerror(errno));
+        close(timer_fd);
+        close(epoll_fd);
+        return -1;
+    }
+
+    if (__guacd_client_arm_timer(timer_fd, GUACD_TIMEOUT)) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to start timer: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    /* Watch web-client, timer, and server */
+    event.events = EPOLLIN;
+
+    event.data.u32 = GUACD_CLIENT_EVENT_INPUT;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &event))
+        goto watch_failed;
+
+    event.data.u32 = GUACD_CLIENT_EVENT_TIMER;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event))
+        goto watch_failed;
+
+    event.data.u32 = GUACD_CLIENT_EVENT_CLIENT_TIMER;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_timer_fd, &event))
+        goto watch_failed;
+
+    for (i = 0; i < fd_count; i++) {
+        event.data.u32 = i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i].fd, &event))
+            goto watch_failed;
+    }
+
+    /* Keep connection alive from the shared keep-alive thread */
+    guac_socket_require_keep_alive(client->socket);
+
+    guac_client_log(client, GUAC_LOG_DEBUG,
+            "Starting event loop for %i server connection(s).", fd_count);
+
+    result = 0;
+    while (client->state == GUAC_CLIENT_RUNNING) {
+
+        int end_frame = 0;
+        int can_send;
+        int count;
+
+        /* Wake for the client timer only while another frame may be sent */
+        if (__guacd_client_arm_timer(client_timer_fd,
+                    watching ? guac_client_get_timer(client) : -1)) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to arm client timer: %s", strerror(errno));
             guac_client_stop(client);
-            return NULL;
+            break;
+        }
+
+        count = epoll_wait(epoll_fd, events, GUACD_CLIENT_MAX_EVENTS, -1);
+        guac_wakeups_record();
+
+        if (count < 0) {
+
+            if (errno == EINTR)
+                continue;
+
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to wait for events: %s", strerror(errno));
+            guac_client_stop(client);
+            break;
+
         }
 
-        /* Free allocated instruction */
-        guac_instruction_free(instruction);
+        for (i = 0; i < count && client->state == GUAC_CLIENT_RUNNING; i++) {
+
+            uint32_t id = events[i].data.u32;
+
+            /* Handle all instructions received */
+            if (id == GUACD_CLIENT_EVENT_INPUT)
+                __guacd_client_read_available(client, &last_input);
+
+            /* Check on web-client once its deadline passes */
+            else if (id == GUACD_CLIENT_EVENT_TIMER) {
+
+                uint64_t expirations;
+                guac_timestamp now = guac_timestamp_current();
+                int remaining = last_input + GUACD_TIMEOUT - now;
+
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0
+                        && errno != EAGAIN)
+                    guac_client_log(client, GUAC_LOG_WARNING,
+                            "Unable to read timer: %s", strerror(errno));
+
+                /* Abort if nothing has been received for too long */
+                if (remaining <= 0) {
+                    guac_client_abort(client,
+                            GUAC_PROTOCOL_STATUS_CLIENT_TIMEOUT,
+                            "Client is not responding.");
+                    break;
+                }
+
+                /* Otherwise, wait until the new deadline */
+                if (__guacd_client_arm_timer(timer_fd, remaining)) {
+                    guac_client_log(client, GUAC_LOG_ERROR,
+                            "Unable to rearm timer: %s", strerror(errno));
+                    guac_client_stop(client);
+                    break;
+                }
+
+            }
+
+            /* The client timer itself is run below, once expired */
+            else if (id == GUACD_CLIENT_EVENT_CLIENT_TIMER) {
+
+                uint64_t expirations;
+
+                if (read(client_timer_fd, &expirations, sizeof(expirations)) < 0
+                        && errno != EAGAIN)
+                    guac_client_log(client, GUAC_LOG_WARNING,
+                            "Unable to read client timer: %s",
+                            strerror(errno));
+
+            }
+
+            /* Handle server messages, ending the frame unless left open */
+            else if (id < (uint32_t) fd_count) {
+
+                int status = fds[id].handler(client, fds[id].fd);
+                if (status < 0) {
+                    guacd_client_log_guac_error(client, GUAC_LOG_DEBUG,
+                            "Error handling server messages");
+                    guac_client_stop(client);
+                    break;
+                }
+
+                if (status != GUAC_CLIENT_FRAME_PENDING)
+                    end_frame = 1;
+
+            }
+
+        }
+
+        if (client->state != GUAC_CLIENT_RUNNING)
+            break;
+
+        /* Run client timer once expired */
+        if (watching && guac_client_get_timer(client) == 0) {
+
+            if (guac_client_run_timer(client)) {
+                guacd_client_log_guac_error(client, GUAC_LOG_DEBUG,
+                        "Error handling client timer");
+                guac_client_stop(client);
+                break;
+            }
+
+            end_frame = 1;
+
+        }
+
+        /* End frame */
+        if (end_frame && __guacd_client_send_sync(client))
+            break;
+
+        /* Only watch server while another frame may be sent, leaving
+         * messages to accumulate until the web-client catches up */
+        can_send = guac_client_can_send_frame(client);
+        if (can_send != watching) {
+
+            if (__guacd_client_watch_fds(epoll_fd, fds, fd_count, can_send)) {
+                guac_client_log(client, GUAC_LOG_ERROR,
+                        "Unable to update watched server connections: %s",
+                        strerror(errno));
+                guac_client_stop(client);
+                break;
+            }
+
+            watching = can_send;
+
+        }
 
     }
 
-    guac_client_log(client, GUAC_LOG_DEBUG,
-            "Input thread terminated.");
+    guac_client_log(client, GUAC_LOG_DEBUG, "Event loop terminated.");
+    goto cleanup;
 
-    return NULL;
+watch_failed:
+    guac_client_log(client, GUAC_LOG_ERROR,
+            "Unable to watch file descriptor: %s", strerror(errno));
+
+cleanup:
+    close(client_timer_fd);
+    close(timer_fd);
+    close(epoll_fd);
+    return result;
 
 }
 
-int guacd_client_start(guac_client* client) {
+#endif
+
+int guacd_client_start(guac_client* client, int fd) {
 
     pthread_t input_thread, output_thread;
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+
+    /* Multiplex all I/O within this thread if the client has registered
+     * its server connections */
+    guac_client_fd fds[GUAC_CLIENT_MAX_FDS];
+    int fd_count = guac_client_get_fds(client, fds, GUAC_CLIENT_MAX_FDS);
+    if (fd_count > 0)
+        return __guacd_client_run_events(client, fd, fds, fd_count);
+
+#endif
+
     if (pthread_create(&output_thread, NULL, __guacd_client_output_thread, (void*) client)) {
         guac_client_log(client, GUAC_LOG_ERROR, "Unable to start output thread");
         return -1;
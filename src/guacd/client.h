@@ -28,14 +28,6 @@
 
 #include <guacamole/client.h>
 
-/**
- * The time to allow between sync responses in milliseconds. If a sync
- * instruction is sent to the client and no response is received within this
- * timeframe, server messages will not be handled until a sync instruction is
- * received from the client.
- */
-#define GUACD_SYNC_THRESHOLD 500
-
 /**
  * The time to allow between server sync messages in milliseconds. A sync
  * message from the server will be sent every GUACD_SYNC_FREQUENCY milliseconds.
@@ -47,10 +39,11 @@
 #define GUACD_SYNC_FREQUENCY 5000
 
 /**
- * The amount of time to wait after handling server messages. If a client
- * plugin has a message handler, and sends instructions when server messages
- * are being handled, there will be a pause of this many milliseconds before
- * the next call to the message handler.
+ * The maximum amount of time to wait, in milliseconds, for the client to
+ * acknowledge enough frames that another may be sent. Server messages are
+ * not handled while the client is this far behind, allowing the server to
+ * combine its changes into fewer, larger updates. The state of the
+ * connection is rechecked after each wait.
  */
 #define GUACD_MESSAGE_HANDLE_FREQUENCY 50
 
@@ -73,7 +66,48 @@
  */
 #define GUACD_CLIENT_MAX_CONNECTIONS 65536
 
-int guacd_client_start(guac_client* client);
+/**
+ * The identifier of events signalling that instructions have been received
+ * from the web-client, when handling a client with epoll. Events of file
+ * descriptors registered by the client are identified by their index, which
+ * is always less than GUAC_CLIENT_MAX_FDS.
+ */
+#define GUACD_CLIENT_EVENT_INPUT GUAC_CLIENT_MAX_FDS
+
+/**
+ * The identifier of events signalling that the timer bounding the time
+ * allowed between instructions from the web-client has fired, when handling
+ * a client with epoll.
+ */
+#define GUACD_CLIENT_EVENT_TIMER (GUAC_CLIENT_MAX_FDS + 1)
+
+/**
+ * The identifier of events signalling that the timer armed by the client
+ * with guac_client_set_timer() has fired, when handling a client with epoll.
+ */
+#define GUACD_CLIENT_EVENT_CLIENT_TIMER (GUAC_CLIENT_MAX_FDS + 2)
+
+/**
+ * The maximum number of events handled per wait when handling a client with
+ * epoll: one for each file descriptor which may be registered by the client,
+ * plus the web-client and both timers.
+ */
+#define GUACD_CLIENT_MAX_EVENTS (GUAC_CLIENT_MAX_FDS + 3)
+
+/**
+ * Handles all I/O of the given client until it stops. If the client has
+ * registered file descriptors with guac_client_add_fd() and epoll is
+ * available, all I/O is handled within the current thread as events arrive.
+ * Otherwise, separate threads read instructions from the web-client and
+ * poll the client for server messages.
+ *
+ * @param client The client to handle.
+ * @param fd The file descriptor of the connection to the web-client, which
+ *           must be the file descriptor underlying the socket of the client.
+ * @return Zero if the client ran until stopped, non-zero if the client could
+ *         not be started.
+ */
+int guacd_client_start(guac_client* client, int fd);
 
 #endif
 
@@ -35,7 +35,7 @@ int guacd_conf_parse_args(guacd_config* config, int argc, char** argv) {
 
     /* Parse arguments */
     int opt;
-    while ((opt = getopt(argc, argv, "l:b:p:L:C:K:f")) != -1) {
+    while ((opt = getopt(argc, argv, "l:b:B:a:p:L:w:C:K:ft")) != -1) {
 
         /* -l: Bind port */
         if (opt == 'l') {
@@ -49,11 +49,42 @@ int guacd_conf_parse_args(guacd_config* config, int argc, char** argv) {
             config->bind_host = strdup(optarg);
         }
 
+        /* -B: Listen backlog */
+        else if (opt == 'B') {
+
+            int backlog = guacd_parse_count(optarg);
+            if (backlog < 1) {
+                fprintf(stderr, "Invalid listen backlog. The backlog must be a positive integer.\n");
+                return 1;
+            }
+
+            config->listen_backlog = backlog;
+
+        }
+
+        /* -a: Number of acceptor processes */
+        else if (opt == 'a') {
+
+            int acceptors = guacd_parse_count(optarg);
+            if (acceptors < 1) {
+                fprintf(stderr, "Invalid number of acceptors. The number of acceptors must be a positive integer.\n");
+                return 1;
+            }
+
+            config->acceptors = acceptors;
+
+        }
+
         /* -f: Run in foreground */
         else if (opt == 'f') {
             config->foreground = 1;
         }
 
+        /* -t: Handle connections with threads */
+        else if (opt == 't') {
+            config->threaded = 1;
+        }
+
         /* -p: PID file */
         else if (opt == 'p') {
             free(config->pidfile);
@@ -74,6 +105,19 @@ int guacd_conf_parse_args(guacd_config* config, int argc, char** argv) {
 
         }
 
+        /* -w: Number of pre-forked workers */
+        else if (opt == 'w') {
+
+            int workers = guacd_parse_count(optarg);
+            if (workers < 0) {
+                fprintf(stderr, "Invalid number of pre-forked workers. The number of workers must be zero or a positive integer.\n");
+                return 1;
+            }
+
+            config->prefork_workers = workers;
+
+        }
+
 #ifdef ENABLE_SSL
         /* -C SSL certificate */
         else if (opt == 'C') {
@@ -102,13 +146,17 @@ int guacd_conf_parse_args(guacd_config* config, int argc, char** argv) {
             fprintf(stderr, "USAGE: %s"
                     " [-l LISTENPORT]"
                     " [-b LISTENADDRESS]"
+                    " [-B BACKLOG]"
+                    " [-a ACCEPTORS]"
                     " [-p PIDFILE]"
                     " [-L LEVEL]"
+                    " [-w WORKERS]"
 #ifdef ENABLE_SSL
                     " [-C CERTIFICATE_FILE]"
                     " [-K PEM_FILE]"
 #endif
-                    " [-f]\n", argv[0]);
+                    " [-f]"
+                    " [-t]\n", argv[0]);
 
             return 1;
         }
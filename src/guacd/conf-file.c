@@ -62,6 +62,38 @@ static int guacd_conf_callback(const char* section, const char* param, const cha
             return 0;
         }
 
+        /* Listen backlog */
+        else if (strcmp(param, "listen_backlog") == 0) {
+
+            int backlog = guacd_parse_count(value);
+
+            /* Invalid backlog */
+            if (backlog < 1) {
+                guacd_conf_parse_error = "The listen backlog must be a positive integer.";
+                return 1;
+            }
+
+            config->listen_backlog = backlog;
+            return 0;
+
+        }
+
+        /* Number of acceptor processes */
+        else if (strcmp(param, "acceptors") == 0) {
+
+            int acceptors = guacd_parse_count(value);
+
+            /* Invalid acceptor count */
+            if (acceptors < 1) {
+                guacd_conf_parse_error = "The number of acceptors must be a positive integer.";
+                return 1;
+            }
+
+            config->acceptors = acceptors;
+            return 0;
+
+        }
+
     }
 
     /* Options related to daemon startup */
@@ -91,6 +123,52 @@ static int guacd_conf_callback(const char* section, const char* param, const cha
 
         }
 
+        /* Number of pre-forked worker processes */
+        else if (strcmp(param, "prefork_workers") == 0) {
+
+            int workers = guacd_parse_count(value);
+
+            /* Invalid worker count */
+            if (workers < 0) {
+                guacd_conf_parse_error = "The number of pre-forked workers must be zero or a positive integer.";
+                return 1;
+            }
+
+            config->prefork_workers = workers;
+            return 0;
+
+        }
+
+        /* Handle connections with threads */
+        else if (strcmp(param, "threaded") == 0) {
+
+            int threaded = guacd_parse_boolean(value);
+
+            /* Invalid boolean */
+            if (threaded < 0) {
+                guacd_conf_parse_error = "The value of \"threaded\" must be \"true\" or \"false\".";
+                return 1;
+            }
+
+            config->threaded = threaded;
+            return 0;
+
+        }
+
+        /* Protocols to preload */
+        else if (strcmp(param, "preload_protocols") == 0) {
+            free(config->preload_protocols);
+            config->preload_protocols = strdup(value);
+            return 0;
+        }
+
+        /* Directory of surface traces */
+        else if (strcmp(param, "trace_directory") == 0) {
+            free(config->trace_directory);
+            config->trace_directory = strdup(value);
+            return 0;
+        }
+
     }
 
     /* SSL-specific options */
@@ -180,8 +258,14 @@ guacd_config* guacd_conf_load() {
     /* Load defaults */
     conf->bind_host = NULL;
     conf->bind_port = strdup("4822");
+    conf->listen_backlog = GUACD_DEFAULT_LISTEN_BACKLOG;
+    conf->acceptors = 1;
     conf->pidfile = NULL;
     conf->foreground = 0;
+    conf->prefork_workers = 0;
+    conf->threaded = 0;
+    conf->preload_protocols = NULL;
+    conf->trace_directory = NULL;
     conf->max_log_level = GUAC_LOG_INFO;
 
 #ifdef ENABLE_SSL
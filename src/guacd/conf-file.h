@@ -27,6 +27,12 @@
 
 #include <guacamole/client.h>
 
+/**
+ * The default maximum number of pending connections which may be queued on
+ * the listening socket before further connections are refused.
+ */
+#define GUACD_DEFAULT_LISTEN_BACKLOG 128
+
 /**
  * The contents of a guacd configuration file.
  */
@@ -42,6 +48,20 @@ typedef struct guacd_config {
      */
     char* bind_port;
 
+    /**
+     * The maximum number of pending connections to queue on the listening
+     * socket.
+     */
+    int listen_backlog;
+
+    /**
+     * The number of processes accepting connections. If greater than one,
+     * each acceptor listens on its own sockets, sharing the bound address
+     * with the other acceptors, and the kernel distributes connections among
+     * them.
+     */
+    int acceptors;
+
     /**
      * The file to write the PID in, if any.
      */
@@ -52,6 +72,34 @@ typedef struct guacd_config {
      */
     int foreground;
 
+    /**
+     * The number of worker processes to fork in advance of connections, or
+     * zero if a new process should be forked for each connection as it is
+     * accepted.
+     */
+    int prefork_workers;
+
+    /**
+     * Whether connections should be handled by threads sharing a process,
+     * rather than each by a process of its own. If workers are pre-forked,
+     * connections are shared among those workers, otherwise all connections
+     * are handled within the daemon process itself.
+     */
+    int threaded;
+
+    /**
+     * Comma-separated list of the protocols whose plugins should be loaded
+     * before any connections are accepted, or NULL if plugins should be
+     * loaded only as each connection requires them.
+     */
+    char* preload_protocols;
+
+    /**
+     * The directory within which connections may record surface traces, or
+     * NULL if surface traces may not be recorded.
+     */
+    char* trace_directory;
+
 #ifdef ENABLE_SSL
     /**
      * SSL certificate file.
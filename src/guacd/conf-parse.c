@@ -27,6 +27,9 @@
 #include <guacamole/client.h>
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 /*
@@ -536,3 +539,33 @@ int guacd_parse_log_level(const char* name) {
 
 }
 
+int guacd_parse_count(const char* value) {
+
+    char* end;
+    long count;
+
+    /* Only plain decimal digits are accepted */
+    if (!isdigit((unsigned char) *value))
+        return -1;
+
+    errno = 0;
+    count = strtol(value, &end, 10);
+
+    /* Reject trailing garbage and values which do not fit */
+    if (*end != '\0' || errno == ERANGE || count > INT_MAX)
+        return -1;
+
+    return count;
+
+}
+
+int guacd_parse_boolean(const char* value) {
+
+    if (strcmp(value, "true")  == 0) return 1;
+    if (strcmp(value, "false") == 0) return 0;
+
+    /* Neither true nor false */
+    return -1;
+
+}
+
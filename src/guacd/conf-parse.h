@@ -56,6 +56,19 @@ int guacd_parse_conf(guacd_param_callback* callback, char* buffer, int length, v
  */
 int guacd_parse_log_level(const char* name);
 
+/**
+ * Parses the given string as a non-negative decimal integer, returning the
+ * corresponding value, or -1 if the string is not such an integer or is too
+ * large to be represented.
+ */
+int guacd_parse_count(const char* value);
+
+/**
+ * Parses the given string as a boolean, returning 1 for "true", 0 for
+ * "false", or -1 if the string is neither.
+ */
+int guacd_parse_boolean(const char* value);
+
 /**
  * Human-readable description of the current error, if any.
  */
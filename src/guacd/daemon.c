@@ -22,11 +22,15 @@
 
 #include "config.h"
 
+#include "accept-stats.h"
 #include "client.h"
 #include "client-map.h"
 #include "conf-args.h"
 #include "conf-file.h"
+#include "latency.h"
+#include "listener.h"
 #include "log.h"
+#include "worker-pool.h"
 
 #include <guacamole/client.h>
 #include <guacamole/error.h>
@@ -34,6 +38,8 @@
 #include <guacamole/plugin.h>
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+#include <guacamole/wakeups.h>
 
 #ifdef ENABLE_SSL
 #include <openssl/ssl.h>
@@ -42,9 +48,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <libgen.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -53,11 +62,83 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define GUACD_DEV_NULL "/dev/null"
 #define GUACD_ROOT     "/"
 
+/**
+ * The minimum time an acceptor process must run, in milliseconds, before it
+ * will be replaced if it exits. Acceptors exiting sooner are assumed to be
+ * unable to start at all.
+ */
+#define GUACD_ACCEPTOR_MIN_LIFETIME 1000
+
+/**
+ * The listening sockets of the current acceptor process.
+ */
+static int guacd_listener_fds[GUACD_MAX_LISTENERS];
+
+/**
+ * The number of entries within guacd_listener_fds.
+ */
+static int guacd_listener_count = 0;
+
+/**
+ * State shared by every process handling a connection accepted by guacd.
+ */
+typedef struct guacd_connection_context {
+
+    /**
+     * The map of all connections, indexed by connection ID.
+     */
+    guacd_client_map* map;
+
+#ifdef ENABLE_SSL
+    /**
+     * The SSL context to use for accepted connections, or NULL if SSL/TLS is
+     * not required.
+     */
+    SSL_CTX* ssl_context;
+#endif
+
+    /**
+     * The write end of the pipe over which connect times are reported to
+     * the guacd parent process.
+     */
+    int latency_fd;
+
+    /**
+     * The directory within which connections may record surface traces, or
+     * NULL if surface traces may not be recorded.
+     */
+    const char* trace_directory;
+
+} guacd_connection_context;
+
+/**
+ * An accepted connection which is to be handled by a new thread.
+ */
+typedef struct guacd_connection_thread_params {
+
+    /**
+     * State shared by all connections handled within this process.
+     */
+    guacd_connection_context* context;
+
+    /**
+     * The file descriptor of the accepted connection.
+     */
+    int fd;
+
+    /**
+     * The time at which the connection was accepted.
+     */
+    guac_timestamp accepted;
+
+} guacd_connection_thread_params;
+
 /**
  * Logs a reasonable explanatory message regarding handshake failure based on
  * the current value of guac_error.
@@ -80,10 +161,125 @@ static void guacd_log_handshake_failure() {
 }
 
 /**
- * Creates a new guac_client for the connection on the given socket, adding
- * it to the client map based on its ID.
+ * Logs statistics describing how the locks of the given socket were used
+ * over the life of the connection.
+ */
+static void guacd_log_socket_lock_stats(guac_socket* socket) {
+
+    guac_socket_lock_stats stats;
+    guac_socket_get_lock_stats(socket, &stats);
+
+    guacd_log(GUAC_LOG_DEBUG, "Socket locks acquired %" PRIu64 " times "
+            "(%" PRIu64 " contended), held for %" PRIu64 " us total "
+            "(%" PRIu64 " us max). %" PRIu64 " instructions staged, "
+            "%" PRIu64 " spilled.",
+            stats.acquisitions, stats.contended,
+            stats.hold_time / 1000, stats.max_hold_time / 1000,
+            stats.staged_instructions, stats.spilled_instructions);
+
+}
+
+/**
+ * Logs statistics describing the images encoded and sent over the given
+ * socket over the life of the connection, if any.
  */
-static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket) {
+static void guacd_log_socket_image_stats(guac_socket* socket) {
+
+    guac_socket_image_stats stats;
+    guac_socket_get_image_stats(socket, &stats);
+
+    if (stats.png_images > 0)
+        guacd_log(GUAC_LOG_DEBUG, "Sent %" PRIu64 " PNG images (%" PRIu64 " "
+                "bytes) in %" PRIu64 " us.", stats.png_images,
+                stats.png_bytes, stats.png_time);
+
+    if (stats.jpeg_images > 0)
+        guacd_log(GUAC_LOG_DEBUG, "Sent %" PRIu64 " JPEG images (%" PRIu64 " "
+                "bytes) in %" PRIu64 " us, saving an estimated %" PRId64 " "
+                "bytes.", stats.jpeg_images, stats.jpeg_bytes,
+                stats.jpeg_time, stats.jpeg_bytes_saved);
+
+    if (stats.streamed_images > 0)
+        guacd_log(GUAC_LOG_DEBUG, "Streamed %" PRIu64 " images. First blob "
+                "sent after %" PRIu64 " us on average (%" PRIu64 " us max).",
+                stats.streamed_images,
+                stats.first_blob_time / stats.streamed_images,
+                stats.max_first_blob_time);
+
+}
+
+/**
+ * Logs statistics describing the number of instructions of each opcode
+ * handled by the given client, and the time spent handling them, if handler
+ * timing was enabled.
+ */
+static void guacd_log_client_handler_stats(guac_client* client) {
+
+    guac_client_handler_stats stats[GUAC_CLIENT_INSTRUCTION_HANDLERS];
+    int count = guac_client_get_handler_stats(client, stats,
+            GUAC_CLIENT_INSTRUCTION_HANDLERS);
+    int i;
+
+    for (i = 0; i < count; i++)
+        guacd_log(GUAC_LOG_DEBUG, "Handled %" PRIu64 " \"%s\" instructions "
+                "in %" PRIu64 " us total (%" PRIu64 " us max).",
+                stats[i].count, stats[i].opcode, stats[i].total_time / 1000,
+                stats[i].max_time / 1000);
+
+}
+
+/**
+ * Logs the estimated round-trip time and bandwidth of the connection of the
+ * given client, as measured through acknowledgement of "sync" instructions.
+ */
+static void guacd_log_client_link_stats(guac_client* client) {
+
+    guac_client_link_stats stats;
+    guac_client_get_link_stats(client, &stats);
+
+    if (stats.syncs == 0)
+        return;
+
+    guacd_log(GUAC_LOG_DEBUG, "Link: %" PRIu64 " syncs acknowledged, "
+            "round trip %i ms (%i ms min), bandwidth %i kbit/s "
+            "(%" PRIu64 " samples), window of %i frames (%i ms each).",
+            stats.syncs, stats.rtt, stats.min_rtt, stats.bandwidth / 125,
+            stats.bandwidth_samples, stats.frame_window,
+            stats.frame_interval);
+
+}
+
+/**
+ * Logs the rate at which the threads of the current process have been
+ * woken, such that the cost of idle connections can be seen.
+ */
+static void guacd_log_wakeups() {
+
+    int seconds;
+    double rate = guac_wakeups_get_rate(&seconds);
+
+    guacd_log(GUAC_LOG_DEBUG, "Process woke %.2f times per second over the "
+            "last %i seconds (%" PRIu64 " wakeups total).", rate, seconds,
+            guac_wakeups_get_total());
+
+}
+
+/**
+ * Creates a new guac_client for the connection on the given socket, whose
+ * underlying file descriptor is given, adding it to the client map based on
+ * its ID. The time taken for the connection to become ready, measured from
+ * the given accept time, is reported to the parent process, and the time
+ * taken by each phase of the handshake is logged at the debug level.
+ */
+static void guacd_handle_connection(guacd_connection_context* context,
+        guac_socket* socket, int fd, guac_timestamp accepted) {
+
+    /* Time at which each phase of the handshake completed */
+    guac_timestamp started = guac_timestamp_current();
+    guac_timestamp selected;
+    guac_timestamp loaded;
+    guac_timestamp negotiated;
+    guac_timestamp initialized;
 
     guac_client* client;
     guac_client_plugin* plugin;
@@ -100,6 +296,7 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
 
     /* Get protocol from select instruction */
     select = guac_instruction_expect(socket, GUACD_USEC_TIMEOUT, "select");
+    selected = guac_timestamp_current();
     if (select == NULL) {
 
         /* Log error */
@@ -122,6 +319,7 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
                 select->argc);
 
         /* Free resources */
+        guac_instruction_free(select);
         guac_socket_free(socket);
         return;
     }
@@ -131,6 +329,7 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
     /* Get plugin from protocol in select */
     plugin = guac_client_plugin_open(select->argv[0]);
     guac_instruction_free(select);
+    loaded = guac_timestamp_current();
 
     if (plugin == NULL) {
 
@@ -173,6 +372,10 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
         guacd_log_guac_error(GUAC_LOG_DEBUG, "Error reading \"size\"");
 
         /* Free resources */
+        if (guac_client_plugin_close(plugin))
+            guacd_log_guac_error(GUAC_LOG_WARNING,
+                    "Unable to close client plugin");
+
         guac_socket_free(socket);
         return;
     }
@@ -187,6 +390,11 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
         guacd_log_guac_error(GUAC_LOG_DEBUG, "Error reading \"audio\"");
 
         /* Free resources */
+        guac_instruction_free(size);
+        if (guac_client_plugin_close(plugin))
+            guacd_log_guac_error(GUAC_LOG_WARNING,
+                    "Unable to close client plugin");
+
         guac_socket_free(socket);
         return;
     }
@@ -201,6 +409,12 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
         guacd_log_guac_error(GUAC_LOG_DEBUG, "Error reading \"video\"");
 
         /* Free resources */
+        guac_instruction_free(size);
+        guac_instruction_free(audio);
+        if (guac_client_plugin_close(plugin))
+            guacd_log_guac_error(GUAC_LOG_WARNING,
+                    "Unable to close client plugin");
+
         guac_socket_free(socket);
         return;
     }
@@ -214,6 +428,11 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
         guacd_log_handshake_failure();
         guacd_log_guac_error(GUAC_LOG_DEBUG, "Error reading \"connect\"");
 
+        /* Free resources */
+        guac_instruction_free(size);
+        guac_instruction_free(audio);
+        guac_instruction_free(video);
+
         if (guac_client_plugin_close(plugin))
             guacd_log_guac_error(GUAC_LOG_WARNING,
                     "Unable to close client plugin");
@@ -222,16 +441,31 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
         return;
     }
 
+    negotiated = guac_timestamp_current();
+
     /* Get client */
     client = guac_client_alloc();
     if (client == NULL) {
         guacd_log_guac_error(GUAC_LOG_ERROR, "Unable to create client");
+        guac_instruction_free(connect);
+        guac_instruction_free(size);
+        guac_instruction_free(audio);
+        guac_instruction_free(video);
+        if (guac_client_plugin_close(plugin))
+            guacd_log_guac_error(GUAC_LOG_WARNING,
+                    "Unable to close client plugin");
+
         guac_socket_free(socket);
         return;
     }
 
     client->socket = socket;
     client->log_handler = guacd_client_log;
+    client->trace_directory = context->trace_directory;
+
+    /* Time instruction handlers only if the results will be logged */
+    if (guacd_log_level >= GUAC_LOG_DEBUG)
+        guac_client_set_handler_timing(client, 1);
 
     /* Parse optimal screen dimensions from size instruction */
     client->info.optimal_width  = atoi(size->argv[0]);
@@ -258,12 +492,13 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
     client->info.video_mimetypes[video->argc] = NULL;
 
     /* Store client */
-    if (guacd_client_map_add(map, client))
+    if (guacd_client_map_add(context->map, client))
         guacd_log(GUAC_LOG_ERROR, "Unable to add client. Internal client storage has failed");
 
     /* Send connection ID */
     guacd_log(GUAC_LOG_INFO, "Connection ID is \"%s\"", client->connection_id);
     guac_protocol_send_ready(socket, client->connection_id);
+    guacd_latency_report(context->latency_fd, accepted);
 
     /* Init client */
     init_result = guac_client_plugin_init_client(plugin,
@@ -274,8 +509,16 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
     /* If client could not be started, free everything and fail */
     if (init_result) {
 
+        guacd_client_map_remove(context->map, client->connection_id);
+
+        free(client->info.audio_mimetypes);
+        free(client->info.video_mimetypes);
         guac_client_free(client);
 
+        guac_instruction_free(audio);
+        guac_instruction_free(video);
+        guac_instruction_free(size);
+
         guacd_log_guac_error(GUAC_LOG_INFO, "Connection did not succeed");
 
         if (guac_client_plugin_close(plugin))
@@ -286,17 +529,29 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
         return;
     }
 
+    initialized = guac_timestamp_current();
+    guacd_log(GUAC_LOG_DEBUG, "Handshake took %i ms: %i ms until "
+            "handling began, %i ms awaiting \"select\", %i ms loading plugin, "
+            "%i ms negotiating arguments, %i ms initializing client.",
+            (int) (initialized - accepted),
+            (int) (started - accepted), (int) (selected - started),
+            (int) (loaded - selected), (int) (negotiated - loaded),
+            (int) (initialized - negotiated));
+
     /* Start client threads */
     guacd_log(GUAC_LOG_INFO, "Starting client");
-    if (guacd_client_start(client))
+    if (guacd_client_start(client, fd))
         guacd_log(GUAC_LOG_WARNING, "Client finished abnormally");
     else
         guacd_log(GUAC_LOG_INFO, "Client disconnected");
 
     /* Remove client */
-    if (guacd_client_map_remove(map, client->connection_id) == NULL)
+    if (guacd_client_map_remove(context->map, client->connection_id) == NULL)
         guacd_log(GUAC_LOG_ERROR, "Unable to remove client. Internal client storage has failed");
 
+    guacd_log(GUAC_LOG_DEBUG, "%i other connections remain active within "
+            "this process.", guacd_client_map_count(context->map));
+
     /* Free mimetype lists */
     free(client->info.audio_mimetypes);
     free(client->info.video_mimetypes);
@@ -306,17 +561,186 @@ static void guacd_handle_connection(guacd_client_map* map, guac_socket* socket)
     guac_instruction_free(video);
     guac_instruction_free(size);
 
+    /* Log handler latency for sake of tuning */
+    guacd_log_client_handler_stats(client);
+    guacd_log_client_link_stats(client);
+    guacd_log_wakeups();
+
     /* Clean up */
     guac_client_free(client);
     if (guac_client_plugin_close(plugin))
         guacd_log_guac_error(GUAC_LOG_WARNING,
                 "Unable to close client plugin");
 
+    /* Log lock usage and image encoding for sake of tuning */
+    guacd_log_socket_lock_stats(socket);
+    guacd_log_socket_image_stats(socket);
+
     /* Close socket */
     guac_socket_free(socket);
 
 }
 
+/**
+ * Handles the accepted connection having the given file descriptor within
+ * the current process, which must be a child of the guacd parent. This
+ * function matches the signature of guacd_worker_handler.
+ *
+ * @param fd The file descriptor of the accepted connection.
+ * @param accepted The time at which the connection was accepted.
+ * @param data The guacd_connection_context shared by all connections.
+ */
+static void guacd_handle_accepted(int fd, guac_timestamp accepted,
+        void* data) {
+
+    guacd_connection_context* context = (guacd_connection_context*) data;
+    guac_socket* socket;
+
+#ifdef ENABLE_SSL
+
+    /* If SSL chosen, use it */
+    if (context->ssl_context != NULL) {
+        socket = guac_socket_open_secure(context->ssl_context, fd);
+        if (socket == NULL) {
+            guacd_log_guac_error(GUAC_LOG_ERROR,
+                    "Unable to set up SSL/TLS");
+            close(fd);
+            return;
+        }
+    }
+    else
+        socket = guac_socket_open(fd);
+#else
+    /* Open guac_socket */
+    socket = guac_socket_open(fd);
+#endif
+
+    /* Send large payloads without copying through the buffer */
+    guac_socket_require_writev(socket);
+
+    /* Build instructions within per-thread buffers, such that
+     * threads of the client plugin need not wait for each other */
+    guac_socket_require_staging(socket);
+
+    guacd_handle_connection(context, socket, fd, accepted);
+    close(fd);
+
+}
+
+/**
+ * Loads the plugin of each protocol within the given comma-separated list,
+ * allowing each to initialize any state shared by all of its clients. The
+ * plugins remain loaded for the life of the process, such that processes
+ * forked to handle connections inherit them fully initialized.
+ *
+ * @param protocols A comma-separated list of protocol names.
+ */
+static void guacd_preload_protocols(const char* protocols) {
+
+    char* list = strdup(protocols);
+    char* saveptr;
+    char* protocol;
+
+#ifdef ENABLE_SSL
+    /* Plugins share the OpenSSL state of the daemon */
+    SSL_library_init();
+    SSL_load_error_strings();
+#endif
+
+    for (protocol = strtok_r(list, ", \t", &saveptr); protocol != NULL;
+            protocol = strtok_r(NULL, ", \t", &saveptr)) {
+
+        guac_timestamp start = guac_timestamp_current();
+
+        /* Load plugin, never to be closed */
+        guac_client_plugin* plugin = guac_client_plugin_open(protocol);
+        if (plugin == NULL) {
+            guacd_log_guac_error(GUAC_LOG_WARNING,
+                    "Unable to preload client plugin");
+            continue;
+        }
+
+        if (guac_client_plugin_preload(plugin))
+            guacd_log(GUAC_LOG_WARNING, "Plugin for protocol \"%s\" could "
+                    "not initialize its shared state in advance.", protocol);
+
+        guacd_log(GUAC_LOG_INFO, "Preloaded support for protocol \"%s\" in "
+                "%i ms.", protocol, (int) (guac_timestamp_current() - start));
+
+    }
+
+    free(list);
+
+}
+
+/**
+ * Handles the accepted connection described by the given
+ * guacd_connection_thread_params, freeing those parameters when done. This
+ * function is the entry point of each connection thread.
+ *
+ * @param data The guacd_connection_thread_params describing the connection.
+ * @return Always NULL.
+ */
+static void* guacd_connection_thread(void* data) {
+
+    guacd_connection_thread_params* params =
+        (guacd_connection_thread_params*) data;
+
+    guacd_handle_accepted(params->fd, params->accepted, params->context);
+
+    free(params);
+    return NULL;
+
+}
+
+/**
+ * Handles the accepted connection having the given file descriptor within a
+ * new detached thread of the current process, returning immediately. This
+ * function matches the signature of guacd_worker_handler.
+ *
+ * @param fd The file descriptor of the accepted connection.
+ * @param accepted The time at which the connection was accepted.
+ * @param data The guacd_connection_context shared by all connections.
+ */
+static void guacd_handle_accepted_threaded(int fd, guac_timestamp accepted,
+        void* data) {
+
+    guacd_connection_thread_params* params =
+        malloc(sizeof(guacd_connection_thread_params));
+
+    pthread_attr_t attributes;
+    pthread_t thread;
+    int result;
+
+    if (params == NULL) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to allocate connection thread "
+                "parameters. Dropping connection.");
+        close(fd);
+        return;
+    }
+
+    params->context = (guacd_connection_context*) data;
+    params->fd = fd;
+    params->accepted = accepted;
+
+    /* Connection threads are never joined */
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+    result = pthread_create(&thread, &attributes, guacd_connection_thread,
+            params);
+
+    pthread_attr_destroy(&attributes);
+
+    if (result) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to start connection thread: %s",
+                strerror(result));
+        close(fd);
+        free(params);
+    }
+
+}
+
 int redirect_fd(int fd, int flags) {
 
     /* Attempt to open bit bucket */
@@ -392,115 +816,481 @@ int daemonize() {
 
 }
 
-int main(int argc, char* argv[]) {
-
-    /* Server */
-    int socket_fd;
-    struct addrinfo* addresses;
-    struct addrinfo* current_address;
-    char bound_address[1024];
-    char bound_port[64];
-    int opt_on = 1;
-
-    struct addrinfo hints = {
-        .ai_family   = AF_UNSPEC,
-        .ai_socktype = SOCK_STREAM,
-        .ai_protocol = IPPROTO_TCP
-    };
+/**
+ * Accepts a connection on the given listening socket, handing it to a
+ * pre-forked worker, a new thread, or a new process, depending on the
+ * configuration. If the connection is handled by a new process, that process
+ * exits once the connection is closed, and this function never returns
+ * within it.
+ *
+ * @param config The configuration of guacd.
+ * @param context The state shared by all connections.
+ * @param pool The pool of pre-forked workers, or NULL if workers are not
+ *             forked in advance.
+ * @param stats The accept counters of the current acceptor.
+ * @param socket_fd The listening socket on which a connection is waiting.
+ * @return Zero if the connection was accepted, non-zero otherwise.
+ */
+static int guacd_accept_connection(guacd_config* config,
+        guacd_connection_context* context, guacd_worker_pool* pool,
+        guacd_accept_stats* stats, int socket_fd) {
 
-    /* Client */
-    struct sockaddr_in client_addr;
+    struct sockaddr_storage client_addr;
     socklen_t client_addr_len;
     int connected_socket_fd;
+    guac_timestamp accepted;
+    pid_t child_pid;
 
-#ifdef ENABLE_SSL
-    SSL_CTX* ssl_context = NULL;
-#endif
+    /* Accept connection */
+    client_addr_len = sizeof(client_addr);
+    connected_socket_fd = accept(socket_fd,
+            (struct sockaddr*) &client_addr, &client_addr_len);
 
-    guacd_client_map* map = guacd_client_map_alloc();
+    if (connected_socket_fd < 0) {
+        guacd_log(GUAC_LOG_ERROR, "Could not accept client connection: %s",
+                strerror(errno));
+        return 1;
+    }
 
-    /* General */
-    int retval;
+    accepted = guac_timestamp_current();
+    guacd_accept_stats_record(stats, socket_fd);
 
-    /* Load configuration */
-    guacd_config* config = guacd_conf_load();
-    if (config == NULL || guacd_conf_parse_args(config, argc, argv))
-       exit(EXIT_FAILURE);
+    /* Hand connection to a waiting worker, if any, replacing that worker
+     * only once the connection is on its way */
+    if (pool != NULL) {
 
-    /* Init logging as early as possible */
-    guacd_log_level = config->max_log_level;
-    openlog(GUACD_LOG_NAME, LOG_PID, LOG_DAEMON);
+        int dispatched = !guacd_worker_pool_dispatch(pool,
+                connected_socket_fd, accepted);
 
-    /* Log start */
-    guacd_log(GUAC_LOG_INFO, "Guacamole proxy daemon (guacd) version " VERSION " started");
+        if (dispatched) {
 
-    /* Get addresses for binding */
-    if ((retval = getaddrinfo(config->bind_host, config->bind_port,
-                    &hints, &addresses))) {
+            if (close(connected_socket_fd) < 0)
+                guacd_log(GUAC_LOG_ERROR, "Error closing daemon reference "
+                        "to worker descriptor: %s", strerror(errno));
 
-        guacd_log(GUAC_LOG_ERROR, "Error parsing given address or port: %s",
-                gai_strerror(retval));
-        exit(EXIT_FAILURE);
+            guacd_worker_pool_fill(pool);
+            return 0;
+
+        }
+
+        guacd_log(GUAC_LOG_WARNING, "No pre-forked worker available. "
+                "Forking a new process for this connection.");
 
     }
 
-    /* Get socket */
-    socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socket_fd < 0) {
-        guacd_log(GUAC_LOG_ERROR, "Error opening socket: %s", strerror(errno));
-        exit(EXIT_FAILURE);
+    /* Handle connection within a new thread of this process if threaded
+     * without workers */
+    else if (config->threaded) {
+        guacd_handle_accepted_threaded(connected_socket_fd, accepted,
+                context);
+        return 0;
+    }
+
+    /* 
+     * Once connection is accepted, send child into background.
+     *
+     * Note that we prefer fork() over threads for connection-handling
+     * processes as they give each connection its own memory area, and
+     * isolate the main daemon and other connections from errors in any
+     * particular client plugin.
+     */
+
+    child_pid = fork();
+
+    /* If error, log */
+    if (child_pid == -1)
+        guacd_log(GUAC_LOG_ERROR, "Error forking child process: %s", strerror(errno));
+
+    /* If child, start client, and exit when finished */
+    else if (child_pid == 0) {
+
+        /* Idle workers must see their channels close with the daemon */
+        if (pool != NULL)
+            guacd_worker_pool_close_channels(pool);
+
+        guacd_handle_accepted(connected_socket_fd, accepted, context);
+        exit(EXIT_SUCCESS);
+
+    }
+
+    /* If parent, close reference to child's descriptor */
+    else if (close(connected_socket_fd) < 0) {
+        guacd_log(GUAC_LOG_ERROR, "Error closing daemon reference to "
+                "child descriptor: %s", strerror(errno));
+    }
+
+    /* Replace any workers lost to failed dispatch */
+    if (pool != NULL)
+        guacd_worker_pool_fill(pool);
+
+    return 0;
+
+}
+
+/**
+ * Closes the listening sockets of the current acceptor within a newly-forked
+ * child. Were children to hold these sockets open, connections could be
+ * queued on the sockets of an acceptor long after it has exited.
+ */
+static void guacd_close_listeners() {
+
+    int i;
+
+    for (i = 0; i < guacd_listener_count; i++)
+        close(guacd_listener_fds[i]);
+
+    guacd_listener_count = 0;
+
+}
+
+/**
+ * Accepts connections on the given listening sockets until an error occurs,
+ * forking any workers required by the configuration beforehand.
+ *
+ * @param config The configuration of guacd.
+ * @param context The state shared by all connections.
+ * @param listener_fds The listening sockets to accept connections from.
+ * @param listener_count The number of listening sockets.
+ * @return The exit status of the acceptor.
+ */
+static int guacd_run_acceptor(guacd_config* config,
+        guacd_connection_context* context, int* listener_fds,
+        int listener_count) {
+
+    /* Connect times */
+    int latency_pipe[2];
+    guacd_latency_stats latency_stats = { .count = 0 };
+    const char* mode;
+
+    /* Accept rate and queue lengths */
+    guacd_accept_stats accept_stats;
+
+    /* Pre-forked workers, if enabled */
+    guacd_worker_pool* pool = NULL;
+
+    int i;
+
+    /* Ignore SIGCHLD (force automatic removal of children) */
+    if (signal(SIGCHLD, SIG_IGN) == SIG_ERR) {
+        guacd_log(GUAC_LOG_INFO, "Could not set handler for SIGCHLD to ignore. "
+                "Child processes may pile up in the process table.");
     }
 
-    /* Allow socket reuse */
-    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR,
-                (void*) &opt_on, sizeof(opt_on))) {
-        guacd_log(GUAC_LOG_WARNING, "Unable to set socket options for reuse: %s",
+    /* Children report connect times to the daemon without ever blocking */
+    if (pipe(latency_pipe)
+            || fcntl(latency_pipe[0], F_SETFL, O_NONBLOCK)
+            || fcntl(latency_pipe[1], F_SETFL, O_NONBLOCK)) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to create pipe for connect times: %s",
                 strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    context->latency_fd = latency_pipe[1];
+
+    /* Workers and connection processes never accept */
+    memcpy(guacd_listener_fds, listener_fds, sizeof(int) * listener_count);
+    guacd_listener_count = listener_count;
+    pthread_atfork(NULL, NULL, guacd_close_listeners);
+
+    /* Fork workers in advance of connections, if requested, each handling
+     * many connections with threads if threaded */
+    if (config->prefork_workers > 0 && config->threaded) {
+        guacd_log(GUAC_LOG_INFO, "Forking %i worker processes, each handling "
+                "many connections as threads.", config->prefork_workers);
+        pool = guacd_worker_pool_alloc(config->prefork_workers, 1,
+                guacd_handle_accepted_threaded, context);
+        mode = "threads within workers";
+    }
+
+    /* Otherwise fork one worker per future connection */
+    else if (config->prefork_workers > 0) {
+        guacd_log(GUAC_LOG_INFO, "Pre-forking %i worker processes.",
+                config->prefork_workers);
+        pool = guacd_worker_pool_alloc(config->prefork_workers, 0,
+                guacd_handle_accepted, context);
+        mode = "pre-forked";
+    }
+
+    /* Without workers, threads run within the daemon itself */
+    else if (config->threaded) {
+        guacd_log(GUAC_LOG_INFO, "Handling connections as threads of the "
+                "daemon process.");
+        mode = "threads within daemon";
+    }
+
+    else
+        mode = "forked on accept";
+
+    if (config->prefork_workers > 0 && pool == NULL) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to allocate worker pool.");
+        return EXIT_FAILURE;
+    }
+
+    guacd_accept_stats_init(&accept_stats);
+
+    /* Daemon loop */
+    for (;;) {
+
+        struct pollfd fds[GUACD_MAX_LISTENERS + 1];
+        int ready;
+
+        fds[0].fd = latency_pipe[0];
+        fds[0].events = POLLIN;
+
+        for (i = 0; i < listener_count; i++) {
+            fds[i + 1].fd = listener_fds[i];
+            fds[i + 1].events = POLLIN;
+        }
+
+        /* Wait for connections or reports of connect times */
+        ready = poll(fds, listener_count + 1, -1);
+        guac_wakeups_record();
+
+        if (ready < 0) {
+
+            if (errno == EINTR)
+                continue;
+
+            guacd_log(GUAC_LOG_ERROR, "Could not wait for connections: %s",
+                    strerror(errno));
+            return 3;
+
+        }
+
+        /* Log any connect times reported by children */
+        if (fds[0].revents & POLLIN)
+            guacd_latency_receive(&latency_stats, latency_pipe[0], mode);
+
+        /* Accept from each socket having a connection waiting */
+        for (i = 0; i < listener_count; i++) {
+            if ((fds[i + 1].revents & POLLIN)
+                    && guacd_accept_connection(config, context, pool,
+                        &accept_stats, listener_fds[i]))
+                return 3;
+        }
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Forks a new acceptor process. The acceptor listens on its own sockets,
+ * sharing the bound address with all other acceptors, unless it is given
+ * sockets to inherit.
+ *
+ * @param config The configuration of guacd.
+ * @param context The state shared by all connections.
+ * @param listener_fds The listening sockets currently open within this
+ *                     process.
+ * @param listener_count The number of listening sockets currently open
+ *                       within this process.
+ * @param inherit Non-zero if the acceptor should accept connections from
+ *                the given sockets, zero if those sockets should be closed
+ *                in favor of new sockets of its own.
+ * @param signals The signal mask which the acceptor should restore.
+ * @return The PID of the new acceptor, or -1 if the acceptor could not be
+ *         forked.
+ */
+static pid_t guacd_fork_acceptor(guacd_config* config,
+        guacd_connection_context* context, int* listener_fds,
+        int listener_count, int inherit, sigset_t* signals) {
+
+    int own_fds[GUACD_MAX_LISTENERS];
+    int i;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        guacd_log(GUAC_LOG_ERROR, "Error forking acceptor process: %s",
+                strerror(errno));
+        return -1;
+    }
+
+    /* Supervisor continues to wait on acceptors */
+    if (pid != 0)
+        return pid;
+
+    pthread_sigmask(SIG_SETMASK, signals, NULL);
+
+    /* Listen on sockets of this acceptor alone, such that the kernel
+     * balances connections across acceptors */
+    if (!inherit) {
+
+        for (i = 0; i < listener_count; i++)
+            close(listener_fds[i]);
+
+        listener_count = guacd_listen(config->bind_host, config->bind_port,
+                config->listen_backlog, 1, own_fds);
+        if (listener_count == 0)
+            exit(EXIT_FAILURE);
+
+        listener_fds = own_fds;
+
     }
 
-    /* Attempt binding of each address until success */
-    current_address = addresses;
-    while (current_address != NULL) {
+    exit(guacd_run_acceptor(config, context, listener_fds, listener_count));
 
-        int retval;
+}
+
+/**
+ * Forks the configured number of acceptor processes, replacing any which
+ * exit, until guacd is asked to terminate. The first acceptor inherits the
+ * given listening sockets, which are then closed within this process.
+ *
+ * @param config The configuration of guacd.
+ * @param context The state shared by all connections.
+ * @param listener_fds The listening sockets bound by this process.
+ * @param listener_count The number of listening sockets.
+ * @return The exit status of guacd.
+ */
+static int guacd_supervise_acceptors(guacd_config* config,
+        guacd_connection_context* context, int* listener_fds,
+        int listener_count) {
+
+    pid_t* acceptors = malloc(sizeof(pid_t) * config->acceptors);
+    guac_timestamp* started = malloc(sizeof(guac_timestamp) * config->acceptors);
+    int running = 0;
+    sigset_t signals;
+    sigset_t original;
+    int i;
+
+    if (acceptors == NULL || started == NULL) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to allocate acceptor process "
+                "table.");
+        for (i = 0; i < listener_count; i++)
+            close(listener_fds[i]);
+        free(acceptors);
+        free(started);
+        return EXIT_FAILURE;
+    }
 
-        /* Resolve hostname */
-        if ((retval = getnameinfo(current_address->ai_addr,
-                current_address->ai_addrlen,
-                bound_address, sizeof(bound_address),
-                bound_port, sizeof(bound_port),
-                NI_NUMERICHOST | NI_NUMERICSERV)))
-            guacd_log(GUAC_LOG_ERROR, "Unable to resolve host: %s",
-                    gai_strerror(retval));
+    /* Wait for acceptors to exit or for a request to terminate */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, &original);
+
+    guacd_log(GUAC_LOG_INFO, "Accepting connections with %i processes.",
+            config->acceptors);
+
+    for (i = 0; i < config->acceptors; i++) {
+        acceptors[i] = guacd_fork_acceptor(config, context, listener_fds,
+                listener_count, i == 0, &original);
+        started[i] = guac_timestamp_current();
+        if (acceptors[i] != -1)
+            running++;
+    }
+
+    /* Only acceptors listen */
+    for (i = 0; i < listener_count; i++)
+        close(listener_fds[i]);
+
+    while (running > 0) {
 
-        /* Attempt to bind socket to address */
-        if (bind(socket_fd,
-                    current_address->ai_addr,
-                    current_address->ai_addrlen) == 0) {
+        int sig;
+        int status;
+        pid_t pid;
 
-            guacd_log(GUAC_LOG_DEBUG, "Successfully bound socket to "
-                    "host %s, port %s", bound_address, bound_port);
+        if (sigwait(&signals, &sig))
+            continue;
+
+        /* Stop all acceptors upon request */
+        if (sig != SIGCHLD) {
+
+            guacd_log(GUAC_LOG_INFO, "Stopping acceptor processes.");
+
+            for (i = 0; i < config->acceptors; i++) {
+                if (acceptors[i] != -1)
+                    kill(acceptors[i], SIGTERM);
+            }
 
-            /* Done if successful bind */
             break;
 
         }
 
-        /* Otherwise log information regarding bind failure */
-        else
-            guacd_log(GUAC_LOG_DEBUG, "Unable to bind socket to "
-                    "host %s, port %s: %s",
-                    bound_address, bound_port, strerror(errno));
+        /* Replace each acceptor which has exited */
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+
+            for (i = 0; i < config->acceptors; i++) {
+                if (acceptors[i] == pid)
+                    break;
+            }
+
+            if (i == config->acceptors)
+                continue;
+
+            running--;
+            acceptors[i] = -1;
 
-        current_address = current_address->ai_next;
+            /* Do not retry acceptors which fail as soon as they start */
+            if (guac_timestamp_current() - started[i]
+                    < GUACD_ACCEPTOR_MIN_LIFETIME) {
+                guacd_log(GUAC_LOG_ERROR, "Acceptor process %i exited "
+                        "immediately and will not be replaced.", pid);
+                continue;
+            }
+
+            guacd_log(GUAC_LOG_WARNING, "Acceptor process %i exited. "
+                    "Forking a replacement.", pid);
+
+            acceptors[i] = guacd_fork_acceptor(config, context, NULL, 0, 0,
+                    &original);
+            started[i] = guac_timestamp_current();
+            if (acceptors[i] != -1)
+                running++;
+
+        }
 
     }
 
-    /* If unable to bind to anything, fail */
-    if (current_address == NULL) {
-        guacd_log(GUAC_LOG_ERROR, "Unable to bind socket to any addresses.");
+    free(acceptors);
+    free(started);
+
+    return running > 0 ? 0 : EXIT_FAILURE;
+
+}
+
+int main(int argc, char* argv[]) {
+
+    /* Server */
+    int listener_fds[GUACD_MAX_LISTENERS];
+    int listener_count;
+
+    guacd_connection_context context = {
+        .map = guacd_client_map_alloc(),
+#ifdef ENABLE_SSL
+        .ssl_context = NULL,
+#endif
+        .latency_fd = -1,
+        .trace_directory = NULL
+    };
+
+    /* Load configuration */
+    guacd_config* config = guacd_conf_load();
+    if (config == NULL || guacd_conf_parse_args(config, argc, argv))
+       exit(EXIT_FAILURE);
+
+    /* Init logging as early as possible */
+    guacd_log_level = config->max_log_level;
+    openlog(GUACD_LOG_NAME, LOG_PID, LOG_DAEMON);
+
+    /* Log start */
+    guacd_log(GUAC_LOG_INFO, "Guacamole proxy daemon (guacd) version " VERSION " started");
+
+    /* Allow surface traces only within the configured directory */
+    context.trace_directory = config->trace_directory;
+    if (context.trace_directory != NULL)
+        guacd_log(GUAC_LOG_INFO, "Surface traces may be recorded within "
+                "\"%s\".", context.trace_directory);
+
+    /* Listen on each address family, sharing the address between acceptors
+     * if there are many */
+    listener_count = guacd_listen(config->bind_host, config->bind_port,
+            config->listen_backlog, config->acceptors > 1, listener_fds);
+    if (listener_count == 0)
         exit(EXIT_FAILURE);
-    }
 
 #ifdef ENABLE_SSL
     /* Init SSL if enabled */
@@ -510,12 +1300,17 @@ int main(int argc, char* argv[]) {
         guacd_log(GUAC_LOG_INFO, "Communication will require SSL/TLS.");
         SSL_library_init();
         SSL_load_error_strings();
-        ssl_context = SSL_CTX_new(SSLv23_server_method());
+
+        /* Connections sharing a process share OpenSSL */
+        if (config->threaded)
+            guac_socket_ssl_init_threads();
+
+        context.ssl_context = SSL_CTX_new(SSLv23_server_method());
 
         /* Load key */
         if (config->key_file != NULL) {
             guacd_log(GUAC_LOG_INFO, "Using PEM keyfile %s", config->key_file);
-            if (!SSL_CTX_use_PrivateKey_file(ssl_context, config->key_file, SSL_FILETYPE_PEM)) {
+            if (!SSL_CTX_use_PrivateKey_file(context.ssl_context, config->key_file, SSL_FILETYPE_PEM)) {
                 guacd_log(GUAC_LOG_ERROR, "Unable to load keyfile.");
                 exit(EXIT_FAILURE);
             }
@@ -526,7 +1321,7 @@ int main(int argc, char* argv[]) {
         /* Load cert file if specified */
         if (config->cert_file != NULL) {
             guacd_log(GUAC_LOG_INFO, "Using certificate file %s", config->cert_file);
-            if (!SSL_CTX_use_certificate_chain_file(ssl_context, config->cert_file)) {
+            if (!SSL_CTX_use_certificate_chain_file(context.ssl_context, config->cert_file)) {
                 guacd_log(GUAC_LOG_ERROR, "Unable to load certificate.");
                 exit(EXIT_FAILURE);
             }
@@ -572,98 +1367,17 @@ int main(int argc, char* argv[]) {
                 "SIGPIPE may cause termination of the daemon.");
     }
 
-    /* Ignore SIGCHLD (force automatic removal of children) */
-    if (signal(SIGCHLD, SIG_IGN) == SIG_ERR) {
-        guacd_log(GUAC_LOG_INFO, "Could not set handler for SIGCHLD to ignore. "
-                "Child processes may pile up in the process table.");
-    }
-
-    /* Log listening status */
-    guacd_log(GUAC_LOG_INFO, "Listening on host %s, port %s", bound_address, bound_port);
-
-    /* Free addresses */
-    freeaddrinfo(addresses);
-
-    /* Daemon loop */
-    for (;;) {
-
-        pid_t child_pid;
-
-        /* Listen for connections */
-        if (listen(socket_fd, 5) < 0) {
-            guacd_log(GUAC_LOG_ERROR, "Could not listen on socket: %s", strerror(errno));
-            return 3;
-        }
-
-        /* Accept connection */
-        client_addr_len = sizeof(client_addr);
-        connected_socket_fd = accept(socket_fd,
-                (struct sockaddr*) &client_addr, &client_addr_len);
-
-        if (connected_socket_fd < 0) {
-            guacd_log(GUAC_LOG_ERROR, "Could not accept client connection: %s",
-                    strerror(errno));
-            return 3;
-        }
+    /* Load plugins before forking, if requested */
+    if (config->preload_protocols != NULL)
+        guacd_preload_protocols(config->preload_protocols);
 
-        /* 
-         * Once connection is accepted, send child into background.
-         *
-         * Note that we prefer fork() over threads for connection-handling
-         * processes as they give each connection its own memory area, and
-         * isolate the main daemon and other connections from errors in any
-         * particular client plugin.
-         */
+    /* Accept connections within this process unless there are many
+     * acceptors */
+    if (config->acceptors > 1)
+        return guacd_supervise_acceptors(config, &context, listener_fds,
+                listener_count);
 
-        child_pid = fork();
-
-        /* If error, log */
-        if (child_pid == -1)
-            guacd_log(GUAC_LOG_ERROR, "Error forking child process: %s", strerror(errno));
-
-        /* If child, start client, and exit when finished */
-        else if (child_pid == 0) {
-
-            guac_socket* socket;
-
-#ifdef ENABLE_SSL
-
-            /* If SSL chosen, use it */
-            if (ssl_context != NULL) {
-                socket = guac_socket_open_secure(ssl_context, connected_socket_fd);
-                if (socket == NULL) {
-                    guacd_log_guac_error(GUAC_LOG_ERROR,
-                            "Unable to set up SSL/TLS");
-                    return 0;
-                }
-            }
-            else
-                socket = guac_socket_open(connected_socket_fd);
-#else
-            /* Open guac_socket */
-            socket = guac_socket_open(connected_socket_fd);
-#endif
-
-            guacd_handle_connection(map, socket);
-            close(connected_socket_fd);
-            return 0;
-        }
-
-        /* If parent, close reference to child's descriptor */
-        else if (close(connected_socket_fd) < 0) {
-            guacd_log(GUAC_LOG_ERROR, "Error closing daemon reference to "
-                    "child descriptor: %s", strerror(errno));
-        }
-
-    }
-
-    /* Close socket */
-    if (close(socket_fd) < 0) {
-        guacd_log(GUAC_LOG_ERROR, "Could not close socket: %s", strerror(errno));
-        return 3;
-    }
-
-    return 0;
+    return guacd_run_acceptor(config, &context, listener_fds,
+            listener_count);
 
 }
-
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include "latency.h"
+#include "log.h"
+
+#include <guacamole/timestamp.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void guacd_latency_record(guacd_latency_stats* stats, int latency) {
+    stats->samples[stats->count % GUACD_LATENCY_SAMPLES] = latency;
+    stats->count++;
+}
+
+/**
+ * Comparator for qsort() which orders connect times ascending.
+ */
+static int __guacd_latency_compare(const void* a, const void* b) {
+    return *((const int*) a) - *((const int*) b);
+}
+
+int guacd_latency_percentile(guacd_latency_stats* stats, int percentile) {
+
+    int sorted[GUACD_LATENCY_SAMPLES];
+    int length = stats->count;
+    int index;
+
+    if (length == 0)
+        return 0;
+
+    if (length > GUACD_LATENCY_SAMPLES)
+        length = GUACD_LATENCY_SAMPLES;
+
+    memcpy(sorted, stats->samples, sizeof(int) * length);
+    qsort(sorted, length, sizeof(int), __guacd_latency_compare);
+
+    /* Nearest rank */
+    index = (percentile * length + 99) / 100 - 1;
+    if (index < 0)
+        index = 0;
+
+    return sorted[index];
+
+}
+
+void guacd_latency_report(int fd, guac_timestamp accepted) {
+
+    int latency = guac_timestamp_current() - accepted;
+
+    /* Reports are no larger than PIPE_BUF, and are thus written atomically
+     * even if many processes share the pipe */
+    if (write(fd, &latency, sizeof(latency)) != sizeof(latency))
+        guacd_log(GUAC_LOG_DEBUG, "Connect time of %i ms not reported.",
+                latency);
+
+}
+
+void guacd_latency_receive(guacd_latency_stats* stats, int fd,
+        const char* mode) {
+
+    int latency;
+
+    while (read(fd, &latency, sizeof(latency)) == sizeof(latency)) {
+
+        guac_client_log_level level = GUAC_LOG_DEBUG;
+
+        guacd_latency_record(stats, latency);
+
+        /* Periodically summarize at a more visible level */
+        if (stats->count % GUACD_LATENCY_LOG_INTERVAL == 0)
+            level = GUAC_LOG_INFO;
+
+        /* Skip sorting samples if the summary would not be logged */
+        if (level > guacd_log_level)
+            continue;
+
+        guacd_log(level, "Connection ready after %i ms (%s). Over the last "
+                "%i connections: p50 %i ms, p90 %i ms, p99 %i ms, max %i ms.",
+                latency, mode,
+                stats->count < GUACD_LATENCY_SAMPLES
+                    ? stats->count : GUACD_LATENCY_SAMPLES,
+                guacd_latency_percentile(stats, 50),
+                guacd_latency_percentile(stats, 90),
+                guacd_latency_percentile(stats, 99),
+                guacd_latency_percentile(stats, 100));
+
+    }
+
+}
+
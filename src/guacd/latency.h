@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef _GUACD_LATENCY_H
+#define _GUACD_LATENCY_H
+
+#include "config.h"
+
+#include <guacamole/timestamp.h>
+
+/**
+ * The number of most recent connect times retained when calculating
+ * percentiles.
+ */
+#define GUACD_LATENCY_SAMPLES 1024
+
+/**
+ * The number of connections between each summary of connect times logged at
+ * the info level. Summaries for all other connections are logged at the debug
+ * level.
+ */
+#define GUACD_LATENCY_LOG_INTERVAL 64
+
+/**
+ * The most recent times taken for connections to become ready, measured from
+ * the moment each connection was accepted to the moment its "ready"
+ * instruction was sent.
+ */
+typedef struct guacd_latency_stats {
+
+    /**
+     * Ring buffer of the most recent connect times, in milliseconds.
+     */
+    int samples[GUACD_LATENCY_SAMPLES];
+
+    /**
+     * The total number of connect times ever recorded. Only the most recent
+     * GUACD_LATENCY_SAMPLES are retained.
+     */
+    int count;
+
+} guacd_latency_stats;
+
+/**
+ * Records the given connect time within the given stats.
+ *
+ * @param stats The guacd_latency_stats to update.
+ * @param latency The time taken for a connection to become ready, in
+ *                milliseconds.
+ */
+void guacd_latency_record(guacd_latency_stats* stats, int latency);
+
+/**
+ * Returns the given percentile of the connect times currently retained
+ * within the given stats, or zero if none have been recorded.
+ *
+ * @param stats The guacd_latency_stats to calculate the percentile of.
+ * @param percentile The percentile to calculate, between 0 and 100
+ *                   inclusive.
+ * @return The connect time at the given percentile, in milliseconds.
+ */
+int guacd_latency_percentile(guacd_latency_stats* stats, int percentile);
+
+/**
+ * Reports the time elapsed since the given accept time over the given file
+ * descriptor, which is the write end of a pipe read by the guacd parent
+ * process with guacd_latency_receive(). The report is dropped if it cannot
+ * be written without blocking.
+ *
+ * @param fd The file descriptor to write the report to.
+ * @param accepted The time at which the connection was accepted.
+ */
+void guacd_latency_report(int fd, guac_timestamp accepted);
+
+/**
+ * Reads all reports currently available from the given non-blocking file
+ * descriptor, recording each within the given stats and logging a summary of
+ * the resulting percentiles.
+ *
+ * @param stats The guacd_latency_stats to update.
+ * @param fd The read end of the pipe to which reports are written.
+ * @param mode A human-readable description of the way connections are
+ *             currently being handed to processes, included in the logged
+ *             summary for the sake of comparison.
+ */
+void guacd_latency_receive(guacd_latency_stats* stats, int fd,
+        const char* mode);
+
+#endif
+
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* SO_REUSEPORT is hidden by strict X/Open mode */
+#define _DEFAULT_SOURCE
+
+#include "config.h"
+#include "listener.h"
+#include "log.h"
+
+#include <guacamole/client.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * Creates a socket for the given address, binding and listening on that
+ * socket.
+ *
+ * @param address The address to bind to.
+ * @param backlog The maximum number of pending connections to queue.
+ * @param reuse_port Non-zero if SO_REUSEPORT should be set.
+ * @param v6_only Non-zero if an IPv6 socket should accept only IPv6
+ *                connections, leaving IPv4 to a separate socket.
+ * @return The file descriptor of the listening socket, or -1 on error.
+ */
+static int __guacd_listen_address(struct addrinfo* address, int backlog,
+        int reuse_port, int v6_only) {
+
+    char bound_address[1024];
+    char bound_port[64];
+    int opt_on = 1;
+    int retval;
+    int fd;
+
+    /* Resolve hostname */
+    if ((retval = getnameinfo(address->ai_addr, address->ai_addrlen,
+            bound_address, sizeof(bound_address),
+            bound_port, sizeof(bound_port),
+            NI_NUMERICHOST | NI_NUMERICSERV))) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to resolve host: %s",
+                gai_strerror(retval));
+        return -1;
+    }
+
+    /* Get socket of same family as address */
+    fd = socket(address->ai_family, address->ai_socktype,
+            address->ai_protocol);
+    if (fd < 0) {
+        guacd_log(GUAC_LOG_DEBUG, "Unable to open socket for host %s: %s",
+                bound_address, strerror(errno));
+        return -1;
+    }
+
+    /* Allow socket reuse */
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+                (void*) &opt_on, sizeof(opt_on))) {
+        guacd_log(GUAC_LOG_WARNING, "Unable to set socket options for reuse: %s",
+                strerror(errno));
+    }
+
+    /* Share address with other acceptors, if requested */
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+                    (void*) &opt_on, sizeof(opt_on))) {
+            guacd_log(GUAC_LOG_ERROR, "Unable to share socket between "
+                    "acceptors: %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+#else
+        guacd_log(GUAC_LOG_ERROR, "Sharing sockets between acceptors is not "
+                "supported on this platform.");
+        close(fd);
+        return -1;
+#endif
+    }
+
+    /* Leave IPv4 to its own socket, if any */
+    if (address->ai_family == AF_INET6 && v6_only
+            && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY,
+                (void*) &opt_on, sizeof(opt_on))) {
+        guacd_log(GUAC_LOG_WARNING, "Unable to restrict socket to IPv6: %s",
+                strerror(errno));
+    }
+
+    /* Attempt to bind socket to address */
+    if (bind(fd, address->ai_addr, address->ai_addrlen)) {
+        guacd_log(GUAC_LOG_DEBUG, "Unable to bind socket to "
+                "host %s, port %s: %s",
+                bound_address, bound_port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    guacd_log(GUAC_LOG_DEBUG, "Successfully bound socket to "
+            "host %s, port %s", bound_address, bound_port);
+
+    /* Listen for connections */
+    if (listen(fd, backlog) < 0) {
+        guacd_log(GUAC_LOG_ERROR, "Could not listen on socket: %s",
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    guacd_log(GUAC_LOG_INFO, "Listening on host %s, port %s",
+            bound_address, bound_port);
+
+    return fd;
+
+}
+
+int guacd_listen(const char* host, const char* port, int backlog,
+        int reuse_port, int* fds) {
+
+    struct addrinfo* addresses;
+    struct addrinfo* current_address;
+    int families[GUACD_MAX_LISTENERS] = { AF_INET, AF_INET6 };
+    int inet_bound = 0;
+    int count = 0;
+    int retval;
+    int i;
+
+    struct addrinfo hints = {
+        .ai_family   = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = IPPROTO_TCP
+    };
+
+    /* Get addresses for binding */
+    if ((retval = getaddrinfo(host, port, &hints, &addresses))) {
+        guacd_log(GUAC_LOG_ERROR, "Error parsing given address or port: %s",
+                gai_strerror(retval));
+        return 0;
+    }
+
+    /* Bind the first address of each family which can be bound, binding
+     * IPv4 first such that the IPv6 socket accepts IPv4 connections only if
+     * no IPv4 socket could actually be bound */
+    for (i = 0; i < GUACD_MAX_LISTENERS; i++) {
+
+        for (current_address = addresses; current_address != NULL;
+                current_address = current_address->ai_next) {
+
+            int fd;
+
+            if (current_address->ai_family != families[i])
+                continue;
+
+            fd = __guacd_listen_address(current_address, backlog,
+                    reuse_port, inet_bound);
+            if (fd < 0)
+                continue;
+
+            if (families[i] == AF_INET)
+                inet_bound = 1;
+
+            fds[count++] = fd;
+            break;
+
+        }
+
+    }
+
+    /* Free addresses */
+    freeaddrinfo(addresses);
+
+    if (count == 0)
+        guacd_log(GUAC_LOG_ERROR, "Unable to bind socket to any addresses.");
+
+    else
+        guacd_log(GUAC_LOG_DEBUG, "Up to %i pending connections will be "
+                "queued on each socket.", backlog);
+
+    return count;
+
+}
+
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef _GUACD_LISTENER_H
+#define _GUACD_LISTENER_H
+
+#include "config.h"
+
+/**
+ * The maximum number of sockets on which a single acceptor listens: one for
+ * IPv4 and one for IPv6.
+ */
+#define GUACD_MAX_LISTENERS 2
+
+/**
+ * Binds and listens on one socket for each address family among the
+ * addresses of the given host, such that both IPv4 and IPv6 connections are
+ * accepted where the host has addresses of both kinds. If requested, each
+ * socket allows its address to be shared with other processes binding the
+ * same address with SO_REUSEPORT, in which case the kernel distributes
+ * incoming connections among those processes.
+ *
+ * @param host The host to bind to, or NULL to bind to the loopback
+ *             addresses.
+ * @param port The port to bind to.
+ * @param backlog The maximum number of pending connections to queue on each
+ *                socket.
+ * @param reuse_port Non-zero if the sockets should be shared with other
+ *                   processes through SO_REUSEPORT, zero otherwise.
+ * @param fds Array of at least GUACD_MAX_LISTENERS entries which will
+ *            receive the file descriptors of the listening sockets.
+ * @return The number of listening sockets, or zero if no address could be
+ *         bound.
+ */
+int guacd_listen(const char* host, const char* port, int backlog,
+        int reuse_port, int* fds);
+
+#endif
+
@@ -24,13 +24,62 @@
 
 #include "socket-ssl.h"
 
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
 #include <guacamole/error.h>
 #include <guacamole/socket.h>
+#include <openssl/crypto.h>
 #include <openssl/ssl.h>
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/**
+ * Array of mutexes, used by OpenSSL.
+ */
+static pthread_mutex_t* __guac_socket_ssl_locks;
+
+/**
+ * Called by OpenSSL when locking or unlocking the Nth mutex.
+ */
+static void __guac_socket_ssl_locking_callback(int mode, int n,
+        const char* file, int line) {
+    if (mode & CRYPTO_LOCK)
+        pthread_mutex_lock(&(__guac_socket_ssl_locks[n]));
+    else if (mode & CRYPTO_UNLOCK)
+        pthread_mutex_unlock(&(__guac_socket_ssl_locks[n]));
+}
+
+/**
+ * Called by OpenSSL when determining the current thread ID.
+ */
+static unsigned long __guac_socket_ssl_id_callback() {
+    return (unsigned long) pthread_self();
+}
+#endif
+
+void guac_socket_ssl_init_threads() {
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    int i;
+    int count = CRYPTO_num_locks();
+
+    /* Locks live for the life of the process once installed */
+    if (CRYPTO_get_locking_callback() != NULL)
+        return;
+
+    __guac_socket_ssl_locks = malloc(sizeof(pthread_mutex_t) * count);
+    for (i = 0; i < count; i++)
+        pthread_mutex_init(&(__guac_socket_ssl_locks[i]), NULL);
+
+    CRYPTO_set_id_callback(__guac_socket_ssl_id_callback);
+    CRYPTO_set_locking_callback(__guac_socket_ssl_locking_callback);
+#endif
+
+}
+
 static ssize_t __guac_socket_ssl_read_handler(guac_socket* socket,
         void* buf, size_t count) {
 
@@ -69,6 +118,90 @@ static ssize_t __guac_socket_ssl_write_handler(guac_socket* socket,
 
 }
 
+/**
+ * Writes the given data to the SSL connection of the given socket in its
+ * entirety, recording any error in guac_error.
+ *
+ * @param socket The guac_socket being written to.
+ * @param buf The data to write.
+ * @param count The number of bytes to write.
+ * @return Zero on success, or -1 if an error occurs.
+ */
+static int __guac_socket_ssl_write_all(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    while (count > 0) {
+
+        ssize_t written = __guac_socket_ssl_write_handler(socket, buf, count);
+        if (written <= 0)
+            return -1;
+
+        buf = ((const char*) buf) + written;
+        count -= written;
+
+    }
+
+    return 0;
+
+}
+
+static ssize_t __guac_socket_ssl_writev_handler(guac_socket* socket,
+        const struct iovec* iov, int iovcnt) {
+
+    /* OpenSSL has no equivalent to writev(), so segments are instead
+     * coalesced into blocks the size of a full TLS record */
+    char record[GUAC_SOCKET_SSL_RECORD_SIZE];
+    size_t buffered = 0;
+    ssize_t total = 0;
+
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+
+        const char* buf = iov[i].iov_base;
+        size_t count = iov[i].iov_len;
+        total += count;
+
+        while (count > 0) {
+
+            /* Write full records directly if nothing is pending */
+            if (buffered == 0 && count >= sizeof(record)) {
+                size_t length = count - count % sizeof(record);
+                if (__guac_socket_ssl_write_all(socket, buf, length))
+                    return -1;
+                buf += length;
+                count -= length;
+                continue;
+            }
+
+            /* Otherwise, add as much as possible to the pending record */
+            size_t length = sizeof(record) - buffered;
+            if (length > count)
+                length = count;
+
+            memcpy(record + buffered, buf, length);
+            buffered += length;
+            buf += length;
+            count -= length;
+
+            /* Write record once full */
+            if (buffered == sizeof(record)) {
+                if (__guac_socket_ssl_write_all(socket, record, buffered))
+                    return -1;
+                buffered = 0;
+            }
+
+        }
+
+    }
+
+    /* Write any partial record */
+    if (buffered > 0 && __guac_socket_ssl_write_all(socket, record, buffered))
+        return -1;
+
+    return total;
+
+}
+
 static int __guac_socket_ssl_select_handler(guac_socket* socket, int usec_timeout) {
 
     guac_socket_ssl_data* data = (guac_socket_ssl_data*) socket->data;
@@ -77,6 +210,10 @@ static int __guac_socket_ssl_select_handler(guac_socket* socket, int usec_timeou
     struct timeval timeout;
     int retval;
 
+    /* Data already decrypted by OpenSSL is invisible to select() */
+    if (SSL_pending(data->ssl) > 0)
+        return 1;
+
     /* No timeout if usec_timeout is negative */
     if (usec_timeout < 0)
         retval = select(data->fd + 1, &fds, NULL, NULL, NULL); 
@@ -112,6 +249,7 @@ static int __guac_socket_ssl_free_handler(guac_socket* socket) {
     /* Shutdown SSL */
     guac_socket_ssl_data* data = (guac_socket_ssl_data*) socket->data;
     SSL_shutdown(data->ssl);
+    SSL_free(data->ssl);
 
     free(data);
     return 0;
@@ -146,6 +284,7 @@ guac_socket* guac_socket_open_secure(SSL_CTX* context, int fd) {
     /* Set read/write handlers */
     socket->read_handler   = __guac_socket_ssl_read_handler;
     socket->write_handler  = __guac_socket_ssl_write_handler;
+    socket->writev_handler = __guac_socket_ssl_writev_handler;
     socket->select_handler = __guac_socket_ssl_select_handler;
     socket->free_handler   = __guac_socket_ssl_free_handler;
 
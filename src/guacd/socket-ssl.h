@@ -29,6 +29,13 @@
 #include <guacamole/socket.h>
 #include <openssl/ssl.h>
 
+/**
+ * The maximum number of bytes of plaintext carried by a single TLS record.
+ * Scatter-gather writes to SSL sockets are coalesced into blocks of this
+ * size.
+ */
+#define GUAC_SOCKET_SSL_RECORD_SIZE 16384
+
 /**
  * SSL socket-specific data.
  */
@@ -58,5 +65,13 @@ typedef struct guac_socket_ssl_data {
  */
 guac_socket* guac_socket_open_secure(SSL_CTX* context, int fd);
 
+/**
+ * Provides OpenSSL with the locks it requires to be used by many threads at
+ * once, if OpenSSL requires them and no other part of the process has
+ * already done so. This must be called before SSL sockets are used by more
+ * than one thread.
+ */
+void guac_socket_ssl_init_threads();
+
 #endif
 
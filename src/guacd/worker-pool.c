@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include "log.h"
+#include "worker-pool.h"
+
+#include <guacamole/timestamp.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * Control message buffer large enough to contain a single file descriptor,
+ * aligned as required for a struct cmsghdr.
+ */
+typedef union __guacd_worker_control {
+
+    /**
+     * Header of the control message, present only to force alignment.
+     */
+    struct cmsghdr header;
+
+    /**
+     * Storage for the control message.
+     */
+    char buffer[CMSG_SPACE(sizeof(int))];
+
+} __guacd_worker_control;
+
+/**
+ * Receives a single connection over the given channel, storing its file
+ * descriptor and accept time.
+ *
+ * @param channel The worker's end of the socket pair shared with the
+ *                parent.
+ * @param fd Pointer to the int in which the received file descriptor should
+ *           be stored.
+ * @param accepted Pointer to the guac_timestamp in which the time the
+ *                 connection was accepted should be stored.
+ * @return Zero if a connection was received, non-zero if the channel was
+ *         closed or no connection could be received.
+ */
+static int __guacd_worker_receive(int channel, int* fd,
+        guac_timestamp* accepted) {
+
+    __guacd_worker_control control;
+    struct cmsghdr* cmsg;
+    ssize_t length;
+
+    struct iovec iov = {
+        .iov_base = accepted,
+        .iov_len  = sizeof(*accepted)
+    };
+
+    struct msghdr message = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = control.buffer,
+        .msg_controllen = sizeof(control.buffer)
+    };
+
+    /* Wait for connection */
+    do {
+        length = recvmsg(channel, &message, 0);
+    } while (length < 0 && errno == EINTR);
+
+    /* Fail quietly if the parent closed the channel */
+    if (length != sizeof(*accepted))
+        return 1;
+
+    /* Retrieve file descriptor of accepted connection */
+    cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+            || cmsg->cmsg_type != SCM_RIGHTS) {
+        guacd_log(GUAC_LOG_ERROR, "Worker received no connection.");
+        return 1;
+    }
+
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(*fd));
+    return 0;
+
+}
+
+/**
+ * Waits within a newly-forked worker process for connections to be sent
+ * over the given channel, handling each as it arrives. Workers of pools
+ * which are not persistent handle exactly one connection and then exit.
+ * Persistent workers handle connections until the channel is closed, at
+ * which point only the calling thread exits, such that the process remains
+ * until any connections still being handled by other threads are finished.
+ * This function never returns.
+ *
+ * @param pool The worker pool which forked this worker.
+ * @param channel The worker's end of the socket pair shared with the
+ *                parent.
+ */
+static void __guacd_worker_run(guacd_worker_pool* pool, int channel) {
+
+    guac_timestamp accepted;
+    int fd;
+
+    /* Exit if the parent closed the channel before handing off anything */
+    if (__guacd_worker_receive(channel, &fd, &accepted))
+        exit(EXIT_SUCCESS);
+
+    /* Handle exactly one connection if not persistent */
+    if (!pool->persistent) {
+        close(channel);
+        pool->handler(fd, accepted, pool->data);
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Otherwise continue handling connections until channel is closed */
+    do {
+        pool->handler(fd, accepted, pool->data);
+    } while (!__guacd_worker_receive(channel, &fd, &accepted));
+
+    close(channel);
+    pthread_exit(NULL);
+
+}
+
+/**
+ * Forks a single new worker, adding it to the workers of the given
+ * pool, which must not already be full.
+ *
+ * @param pool The worker pool to add a worker to.
+ * @return Zero if the worker was forked successfully, non-zero otherwise.
+ */
+static int __guacd_worker_pool_spawn(guacd_worker_pool* pool) {
+
+    guacd_worker* worker;
+    int channel[2];
+    pid_t pid;
+
+    /* Packets keep each connection distinct from the next, and unlike
+     * datagrams are seen to end once the parent closes its end */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, channel)) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to create worker channel: %s",
+                strerror(errno));
+        return 1;
+    }
+
+    pid = fork();
+
+    /* If error, log */
+    if (pid == -1) {
+        guacd_log(GUAC_LOG_ERROR, "Error forking worker process: %s",
+                strerror(errno));
+        close(channel[0]);
+        close(channel[1]);
+        return 1;
+    }
+
+    /* If child, wait for connection */
+    if (pid == 0) {
+        close(channel[0]);
+        guacd_worker_pool_close_channels(pool);
+        __guacd_worker_run(pool, channel[1]);
+    }
+
+    /* If parent, store worker */
+    close(channel[1]);
+
+    worker = &(pool->workers[pool->count++]);
+    worker->pid = pid;
+    worker->fd = channel[0];
+
+    return 0;
+
+}
+
+guacd_worker_pool* guacd_worker_pool_alloc(int size, int persistent,
+        guacd_worker_handler* handler, void* data) {
+
+    guacd_worker_pool* pool = malloc(sizeof(guacd_worker_pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->workers = malloc(sizeof(guacd_worker) * size);
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->size = size;
+    pool->persistent = persistent;
+    pool->count = 0;
+    pool->next = 0;
+    pool->handler = handler;
+    pool->data = data;
+
+    guacd_worker_pool_fill(pool);
+    return pool;
+
+}
+
+int guacd_worker_pool_fill(guacd_worker_pool* pool) {
+
+    while (pool->count < pool->size) {
+
+        /* Leave remaining workers for a later attempt if fork fails */
+        if (__guacd_worker_pool_spawn(pool))
+            break;
+
+    }
+
+    return pool->count;
+
+}
+
+int guacd_worker_pool_dispatch(guacd_worker_pool* pool, int fd,
+        guac_timestamp accepted) {
+
+    __guacd_worker_control control;
+    struct cmsghdr* cmsg;
+
+    struct iovec iov = {
+        .iov_base = &accepted,
+        .iov_len  = sizeof(accepted)
+    };
+
+    struct msghdr message = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = control.buffer,
+        .msg_controllen = sizeof(control.buffer)
+    };
+
+    /* Attach accepted connection */
+    memset(&control, 0, sizeof(control));
+    cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+    /* Try workers until one accepts, skipping any which have died */
+    while (pool->count > 0) {
+
+        guacd_worker* worker;
+        ssize_t length;
+        int index;
+
+        /* Persistent workers take connections in turn, while other workers
+         * are each consumed by a single connection */
+        if (pool->persistent) {
+            index = pool->next % pool->count;
+            pool->next = index + 1;
+        }
+        else
+            index = pool->count - 1;
+
+        worker = &(pool->workers[index]);
+
+        do {
+            length = sendmsg(worker->fd, &message, 0);
+        } while (length < 0 && errno == EINTR);
+
+        if (length == sizeof(accepted)) {
+
+            guacd_log(GUAC_LOG_DEBUG, "Connection handed to worker process "
+                    "%i", worker->pid);
+
+            /* Consume worker unless persistent */
+            if (!pool->persistent) {
+                close(worker->fd);
+                pool->count--;
+            }
+
+            return 0;
+
+        }
+
+        guacd_log(GUAC_LOG_WARNING, "Unable to hand connection to worker "
+                "process %i: %s", worker->pid, strerror(errno));
+
+        /* Remove failed worker, replacing it with the last worker */
+        close(worker->fd);
+        *worker = pool->workers[--pool->count];
+
+    }
+
+    return 1;
+
+}
+
+void guacd_worker_pool_close_channels(guacd_worker_pool* pool) {
+
+    int i;
+    for (i = 0; i < pool->count; i++)
+        close(pool->workers[i].fd);
+
+}
+
+void guacd_worker_pool_free(guacd_worker_pool* pool) {
+    guacd_worker_pool_close_channels(pool);
+    free(pool->workers);
+    free(pool);
+}
+
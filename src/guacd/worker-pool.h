@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef _GUACD_WORKER_POOL_H
+#define _GUACD_WORKER_POOL_H
+
+#include "config.h"
+
+#include <guacamole/timestamp.h>
+
+#include <sys/types.h>
+
+/**
+ * Handler which is invoked within a worker process once an accepted
+ * connection has been handed to that worker. Unless the pool is persistent,
+ * the worker process exits when the handler returns.
+ *
+ * @param fd The file descriptor of the accepted connection.
+ * @param accepted The time at which the connection was accepted.
+ * @param data The arbitrary data given when the pool was allocated.
+ */
+typedef void guacd_worker_handler(int fd, guac_timestamp accepted,
+        void* data);
+
+/**
+ * A worker process, waiting for connections.
+ */
+typedef struct guacd_worker {
+
+    /**
+     * The PID of the worker process.
+     */
+    pid_t pid;
+
+    /**
+     * The parent's end of the socket pair over which the accepted connection
+     * will be sent to the worker.
+     */
+    int fd;
+
+} guacd_worker;
+
+/**
+ * A pool of worker processes, forked in advance of the connections they will
+ * handle such that the cost of fork() is not paid while a user waits. Unless
+ * the pool is persistent, each worker handles exactly one connection, and is
+ * replaced as soon as it has been handed that connection. Workers of a
+ * persistent pool each handle many connections, taking them in turn, and are
+ * replaced only if they die.
+ */
+typedef struct guacd_worker_pool {
+
+    /**
+     * The number of workers the pool should maintain.
+     */
+    int size;
+
+    /**
+     * Whether each worker handles many connections rather than one. The
+     * handler of a persistent pool must not block while the connection is
+     * handled, and should instead hand the connection to a new thread.
+     */
+    int persistent;
+
+    /**
+     * The number of workers currently available to take connections.
+     */
+    int count;
+
+    /**
+     * All workers currently available to take connections. Only the first
+     * count entries are valid.
+     */
+    guacd_worker* workers;
+
+    /**
+     * The index of the worker of a persistent pool which takes the next
+     * connection. This may exceed the index of the last worker if workers
+     * have since been removed, in which case it wraps to the first.
+     */
+    int next;
+
+    /**
+     * The handler to invoke within each worker once it has been handed a
+     * connection.
+     */
+    guacd_worker_handler* handler;
+
+    /**
+     * Arbitrary data to pass to the handler.
+     */
+    void* data;
+
+} guacd_worker_pool;
+
+/**
+ * Allocates a new pool of worker processes, forking the given number of
+ * workers immediately. If some workers cannot be forked, the pool is still
+ * returned, and will attempt to fork the remaining workers when next filled.
+ *
+ * @param size The number of workers the pool should maintain.
+ * @param persistent Non-zero if each worker should handle many connections,
+ *                   zero if each worker should handle exactly one.
+ * @param handler The handler to invoke within each worker once it has been
+ *                handed a connection.
+ * @param data Arbitrary data to pass to the handler.
+ * @return A newly-allocated worker pool, or NULL if the pool could not be
+ *         allocated.
+ */
+guacd_worker_pool* guacd_worker_pool_alloc(int size, int persistent,
+        guacd_worker_handler* handler, void* data);
+
+/**
+ * Forks new workers until the given pool contains its configured number of
+ * workers.
+ *
+ * @param pool The worker pool to fill.
+ * @return The number of workers within the pool after filling.
+ */
+int guacd_worker_pool_fill(guacd_worker_pool* pool);
+
+/**
+ * Hands the given accepted connection to a worker within the given pool.
+ * The pool is not refilled automatically; guacd_worker_pool_fill()
+ * should be called once the connection has been dispatched. The given file
+ * descriptor remains open in the calling process regardless of whether
+ * dispatch succeeds.
+ *
+ * @param pool The worker pool to dispatch the connection to.
+ * @param fd The file descriptor of the accepted connection.
+ * @param accepted The time at which the connection was accepted.
+ * @return Zero if the connection was handed to a worker, non-zero if no
+ *         worker could accept it.
+ */
+int guacd_worker_pool_dispatch(guacd_worker_pool* pool, int fd,
+        guac_timestamp accepted);
+
+/**
+ * Closes the parent's end of the channel to every worker within the given
+ * pool. This is called within processes forked outside the pool, such that
+ * workers are not kept waiting by copies of those channels should the parent
+ * exit.
+ *
+ * @param pool The worker pool whose channels should be closed.
+ */
+void guacd_worker_pool_close_channels(guacd_worker_pool* pool);
+
+/**
+ * Frees the given worker pool. Workers see their channel close and exit once
+ * any connections they are handling are finished.
+ *
+ * @param pool The worker pool to free.
+ */
+void guacd_worker_pool_free(guacd_worker_pool* pool);
+
+#endif
+
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "base64.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SIMD kernels are built only for x86 compilers which understand per-function
+ * target attributes, such that the library as a whole need not be compiled
+ * for a newer CPU than it will actually run on.
+ */
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define GUAC_BASE64_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Signature shared by all base64 group encoding implementations.
+ */
+typedef size_t guac_base64_encoder(char* output, const unsigned char* input,
+        size_t groups);
+
+/**
+ * The implementation selected for the current CPU, as chosen by
+ * __guac_base64_select_encoder().
+ */
+static guac_base64_encoder* __guac_base64_encoder = NULL;
+
+/**
+ * Guard ensuring the encoder implementation is selected exactly once.
+ */
+static pthread_once_t __guac_base64_encoder_once = PTHREAD_ONCE_INIT;
+
+size_t guac_base64_encode_groups_scalar(char* output,
+        const unsigned char* input, size_t groups) {
+
+    const char* alphabet = __guac_socket_BASE64_CHARACTERS;
+    size_t remaining = groups;
+
+    while (remaining > 0) {
+
+        /* Combine group into a single 24-bit value */
+        uint32_t value = (input[0] << 16) | (input[1] << 8) | input[2];
+
+        /* Split into four 6-bit characters */
+        output[0] = alphabet[(value >> 18) & 0x3F];
+        output[1] = alphabet[(value >> 12) & 0x3F];
+        output[2] = alphabet[(value >>  6) & 0x3F];
+        output[3] = alphabet[ value        & 0x3F];
+
+        input  += 3;
+        output += 4;
+        remaining--;
+
+    }
+
+    return groups * 4;
+
+}
+
+#ifdef GUAC_BASE64_X86_SIMD
+
+/**
+ * Encodes 12 bytes of input (the low 12 bytes of the given vector) into 16
+ * base64 characters, using the pshufb-based approach described by Wojciech
+ * Muła. Each 3-byte group is first spread across a 32-bit lane, the four
+ * 6-bit values are isolated with shifts implemented as multiplies, and the
+ * resulting values are translated into the base64 alphabet by adding a
+ * per-range offset selected with a second byte shuffle.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i __guac_base64_encode_ssse3_vector(__m128i input) {
+
+    /* Spread each 3-byte group across a 32-bit lane as [b1 b0 b2 b1] */
+    __m128i in = _mm_shuffle_epi8(input, _mm_set_epi8(
+                10, 11,  9, 10,
+                 7,  8,  6,  7,
+                 4,  5,  3,  4,
+                 1,  2,  0,  1));
+
+    /* Isolate the first and third 6-bit values of each group */
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+
+    /* Isolate the second and fourth 6-bit values of each group */
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+    /* Each byte now contains a single 6-bit value */
+    __m128i indices = _mm_or_si128(t1, t3);
+
+    /* Map values 52-63 onto 1-12, and everything else onto 0 */
+    __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+
+    /* Map values 0-25 onto 13 */
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+    /* Translate ranges into offsets relative to the base64 alphabet */
+    __m128i offsets = _mm_shuffle_epi8(_mm_setr_epi8(
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                '/' - 63, 'A',      0,        0), reduced);
+
+    return _mm_add_epi8(indices, offsets);
+
+}
+
+/**
+ * Encodes 24 bytes of input (the low 12 bytes of each 128-bit lane) into 32
+ * base64 characters. This is the AVX2 equivalent of
+ * __guac_base64_encode_ssse3_vector(), operating on both lanes at once.
+ */
+__attribute__((target("avx2")))
+static inline __m256i __guac_base64_encode_avx2_vector(__m256i input) {
+
+    /* Spread each 3-byte group across a 32-bit lane as [b1 b0 b2 b1] */
+    __m256i in = _mm256_shuffle_epi8(input, _mm256_set_epi8(
+                10, 11,  9, 10,  7,  8,  6,  7,
+                 4,  5,  3,  4,  1,  2,  0,  1,
+                10, 11,  9, 10,  7,  8,  6,  7,
+                 4,  5,  3,  4,  1,  2,  0,  1));
+
+    /* Isolate the first and third 6-bit values of each group */
+    __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+
+    /* Isolate the second and fourth 6-bit values of each group */
+    __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+
+    /* Each byte now contains a single 6-bit value */
+    __m256i indices = _mm256_or_si256(t1, t3);
+
+    /* Map values 52-63 onto 1-12, and everything else onto 0 */
+    __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+
+    /* Map values 0-25 onto 13 */
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    reduced = _mm256_or_si256(reduced,
+            _mm256_and_si256(less, _mm256_set1_epi8(13)));
+
+    /* Translate ranges into offsets relative to the base64 alphabet */
+    __m256i offsets = _mm256_shuffle_epi8(_mm256_setr_epi8(
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                '/' - 63, 'A',      0,        0,
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                '/' - 63, 'A',      0,        0), reduced);
+
+    return _mm256_add_epi8(indices, offsets);
+
+}
+
+/**
+ * SSSE3 implementation of guac_base64_encode_groups(). Groups are encoded
+ * four at a time. As each iteration loads 16 bytes while consuming only 12,
+ * the final groups are always handled by the scalar implementation.
+ */
+__attribute__((target("ssse3")))
+static size_t __guac_base64_encode_groups_ssse3(char* output,
+        const unsigned char* input, size_t groups) {
+
+    size_t remaining = groups;
+
+    /* Encode 12 bytes at a time while a full 16-byte load is safe */
+    while (remaining >= 6) {
+
+        __m128i in = _mm_loadu_si128((const __m128i*) input);
+        _mm_storeu_si128((__m128i*) output,
+                __guac_base64_encode_ssse3_vector(in));
+
+        input  += 12;
+        output += 16;
+        remaining -= 4;
+
+    }
+
+    /* Encode any remaining groups */
+    guac_base64_encode_groups_scalar(output, input, remaining);
+    return groups * 4;
+
+}
+
+/**
+ * AVX2 implementation of guac_base64_encode_groups(). Groups are encoded
+ * eight at a time, with each 128-bit lane loaded separately such that the
+ * in-lane shuffles of AVX2 see the same layout as the SSSE3 kernel.
+ */
+__attribute__((target("avx2")))
+static size_t __guac_base64_encode_groups_avx2(char* output,
+        const unsigned char* input, size_t groups) {
+
+    size_t remaining = groups;
+
+    /* Encode 24 bytes at a time while both 16-byte loads are safe */
+    while (remaining >= 10) {
+
+        __m128i low  = _mm_loadu_si128((const __m128i*) input);
+        __m128i high = _mm_loadu_si128((const __m128i*) (input + 12));
+
+        __m256i in = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(low), high, 1);
+
+        _mm256_storeu_si256((__m256i*) output,
+                __guac_base64_encode_avx2_vector(in));
+
+        input  += 24;
+        output += 32;
+        remaining -= 8;
+
+    }
+
+    /* Encode any remaining groups */
+    __guac_base64_encode_groups_ssse3(output, input, remaining);
+    return groups * 4;
+
+}
+
+#endif
+
+/**
+ * Selects the fastest encoder implementation supported by the current CPU,
+ * storing the result in __guac_base64_encoder.
+ */
+static void __guac_base64_select_encoder() {
+
+#ifdef GUAC_BASE64_X86_SIMD
+    __builtin_cpu_init();
+
+    /* Prefer AVX2 if available */
+    if (__builtin_cpu_supports("avx2")) {
+        __guac_base64_encoder = __guac_base64_encode_groups_avx2;
+        return;
+    }
+
+    /* Otherwise, use SSSE3 if available */
+    if (__builtin_cpu_supports("ssse3")) {
+        __guac_base64_encoder = __guac_base64_encode_groups_ssse3;
+        return;
+    }
+#endif
+
+    /* Fall back to portable implementation */
+    __guac_base64_encoder = guac_base64_encode_groups_scalar;
+
+}
+
+size_t guac_base64_encode_groups(char* output, const unsigned char* input,
+        size_t groups) {
+
+    pthread_once(&__guac_base64_encoder_once, __guac_base64_select_encoder);
+    return __guac_base64_encoder(output, input, groups);
+
+}
+
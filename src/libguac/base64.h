@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_BASE64_H
+#define __GUAC_BASE64_H
+
+#include "config.h"
+
+#include <stddef.h>
+
+/**
+ * The characters of the base64 alphabet, in order of value.
+ */
+extern char __guac_socket_BASE64_CHARACTERS[64];
+
+/**
+ * Encodes the given number of complete 3-byte groups as base64, writing
+ * exactly four characters per group. No padding is ever written, as only
+ * complete groups are encoded. The fastest implementation supported by the
+ * current CPU is selected automatically upon first use.
+ *
+ * @param output
+ *     The buffer to write encoded characters into. This buffer must have
+ *     room for at least groups * 4 characters.
+ *
+ * @param input
+ *     The bytes to encode. This buffer must contain at least groups * 3
+ *     bytes.
+ *
+ * @param groups
+ *     The number of 3-byte groups to encode.
+ *
+ * @return
+ *     The number of characters written to the output buffer, which will
+ *     always be groups * 4.
+ */
+size_t guac_base64_encode_groups(char* output, const unsigned char* input,
+        size_t groups);
+
+/**
+ * Encodes the given number of complete 3-byte groups as base64 using only
+ * the portable scalar implementation, regardless of the capabilities of the
+ * current CPU. The semantics of this function are otherwise identical to
+ * guac_base64_encode_groups().
+ *
+ * @param output
+ *     The buffer to write encoded characters into. This buffer must have
+ *     room for at least groups * 4 characters.
+ *
+ * @param input
+ *     The bytes to encode. This buffer must contain at least groups * 3
+ *     bytes.
+ *
+ * @param groups
+ *     The number of 3-byte groups to encode.
+ *
+ * @return
+ *     The number of characters written to the output buffer, which will
+ *     always be groups * 4.
+ */
+size_t guac_base64_encode_groups_scalar(char* output,
+        const unsigned char* input, size_t groups);
+
+#endif
+
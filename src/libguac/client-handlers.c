@@ -78,6 +78,7 @@ int __guac_handle_sync(guac_client* client, guac_instruction* instruction) {
         return -1;
 
     client->last_received_timestamp = timestamp;
+    __guac_client_sync_received(client, timestamp, guac_timestamp_current());
     return 0;
 }
 
@@ -24,6 +24,7 @@
 
 #include "client.h"
 #include "client-handlers.h"
+#include "encode.h"
 #include "error.h"
 #include "instruction.h"
 #include "layer.h"
@@ -39,10 +40,14 @@
 #include <uuid.h>
 #endif
 
+#include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 
 guac_layer __GUAC_DEFAULT_LAYER = {
     .index = 0
@@ -95,12 +100,17 @@ guac_stream* guac_client_alloc_stream(guac_client* client) {
     guac_stream* allocd_stream;
     int stream_index;
 
+    pthread_mutex_lock(&(client->__stream_lock));
+
     /* Refuse to allocate beyond maximum */
-    if (client->__stream_pool->active == GUAC_CLIENT_MAX_STREAMS)
+    if (client->__stream_pool->active == GUAC_CLIENT_MAX_STREAMS) {
+        pthread_mutex_unlock(&(client->__stream_lock));
         return NULL;
+    }
 
     /* Allocate stream */
     stream_index = guac_pool_next_int(client->__stream_pool);
+    pthread_mutex_unlock(&(client->__stream_lock));
 
     /* Initialize stream */
     allocd_stream = &(client->__output_streams[stream_index]);
@@ -117,13 +127,93 @@ guac_stream* guac_client_alloc_stream(guac_client* client) {
 void guac_client_free_stream(guac_client* client, guac_stream* stream) {
 
     /* Release index to pool */
+    pthread_mutex_lock(&(client->__stream_lock));
     guac_pool_free_int(client->__stream_pool, stream->index);
+    pthread_mutex_unlock(&(client->__stream_lock));
 
     /* Mark stream as closed */
     stream->index = GUAC_CLIENT_CLOSED_STREAM_INDEX;
 
 }
 
+/**
+ * Streams the contents of the given surface to the given layer using an
+ * "img" instruction, encoding the image in the given format.
+ */
+static int __guac_client_stream_image(guac_client* client,
+        guac_socket* socket, guac_encode_format format, const char* mimetype,
+        int quality, guac_composite_mode mode, const guac_layer* layer,
+        int x, int y, cairo_surface_t* surface) {
+
+    guac_client_image_stats* stats = &(client->image_stats);
+    guac_encode_stream_stats image;
+    int ret_val;
+    guac_stream* stream;
+
+    /* Refuse formats which cannot be encoded before sending anything */
+    if (!guac_encode_supported(format)) {
+        guac_error = GUAC_STATUS_NOT_SUPPORTED;
+        guac_error_message = "Image format not supported by this build";
+        return -1;
+    }
+
+    /* Allocate stream for image */
+    stream = guac_client_alloc_stream(client);
+    if (stream == NULL) {
+        guac_error = GUAC_STATUS_NO_SPACE;
+        guac_error_message = "Unable to allocate stream for image";
+        return -1;
+    }
+
+    /* Declare stream, send image data, and end stream */
+    ret_val =
+           guac_protocol_send_img(socket, stream, mode, layer, mimetype, x, y)
+        || guac_encode_stream(socket, stream, format, surface, quality, &image)
+        || guac_protocol_send_end(socket, stream);
+
+    guac_client_free_stream(client, stream);
+
+    if (ret_val)
+        return ret_val;
+
+    /* Record image within statistics of client */
+    pthread_mutex_lock(&(client->__image_stats_lock));
+
+    stats->images++;
+    stats->bytes += image.bytes;
+    stats->first_blob_time += image.first_blob_time;
+    stats->total_time += image.total_time;
+
+    if (image.first_blob_time > stats->max_first_blob_time)
+        stats->max_first_blob_time = image.first_blob_time;
+
+    if (image.total_time > stats->max_total_time)
+        stats->max_total_time = image.total_time;
+
+    pthread_mutex_unlock(&(client->__image_stats_lock));
+
+    return 0;
+
+}
+
+int guac_client_stream_png(guac_client* client, guac_socket* socket,
+        guac_composite_mode mode, const guac_layer* layer, int x, int y,
+        cairo_surface_t* surface) {
+
+    return __guac_client_stream_image(client, socket, GUAC_ENCODE_PNG,
+            "image/png", 0, mode, layer, x, y, surface);
+
+}
+
+int guac_client_stream_jpeg(guac_client* client, guac_socket* socket,
+        guac_composite_mode mode, const guac_layer* layer, int x, int y,
+        cairo_surface_t* surface, int quality) {
+
+    return __guac_client_stream_image(client, socket, GUAC_ENCODE_JPEG,
+            "image/jpeg", quality, mode, layer, x, y, surface);
+
+}
+
 /**
  * Returns a newly allocated string containing a guaranteed-unique connection
  * identifier string which is 37 characters long and begins with a '$'
@@ -215,6 +305,15 @@ guac_client* guac_client_alloc() {
 
     /* Allocate stream pool */
     client->__stream_pool = guac_pool_alloc(0);
+    pthread_mutex_init(&(client->__stream_lock), NULL);
+    pthread_mutex_init(&(client->__image_stats_lock), NULL);
+
+    /* Nothing yet known of connection speed */
+    pthread_mutex_init(&(client->__link_lock), NULL);
+    pthread_cond_init(&(client->__link_cond), NULL);
+    client->__window_min_rtt = INT_MAX;
+    client->__previous_min_rtt = INT_MAX;
+    client->__link_stats.frame_window = GUAC_CLIENT_MIN_FRAME_WINDOW;
 
     /* Initialze streams */
     client->__input_streams = malloc(sizeof(guac_stream) * GUAC_CLIENT_MAX_STREAMS);
@@ -225,6 +324,12 @@ guac_client* guac_client_alloc() {
         client->__output_streams[i].index = GUAC_CLIENT_CLOSED_STREAM_INDEX;
     }
 
+    /* Add handlers for core protocol */
+    for (i=0; __guac_instruction_handler_map[i].opcode != NULL; i++)
+        guac_client_set_instruction_handler(client,
+                __guac_instruction_handler_map[i].opcode,
+                __guac_instruction_handler_map[i].handler);
+
     return client;
 
 }
@@ -248,28 +353,507 @@ void guac_client_free(guac_client* client) {
 
     /* Free stream pool */
     guac_pool_free(client->__stream_pool);
+    pthread_mutex_destroy(&(client->__stream_lock));
+    pthread_mutex_destroy(&(client->__image_stats_lock));
+    pthread_cond_destroy(&(client->__link_cond));
+    pthread_mutex_destroy(&(client->__link_lock));
 
     free(client);
 }
 
-int guac_client_handle_instruction(guac_client* client, guac_instruction* instruction) {
+/**
+ * Returns the hash of the given opcode, used to locate its handler.
+ *
+ * @param opcode The opcode to hash.
+ * @return The hash of the given opcode.
+ */
+static unsigned int __guac_client_hash_opcode(const char* opcode) {
+
+    /* 32-bit FNV-1a */
+    unsigned int hash = 2166136261u;
+    while (*opcode != '\0')
+        hash = (hash ^ (unsigned char) *(opcode++)) * 16777619u;
 
-    /* For each defined instruction */
-    __guac_instruction_handler_mapping* current = __guac_instruction_handler_map;
-    while (current->opcode != NULL) {
+    return hash;
 
-        /* If recognized, call handler */
-        if (strcmp(instruction->opcode, current->opcode) == 0)
-            return current->handler(client, instruction);
+}
+
+/**
+ * Returns the slot within the handler table of the given client which
+ * contains the handler for the given opcode. If there is no such handler, the
+ * unused slot in which that handler would be stored is returned.
+ *
+ * @param client The client whose handler table should be searched.
+ * @param opcode The opcode to search for.
+ * @param hash The hash of the given opcode.
+ * @return The slot containing the handler for the given opcode, the unused
+ *         slot where that handler would be stored, or NULL if there is no
+ *         such handler and the table is full.
+ */
+static __guac_client_handler_slot* __guac_client_find_handler(
+        guac_client* client, const char* opcode, unsigned int hash) {
+
+    int i;
+
+    /* Probe linearly from hashed position */
+    for (i = 0; i < GUAC_CLIENT_INSTRUCTION_HANDLERS; i++) {
+
+        __guac_client_handler_slot* slot = &(client->__handlers[
+                (hash + i) & (GUAC_CLIENT_INSTRUCTION_HANDLERS - 1)]);
+
+        /* Stop at first unused slot */
+        if (slot->handler == NULL)
+            return slot;
+
+        /* Compare full opcode only if hashes match */
+        if (slot->hash == hash && strcmp(slot->stats.opcode, opcode) == 0)
+            return slot;
 
-        current++;
     }
 
+    return NULL;
+
+}
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds, for the
+ * sake of measuring handler latency.
+ *
+ * @return The current value of the monotonic clock, in nanoseconds.
+ */
+static uint64_t __guac_client_monotonic_ns() {
+
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+
+    return (uint64_t) current.tv_sec * 1000000000 + current.tv_nsec;
+
+}
+
+int guac_client_handle_instruction(guac_client* client, guac_instruction* instruction) {
+
+    uint64_t start;
+    uint64_t elapsed;
+    int result;
+
+    /* Look up handler by opcode */
+    __guac_client_handler_slot* slot = __guac_client_find_handler(client,
+            instruction->opcode,
+            __guac_client_hash_opcode(instruction->opcode));
+
     /* If unrecognized, ignore */
+    if (slot == NULL || slot->handler == NULL)
+        return 0;
+
+    if (!client->__handler_timing)
+        return slot->handler(client, instruction);
+
+    /* Record time spent within handler */
+    start = __guac_client_monotonic_ns();
+    result = slot->handler(client, instruction);
+    elapsed = __guac_client_monotonic_ns() - start;
+
+    slot->stats.count++;
+    slot->stats.total_time += elapsed;
+    if (elapsed > slot->stats.max_time)
+        slot->stats.max_time = elapsed;
+
+    return result;
+
+}
+
+int guac_client_set_instruction_handler(guac_client* client,
+        const char* opcode, guac_client_instruction_handler* handler) {
+
+    unsigned int hash = __guac_client_hash_opcode(opcode);
+    __guac_client_handler_slot* slot = __guac_client_find_handler(client,
+            opcode, hash);
+
+    /* Fail if no room for new opcode */
+    if (slot == NULL) {
+        guac_error = GUAC_STATUS_NO_SPACE;
+        guac_error_message = "Too many instruction handlers";
+        return 1;
+    }
+
+    /* Reset statistics only for new opcodes */
+    if (slot->handler == NULL) {
+        memset(&(slot->stats), 0, sizeof(slot->stats));
+        slot->hash = hash;
+        slot->stats.opcode = opcode;
+    }
+
+    slot->handler = handler;
     return 0;
 
 }
 
+void guac_client_set_handler_timing(guac_client* client, int enabled) {
+    client->__handler_timing = enabled;
+}
+
+int guac_client_get_handler_stats(guac_client* client,
+        guac_client_handler_stats* stats, int max) {
+
+    int i;
+    int count = 0;
+
+    for (i = 0; i < GUAC_CLIENT_INSTRUCTION_HANDLERS && count < max; i++) {
+
+        __guac_client_handler_slot* slot = &(client->__handlers[i]);
+
+        /* Include only opcodes which have been handled */
+        if (slot->handler != NULL && slot->stats.count > 0)
+            stats[count++] = slot->stats;
+
+    }
+
+    return count;
+
+}
+
+void guac_client_sync_sent(guac_client* client, guac_timestamp timestamp) {
+
+    uint64_t bytes = guac_socket_get_bytes_written(client->socket);
+    int count;
+
+    pthread_mutex_lock(&(client->__link_lock));
+
+    count = client->__pending_sync_count;
+
+    /* Repeated timestamps extend the frame already pending */
+    if (count > 0 && client->__pending_syncs[count - 1].timestamp == timestamp)
+        client->__pending_syncs[count - 1].bytes = bytes;
+
+    else {
+
+        /* Forget the oldest sync if too many are outstanding */
+        if (count == GUAC_CLIENT_MAX_PENDING_SYNCS) {
+            count--;
+            memmove(client->__pending_syncs, client->__pending_syncs + 1,
+                    sizeof(__guac_client_sync) * count);
+        }
+
+        client->__pending_syncs[count].timestamp = timestamp;
+        client->__pending_syncs[count].bytes = bytes;
+        client->__pending_sync_count = count + 1;
+
+    }
+
+    pthread_mutex_unlock(&(client->__link_lock));
+
+}
+
+/**
+ * Updates the smoothed and minimum round-trip times of the given client with
+ * the given sample. The link lock must be held.
+ *
+ * @param client The proxy client to update.
+ * @param rtt The round-trip time measured, in milliseconds.
+ */
+static void __guac_client_update_rtt(guac_client* client, int rtt) {
+
+    guac_client_link_stats* stats = &(client->__link_stats);
+
+    /* Smooth round-trip time, starting with the first sample */
+    if (stats->syncs == 0)
+        stats->rtt = rtt;
+    else
+        stats->rtt += (rtt - stats->rtt) / 8;
+
+    /* Track minimum over the current and previous windows */
+    if (rtt < client->__window_min_rtt)
+        client->__window_min_rtt = rtt;
+
+    if (client->__window_min_rtt < client->__previous_min_rtt)
+        stats->min_rtt = client->__window_min_rtt;
+    else
+        stats->min_rtt = client->__previous_min_rtt;
+
+    if (++client->__window_samples == GUAC_CLIENT_RTT_WINDOW) {
+        client->__previous_min_rtt = client->__window_min_rtt;
+        client->__window_min_rtt = INT_MAX;
+        client->__window_samples = 0;
+    }
+
+    stats->syncs++;
+
+}
+
+/**
+ * Updates the bandwidth estimate of the given client with a frame of the
+ * given size which took the given number of milliseconds to transfer. The
+ * link lock must be held.
+ *
+ * @param client The proxy client to update.
+ * @param bytes The number of bytes within the frame.
+ * @param duration The time taken to transfer the frame, in milliseconds.
+ */
+static void __guac_client_update_bandwidth(guac_client* client,
+        uint64_t bytes, int duration) {
+
+    guac_client_link_stats* stats = &(client->__link_stats);
+    uint64_t bandwidth;
+
+    /* Frames transferred too quickly to time give only a lower bound */
+    if (duration < GUAC_CLIENT_MIN_SAMPLE_DURATION) {
+
+        bandwidth = bytes * 1000 / GUAC_CLIENT_MIN_SAMPLE_DURATION;
+        if (bandwidth > INT_MAX)
+            bandwidth = INT_MAX;
+
+        if ((int) bandwidth > stats->bandwidth)
+            stats->bandwidth = bandwidth;
+
+    }
+
+    /* Otherwise smooth estimate, starting with the first sample */
+    else {
+
+        bandwidth = bytes * 1000 / duration;
+        if (bandwidth > INT_MAX)
+            bandwidth = INT_MAX;
+
+        if (stats->bandwidth == 0)
+            stats->bandwidth = bandwidth;
+        else
+            stats->bandwidth += ((int) bandwidth - stats->bandwidth) / 4;
+
+    }
+
+    stats->bandwidth_samples++;
+
+}
+
+/**
+ * Updates the rate at which the remote client of the given client drains
+ * frames, and the resulting frame window, with the given interval between
+ * acknowledgements received while the connection was busy. The link lock
+ * must be held.
+ *
+ * @param client The proxy client to update.
+ * @param interval The time taken to drain a single frame, in milliseconds.
+ */
+static void __guac_client_update_frame_window(guac_client* client,
+        int interval) {
+
+    guac_client_link_stats* stats = &(client->__link_stats);
+    int window;
+
+    if (interval < 1)
+        interval = 1;
+
+    /* Smooth interval, starting with the first sample */
+    if (stats->frame_interval == 0)
+        stats->frame_interval = interval;
+    else
+        stats->frame_interval += (interval - stats->frame_interval) / 4;
+
+    /* Allow enough frames to cover the idle round trip, plus the frame
+     * being drained */
+    window = (stats->min_rtt + stats->frame_interval - 1)
+           / stats->frame_interval + 1;
+
+    if (window < GUAC_CLIENT_MIN_FRAME_WINDOW)
+        window = GUAC_CLIENT_MIN_FRAME_WINDOW;
+    else if (window > GUAC_CLIENT_MAX_FRAME_WINDOW)
+        window = GUAC_CLIENT_MAX_FRAME_WINDOW;
+
+    stats->frame_window = window;
+
+}
+
+void __guac_client_sync_received(guac_client* client,
+        guac_timestamp timestamp, guac_timestamp now) {
+
+    __guac_client_sync sync;
+    uint64_t bytes;
+    int rtt;
+    int i;
+
+    pthread_mutex_lock(&(client->__link_lock));
+
+    /* Locate acknowledged sync, ignoring unknown timestamps */
+    for (i = 0; i < client->__pending_sync_count; i++) {
+        if (client->__pending_syncs[i].timestamp == timestamp)
+            break;
+    }
+
+    if (i == client->__pending_sync_count) {
+        pthread_mutex_unlock(&(client->__link_lock));
+        return;
+    }
+
+    /* Acknowledgement implies all earlier syncs were received */
+    sync = client->__pending_syncs[i];
+    client->__pending_sync_count -= i + 1;
+    memmove(client->__pending_syncs, client->__pending_syncs + i + 1,
+            sizeof(__guac_client_sync) * client->__pending_sync_count);
+
+    rtt = now - sync.timestamp;
+    if (rtt < 0)
+        rtt = 0;
+
+    __guac_client_update_rtt(client, rtt);
+
+    /* While busy, acknowledgements arrive as quickly as frames drain */
+    if (client->__last_acknowledged != 0
+            && sync.timestamp < client->__last_acknowledged)
+        __guac_client_update_frame_window(client,
+                (now - client->__last_acknowledged) / (i + 1));
+
+    /* Measure throughput of frames large enough to be meaningful */
+    bytes = sync.bytes - client->__acknowledged_bytes;
+    if (client->__last_acknowledged != 0
+            && bytes >= GUAC_CLIENT_MIN_SAMPLE_BYTES) {
+
+        int duration;
+
+        /* If sent while the previous frame was still in flight, the link
+         * was busy throughout the time between acknowledgements */
+        if (sync.timestamp < client->__last_acknowledged)
+            duration = now - client->__last_acknowledged;
+
+        /* Otherwise, transfer took whatever exceeded the idle latency */
+        else
+            duration = rtt - client->__link_stats.min_rtt;
+
+        __guac_client_update_bandwidth(client, bytes, duration);
+
+    }
+
+    client->__acknowledged_bytes = sync.bytes;
+    client->__last_acknowledged = now;
+
+    /* Frame window may now be open */
+    pthread_cond_broadcast(&(client->__link_cond));
+    pthread_mutex_unlock(&(client->__link_lock));
+
+}
+
+void guac_client_get_link_stats(guac_client* client,
+        guac_client_link_stats* stats) {
+
+    pthread_mutex_lock(&(client->__link_lock));
+    *stats = client->__link_stats;
+    pthread_mutex_unlock(&(client->__link_lock));
+
+}
+
+int guac_client_can_send_frame(guac_client* client) {
+
+    int open;
+
+    pthread_mutex_lock(&(client->__link_lock));
+    open = client->__pending_sync_count < client->__link_stats.frame_window;
+    pthread_mutex_unlock(&(client->__link_lock));
+
+    return open;
+
+}
+
+int guac_client_wait_for_frame_window(guac_client* client, int msec) {
+
+    struct timeval now;
+    struct timespec deadline;
+    int open;
+
+    /* Calculate absolute time to wait until */
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + msec / 1000;
+    deadline.tv_nsec = (now.tv_usec + (msec % 1000) * 1000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&(client->__link_lock));
+
+    /* Wait for acknowledgements until window opens or time runs out */
+    while (!(open = client->__pending_sync_count
+                < client->__link_stats.frame_window)) {
+        if (pthread_cond_timedwait(&(client->__link_cond),
+                    &(client->__link_lock), &deadline))
+            break;
+    }
+
+    pthread_mutex_unlock(&(client->__link_lock));
+    return open;
+
+}
+
+int guac_client_add_fd(guac_client* client, int fd,
+        guac_client_fd_handler* handler) {
+
+    guac_client_fd* entry;
+
+    if (client->__fd_count == GUAC_CLIENT_MAX_FDS) {
+        guac_error = GUAC_STATUS_NO_SPACE;
+        guac_error_message = "Too many file descriptors registered";
+        return -1;
+    }
+
+    entry = &(client->__fds[client->__fd_count++]);
+    entry->fd = fd;
+    entry->handler = handler;
+
+    return 0;
+
+}
+
+int guac_client_get_fds(guac_client* client, guac_client_fd* fds, int max) {
+
+    int count = client->__fd_count;
+    if (count > max)
+        count = max;
+
+    memcpy(fds, client->__fds, sizeof(guac_client_fd) * count);
+    return count;
+
+}
+
+void guac_client_set_timer(guac_client* client, int msec,
+        guac_client_timer_handler* handler) {
+
+    /* Disarm if requested */
+    if (msec < 0) {
+        client->__timer_handler = NULL;
+        return;
+    }
+
+    client->__timer_handler = handler;
+    client->__timer_deadline = guac_timestamp_current() + msec;
+
+}
+
+int guac_client_get_timer(guac_client* client) {
+
+    guac_timestamp remaining;
+
+    if (client->__timer_handler == NULL)
+        return -1;
+
+    remaining = client->__timer_deadline - guac_timestamp_current();
+    if (remaining < 0)
+        return 0;
+
+    return remaining;
+
+}
+
+int guac_client_run_timer(guac_client* client) {
+
+    guac_client_timer_handler* handler = client->__timer_handler;
+
+    if (handler == NULL)
+        return 0;
+
+    /* Disarm before invoking, such that the handler may re-arm */
+    client->__timer_handler = NULL;
+    return handler(client);
+
+}
+
 void vguac_client_log(guac_client* client, guac_client_log_level level,
         const char* format, va_list ap) {
 
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "encode.h"
+#include "encode-jpeg.h"
+#include "error.h"
+
+#include <cairo/cairo.h>
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+/*
+ * Rows can be handed to libjpeg without conversion if it understands the
+ * in-memory layout of Cairo's 32-bit pixels, which depends on byte order.
+ */
+#if defined(JCS_EXTENSIONS) && defined(__BYTE_ORDER__)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define GUAC_JPEG_NATIVE_COLOR_SPACE JCS_EXT_BGRX
+#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define GUAC_JPEG_NATIVE_COLOR_SPACE JCS_EXT_XRGB
+#endif
+#endif
+
+/**
+ * The size of the buffer handed to libjpeg for output. Each time this buffer
+ * fills, its contents are passed to the write handler.
+ */
+#define GUAC_JPEG_OUTPUT_BUFFER_SIZE 8192
+
+/**
+ * libjpeg destination manager which passes all output to a
+ * guac_encode_write_handler.
+ */
+typedef struct guac_jpeg_destination {
+
+    /**
+     * The libjpeg destination manager. This must be the first member, as
+     * libjpeg is only aware of this structure.
+     */
+    struct jpeg_destination_mgr parent;
+
+    /**
+     * The handler to invoke for each chunk of encoded data.
+     */
+    guac_encode_write_handler* handler;
+
+    /**
+     * Arbitrary data to pass to the handler.
+     */
+    void* data;
+
+    /**
+     * The buffer into which libjpeg writes its output.
+     */
+    JOCTET buffer[GUAC_JPEG_OUTPUT_BUFFER_SIZE];
+
+} guac_jpeg_destination;
+
+/**
+ * libjpeg error manager which returns control to guac_jpeg_encode() upon
+ * error, rather than terminating the process.
+ */
+typedef struct guac_jpeg_error {
+
+    /**
+     * The standard libjpeg error manager. This must be the first member, as
+     * libjpeg is only aware of this structure.
+     */
+    struct jpeg_error_mgr parent;
+
+    /**
+     * The point to return to upon error.
+     */
+    jmp_buf env;
+
+} guac_jpeg_error;
+
+/**
+ * Called by libjpeg upon fatal error.
+ */
+static void __guac_jpeg_error_exit(j_common_ptr cinfo) {
+    guac_jpeg_error* error = (guac_jpeg_error*) cinfo->err;
+    longjmp(error->env, 1);
+}
+
+/**
+ * Called by libjpeg before any data is written.
+ */
+static void __guac_jpeg_init_destination(j_compress_ptr cinfo) {
+
+    guac_jpeg_destination* dest = (guac_jpeg_destination*) cinfo->dest;
+
+    dest->parent.next_output_byte = dest->buffer;
+    dest->parent.free_in_buffer = sizeof(dest->buffer);
+
+}
+
+/**
+ * Called by libjpeg when the output buffer is full.
+ */
+static boolean __guac_jpeg_empty_output_buffer(j_compress_ptr cinfo) {
+
+    guac_jpeg_destination* dest = (guac_jpeg_destination*) cinfo->dest;
+
+    /* Pass entire buffer to handler */
+    if (dest->handler(dest->data, dest->buffer, sizeof(dest->buffer)))
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+
+    dest->parent.next_output_byte = dest->buffer;
+    dest->parent.free_in_buffer = sizeof(dest->buffer);
+
+    return TRUE;
+
+}
+
+/**
+ * Called by libjpeg once all data has been written.
+ */
+static void __guac_jpeg_term_destination(j_compress_ptr cinfo) {
+
+    guac_jpeg_destination* dest = (guac_jpeg_destination*) cinfo->dest;
+    int length = sizeof(dest->buffer) - dest->parent.free_in_buffer;
+
+    /* Pass any remaining data to handler */
+    if (length > 0 && dest->handler(dest->data, dest->buffer, length))
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+
+}
+
+int guac_jpeg_encode(cairo_surface_t* surface, int quality,
+        guac_encode_write_handler* handler, void* data) {
+
+    struct jpeg_compress_struct cinfo;
+    guac_jpeg_error error;
+    guac_jpeg_destination dest;
+    JSAMPROW converted = NULL;
+    JSAMPROW row;
+
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    unsigned char* pixels = cairo_image_surface_get_data(surface);
+
+    /* Only 32-bit image surfaces are supported */
+    cairo_format_t format = cairo_image_surface_get_format(surface);
+    if (pixels == NULL || (format != CAIRO_FORMAT_RGB24
+                && format != CAIRO_FORMAT_ARGB32)) {
+        guac_error = GUAC_STATUS_INVALID_ARGUMENT;
+        guac_error_message = "JPEG encoding requires a 32-bit image surface";
+        return -1;
+    }
+
+    /* Flush pending operations to surface */
+    cairo_surface_flush(surface);
+
+#ifndef GUAC_JPEG_NATIVE_COLOR_SPACE
+    /* Allocate row for conversion to packed RGB */
+    converted = malloc(width * 3);
+#endif
+
+    /* Return here upon error */
+    cinfo.err = jpeg_std_error(&error.parent);
+    error.parent.error_exit = __guac_jpeg_error_exit;
+    if (setjmp(error.env)) {
+        jpeg_destroy_compress(&cinfo);
+        free(converted);
+        guac_error = GUAC_STATUS_IO_ERROR;
+        guac_error_message = "libjpeg output error";
+        return -1;
+    }
+
+    jpeg_create_compress(&cinfo);
+
+    /* Direct output to handler */
+    dest.parent.init_destination = __guac_jpeg_init_destination;
+    dest.parent.empty_output_buffer = __guac_jpeg_empty_output_buffer;
+    dest.parent.term_destination = __guac_jpeg_term_destination;
+    dest.handler = handler;
+    dest.data = data;
+    cinfo.dest = (struct jpeg_destination_mgr*) &dest;
+
+    /* Describe image */
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+
+#ifdef GUAC_JPEG_NATIVE_COLOR_SPACE
+    cinfo.input_components = 4;
+    cinfo.in_color_space = GUAC_JPEG_NATIVE_COLOR_SPACE;
+#else
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+#endif
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+
+        unsigned char* source = pixels + cinfo.next_scanline * stride;
+
+#ifdef GUAC_JPEG_NATIVE_COLOR_SPACE
+        /* Surface rows are already in a format libjpeg understands */
+        row = source;
+#else
+        /* Convert row to packed RGB */
+        uint32_t* current = (uint32_t*) source;
+        JSAMPROW output = converted;
+        int x;
+
+        for (x = 0; x < width; x++) {
+            uint32_t color = *(current++);
+            *(output++) = (color >> 16) & 0xFF;
+            *(output++) = (color >> 8)  & 0xFF;
+            *(output++) =  color        & 0xFF;
+        }
+
+        row = converted;
+#endif
+
+        jpeg_write_scanlines(&cinfo, &row, 1);
+
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(converted);
+
+    return 0;
+
+}
+
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_ENCODE_JPEG_H
+#define __GUAC_ENCODE_JPEG_H
+
+#include "config.h"
+
+#include "encode.h"
+
+#include <cairo/cairo.h>
+
+/**
+ * Encodes the given surface as a baseline JPEG of the given quality, passing
+ * the encoded data to the given handler as it is produced. Any alpha channel
+ * of the surface is ignored. The encoded image is never buffered in its
+ * entirety.
+ *
+ * @param surface
+ *     The Cairo surface to encode.
+ *
+ * @param quality
+ *     The JPEG quality to use, from 0 to 100.
+ *
+ * @param handler
+ *     The handler to invoke for each chunk of encoded data.
+ *
+ * @param data
+ *     Arbitrary data to pass to the handler.
+ *
+ * @return
+ *     Zero if the image was encoded successfully, non-zero otherwise, in
+ *     which case guac_error is set appropriately.
+ */
+int guac_jpeg_encode(cairo_surface_t* surface, int quality,
+        guac_encode_write_handler* handler, void* data);
+
+#endif
+
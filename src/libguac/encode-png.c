@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "encode.h"
+#include "encode-png.h"
+#include "error.h"
+#include "palette.h"
+
+#include <png.h>
+#include <cairo/cairo.h>
+
+#ifdef HAVE_PNGSTRUCT_H
+#include <pngstruct.h>
+#endif
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The handler and associated data receiving the output of an in-progress
+ * call to guac_png_encode().
+ */
+typedef struct guac_png_output {
+
+    /**
+     * The handler to invoke for each chunk of encoded data.
+     */
+    guac_encode_write_handler* handler;
+
+    /**
+     * Arbitrary data to pass to the handler.
+     */
+    void* data;
+
+} guac_png_output;
+
+/**
+ * Key used to store the palette of each thread which encodes PNG images,
+ * such that the palette and its storage are reused across images.
+ */
+static pthread_key_t __guac_png_palette_key;
+
+/**
+ * Guard ensuring __guac_png_palette_key is created exactly once.
+ */
+static pthread_once_t __guac_png_palette_key_init = PTHREAD_ONCE_INIT;
+
+/**
+ * Frees the given palette upon exit of the thread which used it.
+ */
+static void __guac_png_palette_destroy(void* palette) {
+    guac_palette_free((guac_palette*) palette);
+}
+
+/**
+ * Creates __guac_png_palette_key.
+ */
+static void __guac_png_palette_key_alloc() {
+    pthread_key_create(&__guac_png_palette_key, __guac_png_palette_destroy);
+}
+
+/**
+ * Returns the palette belonging to the current thread, allocating it if
+ * necessary, or NULL if no palette could be allocated.
+ */
+static guac_palette* __guac_png_get_palette() {
+
+    guac_palette* palette;
+
+    pthread_once(&__guac_png_palette_key_init, __guac_png_palette_key_alloc);
+
+    /* Allocate palette upon first use by this thread */
+    palette = (guac_palette*) pthread_getspecific(__guac_png_palette_key);
+    if (palette == NULL) {
+        palette = guac_palette_alloc();
+        if (palette != NULL)
+            pthread_setspecific(__guac_png_palette_key, palette);
+    }
+
+    return palette;
+
+}
+
+/**
+ * libpng write function which passes all data to the guac_png_output
+ * associated with the given PNG write structure.
+ */
+static void __guac_png_write_data(png_structp png, png_bytep data,
+        png_size_t length) {
+
+    /* Get output structure */
+    guac_png_output* output;
+#ifdef HAVE_PNG_GET_IO_PTR
+    output = (guac_png_output*) png_get_io_ptr(png);
+#else
+    output = (guac_png_output*) png->io_ptr;
+#endif
+
+    if (output->handler(output->data, data, length))
+        png_error(png, "PNG output handler failed");
+
+}
+
+/**
+ * libpng flush function. Data is always passed along immediately, thus there
+ * is nothing to flush.
+ */
+static void __guac_png_flush_data(png_structp png) {
+    /* Dummy function */
+}
+
+/**
+ * Cairo write function which passes all data to the given guac_png_output.
+ */
+static cairo_status_t __guac_png_write_cairo(void* closure,
+        const unsigned char* data, unsigned int length) {
+
+    guac_png_output* output = (guac_png_output*) closure;
+
+    if (output->handler(output->data, data, length))
+        return CAIRO_STATUS_WRITE_ERROR;
+
+    return CAIRO_STATUS_SUCCESS;
+
+}
+
+/**
+ * Encodes the given surface as PNG using Cairo's own PNG encoder.
+ */
+static int __guac_png_encode_cairo(cairo_surface_t* surface,
+        guac_png_output* output) {
+
+    if (cairo_surface_write_to_png_stream(surface, __guac_png_write_cairo,
+                output) != CAIRO_STATUS_SUCCESS) {
+        guac_error = GUAC_STATUS_INTERNAL_ERROR;
+        guac_error_message = "Cairo PNG backend failed";
+        return -1;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Packs the given row of 8-bit palette indices in place, such that each
+ * index occupies only the given number of bits, most significant first, as
+ * required by PNG.
+ */
+static void __guac_png_pack_row(unsigned char* row, int width, int bpp) {
+
+    unsigned char* packed = row;
+    int x;
+
+    switch (bpp) {
+
+        case 1:
+            for (x=0; x+8<=width; x+=8, row+=8)
+                *(packed++) = (row[0] << 7) | (row[1] << 6) | (row[2] << 5)
+                            | (row[3] << 4) | (row[4] << 3) | (row[5] << 2)
+                            | (row[6] << 1) |  row[7];
+            break;
+
+        case 2:
+            for (x=0; x+4<=width; x+=4, row+=4)
+                *(packed++) = (row[0] << 6) | (row[1] << 4) | (row[2] << 2)
+                            |  row[3];
+            break;
+
+        case 4:
+            for (x=0; x+2<=width; x+=2, row+=2)
+                *(packed++) = (row[0] << 4) | row[1];
+            break;
+
+        /* Nothing to pack at 8 bits per index */
+        default:
+            return;
+
+    }
+
+    /* Pack final partial byte, padding with zeroes */
+    if (x < width) {
+
+        int value = 0;
+        int shift = 8 - bpp;
+
+        for (; x<width; x++, shift-=bpp)
+            value |= *(row++) << shift;
+
+        *packed = value;
+
+    }
+
+}
+
+/**
+ * Encodes the given RGB24 surface as a palette PNG using the given palette,
+ * which must have been built from the same surface. Each row is mapped to
+ * palette indices only as it is written, packed in place within the single
+ * row of index storage held by the palette.
+ */
+static int __guac_png_encode_palette(cairo_surface_t* surface,
+        guac_palette* palette, guac_png_output* output) {
+
+    png_structp png;
+    png_infop png_info;
+    unsigned char* data;
+    int stride;
+    int bpp;
+
+    int y;
+
+    /* Get image surface properties */
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+
+    data = cairo_image_surface_get_data(surface);
+    stride = cairo_image_surface_get_stride(surface);
+
+    /* Calculate BPP from palette size */
+    if      (palette->size <= 2)  bpp = 1;
+    else if (palette->size <= 4)  bpp = 2;
+    else if (palette->size <= 16) bpp = 4;
+    else                          bpp = 8;
+
+    /* Set up PNG writer */
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png) {
+        guac_error = GUAC_STATUS_INTERNAL_ERROR;
+        guac_error_message = "libpng failed to create write structure";
+        return -1;
+    }
+
+    png_info = png_create_info_struct(png);
+    if (!png_info) {
+        png_destroy_write_struct(&png, NULL);
+        guac_error = GUAC_STATUS_INTERNAL_ERROR;
+        guac_error_message = "libpng failed to create info structure";
+        return -1;
+    }
+
+    /* Set error handler */
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &png_info);
+        guac_error = GUAC_STATUS_IO_ERROR;
+        guac_error_message = "libpng output error";
+        return -1;
+    }
+
+    /* Set up writer */
+    png_set_write_fn(png, output,
+            __guac_png_write_data,
+            __guac_png_flush_data);
+
+    /* Write image info */
+    png_set_IHDR(
+        png,
+        png_info,
+        width,
+        height,
+        bpp,
+        PNG_COLOR_TYPE_PALETTE,
+        PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT,
+        PNG_FILTER_TYPE_DEFAULT
+    );
+
+    /* Write palette */
+    png_set_PLTE(png, png_info, palette->colors, palette->size);
+    png_write_info(png, png_info);
+
+    /* Map, pack, and write each row of indices */
+    for (y=0; y<height; y++) {
+        unsigned char* row = guac_palette_map_row(palette,
+                (uint32_t*) (data + y * stride), width);
+        __guac_png_pack_row(row, width, bpp);
+        png_write_row(png, row);
+    }
+
+    /* Finish write */
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &png_info);
+
+    return 0;
+
+}
+
+int guac_png_encode(cairo_surface_t* surface,
+        guac_encode_write_handler* handler, void* data) {
+
+    guac_png_output output;
+    guac_palette* palette;
+    int result;
+
+    output.handler = handler;
+    output.data = data;
+
+    /* If not RGB24, use Cairo PNG writer */
+    if (cairo_image_surface_get_format(surface) != CAIRO_FORMAT_RGB24
+            || cairo_image_surface_get_data(surface) == NULL)
+        return __guac_png_encode_cairo(surface, &output);
+
+    /* Flush pending operations to surface */
+    cairo_surface_flush(surface);
+
+    /* Attempt to build palette, reusing that of the current thread */
+    palette = __guac_png_get_palette();
+
+    /* If not possible, resort to Cairo PNG writer */
+    if (palette == NULL || guac_palette_build(palette, surface))
+        result = __guac_png_encode_cairo(surface, &output);
+
+    else
+        result = __guac_png_encode_palette(surface, palette, &output);
+
+    return result;
+
+}
+
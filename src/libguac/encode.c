@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "encode.h"
+#include "encode-png.h"
+#include "error.h"
+#include "protocol.h"
+#include "socket.h"
+#include "stream.h"
+
+#ifdef ENABLE_JPEG
+#include "encode-jpeg.h"
+#endif
+
+#include <cairo/cairo.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The state of an image being streamed by guac_encode_stream().
+ */
+typedef struct guac_encode_stream_state {
+
+    /**
+     * The socket over which blobs are sent.
+     */
+    guac_socket* socket;
+
+    /**
+     * The stream over which blobs are sent.
+     */
+    guac_stream* stream;
+
+    /**
+     * Encoded data not yet sent.
+     */
+    unsigned char buffer[GUAC_ENCODE_BLOB_SIZE];
+
+    /**
+     * The number of bytes currently within the buffer.
+     */
+    int length;
+
+    /**
+     * The total number of bytes of encoded data produced thus far.
+     */
+    uint64_t total;
+
+    /**
+     * The time at which the first blob was sent, in microseconds, or zero if
+     * no blob has yet been sent.
+     */
+    uint64_t first_blob;
+
+} guac_encode_stream_state;
+
+/**
+ * Returns the current value of a monotonic clock, in microseconds.
+ */
+static uint64_t __guac_encode_monotonic_us() {
+
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+
+    return (uint64_t) current.tv_sec * 1000000 + current.tv_nsec / 1000;
+
+}
+
+/**
+ * Records an encoded image within the image statistics of the given socket.
+ *
+ * @param socket The socket whose statistics should be updated.
+ * @param format The format the image was encoded in.
+ * @param surface The surface which was encoded.
+ * @param bytes The size of the encoded image, in bytes.
+ * @param encode_time The time taken to encode the image, in microseconds.
+ */
+static void __guac_encode_record(guac_socket* socket,
+        guac_encode_format format, cairo_surface_t* surface,
+        uint64_t bytes, uint64_t encode_time) {
+
+    guac_socket_image_stats* stats = &(socket->__image_stats);
+    uint64_t pixels = (uint64_t) cairo_image_surface_get_width(surface)
+                    * cairo_image_surface_get_height(surface);
+
+    pthread_mutex_lock(&(socket->__image_stats_lock));
+
+    if (format == GUAC_ENCODE_JPEG) {
+        stats->jpeg_images++;
+        stats->jpeg_bytes += bytes;
+        stats->jpeg_time += encode_time;
+        stats->jpeg_pixels += pixels;
+    }
+
+    else {
+        stats->png_images++;
+        stats->png_bytes += bytes;
+        stats->png_time += encode_time;
+        stats->png_pixels += pixels;
+    }
+
+    pthread_mutex_unlock(&(socket->__image_stats_lock));
+
+}
+
+int guac_encode_supported(guac_encode_format format) {
+
+#ifndef ENABLE_JPEG
+    if (format == GUAC_ENCODE_JPEG)
+        return 0;
+#endif
+
+    return 1;
+
+}
+
+int guac_encode_surface(guac_encode_format format, cairo_surface_t* surface,
+        int quality, guac_encode_write_handler* handler, void* data) {
+
+#ifdef ENABLE_JPEG
+    if (format == GUAC_ENCODE_JPEG)
+        return guac_jpeg_encode(surface, quality, handler, data);
+#else
+    if (format == GUAC_ENCODE_JPEG) {
+        guac_error = GUAC_STATUS_NOT_SUPPORTED;
+        guac_error_message = "JPEG support was not enabled at build time";
+        return -1;
+    }
+#endif
+
+    return guac_png_encode(surface, handler, data);
+
+}
+
+/**
+ * guac_encode_write_handler which appends all encoded data to the given
+ * guac_encode_buffer, growing its storage as necessary.
+ */
+static int __guac_encode_buffer_write(void* data,
+        const unsigned char* buffer, int length) {
+
+    guac_encode_buffer* encoded = (guac_encode_buffer*) data;
+    unsigned char* resized;
+
+    /* Calculate next buffer size */
+    int next_size = encoded->length + length;
+
+    /* If need resizing, double buffer size until big enough */
+    if (next_size > encoded->size) {
+
+        do {
+            encoded->size <<= 1;
+        } while (next_size > encoded->size);
+
+        /* Resize buffer, aborting encoding if impossible */
+        resized = realloc(encoded->data, encoded->size);
+        if (resized == NULL) {
+            guac_error = GUAC_STATUS_NO_MEMORY;
+            guac_error_message = "Unable to grow buffer for encoded image";
+            return -1;
+        }
+
+        encoded->data = resized;
+
+    }
+
+    /* Append data to buffer */
+    memcpy(encoded->data + encoded->length, buffer, length);
+    encoded->length += length;
+
+    return 0;
+
+}
+
+int guac_encode_buffer_surface(guac_socket* socket, guac_encode_buffer* buffer,
+        guac_encode_format format, cairo_surface_t* surface, int quality) {
+
+    uint64_t start = __guac_encode_monotonic_us();
+
+    /* Set up buffer */
+    buffer->size = 8192;
+    buffer->data = malloc(buffer->size);
+    buffer->length = 0;
+
+    if (buffer->data == NULL) {
+        guac_error = GUAC_STATUS_NO_MEMORY;
+        guac_error_message = "Unable to allocate buffer for encoded image";
+        return -1;
+    }
+
+    /* Encode entire image */
+    if (guac_encode_surface(format, surface, quality,
+                __guac_encode_buffer_write, buffer)) {
+        guac_encode_buffer_free(buffer);
+        return -1;
+    }
+
+    __guac_encode_record(socket, format, surface, buffer->length,
+            __guac_encode_monotonic_us() - start);
+
+    return 0;
+
+}
+
+void guac_encode_buffer_free(guac_encode_buffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+}
+
+/**
+ * Sends all data currently buffered within the given stream state as a
+ * single blob, recording the time if this is the first blob of the image.
+ */
+static int __guac_encode_stream_flush(guac_encode_stream_state* state) {
+
+    if (state->length == 0)
+        return 0;
+
+    if (guac_protocol_send_blob(state->socket, state->stream,
+                state->buffer, state->length))
+        return -1;
+
+    if (state->first_blob == 0)
+        state->first_blob = __guac_encode_monotonic_us();
+
+    state->length = 0;
+    return 0;
+
+}
+
+/**
+ * guac_encode_write_handler which appends encoded data to the buffer of the
+ * given guac_encode_stream_state, sending a blob each time the buffer fills.
+ */
+static int __guac_encode_stream_write(void* data, const unsigned char* buffer,
+        int length) {
+
+    guac_encode_stream_state* state = (guac_encode_stream_state*) data;
+
+    state->total += length;
+
+    while (length > 0) {
+
+        /* Copy as much as will fit within the current blob */
+        int remaining = GUAC_ENCODE_BLOB_SIZE - state->length;
+        if (remaining > length)
+            remaining = length;
+
+        memcpy(state->buffer + state->length, buffer, remaining);
+        state->length += remaining;
+        buffer += remaining;
+        length -= remaining;
+
+        /* Send blob once full */
+        if (state->length == GUAC_ENCODE_BLOB_SIZE
+                && __guac_encode_stream_flush(state))
+            return -1;
+
+    }
+
+    return 0;
+
+}
+
+int guac_encode_stream(guac_socket* socket, guac_stream* stream,
+        guac_encode_format format, cairo_surface_t* surface, int quality,
+        guac_encode_stream_stats* image) {
+
+    guac_encode_stream_state state;
+    guac_socket_image_stats* stats = &(socket->__image_stats);
+    uint64_t start = __guac_encode_monotonic_us();
+    uint64_t first_blob_time;
+    uint64_t total_time;
+
+    state.socket = socket;
+    state.stream = stream;
+    state.length = 0;
+    state.total = 0;
+    state.first_blob = 0;
+
+    /* Encode and send image, including any final partial blob */
+    if (guac_encode_surface(format, surface, quality,
+                __guac_encode_stream_write, &state)
+            || __guac_encode_stream_flush(&state))
+        return -1;
+
+    total_time = __guac_encode_monotonic_us() - start;
+    __guac_encode_record(socket, format, surface, state.total, total_time);
+
+    /* Update streaming statistics, counting no time if no blob was sent */
+    first_blob_time = state.first_blob != 0 ? state.first_blob - start : 0;
+    pthread_mutex_lock(&(socket->__image_stats_lock));
+
+    stats->streamed_images++;
+    stats->first_blob_time += first_blob_time;
+    if (first_blob_time > stats->max_first_blob_time)
+        stats->max_first_blob_time = first_blob_time;
+
+    pthread_mutex_unlock(&(socket->__image_stats_lock));
+
+    if (image != NULL) {
+        image->bytes = state.total;
+        image->first_blob_time = first_blob_time;
+        image->total_time = total_time;
+    }
+
+    return 0;
+
+}
+
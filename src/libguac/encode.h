@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __GUAC_ENCODE_H
+#define __GUAC_ENCODE_H
+
+#include "config.h"
+
+#include "socket.h"
+#include "stream.h"
+
+#include <cairo/cairo.h>
+
+#include <stdint.h>
+
+/**
+ * The maximum number of bytes of encoded image data to send within each blob
+ * instruction when streaming an image. Once base64-encoded, each blob will
+ * contain no more than 8064 bytes of data.
+ */
+#define GUAC_ENCODE_BLOB_SIZE 6048
+
+/**
+ * All image formats supported by the encoders within libguac.
+ */
+typedef enum guac_encode_format {
+
+    /**
+     * Lossless PNG, written as a palette image where possible.
+     */
+    GUAC_ENCODE_PNG,
+
+    /**
+     * Lossy JPEG.
+     */
+    GUAC_ENCODE_JPEG
+
+} guac_encode_format;
+
+/**
+ * Handler which receives encoded image data as it is produced by an encoder.
+ * Each call receives the next contiguous chunk of the encoded image.
+ *
+ * @param data
+ *     The arbitrary data pointer originally given to the encoder.
+ *
+ * @param buffer
+ *     The next chunk of encoded data.
+ *
+ * @param length
+ *     The number of bytes in the given chunk.
+ *
+ * @return
+ *     Zero if the chunk was handled successfully, non-zero if encoding
+ *     should be aborted.
+ */
+typedef int guac_encode_write_handler(void* data, const unsigned char* buffer,
+        int length);
+
+/**
+ * An image which has been encoded in its entirety into memory.
+ */
+typedef struct guac_encode_buffer {
+
+    /**
+     * The encoded image data.
+     */
+    unsigned char* data;
+
+    /**
+     * The number of bytes of encoded image data.
+     */
+    int length;
+
+    /**
+     * The number of bytes allocated for data.
+     */
+    int size;
+
+} guac_encode_buffer;
+
+/**
+ * Measurements of a single image sent by guac_encode_stream().
+ */
+typedef struct guac_encode_stream_stats {
+
+    /**
+     * The size of the encoded image, in bytes.
+     */
+    uint64_t bytes;
+
+    /**
+     * The time elapsed between the start of encoding and the first blob
+     * being written, in microseconds.
+     */
+    uint64_t first_blob_time;
+
+    /**
+     * The time taken to encode and write the entire image, in microseconds.
+     */
+    uint64_t total_time;
+
+} guac_encode_stream_stats;
+
+/**
+ * Returns whether the given image format was enabled when libguac was built.
+ *
+ * @param format
+ *     The image format to check.
+ *
+ * @return
+ *     Non-zero if images can be encoded in the given format, zero otherwise.
+ */
+int guac_encode_supported(guac_encode_format format);
+
+/**
+ * Encodes the given surface in the given format, passing the encoded data to
+ * the given handler as it is produced.
+ *
+ * @param format
+ *     The format to encode the surface in.
+ *
+ * @param surface
+ *     The Cairo surface to encode.
+ *
+ * @param quality
+ *     The quality to use for lossy formats, from 0 to 100. This is ignored
+ *     by lossless formats.
+ *
+ * @param handler
+ *     The handler to invoke for each chunk of encoded data.
+ *
+ * @param data
+ *     Arbitrary data to pass to the handler.
+ *
+ * @return
+ *     Zero if the image was encoded successfully, non-zero otherwise, in
+ *     which case guac_error is set appropriately.
+ */
+int guac_encode_surface(guac_encode_format format, cairo_surface_t* surface,
+        int quality, guac_encode_write_handler* handler, void* data);
+
+/**
+ * Encodes the given surface in its entirety into the given buffer, recording
+ * the encoded size and the time taken within the image statistics of the
+ * given socket. The buffer must later be freed with
+ * guac_encode_buffer_free().
+ *
+ * @param socket
+ *     The socket whose image statistics should be updated.
+ *
+ * @param buffer
+ *     The buffer to encode the image into.
+ *
+ * @param format
+ *     The format to encode the surface in.
+ *
+ * @param surface
+ *     The Cairo surface to encode.
+ *
+ * @param quality
+ *     The quality to use for lossy formats, from 0 to 100.
+ *
+ * @return
+ *     Zero if the image was encoded successfully, non-zero otherwise, in
+ *     which case guac_error is set appropriately and the buffer need not be
+ *     freed.
+ */
+int guac_encode_buffer_surface(guac_socket* socket, guac_encode_buffer* buffer,
+        guac_encode_format format, cairo_surface_t* surface, int quality);
+
+/**
+ * Frees the data of the given buffer.
+ *
+ * @param buffer
+ *     The buffer to free.
+ */
+void guac_encode_buffer_free(guac_encode_buffer* buffer);
+
+/**
+ * Encodes the given surface, sending the encoded data over the given stream
+ * as a series of blob instructions, each containing no more than
+ * GUAC_ENCODE_BLOB_SIZE bytes. Blobs are sent as soon as they are filled,
+ * such that the first blob leaves before encoding has completed. The stream
+ * is not ended by this function. The image statistics of the socket are
+ * updated accordingly.
+ *
+ * @param socket
+ *     The guac_socket over which blobs should be sent.
+ *
+ * @param stream
+ *     The stream to send the encoded image over.
+ *
+ * @param format
+ *     The format to encode the surface in.
+ *
+ * @param surface
+ *     The Cairo surface to encode.
+ *
+ * @param quality
+ *     The quality to use for lossy formats, from 0 to 100.
+ *
+ * @param image
+ *     The guac_encode_stream_stats to populate with measurements of the
+ *     image sent, or NULL if these measurements are not needed.
+ *
+ * @return
+ *     Zero if the image was encoded and sent successfully, non-zero
+ *     otherwise, in which case guac_error is set appropriately.
+ */
+int guac_encode_stream(guac_socket* socket, guac_stream* stream,
+        guac_encode_format format, cairo_surface_t* surface, int quality,
+        guac_encode_stream_stats* image);
+
+#endif
+
@@ -34,6 +34,71 @@
  */
 #define GUAC_CLIENT_MAX_STREAMS 64
 
+/**
+ * The number of slots within the hashed table of instruction handlers of each
+ * guac_client. This must be a power of two, and is the maximum number of
+ * distinct opcodes which may be handled, including those handled by libguac
+ * itself.
+ */
+#define GUAC_CLIENT_INSTRUCTION_HANDLERS 64
+
+/**
+ * The maximum number of unacknowledged "sync" instructions tracked by each
+ * guac_client when estimating the speed of its connection. Older syncs are
+ * forgotten once this many are pending.
+ */
+#define GUAC_CLIENT_MAX_PENDING_SYNCS 32
+
+/**
+ * The number of round-trip samples over which the minimum round-trip time is
+ * taken. The minimum of the previous window is retained alongside that of
+ * the current window, such that the estimate adapts to route changes.
+ */
+#define GUAC_CLIENT_RTT_WINDOW 64
+
+/**
+ * The minimum number of bytes which must be sent between two syncs for the
+ * time taken to acknowledge the latter to be used as a bandwidth sample.
+ * Smaller frames are dominated by latency and say little about throughput.
+ */
+#define GUAC_CLIENT_MIN_SAMPLE_BYTES 8192
+
+/**
+ * The shortest transfer duration, in milliseconds, which is considered
+ * measurable. Frames which appear to transfer more quickly than this only
+ * provide a lower bound on bandwidth.
+ */
+#define GUAC_CLIENT_MIN_SAMPLE_DURATION 10
+
+/**
+ * The smallest number of frames which may be in flight, unacknowledged by
+ * the remote client, before further frames must wait. This is also the
+ * window used until the speed of the connection has been measured.
+ */
+#define GUAC_CLIENT_MIN_FRAME_WINDOW 2
+
+/**
+ * The largest number of frames which may be in flight, unacknowledged by the
+ * remote client, before further frames must wait. This must not exceed
+ * GUAC_CLIENT_MAX_PENDING_SYNCS.
+ */
+#define GUAC_CLIENT_MAX_FRAME_WINDOW 16
+
+/**
+ * The maximum number of file descriptors which may be registered with a
+ * single guac_client for the sake of event-driven handling of server
+ * messages.
+ */
+#define GUAC_CLIENT_MAX_FDS 8
+
+/**
+ * The value returned by a guac_client_fd_handler which has handled server
+ * messages without completing a frame. No "sync" instruction follows such a
+ * call, the frame instead being completed later, typically by the handler
+ * of the client timer.
+ */
+#define GUAC_CLIENT_FRAME_PENDING 1
+
 /**
  * The index of a closed stream.
  */
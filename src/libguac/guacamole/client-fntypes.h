@@ -31,17 +31,40 @@
  */
 
 #include "client-types.h"
+#include "instruction-types.h"
 #include "protocol-types.h"
 #include "stream-types.h"
 
 #include <stdarg.h>
 
+/**
+ * Handler for instructions received from the web-client having a particular
+ * opcode, as added with guac_client_set_instruction_handler().
+ */
+typedef int guac_client_instruction_handler(guac_client* client,
+        guac_instruction* instruction);
+
 /**
  * Handler for server messages (where "server" refers to the server that
  * the proxy client is connected to).
  */
 typedef int guac_client_handle_messages(guac_client* client);
 
+/**
+ * Handler for data which has become available on a file descriptor
+ * registered with guac_client_add_fd(), typically the connection to the
+ * server that the proxy client is connected to. The handler must handle
+ * only the data available without blocking, and then return zero if a frame
+ * has been completed, GUAC_CLIENT_FRAME_PENDING if the frame remains open,
+ * or a negative value if an error occurred.
+ */
+typedef int guac_client_fd_handler(guac_client* client, int fd);
+
+/**
+ * Handler for the expiry of the timer armed with guac_client_set_timer().
+ */
+typedef int guac_client_timer_handler(guac_client* client);
+
 /**
  * Handler for Guacamole mouse events.
  */
@@ -118,5 +141,13 @@ typedef void guac_client_log_handler(guac_client* client, guac_client_log_level
  */
 typedef int guac_client_init_handler(guac_client* client, int argc, char** argv);
 
+/**
+ * Handler which should initialize any state which is shared by all clients
+ * of a plugin, such as font caches or library-wide tables, ahead of any
+ * connection. This is invoked at most once per process, before any client is
+ * initialized, and only if the plugin is loaded in advance of connections.
+ */
+typedef int guac_client_preload_handler();
+
 #endif
 
@@ -93,5 +93,40 @@ typedef enum guac_client_log_level {
  */
 typedef struct guac_client_info guac_client_info;
 
+/**
+ * Statistics describing the images streamed to the remote client using
+ * guac_client_stream_png() or guac_client_stream_jpeg().
+ */
+typedef struct guac_client_image_stats guac_client_image_stats;
+
+/**
+ * Statistics describing the handling of all received instructions having a
+ * particular opcode.
+ */
+typedef struct guac_client_handler_stats guac_client_handler_stats;
+
+/**
+ * A single slot within the hashed table of instruction handlers of a
+ * guac_client.
+ */
+typedef struct __guac_client_handler_slot __guac_client_handler_slot;
+
+/**
+ * Estimates of the round-trip time and throughput of the connection between
+ * guacd and the remote client, derived from "sync" instructions.
+ */
+typedef struct guac_client_link_stats guac_client_link_stats;
+
+/**
+ * A "sync" instruction which has been sent but not yet acknowledged.
+ */
+typedef struct __guac_client_sync __guac_client_sync;
+
+/**
+ * A file descriptor registered with a guac_client, along with the handler
+ * to invoke when that file descriptor becomes readable.
+ */
+typedef struct guac_client_fd guac_client_fd;
+
 #endif
 
@@ -35,11 +35,16 @@
 #include "instruction-types.h"
 #include "layer-types.h"
 #include "pool-types.h"
+#include "protocol-types.h"
 #include "socket-types.h"
 #include "stream-types.h"
 #include "timestamp-types.h"
 
+#include <cairo/cairo.h>
+
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 struct guac_client_info {
 
@@ -82,6 +87,171 @@ struct guac_client_info {
 
 };
 
+struct guac_client_image_stats {
+
+    /**
+     * The number of images streamed.
+     */
+    uint64_t images;
+
+    /**
+     * The total number of bytes of encoded image data streamed, not
+     * including the overhead of base64 encoding or of the surrounding
+     * instructions.
+     */
+    uint64_t bytes;
+
+    /**
+     * The total time elapsed between the start of encoding and the first blob
+     * of each image being written, in microseconds.
+     */
+    uint64_t first_blob_time;
+
+    /**
+     * The longest time elapsed between the start of encoding and the first
+     * blob of any image being written, in microseconds.
+     */
+    uint64_t max_first_blob_time;
+
+    /**
+     * The total time taken to encode and write each image, in microseconds.
+     */
+    uint64_t total_time;
+
+    /**
+     * The longest time taken to encode and write any image, in microseconds.
+     */
+    uint64_t max_total_time;
+
+};
+
+struct guac_client_handler_stats {
+
+    /**
+     * The opcode of the instructions described by these statistics.
+     */
+    const char* opcode;
+
+    /**
+     * The number of instructions with this opcode which have been handled.
+     * This is only updated while handler timing is enabled.
+     */
+    uint64_t count;
+
+    /**
+     * The total amount of time spent within the handler for this opcode, in
+     * nanoseconds. This is only updated while handler timing is enabled.
+     */
+    uint64_t total_time;
+
+    /**
+     * The longest time spent within any single call to the handler for this
+     * opcode, in nanoseconds. This is only updated while handler timing is
+     * enabled.
+     */
+    uint64_t max_time;
+
+};
+
+struct __guac_client_handler_slot {
+
+    /**
+     * The hash of the opcode stored within this slot.
+     */
+    unsigned int hash;
+
+    /**
+     * The handler to invoke for instructions having this opcode, or NULL if
+     * this slot is unused.
+     */
+    guac_client_instruction_handler* handler;
+
+    /**
+     * The opcode handled, along with statistics describing its handling.
+     */
+    guac_client_handler_stats stats;
+
+};
+
+struct guac_client_link_stats {
+
+    /**
+     * The number of "sync" instructions acknowledged by the remote client.
+     */
+    uint64_t syncs;
+
+    /**
+     * The smoothed time between sending a "sync" instruction and receiving
+     * its acknowledgement, in milliseconds. This includes the time taken to
+     * transfer and process everything sent before that sync.
+     */
+    int rtt;
+
+    /**
+     * The shortest recent round-trip time, in milliseconds, approximating
+     * the latency of the connection when idle.
+     */
+    int min_rtt;
+
+    /**
+     * The smoothed estimate of the rate at which the remote client receives
+     * and processes data, in bytes per second, or zero if no estimate has
+     * yet been made.
+     */
+    int bandwidth;
+
+    /**
+     * The number of frames large enough to have contributed to the
+     * bandwidth estimate.
+     */
+    uint64_t bandwidth_samples;
+
+    /**
+     * The smoothed time between acknowledgements of frames sent while the
+     * connection was busy, in milliseconds, reflecting the rate at which
+     * the remote client drains frames, or zero if not yet measured.
+     */
+    int frame_interval;
+
+    /**
+     * The number of frames which may currently be in flight, unacknowledged
+     * by the remote client, before further frames must wait. This is enough
+     * frames to keep the connection busy throughout its round trip at the
+     * rate frames are being drained.
+     */
+    int frame_window;
+
+};
+
+struct __guac_client_sync {
+
+    /**
+     * The timestamp sent within the "sync" instruction.
+     */
+    guac_timestamp timestamp;
+
+    /**
+     * The total number of bytes written to the socket of the client once
+     * the "sync" instruction had been flushed.
+     */
+    uint64_t bytes;
+
+};
+
+struct guac_client_fd {
+
+    /**
+     * The file descriptor to watch for readability.
+     */
+    int fd;
+
+    /**
+     * The handler to invoke whenever the file descriptor is readable.
+     */
+    guac_client_fd_handler* handler;
+
+};
+
 struct guac_client {
 
     /**
@@ -385,6 +555,12 @@ struct guac_client {
      */
     guac_pool* __stream_pool;
 
+    /**
+     * Lock which is acquired when streams are allocated or freed, such that
+     * streams may be used by multiple threads.
+     */
+    pthread_mutex_t __stream_lock;
+
     /**
      * All available output streams (data going to connected client).
      */
@@ -404,6 +580,119 @@ struct guac_client {
      */
     char* connection_id;
 
+    /**
+     * Statistics describing all images streamed thus far using
+     * guac_client_stream_png() or guac_client_stream_jpeg(). As images may
+     * be streamed by several threads at once, these statistics are updated
+     * only while __image_stats_lock is held.
+     */
+    guac_client_image_stats image_stats;
+
+    /**
+     * Lock which is acquired while image_stats is being updated.
+     */
+    pthread_mutex_t __image_stats_lock;
+
+    /**
+     * Hashed table of all opcodes handled by this client, indexed by opcode
+     * hash using linear probing. This table initially contains the handlers
+     * defined by libguac, which invoke the handlers of this structure, and
+     * may be extended with guac_client_set_instruction_handler().
+     */
+    __guac_client_handler_slot __handlers[GUAC_CLIENT_INSTRUCTION_HANDLERS];
+
+    /**
+     * Non-zero if the number of instructions handled and the time spent
+     * within each handler should be recorded, zero otherwise.
+     */
+    int __handler_timing;
+
+    /**
+     * Lock which is acquired while the link statistics of this client are
+     * updated or read.
+     */
+    pthread_mutex_t __link_lock;
+
+    /**
+     * Condition which is signalled whenever a "sync" is acknowledged, and
+     * thus whenever the frame window may have opened.
+     */
+    pthread_cond_t __link_cond;
+
+    /**
+     * All "sync" instructions sent but not yet acknowledged, oldest first.
+     */
+    __guac_client_sync __pending_syncs[GUAC_CLIENT_MAX_PENDING_SYNCS];
+
+    /**
+     * The number of entries within __pending_syncs.
+     */
+    int __pending_sync_count;
+
+    /**
+     * The total number of bytes written to the socket of this client as of
+     * the most recently acknowledged "sync".
+     */
+    uint64_t __acknowledged_bytes;
+
+    /**
+     * The time at which the most recent acknowledgement was received, or
+     * zero if no sync has been acknowledged.
+     */
+    guac_timestamp __last_acknowledged;
+
+    /**
+     * The shortest round-trip time within the current window of samples,
+     * in milliseconds.
+     */
+    int __window_min_rtt;
+
+    /**
+     * The shortest round-trip time within the previous window of samples,
+     * in milliseconds.
+     */
+    int __previous_min_rtt;
+
+    /**
+     * The number of samples within the current window of round-trip times.
+     */
+    int __window_samples;
+
+    /**
+     * Current estimates of the speed of the connection to the remote client.
+     */
+    guac_client_link_stats __link_stats;
+
+    /**
+     * All file descriptors registered with guac_client_add_fd().
+     */
+    guac_client_fd __fds[GUAC_CLIENT_MAX_FDS];
+
+    /**
+     * The number of entries within __fds.
+     */
+    int __fd_count;
+
+    /**
+     * The handler to invoke once the timer armed with guac_client_set_timer()
+     * expires, or NULL if the timer is not armed.
+     */
+    guac_client_timer_handler* __timer_handler;
+
+    /**
+     * The time at which the timer armed with guac_client_set_timer()
+     * expires.
+     */
+    guac_timestamp __timer_deadline;
+
+    /**
+     * The directory within which traces of this connection may be recorded
+     * for later analysis, or NULL if traces may not be recorded. This is
+     * set by whatever created the client, such as guacd, and is never
+     * chosen by the connecting user.
+     */
+    const char* trace_directory;
+
 };
 
 /**
@@ -423,16 +712,193 @@ void guac_client_free(guac_client* client);
 
 /**
  * Call the appropriate handler defined by the given client for the given
- * instruction. A comparison is made between the instruction opcode and the
- * initial handler lookup table defined in client-handlers.c. The intial
- * handlers will in turn call the client's handler (if defined).
+ * instruction. The handler is looked up by the hash of the instruction
+ * opcode within the handler table of the client, which initially contains
+ * the handlers defined in client-handlers.c. The intial handlers will in turn
+ * call the client's handler (if defined). Instructions having unrecognized
+ * opcodes are ignored.
  *
  * @param client The proxy client whose handlers should be called.
  * @param instruction The instruction to pass to the proxy client via the
  *                    appropriate handler.
+ * @return The value returned by the handler, or zero if the opcode is not
+ *         handled.
  */
 int guac_client_handle_instruction(guac_client* client, guac_instruction* instruction);
 
+/**
+ * Sets the handler which should be invoked for all instructions received
+ * having the given opcode, replacing any existing handler for that opcode,
+ * including those defined by libguac. This allows client plugins to handle
+ * opcodes beyond those of the core protocol.
+ *
+ * @param client The proxy client to add the handler to.
+ * @param opcode The opcode to handle. This string is not copied, and must
+ *               remain valid for the life of the client.
+ * @param handler The handler to invoke for instructions having the given
+ *                opcode. This must not be NULL.
+ * @return Zero if the handler was set successfully, non-zero if the handler
+ *         table is full, in which case guac_error is set appropriately.
+ */
+int guac_client_set_instruction_handler(guac_client* client,
+        const char* opcode, guac_client_instruction_handler* handler);
+
+/**
+ * Enables or disables recording of the number of instructions handled for
+ * each opcode, and of the time spent within each handler. Timing is disabled
+ * by default. This function must not be called while instructions are being
+ * handled.
+ *
+ * @param client The proxy client to enable or disable handler timing of.
+ * @param enabled Non-zero to enable handler timing, zero to disable.
+ */
+void guac_client_set_handler_timing(guac_client* client, int enabled);
+
+/**
+ * Retrieves statistics describing the handling of each opcode for which at
+ * least one instruction has been handled while handler timing was enabled.
+ * This function must not be called while instructions are being handled.
+ *
+ * @param client The proxy client to retrieve handler statistics of.
+ * @param stats An array of guac_client_handler_stats to populate.
+ * @param max The maximum number of entries to store within the array.
+ * @return The number of entries stored within the array.
+ */
+int guac_client_get_handler_stats(guac_client* client,
+        guac_client_handler_stats* stats, int max);
+
+/**
+ * Notes that a "sync" instruction bearing the given timestamp has just been
+ * sent and flushed on the socket of the given client. The bytes written
+ * since the previous sync, together with the time taken for this sync to be
+ * acknowledged, are used to estimate the speed of the connection.
+ *
+ * @param client The proxy client which sent the sync.
+ * @param timestamp The timestamp sent within the sync.
+ */
+void guac_client_sync_sent(guac_client* client, guac_timestamp timestamp);
+
+/**
+ * Updates the estimated speed of the connection of the given client upon
+ * acknowledgement of a "sync" instruction. This is called automatically by
+ * the handler for received "sync" instructions.
+ *
+ * @param client The proxy client which received the acknowledgement.
+ * @param timestamp The timestamp acknowledged.
+ * @param now The time at which the acknowledgement was received.
+ */
+void __guac_client_sync_received(guac_client* client,
+        guac_timestamp timestamp, guac_timestamp now);
+
+/**
+ * Retrieves the current estimates of the round-trip time and throughput of
+ * the connection of the given client. This function is threadsafe.
+ *
+ * @param client The proxy client to retrieve link statistics of.
+ * @param stats The guac_client_link_stats to populate.
+ */
+void guac_client_get_link_stats(guac_client* client,
+        guac_client_link_stats* stats);
+
+/**
+ * Returns whether another frame may be sent to the remote client of the
+ * given client, as fewer frames than the current frame window are awaiting
+ * acknowledgement. This function is threadsafe.
+ *
+ * @param client The proxy client to check.
+ * @return Non-zero if another frame may be sent, zero otherwise.
+ */
+int guac_client_can_send_frame(guac_client* client);
+
+/**
+ * Waits for up to the given number of milliseconds for the frame window of
+ * the given client to open, returning immediately if it is already open.
+ * The window opens as earlier frames are acknowledged.
+ *
+ * @param client The proxy client to wait for.
+ * @param msec The maximum number of milliseconds to wait.
+ * @return Non-zero if another frame may now be sent, zero if the timeout
+ *         elapsed first.
+ */
+int guac_client_wait_for_frame_window(guac_client* client, int msec);
+
+/**
+ * Registers the given file descriptor with the given client, such that the
+ * given handler is invoked whenever data is available to be read from that
+ * file descriptor and another frame may be sent. Each call to the handler
+ * which completes a frame is followed by a "sync" instruction, as with
+ * handle_messages. A handler leaving the frame open (by returning
+ * GUAC_CLIENT_FRAME_PENDING) should arm the client timer with
+ * guac_client_set_timer() to complete the frame later.
+ *
+ * If the program hosting the client supports this (as guacd does), all
+ * server messages are handled this way once any file descriptor is
+ * registered, and handle_messages is not called. Programs without such
+ * support continue to call handle_messages, which must thus still be set.
+ * File descriptors must be registered before guac_client_init() returns.
+ *
+ * @param client The proxy client to register the file descriptor with.
+ * @param fd The file descriptor to watch.
+ * @param handler The handler to invoke when the file descriptor is readable.
+ * @return Zero on success, non-zero if too many file descriptors are
+ *         already registered.
+ */
+int guac_client_add_fd(guac_client* client, int fd,
+        guac_client_fd_handler* handler);
+
+/**
+ * Returns the file descriptors registered with the given client through
+ * guac_client_add_fd(), storing at most the given number within the given
+ * array.
+ *
+ * @param client The proxy client to retrieve the file descriptors of.
+ * @param fds The array to populate.
+ * @param max The maximum number of entries to store within the array.
+ * @return The number of entries stored.
+ */
+int guac_client_get_fds(guac_client* client, guac_client_fd* fds, int max);
+
+/**
+ * Arms the single timer of the given client, such that the given handler is
+ * invoked once, after the given number of milliseconds, replacing any timer
+ * previously armed. As with handlers registered through guac_client_add_fd(),
+ * the handler is invoked only while another frame may be sent, and each call
+ * to the handler is followed by a "sync" instruction.
+ *
+ * The timer is honored only by programs which handle server messages through
+ * file descriptors registered with guac_client_add_fd() (as guacd does), and
+ * must only be armed from within handlers invoked by such programs. Clients
+ * relying on handle_messages must instead bound their own waits.
+ *
+ * @param client The proxy client whose timer should be armed.
+ * @param msec The number of milliseconds after which the handler should be
+ *             invoked, or a negative value to disarm the timer.
+ * @param handler The handler to invoke once the timer expires.
+ */
+void guac_client_set_timer(guac_client* client, int msec,
+        guac_client_timer_handler* handler);
+
+/**
+ * Returns the number of milliseconds until the timer of the given client
+ * expires.
+ *
+ * @param client The proxy client whose timer should be checked.
+ * @return The number of milliseconds until the timer expires, zero if the
+ *         timer has expired, or -1 if the timer is not armed.
+ */
+int guac_client_get_timer(guac_client* client);
+
+/**
+ * Disarms the timer of the given client and invokes its handler, regardless
+ * of whether the timer has expired. If the timer is not armed, this function
+ * has no effect.
+ *
+ * @param client The proxy client whose timer should be run.
+ * @return The value returned by the handler, or zero if the timer was not
+ *         armed.
+ */
+int guac_client_run_timer(guac_client* client);
+
 /**
  * Writes a message in the log used by the given client. The logger used will
  * normally be defined by guacd (or whichever program loads the proxy client)
@@ -536,7 +1002,8 @@ void guac_client_free_layer(guac_client* client, guac_layer* layer);
 
 /**
  * Allocates a new stream. An arbitrary index is automatically assigned
- * if no previously-allocated stream is available for use.
+ * if no previously-allocated stream is available for use. This function is
+ * threadsafe.
  *
  * @param client The proxy client to allocate the layer buffer for.
  * @return The next available stream, or a newly allocated stream.
@@ -545,13 +1012,63 @@ guac_stream* guac_client_alloc_stream(guac_client* client);
 
 /**
  * Returns the given stream to the pool of available streams, such that it
- * can be reused by any subsequent call to guac_client_alloc_stream().
+ * can be reused by any subsequent call to guac_client_alloc_stream(). This
+ * function is threadsafe.
  *
  * @param client The proxy client to return the buffer to.
  * @param stream The stream to return to the pool of available stream.
  */
 void guac_client_free_stream(guac_client* client, guac_stream* stream);
 
+/**
+ * Streams the contents of the given surface to the given layer as a PNG image
+ * using the "img" instruction. Unlike guac_protocol_send_png(), the encoded
+ * image is never buffered in its entirety, but is instead sent in a series
+ * of bounded blobs as it is produced by the encoder. A stream is allocated
+ * for the duration of the image, and is freed once the image has been sent.
+ * The image_stats of the client and the image statistics of the socket are
+ * updated accordingly.
+ *
+ * Remote clients which do not support the "img" instruction will not be able
+ * to display images sent by this function.
+ *
+ * @param client The proxy client to allocate the stream from.
+ * @param socket The socket over which the image should be sent.
+ * @param mode The composite mode to use when drawing the image.
+ * @param layer The destination layer.
+ * @param x The destination X coordinate.
+ * @param y The destination Y coordinate.
+ * @param surface A cairo surface containing the image data to send.
+ * @return Zero on success, non-zero on error, in which case guac_error is
+ *         set appropriately.
+ */
+int guac_client_stream_png(guac_client* client, guac_socket* socket,
+        guac_composite_mode mode, const guac_layer* layer, int x, int y,
+        cairo_surface_t* surface);
+
+/**
+ * Streams the contents of the given surface to the given layer as a JPEG
+ * image using the "img" instruction, in the same manner as
+ * guac_client_stream_png(). As JPEG is lossy, this is best suited to
+ * photographic content.
+ *
+ * @param client The proxy client to allocate the stream from.
+ * @param socket The socket over which the image should be sent.
+ * @param mode The composite mode to use when drawing the image.
+ * @param layer The destination layer.
+ * @param x The destination X coordinate.
+ * @param y The destination Y coordinate.
+ * @param surface A cairo surface containing the image data to send.
+ * @param quality The JPEG quality to use, from 0 to 100.
+ * @return Zero on success, non-zero on error, in which case guac_error is
+ *         set appropriately. If libguac was built without JPEG support,
+ *         guac_error is set to GUAC_STATUS_NOT_SUPPORTED and nothing is
+ *         sent.
+ */
+int guac_client_stream_jpeg(guac_client* client, guac_socket* socket,
+        guac_composite_mode mode, const guac_layer* layer, int x, int y,
+        cairo_surface_t* surface, int quality);
+
 /**
  * The default Guacamole client layer, layer 0.
  */
@@ -145,6 +145,26 @@ int guac_instruction_waiting(guac_socket* socket, int usec_timeout);
  */
 guac_instruction* guac_instruction_read(guac_socket* socket, int usec_timeout);
 
+/**
+ * Reads a single instruction from the given guac_socket connection, without
+ * allocating a new instruction. The instruction returned is owned by the
+ * socket, and is overwritten by the next call to guac_instruction_next() for
+ * the same socket. It must not be freed.
+ *
+ * If an error occurs reading the instruction, NULL is returned,
+ * and guac_error is set appropriately.
+ *
+ * @param socket The guac_socket connection to use.
+ * @param usec_timeout The maximum number of microseconds to wait before
+ *                     giving up.
+ * @return The instruction read, which remains valid only until the next
+ *         instruction is read from the same socket, or NULL on error or if
+ *         the instruction could not be read completely because the timeout
+ *         elapsed. As with guac_instruction_read(), subsequent calls will
+ *         continue parsing the incomplete instruction.
+ */
+guac_instruction* guac_instruction_next(guac_socket* socket, int usec_timeout);
+
 /**
  * Reads a single instruction with the given opcode from the given guac_socket
  * connection.
@@ -46,6 +46,12 @@ struct guac_client_plugin {
      */
     guac_client_init_handler* init_handler;
 
+    /**
+     * Reference to the preload handler of this client plugin, or NULL if
+     * the plugin has no state worth initializing in advance of connections.
+     */
+    guac_client_preload_handler* preload_handler;
+
     /**
      * NULL-terminated array of all arguments accepted by this client
      * plugin, in order. The values of these arguments will be passed
@@ -76,6 +82,19 @@ guac_client_plugin* guac_client_plugin_open(const char* protocol);
  */
 int guac_client_plugin_close(guac_client_plugin* plugin);
 
+/**
+ * Initializes any state shared by all clients of the given plugin, using the
+ * preload routine provided by that plugin, if any. This is intended to be
+ * called once, before any client is initialized, by processes which load
+ * plugins in advance of connections and then fork to handle each connection,
+ * such that the initialized state is inherited rather than rebuilt.
+ *
+ * @param plugin The client plugin to preload.
+ * @return Zero if preloading was successful or the plugin has no preload
+ *         routine, non-zero otherwise.
+ */
+int guac_client_plugin_preload(guac_client_plugin* plugin);
+
 /**
  * Initializes the given guac_client using the initialization routine provided
  * by the given guac_client_plugin.
@@ -473,6 +473,55 @@ int guac_protocol_send_curve(guac_socket* socket, const guac_layer* layer,
  */
 int guac_protocol_send_identity(guac_socket* socket, const guac_layer* layer);
 
+/**
+ * Sends an img instruction over the given guac_socket connection, beginning
+ * a stream of image data which will be drawn to the given layer at the given
+ * coordinates once the stream is complete. The image data itself must be sent
+ * separately using blob instructions, terminated with an end instruction.
+ * Unlike the png instruction, this allows image data to be sent as it is
+ * produced, without first being buffered in its entirety.
+ *
+ * If an error occurs sending the instruction, a non-zero value is
+ * returned, and guac_error is set appropriately.
+ *
+ * @param socket The guac_socket connection to use.
+ * @param stream The stream to use.
+ * @param mode The composite mode to use.
+ * @param layer The destination layer.
+ * @param mimetype The mimetype of the image data being sent.
+ * @param x The destination X coordinate.
+ * @param y The destination Y coordinate.
+ * @return Zero on success, non-zero on error.
+ */
+int guac_protocol_send_img(guac_socket* socket, const guac_stream* stream,
+        guac_composite_mode mode, const guac_layer* layer,
+        const char* mimetype, int x, int y);
+
+/**
+ * Sends a jpeg instruction over the given guac_socket connection. The surface
+ * given will be encoded as JPEG at the given quality, and automatically
+ * base64-encoded for transmission. As JPEG is lossy, this is best suited to
+ * photographic content. The image is encoded in its entirety before any part
+ * of the instruction is sent.
+ *
+ * If an error occurs sending the instruction, a non-zero value is
+ * returned, and guac_error is set appropriately. If libguac was built
+ * without JPEG support, guac_error is set to GUAC_STATUS_NOT_SUPPORTED and
+ * nothing is sent.
+ *
+ * @param socket The guac_socket connection to use.
+ * @param mode The composite mode to use.
+ * @param layer The destination layer.
+ * @param x The destination X coordinate.
+ * @param y The destination Y coordinate.
+ * @param surface A cairo surface containing the image data to send.
+ * @param quality The JPEG quality to use, from 0 to 100.
+ * @return Zero on success, non-zero on error.
+ */
+int guac_protocol_send_jpeg(guac_socket* socket, guac_composite_mode mode,
+        const guac_layer* layer, int x, int y, cairo_surface_t* surface,
+        int quality);
+
 /**
  * Sends an lfill instruction over the given guac_socket connection.
  *
@@ -34,6 +34,35 @@
  */
 #define GUAC_SOCKET_OUTPUT_BUFFER_SIZE 8192
 
+/**
+ * The maximum number of segments which may be pending within the output
+ * chain of a socket using scatter-gather output before that chain is
+ * flushed.
+ */
+#define GUAC_SOCKET_MAX_SEGMENTS 64
+
+/**
+ * The minimum number of bytes of base64 input which will be encoded into a
+ * segment of its own, rather than into the output buffer, on a socket using
+ * scatter-gather output.
+ */
+#define GUAC_SOCKET_SEGMENT_THRESHOLD 16384
+
+/**
+ * The maximum number of bytes which may be held within separately-allocated
+ * segments of the output chain of a socket using scatter-gather output before
+ * that chain is flushed.
+ */
+#define GUAC_SOCKET_MAX_SEGMENT_BYTES 1048576
+
+/**
+ * The maximum number of bytes of a single instruction which will be built
+ * within a per-thread staging buffer on a socket with instruction staging
+ * enabled. Larger instructions are instead written directly to the socket
+ * while holding its buffer lock.
+ */
+#define GUAC_SOCKET_STAGING_LIMIT 65536
+
 /**
  * The number of milliseconds to wait between keep-alive pings on a socket
  * with keep-alive enabled.
@@ -31,6 +31,7 @@
 
 #include "socket-types.h"
 
+#include <sys/uio.h>
 #include <unistd.h>
 
 /**
@@ -59,6 +60,22 @@ typedef ssize_t guac_socket_read_handler(guac_socket* socket,
 typedef ssize_t guac_socket_write_handler(guac_socket* socket,
         const void* buf, size_t count);
 
+/**
+ * Generic handler for scatter-gather socket write operations, modeled after
+ * the standard POSIX writev() function. When set within a guac_socket which
+ * has scatter-gather output enabled, a handler of this type will be called
+ * to write all pending segments of data at once. If not set, the write
+ * handler will be called for each segment instead.
+ *
+ * @param socket The guac_socket being written to.
+ * @param iov The segments of data to be written, in order.
+ * @param iovcnt The number of segments in the iov array.
+ * @return The number of bytes written, which may be less than the total
+ *         number of bytes in all segments, or -1 if an error occurs.
+ */
+typedef ssize_t guac_socket_writev_handler(guac_socket* socket,
+        const struct iovec* iov, int iovcnt);
+
 /**
  * Generic handler for socket select operations, similar to the POSIX select()
  * function. When guac_socket_select() is called on a guac_socket, its
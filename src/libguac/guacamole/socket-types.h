@@ -35,6 +35,17 @@
  */
 typedef struct guac_socket guac_socket;
 
+/**
+ * Statistics describing the usage of the locks which make a guac_socket
+ * threadsafe.
+ */
+typedef struct guac_socket_lock_stats guac_socket_lock_stats;
+
+/**
+ * Statistics describing the images encoded and sent over a guac_socket.
+ */
+typedef struct guac_socket_image_stats guac_socket_image_stats;
+
 /**
  * Possible current states of a guac_socket.
  */
@@ -29,6 +29,7 @@
  * @file socket.h
  */
 
+#include "instruction-types.h"
 #include "socket-constants.h"
 #include "socket-fntypes.h"
 #include "socket-types.h"
@@ -36,8 +37,121 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+struct guac_socket_lock_stats {
+
+    /**
+     * The number of times a lock was acquired.
+     */
+    uint64_t acquisitions;
+
+    /**
+     * The number of acquisitions which had to wait for another thread to
+     * release the lock.
+     */
+    uint64_t contended;
+
+    /**
+     * The total amount of time locks were held, in nanoseconds.
+     */
+    uint64_t hold_time;
+
+    /**
+     * The longest amount of time any lock was held at once, in nanoseconds.
+     */
+    uint64_t max_hold_time;
+
+    /**
+     * The number of instructions built within per-thread staging buffers
+     * and published to the socket as a single unit.
+     */
+    uint64_t staged_instructions;
+
+    /**
+     * The number of instructions which were too large to stage, and were
+     * instead written directly while holding the buffer lock.
+     */
+    uint64_t spilled_instructions;
+
+};
+
+struct guac_socket_image_stats {
+
+    /**
+     * The number of images sent as PNG.
+     */
+    uint64_t png_images;
+
+    /**
+     * The total size of all images sent as PNG, in bytes, not including the
+     * overhead of base64 encoding or of the surrounding instructions.
+     */
+    uint64_t png_bytes;
+
+    /**
+     * The total time spent encoding and sending images as PNG, in
+     * microseconds.
+     */
+    uint64_t png_time;
+
+    /**
+     * The total number of pixels within all images sent as PNG.
+     */
+    uint64_t png_pixels;
+
+    /**
+     * The number of images sent as JPEG.
+     */
+    uint64_t jpeg_images;
+
+    /**
+     * The total size of all images sent as JPEG, in bytes, not including the
+     * overhead of base64 encoding or of the surrounding instructions.
+     */
+    uint64_t jpeg_bytes;
+
+    /**
+     * The total time spent encoding and sending images as JPEG, in
+     * microseconds.
+     */
+    uint64_t jpeg_time;
+
+    /**
+     * The total number of pixels within all images sent as JPEG.
+     */
+    uint64_t jpeg_pixels;
+
+    /**
+     * The estimated number of bytes saved by sending images as JPEG rather
+     * than PNG, assuming each pixel sent as JPEG would otherwise have cost
+     * the average number of bytes per pixel of the images sent as PNG. This
+     * is calculated by guac_socket_get_image_stats(), is zero if no images
+     * have been sent as PNG, and may be negative.
+     */
+    int64_t jpeg_bytes_saved;
+
+    /**
+     * The number of images streamed using "img" instructions, regardless of
+     * format.
+     */
+    uint64_t streamed_images;
+
+    /**
+     * The total time elapsed between the start of encoding and the first blob
+     * of each streamed image being written, in microseconds.
+     */
+    uint64_t first_blob_time;
+
+    /**
+     * The longest time elapsed between the start of encoding and the first
+     * blob of any streamed image being written, in microseconds.
+     */
+    uint64_t max_first_blob_time;
+
+};
+
 struct guac_socket {
 
     /**
@@ -57,6 +171,14 @@ struct guac_socket {
      */
     guac_socket_write_handler* write_handler;
 
+    /**
+     * Handler which will be called when pending segments of data need to be
+     * written to this socket, if scatter-gather output has been enabled with
+     * guac_socket_require_writev(). If not defined, the write handler will be
+     * called for each segment instead.
+     */
+    guac_socket_writev_handler* writev_handler;
+
     /**
      * Handler which will be called whenever guac_socket_select is invoked
      * on this socket.
@@ -101,6 +223,44 @@ struct guac_socket {
      */
     char __out_buf[GUAC_SOCKET_OUTPUT_BUFFER_SIZE];
 
+    /**
+     * Whether data should be written using scatter-gather output, with
+     * large encoded payloads held by reference in a chain of pending
+     * segments rather than copied through the main write buffer.
+     */
+    int __writev_enabled;
+
+    /**
+     * The chain of segments pending output. Each segment refers either to
+     * a region of the main write buffer or to a separately-allocated block
+     * of encoded data.
+     */
+    struct iovec __segments[GUAC_SOCKET_MAX_SEGMENTS];
+
+    /**
+     * For each pending segment, the separately-allocated block of data
+     * which must be freed once that segment has been written, or NULL if
+     * the segment refers to the main write buffer.
+     */
+    void* __segment_owned[GUAC_SOCKET_MAX_SEGMENTS];
+
+    /**
+     * The number of segments currently pending output.
+     */
+    int __segment_count;
+
+    /**
+     * The offset within the main write buffer of the first byte not yet
+     * part of any pending segment.
+     */
+    int __segment_start;
+
+    /**
+     * The total number of bytes held within separately-allocated pending
+     * segments.
+     */
+    size_t __segment_bytes;
+
     /**
      * Pointer to the first character of the current in-progress instruction
      * within the buffer.
@@ -119,6 +279,13 @@ struct guac_socket {
      */
     char __instructionbuf[32768];
 
+    /**
+     * The instruction most recently read from this socket, reused for each
+     * instruction read via guac_instruction_next(). This is allocated upon
+     * the first read, and is NULL until then.
+     */
+    guac_instruction* __instruction;
+
     /**
      * Whether instructions should be guaranteed atomic across threads using
      * locks. By default, thread safety is disabled on sockets.
@@ -136,15 +303,71 @@ struct guac_socket {
      */
     pthread_mutex_t __buffer_lock;
 
+    /**
+     * Whether instructions are built within per-thread staging buffers and
+     * published to the buffer as a single unit, rather than holding the
+     * instruction lock while each instruction is written.
+     */
+    int __staging_enabled;
+
+    /**
+     * Usage statistics of the instruction lock.
+     */
+    guac_socket_lock_stats __instruction_lock_stats;
+
+    /**
+     * The time the instruction lock was last acquired, in nanoseconds.
+     */
+    uint64_t __instruction_lock_acquired;
+
+    /**
+     * Usage statistics of the buffer lock.
+     */
+    guac_socket_lock_stats __buffer_lock_stats;
+
+    /**
+     * The time the buffer lock was last acquired, in nanoseconds.
+     */
+    uint64_t __buffer_lock_acquired;
+
+    /**
+     * Lock which is acquired while image statistics are being updated.
+     */
+    pthread_mutex_t __image_stats_lock;
+
+    /**
+     * Statistics describing all images encoded and sent thus far.
+     */
+    guac_socket_image_stats __image_stats;
+
+    /**
+     * The total number of bytes passed to the write handlers of this socket
+     * and accepted by them.
+     */
+    uint64_t __bytes_written;
+
     /**
      * Whether automatic keep-alive is enabled.
      */
     int __keep_alive_enabled;
 
     /**
-     * The keep-alive thread.
+     * The index of the slot of the keep-alive timer wheel containing this
+     * socket, or -1 if this socket is not within the wheel.
+     */
+    int __keep_alive_slot;
+
+    /**
+     * The previous socket within the same slot of the keep-alive timer
+     * wheel, or NULL if this socket is first.
      */
-    pthread_t __keep_alive_thread;
+    guac_socket* __keep_alive_prev;
+
+    /**
+     * The next socket within the same slot of the keep-alive timer wheel,
+     * or NULL if this socket is last.
+     */
+    guac_socket* __keep_alive_next;
 
 };
 
@@ -178,18 +401,79 @@ void guac_socket_require_threadsafe(guac_socket* socket);
 /**
  * Declares that the given socket must automatically send a keep-alive ping
  * to ensure neither side of the socket times out while the socket is open.
- * This ping will take the form of a "nop" instruction. Enabling keep-alive
- * automatically enables threadsafety.
+ * This ping will take the form of a "nop" instruction, and is sent only if
+ * nothing else has been written for GUAC_SOCKET_KEEP_ALIVE_INTERVAL
+ * milliseconds. Pings for all sockets of the current process are sent by a
+ * single shared thread, which sleeps until the next ping may be due.
+ * Enabling keep-alive automatically enables threadsafety. Enabling
+ * keep-alive on a socket which already has keep-alive enabled has no
+ * effect.
  *
  * @param socket The guac_socket to declare as requiring an automatic
  *               keep-alive ping.
  */
 void guac_socket_require_keep_alive(guac_socket* socket);
 
+/**
+ * Declares that the given socket should write data using scatter-gather
+ * output. Rather than copying all data through the fixed-size output buffer,
+ * large base64 payloads are encoded into separate segments which are held
+ * by reference, and all pending segments are written at once when the
+ * socket is flushed, using the writev handler of the socket if defined.
+ *
+ * @param socket The guac_socket to declare as using scatter-gather output.
+ */
+void guac_socket_require_writev(guac_socket* socket);
+
+/**
+ * Declares that the given socket must behave in a threadsafe way, building
+ * each instruction within a staging buffer private to the writing thread.
+ * Each complete instruction is then published to the socket while briefly
+ * holding its buffer lock, such that instructions never interleave, but
+ * threads need not wait for each other while building instructions.
+ * Instructions larger than GUAC_SOCKET_STAGING_LIMIT are written directly,
+ * holding the buffer lock for the remainder of the instruction. Enabling
+ * instruction staging automatically enables threadsafety.
+ *
+ * @param socket The guac_socket to declare as using instruction staging.
+ */
+void guac_socket_require_staging(guac_socket* socket);
+
+/**
+ * Retrieves statistics describing how the locks which make the given socket
+ * threadsafe have been used, combined across all such locks.
+ *
+ * @param socket The guac_socket to retrieve lock statistics of.
+ * @param stats The guac_socket_lock_stats to populate.
+ */
+void guac_socket_get_lock_stats(guac_socket* socket,
+        guac_socket_lock_stats* stats);
+
+/**
+ * Retrieves statistics describing all images encoded and sent over the given
+ * socket, broken down by image format.
+ *
+ * @param socket The guac_socket to retrieve image statistics of.
+ * @param stats The guac_socket_image_stats to populate.
+ */
+void guac_socket_get_image_stats(guac_socket* socket,
+        guac_socket_image_stats* stats);
+
+/**
+ * Returns the total number of bytes actually written by the given socket
+ * through its write handlers, excluding any data which is still buffered.
+ *
+ * @param socket The guac_socket to retrieve the number of bytes written of.
+ * @return The total number of bytes written.
+ */
+uint64_t guac_socket_get_bytes_written(guac_socket* socket);
+
 /**
  * Marks the beginning of a Guacamole protocol instruction. If threadsafety
  * is enabled on the socket, other instructions will be blocked from sending
- * until this instruction is complete.
+ * until this instruction is complete. If instruction staging is enabled, the
+ * instruction is instead built privately by the current thread until
+ * complete.
  *
  * @param socket The guac_socket beginning an instruction.
  */
@@ -251,6 +535,40 @@ guac_socket* guac_socket_open(int fd);
  */
 guac_socket* guac_socket_nest(guac_socket* parent, int index);
 
+/**
+ * Allocates and initializes a new guac_socket which holds all data written
+ * to it in memory until guac_socket_buffer_commit() is called, at which point
+ * the data is written to the given existing guac_socket as a single unit.
+ * This allows instructions to be built concurrently by several threads,
+ * each using its own buffer socket, and then sent in a well-defined order.
+ * Any data not committed when the socket is freed is discarded.
+ *
+ * If an error occurs while allocating the guac_socket object, NULL is returned,
+ * and guac_error is set appropriately.
+ *
+ * @param parent The guac_socket which should receive all data written to the
+ *               new guac_socket upon commit.
+ * @return A newly allocated guac_socket object associated with the given
+ *         guac_socket, or NULL if an error occurs while allocating the
+ *         guac_socket object.
+ */
+guac_socket* guac_socket_buffer(guac_socket* parent);
+
+/**
+ * Writes all data held by the given buffer socket to its parent, atomically
+ * with respect to other instructions written to the parent, and adds the
+ * image statistics of the buffer socket to those of the parent. The buffer
+ * socket is left empty and may continue to be used. The given socket must
+ * have been allocated with guac_socket_buffer().
+ *
+ * If an error occurs while writing, a non-zero value is returned, and
+ * guac_error is set appropriately.
+ *
+ * @param socket The buffer socket whose data should be written.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+int guac_socket_buffer_commit(guac_socket* socket);
+
 /**
  * Writes the given unsigned int to the given guac_socket object. The data
  * written may be buffered until the buffer is flushed automatically or
@@ -281,6 +599,26 @@ ssize_t guac_socket_write_int(guac_socket* socket, int64_t i);
 */
 ssize_t guac_socket_write_string(guac_socket* socket, const char* str);
 
+/**
+ * Writes the given data to the given guac_socket object, following any data
+ * already buffered. Unlike guac_socket_write_string(), the data need not be
+ * null-terminated. Small amounts of data are buffered as with
+ * guac_socket_write_string(), while large amounts of data are written
+ * immediately, together with any buffered data, without first being copied
+ * into the write buffer. As with guac_socket_write_string(), the data is not
+ * escaped.
+ *
+ * If an error occurs while writing, a non-zero value is returned, and
+ * guac_error is set appropriately.
+ *
+ * @param socket The guac_socket object to write to.
+ * @param buf A buffer containing the data to write.
+ * @param count The number of bytes to write.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+ssize_t guac_socket_write_bytes(guac_socket* socket, const void* buf,
+        size_t count);
+
 /**
  * Writes the given binary data to the given guac_socket object as base64-
  * encoded data. The data written may be buffered until the buffer is flushed
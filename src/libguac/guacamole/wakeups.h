@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef _GUAC_WAKEUPS_H
+#define _GUAC_WAKEUPS_H
+
+/**
+ * Provides functions for counting the number of times the threads of the
+ * current process wake up to do work, such that the cost of idle
+ * connections can be measured.
+ *
+ * @file wakeups.h
+ */
+
+#include <stdint.h>
+
+/**
+ * The number of most recent seconds over which the rate of wakeups is
+ * averaged.
+ */
+#define GUAC_WAKEUPS_WINDOW 60
+
+/**
+ * Records that a thread of the current process has woken up, whether due to
+ * data becoming available or a timeout elapsing. This function is
+ * threadsafe.
+ */
+void guac_wakeups_record();
+
+/**
+ * Returns the total number of wakeups recorded within the current process.
+ *
+ * @return The total number of wakeups recorded.
+ */
+uint64_t guac_wakeups_get_total();
+
+/**
+ * Returns the average number of wakeups recorded per second within the
+ * current process over the last GUAC_WAKEUPS_WINDOW complete seconds, or over
+ * all complete seconds since the first wakeup was recorded if fewer have
+ * passed.
+ *
+ * @param seconds Pointer to an int which will receive the number of seconds
+ *                over which the rate was averaged, or NULL if this is not
+ *                needed.
+ * @return The average number of wakeups per second.
+ */
+double guac_wakeups_get_rate(int* seconds);
+
+#endif
+
@@ -25,12 +25,15 @@
 #include "error.h"
 #include "instruction.h"
 #include "socket.h"
-#include "unicode.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 guac_instruction* guac_instruction_alloc() {
 
     /* Allocate space for instruction */
@@ -54,126 +57,218 @@ void guac_instruction_reset(guac_instruction* instruction) {
     instruction->__element_length = 0;
 }
 
-int guac_instruction_append(guac_instruction* instr,
-        void* buffer, int length) {
+/**
+ * Returns whether the given byte is a UTF-8 continuation byte, and thus does
+ * not begin a new character.
+ */
+#define GUAC_INSTRUCTION_IS_CONTINUATION(c) (((c) & 0xC0) == 0x80)
+
+/**
+ * Skips the given number of UTF-8 characters within the given buffer,
+ * returning a pointer to the character immediately following them, which
+ * should be an element terminator. Characters are counted by the bytes which
+ * begin them, such that characters split across calls are handled naturally.
+ * Where SSE2 is available, sixteen bytes are examined at a time, and runs of
+ * ASCII (as well as well-formed multibyte characters) are skipped in bulk.
+ *
+ * @param current The first byte of the buffer to scan.
+ * @param end The first byte beyond the end of the buffer.
+ * @param remaining The number of characters which must be skipped before the
+ *                  terminator is reached. This is updated to reflect the
+ *                  number of characters still to be skipped if the
+ *                  terminator is not within the buffer.
+ * @return A pointer to the terminator, or NULL if the terminator is not
+ *         within the buffer.
+ */
+static char* __guac_instruction_skip(char* current, char* end,
+        int* remaining) {
 
-    char* char_buffer = (char*) buffer;
-    int bytes_parsed = 0;
+    int count = *remaining;
 
-    /* Do not exceed maximum number of elements */
-    if (instr->__elementc == GUAC_INSTRUCTION_MAX_ELEMENTS
-            && instr->state != GUAC_INSTRUCTION_PARSE_COMPLETE) {
-        instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
-        return 0;
-    }
+#ifdef __SSE2__
+    const __m128i lead_mask = _mm_set1_epi8((char) 0xC0);
+    const __m128i continuation = _mm_set1_epi8((char) 0x80);
 
-    /* Parse element length */
-    if (instr->state == GUAC_INSTRUCTION_PARSE_LENGTH) {
+    /* Skip blocks which lie entirely before the terminator */
+    while (end - current >= 16) {
 
-        int parsed_length = instr->__element_length;
-        while (bytes_parsed < length) {
+        __m128i block = _mm_loadu_si128((const __m128i*) current);
 
-            /* Pull next character */
-            char c = *(char_buffer++);
-            bytes_parsed++;
+        /* Count bytes which begin characters */
+        int continuations = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_and_si128(block, lead_mask), continuation));
+        int starts = 16 - __builtin_popcount(continuations);
 
-            /* If digit, add to length */
-            if (c >= '0' && c <= '9')
-                parsed_length = parsed_length*10 + c - '0';
+        /* Terminator is within this block if it begins more characters
+         * than remain */
+        if (starts > count)
+            break;
 
-            /* If period, switch to parsing content */
-            else if (c == '.') {
-                instr->__elementv[instr->__elementc++] = char_buffer;
-                instr->state = GUAC_INSTRUCTION_PARSE_CONTENT;
-                break;
-            }
+        count -= starts;
+        current += 16;
 
-            /* If not digit, parse error */
-            else {
-                instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
-                return 0;
-            }
+    }
+#endif
 
-        }
+    /* Locate terminator bytewise */
+    while (current < end) {
 
-        /* If too long, parse error */
-        if (parsed_length > GUAC_INSTRUCTION_MAX_LENGTH) {
-            instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
-            return 0;
+        if (!GUAC_INSTRUCTION_IS_CONTINUATION((unsigned char) *current)) {
+            if (count == 0) {
+                *remaining = 0;
+                return current;
+            }
+            count--;
         }
 
-        /* Save length */
-        instr->__element_length = parsed_length;
+        current++;
 
-    } /* end parse length */
+    }
 
-    /* Parse element content */
-    if (instr->state == GUAC_INSTRUCTION_PARSE_CONTENT) {
+    *remaining = count;
+    return NULL;
 
-        while (bytes_parsed < length && instr->__element_length >= 0) {
+}
 
-            /* Get length of current character */
-            char c = *char_buffer;
-            int char_length = guac_utf8_charsize((unsigned char) c);
+int guac_instruction_append(guac_instruction* instr,
+        void* buffer, int length) {
 
-            /* If full character not present in buffer, stop now */
-            if (char_length + bytes_parsed > length)
-                break;
+    char* current = (char*) buffer;
+    char* end = current + length;
 
-            /* Record character as parsed */
-            bytes_parsed += char_length;
+    while (current < end) {
 
-            /* If end of element, handle terminator */
-            if (instr->__element_length == 0) {
+        /* Parse element length */
+        if (instr->state == GUAC_INSTRUCTION_PARSE_LENGTH) {
 
-                *char_buffer = '\0';
+            int parsed_length = instr->__element_length;
 
-                /* If semicolon, store end-of-instruction */
-                if (c == ';') {
-                    instr->state = GUAC_INSTRUCTION_PARSE_COMPLETE;
-                    instr->opcode = instr->__elementv[0];
-                    instr->argv = &(instr->__elementv[1]);
-                    instr->argc = instr->__elementc - 1;
-                    break;
-                }
+            /* Do not exceed maximum number of elements */
+            if (instr->__elementc == GUAC_INSTRUCTION_MAX_ELEMENTS) {
+                instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
+                return 0;
+            }
+
+            while (current < end) {
+
+                /* Pull next character */
+                char c = *(current++);
+
+                /* If digit, add to length */
+                if (c >= '0' && c <= '9')
+                    parsed_length = parsed_length*10 + c - '0';
 
-                /* If comma, move on to next element */
-                else if (c == ',') {
-                    instr->state = GUAC_INSTRUCTION_PARSE_LENGTH;
+                /* If period, switch to parsing content */
+                else if (c == '.') {
+                    instr->__elementv[instr->__elementc++] = current;
+                    instr->state = GUAC_INSTRUCTION_PARSE_CONTENT;
                     break;
                 }
 
-                /* Otherwise, parse error */
+                /* If not digit, parse error */
                 else {
                     instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
                     return 0;
                 }
 
-            } /* end if end of element */
+                /* If too long, parse error */
+                if (parsed_length > GUAC_INSTRUCTION_MAX_LENGTH) {
+                    instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
+                    return 0;
+                }
 
-            /* Advance to next character */
-            instr->__element_length--;
-            char_buffer += char_length;
+            }
 
-        }
+            /* Save length */
+            instr->__element_length = parsed_length;
+
+        } /* end parse length */
 
-    } /* end parse content */
+        /* Parse element content */
+        else if (instr->state == GUAC_INSTRUCTION_PARSE_CONTENT) {
 
-    return bytes_parsed;
+            char c;
+
+            /* Skip to terminator, consuming everything if not yet present */
+            char* terminator = __guac_instruction_skip(current, end,
+                    &instr->__element_length);
+            if (terminator == NULL) {
+                current = end;
+                break;
+            }
+
+            c = *terminator;
+            *terminator = '\0';
+            current = terminator + 1;
+
+            /* If semicolon, store end-of-instruction */
+            if (c == ';') {
+                instr->state = GUAC_INSTRUCTION_PARSE_COMPLETE;
+                instr->opcode = instr->__elementv[0];
+                instr->argv = &(instr->__elementv[1]);
+                instr->argc = instr->__elementc - 1;
+                break;
+            }
+
+            /* If comma, move on to next element */
+            else if (c == ',')
+                instr->state = GUAC_INSTRUCTION_PARSE_LENGTH;
+
+            /* Otherwise, parse error */
+            else {
+                instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
+                return 0;
+            }
+
+        } /* end parse content */
+
+        /* Nothing more can be parsed if complete */
+        else
+            break;
+
+    }
+
+    return current - (char*) buffer;
 
 }
 
-/* Returns new instruction if one exists, or NULL if no more instructions. */
-guac_instruction* guac_instruction_read(guac_socket* socket,
+/**
+ * Reads the next instruction from the given guac_socket into the instruction
+ * owned by that socket, returning that instruction. If the previous call
+ * returned a complete instruction, that instruction is reset first.
+ * Otherwise, parsing continues where the previous call left off, such that
+ * instructions which arrive across several timeouts are not lost.
+ *
+ * If an error occurs reading the instruction, NULL is returned, and
+ * guac_error is set appropriately.
+ *
+ * @param socket The guac_socket connection to use.
+ * @param usec_timeout The maximum number of microseconds to wait before
+ *                     giving up.
+ * @return The instruction owned by the given socket, if a complete
+ *         instruction was read, or NULL otherwise.
+ */
+static guac_instruction* __guac_instruction_read(guac_socket* socket,
         int usec_timeout) {
 
     char* unparsed_end = socket->__instructionbuf_unparsed_end;
     char* unparsed_start = socket->__instructionbuf_unparsed_start;
-    char* instr_start = socket->__instructionbuf_unparsed_start;
     char* buffer_end = socket->__instructionbuf
                             + sizeof(socket->__instructionbuf);
 
-    guac_instruction* instruction = guac_instruction_alloc();
+    guac_instruction* instruction = socket->__instruction;
+
+    /* Allocate reusable instruction upon first read */
+    if (instruction == NULL) {
+        instruction = socket->__instruction = guac_instruction_alloc();
+        if (instruction == NULL)
+            return NULL;
+    }
+
+    /* Begin new instruction only if previous instruction was finished */
+    else if (instruction->state == GUAC_INSTRUCTION_PARSE_COMPLETE
+          || instruction->state == GUAC_INSTRUCTION_PARSE_ERROR)
+        guac_instruction_reset(instruction);
 
     while (instruction->state != GUAC_INSTRUCTION_PARSE_COMPLETE
         && instruction->state != GUAC_INSTRUCTION_PARSE_ERROR) {
@@ -190,20 +285,24 @@ guac_instruction* guac_instruction_read(guac_socket* socket,
             /* If no space left to read, fail */
             if (unparsed_end == buffer_end) {
 
+                /* Only parsed elements and unparsed data need be kept */
+                char* keep_start = unparsed_start;
+                if (instruction->__elementc > 0)
+                    keep_start = instruction->__elementv[0];
+
                 /* Shift backward if possible */
-                if (instr_start != socket->__instructionbuf) {
+                if (keep_start != socket->__instructionbuf) {
 
                     int i;
 
                     /* Shift buffer */
-                    int offset = instr_start - socket->__instructionbuf;
-                    memmove(socket->__instructionbuf, instr_start,
-                            unparsed_end - instr_start);
+                    int offset = keep_start - socket->__instructionbuf;
+                    memmove(socket->__instructionbuf, keep_start,
+                            unparsed_end - keep_start);
 
                     /* Update tracking pointers */
                     unparsed_end -= offset;
                     unparsed_start -= offset;
-                    instr_start = socket->__instructionbuf;
 
                     /* Update parsed elements, if any */
                     for (i=0; i<instruction->__elementc; i++)
@@ -215,7 +314,7 @@ guac_instruction* guac_instruction_read(guac_socket* socket,
                 else {
                     guac_error = GUAC_STATUS_NO_MEMORY;
                     guac_error_message = "Instruction too long";
-                    return NULL;
+                    break;
                 }
 
             }
@@ -223,7 +322,7 @@ guac_instruction* guac_instruction_read(guac_socket* socket,
             /* No instruction yet? Get more data ... */
             retval = guac_socket_select(socket, usec_timeout);
             if (retval <= 0)
-                return NULL;
+                break;
            
             /* Attempt to fill buffer */
             retval = guac_socket_read(socket, unparsed_end,
@@ -233,7 +332,7 @@ guac_instruction* guac_instruction_read(guac_socket* socket,
             if (retval < 0) {
                 guac_error = GUAC_STATUS_SEE_ERRNO;
                 guac_error_message = "Error filling instruction buffer";
-                return NULL;
+                break;
             }
 
             /* EOF */
@@ -241,7 +340,7 @@ guac_instruction* guac_instruction_read(guac_socket* socket,
                 guac_error = GUAC_STATUS_CLOSED;
                 guac_error_message = "End of stream reached while "
                                      "reading instruction";
-                return NULL;
+                break;
             }
 
             /* Update internal buffer */
@@ -255,6 +354,10 @@ guac_instruction* guac_instruction_read(guac_socket* socket,
 
     } /* end while parsing data */
 
+    /* Data parsed thus far is retained by the instruction */
+    socket->__instructionbuf_unparsed_start = unparsed_start;
+    socket->__instructionbuf_unparsed_end = unparsed_end;
+
     /* Fail on error */
     if (instruction->state == GUAC_INSTRUCTION_PARSE_ERROR) {
         guac_error = GUAC_STATUS_PROTOCOL_ERROR;
@@ -262,12 +365,42 @@ guac_instruction* guac_instruction_read(guac_socket* socket,
         return NULL;
     }
 
-    socket->__instructionbuf_unparsed_start = unparsed_start;
-    socket->__instructionbuf_unparsed_end = unparsed_end;
+    /* Fail if incomplete (guac_error already set) */
+    if (instruction->state != GUAC_INSTRUCTION_PARSE_COMPLETE)
+        return NULL;
+
     return instruction;
 
 }
 
+guac_instruction* guac_instruction_next(guac_socket* socket,
+        int usec_timeout) {
+    return __guac_instruction_read(socket, usec_timeout);
+}
+
+/* Returns new instruction if one exists, or NULL if no more instructions. */
+guac_instruction* guac_instruction_read(guac_socket* socket,
+        int usec_timeout) {
+
+    guac_instruction* copy;
+
+    /* Read into socket's instruction */
+    guac_instruction* instruction = __guac_instruction_read(socket,
+            usec_timeout);
+    if (instruction == NULL)
+        return NULL;
+
+    /* Return independent copy to caller */
+    copy = guac_instruction_alloc();
+    if (copy == NULL)
+        return NULL;
+
+    *copy = *instruction;
+    copy->argv = &(copy->__elementv[1]);
+    return copy;
+
+}
+
 guac_instruction* guac_instruction_expect(guac_socket* socket, int usec_timeout,
         const char* opcode) {
 
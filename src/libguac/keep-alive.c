@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "keep-alive.h"
+#include "socket.h"
+#include "timestamp.h"
+#include "wakeups.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * The number of milliseconds spanned by one full turn of the wheel.
+ */
+#define __GUAC_KEEP_ALIVE_WHEEL_SPAN \
+    (GUAC_KEEP_ALIVE_WHEEL_RESOLUTION * GUAC_KEEP_ALIVE_WHEEL_SLOTS)
+
+/**
+ * Lock which is acquired while the wheel is read or modified.
+ */
+static pthread_mutex_t __guac_keep_alive_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Condition which is signalled when the thread servicing the wheel may need
+ * to wake earlier than planned.
+ */
+static pthread_cond_t __guac_keep_alive_changed = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Condition which is signalled whenever a ping has been sent.
+ */
+static pthread_cond_t __guac_keep_alive_sent = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Guards registration of the handlers which reset the wheel after fork().
+ */
+static pthread_once_t __guac_keep_alive_once = PTHREAD_ONCE_INIT;
+
+/**
+ * The sockets due within each slot of the wheel, as doubly-linked lists.
+ */
+static guac_socket* __guac_keep_alive_slots[GUAC_KEEP_ALIVE_WHEEL_SLOTS];
+
+/**
+ * The number of sockets within the wheel, including any socket currently
+ * having a ping sent.
+ */
+static int __guac_keep_alive_count = 0;
+
+/**
+ * Whether the thread servicing the wheel has been started.
+ */
+static int __guac_keep_alive_running = 0;
+
+/**
+ * The start time of the slot to be processed next. All earlier slots have
+ * been processed.
+ */
+static guac_timestamp __guac_keep_alive_time = 0;
+
+/**
+ * The time at which the thread servicing the wheel will next wake, or zero
+ * if it is waiting indefinitely.
+ */
+static guac_timestamp __guac_keep_alive_wake = 0;
+
+/**
+ * The socket currently having a ping sent, if any. Such sockets are not
+ * within any slot of the wheel.
+ */
+static guac_socket* __guac_keep_alive_busy = NULL;
+
+/**
+ * Returns the index of the slot containing the given time.
+ *
+ * @param time The time to locate.
+ * @return The index of the slot containing the given time.
+ */
+static int __guac_keep_alive_slot(guac_timestamp time) {
+    return (time / GUAC_KEEP_ALIVE_WHEEL_RESOLUTION)
+        % GUAC_KEEP_ALIVE_WHEEL_SLOTS;
+}
+
+/**
+ * Inserts the given socket into the wheel such that it is examined at the
+ * given time, or within the next slot to be processed if that time has
+ * passed. The wheel lock must be held.
+ *
+ * @param socket The socket to insert.
+ * @param deadline The time at which the socket should be examined.
+ */
+static void __guac_keep_alive_insert(guac_socket* socket,
+        guac_timestamp deadline) {
+
+    int slot;
+
+    if (deadline < __guac_keep_alive_time)
+        deadline = __guac_keep_alive_time;
+
+    slot = __guac_keep_alive_slot(deadline);
+
+    socket->__keep_alive_slot = slot;
+    socket->__keep_alive_prev = NULL;
+    socket->__keep_alive_next = __guac_keep_alive_slots[slot];
+
+    if (socket->__keep_alive_next != NULL)
+        socket->__keep_alive_next->__keep_alive_prev = socket;
+
+    __guac_keep_alive_slots[slot] = socket;
+
+}
+
+/**
+ * Removes the given socket from whichever slot of the wheel contains it.
+ * The wheel lock must be held.
+ *
+ * @param socket The socket to remove.
+ */
+static void __guac_keep_alive_unlink(guac_socket* socket) {
+
+    if (socket->__keep_alive_prev != NULL)
+        socket->__keep_alive_prev->__keep_alive_next = socket->__keep_alive_next;
+    else
+        __guac_keep_alive_slots[socket->__keep_alive_slot] =
+            socket->__keep_alive_next;
+
+    if (socket->__keep_alive_next != NULL)
+        socket->__keep_alive_next->__keep_alive_prev = socket->__keep_alive_prev;
+
+    socket->__keep_alive_slot = -1;
+
+}
+
+/**
+ * Moves every socket within the wheel into the slot for its deadline
+ * relative to the given time, restarting the wheel at that time. This is
+ * needed only if the wheel has fallen so far behind that deadlines could
+ * wrap around to slots not yet processed. The wheel lock must be held.
+ *
+ * @param now The current time.
+ */
+static void __guac_keep_alive_restart(guac_timestamp now) {
+
+    guac_socket* pending = NULL;
+    int i;
+
+    /* Collect all sockets, noting the deadline of each */
+    for (i = 0; i < GUAC_KEEP_ALIVE_WHEEL_SLOTS; i++) {
+
+        guac_socket* socket;
+        while ((socket = __guac_keep_alive_slots[i]) != NULL) {
+            __guac_keep_alive_unlink(socket);
+            socket->__keep_alive_next = pending;
+            pending = socket;
+        }
+
+    }
+
+    __guac_keep_alive_time = now - now % GUAC_KEEP_ALIVE_WHEEL_RESOLUTION;
+
+    /* Reinsert relative to the current time */
+    while (pending != NULL) {
+        guac_socket* socket = pending;
+        pending = socket->__keep_alive_next;
+        __guac_keep_alive_insert(socket, socket->last_write_timestamp
+                + GUAC_SOCKET_KEEP_ALIVE_INTERVAL);
+    }
+
+}
+
+/**
+ * Examines the given socket, which has been removed from the wheel, sending
+ * a "nop" if nothing has been written for too long, and reinserting the
+ * socket for the time it may next need a ping. The lock is released while
+ * the ping is sent. Sockets which are busy being written to by another thread
+ * are never waited for, and are instead examined again within the next slot.
+ * The wheel lock must be held.
+ *
+ * @param socket The socket to examine.
+ * @param now The current time.
+ */
+static void __guac_keep_alive_examine(guac_socket* socket, guac_timestamp now) {
+
+    int result = 0;
+    guac_timestamp deadline =
+        socket->last_write_timestamp + GUAC_SOCKET_KEEP_ALIVE_INTERVAL;
+
+    /* Sockets which have been written to recently need no ping yet */
+    if (deadline > now) {
+        __guac_keep_alive_insert(socket, deadline);
+        return;
+    }
+
+    /* Send ping without holding lock, such that other sockets may be
+     * added or removed meanwhile */
+    __guac_keep_alive_busy = socket;
+    pthread_mutex_unlock(&__guac_keep_alive_lock);
+
+    if (socket->state == GUAC_SOCKET_OPEN)
+        result = __guac_socket_try_send_nop(socket);
+
+    pthread_mutex_lock(&__guac_keep_alive_lock);
+    __guac_keep_alive_busy = NULL;
+    pthread_cond_broadcast(&__guac_keep_alive_sent);
+
+    /* Retry shortly if another thread was writing */
+    if (result > 0)
+        __guac_keep_alive_insert(socket,
+                now + GUAC_KEEP_ALIVE_WHEEL_RESOLUTION);
+
+    else
+        __guac_keep_alive_insert(socket,
+                guac_timestamp_current() + GUAC_SOCKET_KEEP_ALIVE_INTERVAL);
+
+}
+
+/**
+ * The thread which services the wheel, sleeping until the end of the next
+ * slot containing any sockets, then examining each socket within each slot
+ * which has elapsed.
+ *
+ * @param data Unused.
+ * @return Always NULL.
+ */
+static void* __guac_keep_alive_thread(void* data) {
+
+    pthread_mutex_lock(&__guac_keep_alive_lock);
+
+    for (;;) {
+
+        guac_timestamp now = guac_timestamp_current();
+        int i;
+
+        /* Ensure deadlines cannot wrap around to unprocessed slots */
+        if (now - __guac_keep_alive_time > __GUAC_KEEP_ALIVE_WHEEL_SPAN
+                - GUAC_SOCKET_KEEP_ALIVE_INTERVAL
+                - 2 * GUAC_KEEP_ALIVE_WHEEL_RESOLUTION)
+            __guac_keep_alive_restart(now);
+
+        /* Examine all sockets within each elapsed slot */
+        while (__guac_keep_alive_time + GUAC_KEEP_ALIVE_WHEEL_RESOLUTION
+                <= now) {
+
+            guac_socket* socket;
+            int slot = __guac_keep_alive_slot(__guac_keep_alive_time);
+
+            /* Advance before examining, such that reinserted sockets
+             * land in later slots */
+            __guac_keep_alive_time += GUAC_KEEP_ALIVE_WHEEL_RESOLUTION;
+
+            while ((socket = __guac_keep_alive_slots[slot]) != NULL) {
+                __guac_keep_alive_unlink(socket);
+                __guac_keep_alive_examine(socket, now);
+            }
+
+        }
+
+        /* Sleep until the end of the next occupied slot */
+        __guac_keep_alive_wake = 0;
+        for (i = 0; i < GUAC_KEEP_ALIVE_WHEEL_SLOTS; i++) {
+
+            guac_timestamp start = __guac_keep_alive_time
+                + i * GUAC_KEEP_ALIVE_WHEEL_RESOLUTION;
+
+            if (__guac_keep_alive_slots[__guac_keep_alive_slot(start)]
+                    != NULL) {
+                __guac_keep_alive_wake = start
+                    + GUAC_KEEP_ALIVE_WHEEL_RESOLUTION;
+                break;
+            }
+
+        }
+
+        /* Without sockets, sleep until one is added */
+        if (__guac_keep_alive_wake == 0)
+            pthread_cond_wait(&__guac_keep_alive_changed,
+                    &__guac_keep_alive_lock);
+
+        else {
+
+            struct timespec deadline;
+            deadline.tv_sec  =  __guac_keep_alive_wake / 1000;
+            deadline.tv_nsec = (__guac_keep_alive_wake % 1000) * 1000000L;
+
+            pthread_cond_timedwait(&__guac_keep_alive_changed,
+                    &__guac_keep_alive_lock, &deadline);
+
+        }
+
+        guac_wakeups_record();
+
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Acquires the wheel lock prior to fork(), such that the wheel is in a
+ * consistent state within the child.
+ */
+static void __guac_keep_alive_prepare_fork() {
+    pthread_mutex_lock(&__guac_keep_alive_lock);
+}
+
+/**
+ * Releases the wheel lock within the parent after fork().
+ */
+static void __guac_keep_alive_parent_fork() {
+    pthread_mutex_unlock(&__guac_keep_alive_lock);
+}
+
+/**
+ * Empties the wheel within the child after fork(). The thread servicing the
+ * wheel does not exist within the child, and the sockets inherited from the
+ * parent are not the child's to ping.
+ */
+static void __guac_keep_alive_child_fork() {
+
+    int i;
+
+    for (i = 0; i < GUAC_KEEP_ALIVE_WHEEL_SLOTS; i++) {
+
+        guac_socket* socket;
+        while ((socket = __guac_keep_alive_slots[i]) != NULL)
+            __guac_keep_alive_unlink(socket);
+
+    }
+
+    if (__guac_keep_alive_busy != NULL) {
+        __guac_keep_alive_busy->__keep_alive_slot = -1;
+        __guac_keep_alive_busy = NULL;
+    }
+
+    __guac_keep_alive_count = 0;
+    __guac_keep_alive_running = 0;
+    __guac_keep_alive_wake = 0;
+
+    pthread_cond_init(&__guac_keep_alive_changed, NULL);
+    pthread_cond_init(&__guac_keep_alive_sent, NULL);
+    pthread_mutex_unlock(&__guac_keep_alive_lock);
+
+}
+
+/**
+ * Registers the handlers which keep the wheel consistent across fork().
+ */
+static void __guac_keep_alive_init() {
+    pthread_atfork(__guac_keep_alive_prepare_fork,
+            __guac_keep_alive_parent_fork, __guac_keep_alive_child_fork);
+}
+
+int __guac_keep_alive_add(guac_socket* socket) {
+
+    guac_timestamp deadline =
+        socket->last_write_timestamp + GUAC_SOCKET_KEEP_ALIVE_INTERVAL;
+
+    pthread_once(&__guac_keep_alive_once, __guac_keep_alive_init);
+    pthread_mutex_lock(&__guac_keep_alive_lock);
+
+    /* Start thread upon first use */
+    if (!__guac_keep_alive_running) {
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, __guac_keep_alive_thread, NULL)) {
+            pthread_mutex_unlock(&__guac_keep_alive_lock);
+            return 1;
+        }
+
+        pthread_detach(thread);
+        __guac_keep_alive_running = 1;
+
+    }
+
+    /* An empty wheel restarts from the current time */
+    if (__guac_keep_alive_count++ == 0) {
+        guac_timestamp now = guac_timestamp_current();
+        __guac_keep_alive_time = now - now % GUAC_KEEP_ALIVE_WHEEL_RESOLUTION;
+    }
+
+    __guac_keep_alive_insert(socket, deadline);
+
+    /* Wake thread only if it would otherwise sleep past this deadline */
+    if (__guac_keep_alive_wake == 0 || deadline < __guac_keep_alive_wake)
+        pthread_cond_signal(&__guac_keep_alive_changed);
+
+    pthread_mutex_unlock(&__guac_keep_alive_lock);
+    return 0;
+
+}
+
+void __guac_keep_alive_remove(guac_socket* socket) {
+
+    pthread_mutex_lock(&__guac_keep_alive_lock);
+
+    /* Wait for any ping in progress */
+    while (__guac_keep_alive_busy == socket)
+        pthread_cond_wait(&__guac_keep_alive_sent, &__guac_keep_alive_lock);
+
+    /* Sockets inherited across fork() are not within the wheel */
+    if (socket->__keep_alive_slot != -1) {
+        __guac_keep_alive_unlink(socket);
+        __guac_keep_alive_count--;
+    }
+
+    pthread_mutex_unlock(&__guac_keep_alive_lock);
+
+}
+
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef _GUAC_KEEP_ALIVE_H
+#define _GUAC_KEEP_ALIVE_H
+
+/**
+ * Provides a single timer wheel, serviced by one thread shared by all
+ * sockets of the current process, which sends keep-alive pings on sockets
+ * with keep-alive enabled. This is used only internally within libguac, and
+ * is not installed along with the library.
+ *
+ * @file keep-alive.h
+ */
+
+#include "config.h"
+
+#include "socket.h"
+
+/**
+ * The number of milliseconds covered by each slot of the keep-alive timer
+ * wheel. Keep-alive pings are sent up to this long after they are due, such
+ * that pings which fall due at nearly the same time are sent together.
+ */
+#define GUAC_KEEP_ALIVE_WHEEL_RESOLUTION 250
+
+/**
+ * The number of slots within the keep-alive timer wheel. The wheel must span
+ * well over GUAC_SOCKET_KEEP_ALIVE_INTERVAL milliseconds.
+ */
+#define GUAC_KEEP_ALIVE_WHEEL_SLOTS 64
+
+/**
+ * Adds the given socket to the keep-alive timer wheel, such that a "nop" is
+ * sent whenever nothing has been written to the socket for
+ * GUAC_SOCKET_KEEP_ALIVE_INTERVAL milliseconds. The thread servicing the
+ * wheel is started if not already running, and sleeps until the next socket
+ * may need a ping, waking not at all while no sockets are registered.
+ *
+ * @param socket The socket to add.
+ * @return Zero on success, non-zero if the thread servicing the wheel could
+ *         not be started.
+ */
+int __guac_keep_alive_add(guac_socket* socket);
+
+/**
+ * Removes the given socket from the keep-alive timer wheel, waiting for any
+ * ping currently being sent on that socket to complete.
+ *
+ * @param socket The socket to remove.
+ */
+void __guac_keep_alive_remove(guac_socket* socket);
+
+/**
+ * Sends a "nop" on the given threadsafe socket and flushes the socket, unless
+ * another thread is currently writing to the socket, in which case nothing
+ * is sent. This never waits for the locks of the socket, but may block while
+ * the "nop" and any data already buffered are written. This function is
+ * defined within socket.c, which owns those locks.
+ *
+ * @param socket The socket to ping.
+ * @return Zero if the "nop" was sent, a positive value if the socket was
+ *         busy and nothing was sent, or a negative value if an error
+ *         occurred while writing.
+ */
+int __guac_socket_try_send_nop(guac_socket* socket);
+
+#endif
+
@@ -31,7 +31,75 @@
 #include <stdlib.h>
 #include <string.h>
 
-guac_palette* guac_palette_alloc(cairo_surface_t* surface) {
+guac_palette* guac_palette_alloc() {
+
+    /* Allocate palette */
+    guac_palette* palette = (guac_palette*) malloc(sizeof(guac_palette));
+    if (palette == NULL)
+        return NULL;
+
+    memset(palette, 0, sizeof(guac_palette));
+
+    return palette;
+
+}
+
+/**
+ * Returns the palette index of the given color, adding the color to the
+ * palette if not already present.
+ *
+ * @return
+ *     The palette index of the given color, or -1 if the color is not present
+ *     and the palette is already full.
+ */
+static int __guac_palette_index(guac_palette* palette, int color) {
+
+    /* Calculate hash code */
+    int hash = ((color & 0xFFF000) >> 12) ^ (color & 0xFFF);
+
+    guac_palette_entry* entry;
+
+    /* Search for open palette entry */
+    for (;;) {
+
+        entry = &(palette->entries[hash]);
+
+        /* If we've found a free space, use it */
+        if (entry->generation != palette->generation) {
+
+            png_color* c;
+
+            /* Stop if already at capacity */
+            if (palette->size == GUAC_PALETTE_MAX_COLORS)
+                return -1;
+
+            /* Store in palette */
+            c = &(palette->colors[palette->size]);
+            c->blue  = (color      ) & 0xFF;
+            c->green = (color >> 8 ) & 0xFF;
+            c->red   = (color >> 16) & 0xFF;
+
+            /* Add color to map */
+            entry->generation = palette->generation;
+            entry->index = palette->size++;
+            entry->color = color;
+
+            return entry->index;
+
+        }
+
+        /* Otherwise, if already stored here, done */
+        if (entry->color == color)
+            return entry->index;
+
+        /* Otherwise, collision. Move on to another bucket */
+        hash = (hash+1) & (GUAC_PALETTE_BUCKETS-1);
+
+    }
+
+}
+
+int guac_palette_build(guac_palette* palette, cairo_surface_t* surface) {
 
     int x, y;
 
@@ -40,59 +108,55 @@ guac_palette* guac_palette_alloc(cairo_surface_t* surface) {
     int stride = cairo_image_surface_get_stride(surface);
     unsigned char* data = cairo_image_surface_get_data(surface);
 
-    /* Allocate palette */
-    guac_palette* palette = (guac_palette*) malloc(sizeof(guac_palette));
-    memset(palette, 0, sizeof(guac_palette));
+    /* Color of previous pixel, initially impossible */
+    int last_color = -1;
+    int last_index = 0;
 
-    for (y=0; y<height; y++) {
-        for (x=0; x<width; x++) {
+    /* Empty palette, clearing hash table only if generation wraps */
+    palette->size = 0;
+    if (++palette->generation == 0) {
+        memset(palette->entries, 0, sizeof(palette->entries));
+        palette->generation = 1;
+    }
 
-            /* Get pixel color */
-            int color = ((uint32_t*) data)[x] & 0xFFFFFF;
+    /* Grow row storage if necessary */
+    if (width > palette->row_size) {
 
-            /* Calculate hash code */
-            int hash = ((color & 0xFFF000) >> 12) ^ (color & 0xFFF);
+        free(palette->row);
+        palette->row = malloc(width);
 
-            guac_palette_entry* entry;
+        /* Without storage, rows cannot be mapped */
+        if (palette->row == NULL) {
+            palette->row_size = 0;
+            return 1;
+        }
 
-            /* Search for open palette entry */
-            for (;;) {
-                
-                entry = &(palette->entries[hash]);
+        palette->row_size = width;
 
-                /* If we've found a free space, use it */
-                if (entry->index == 0) {
+    }
 
-                    png_color* c;
+    for (y=0; y<height; y++) {
 
-                    /* Stop if already at capacity */
-                    if (palette->size == 256) {
-                        guac_palette_free(palette);
-                        return NULL;
-                    }
+        uint32_t* row = (uint32_t*) data;
 
-                    /* Store in palette */
-                    c = &(palette->colors[palette->size]);
-                    c->blue  = (color      ) & 0xFF;
-                    c->green = (color >> 8 ) & 0xFF;
-                    c->red   = (color >> 16) & 0xFF;
+        for (x=0; x<width; x++) {
 
-                    /* Add color to map */
-                    entry->index = ++palette->size;
-                    entry->color = color;
+            /* Get pixel color */
+            int color = row[x] & 0xFFFFFF;
 
-                    break;
+            /* Look up color only when it changes */
+            if (color != last_color) {
 
-                }
+                last_index = __guac_palette_index(palette, color);
 
-                /* Otherwise, if already stored here, done */
-                if (entry->color == color)
-                    break;
+                /* Abort as soon as there are too many colors */
+                if (last_index < 0)
+                    return 1;
 
-                /* Otherwise, collision. Move on to another bucket */
-                hash = (hash+1) & 0xFFF;
+                last_color = color;
 
             }
+
         }
 
         /* Advance to next data row */
@@ -100,38 +164,42 @@ guac_palette* guac_palette_alloc(cairo_surface_t* surface) {
 
     }
 
-    return palette;
+    return 0;
 
 }
 
-int guac_palette_find(guac_palette* palette, int color) {
+unsigned char* guac_palette_map_row(guac_palette* palette,
+        const uint32_t* pixels, int width) {
 
-    /* Calculate hash code */
-    int hash = ((color & 0xFFF000) >> 12) ^ (color & 0xFFF);
+    unsigned char* indices = palette->row;
+    int x;
 
-    guac_palette_entry* entry;
+    /* Color of previous pixel, initially impossible */
+    int last_color = -1;
+    int last_index = 0;
 
-    /* Search for palette entry */
-    for (;;) {
-        
-        entry = &(palette->entries[hash]);
+    for (x=0; x<width; x++) {
 
-        /* If we've found a free space, color not stored. */
-        if (entry->index == 0)
-            return -1;
+        /* Get pixel color */
+        int color = pixels[x] & 0xFFFFFF;
 
-        /* Otherwise, if color indeed stored here, done */
-        if (entry->color == color)
-            return entry->index - 1;
+        /* Look up color only when it changes. As the palette was built from
+         * the surface containing this row, the color is always present. */
+        if (color != last_color) {
+            last_index = __guac_palette_index(palette, color);
+            last_color = color;
+        }
 
-        /* Otherwise, collision. Move on to another bucket */
-        hash = (hash+1) & 0xFFF;
+        indices[x] = last_index;
 
     }
 
+    return indices;
+
 }
 
 void guac_palette_free(guac_palette* palette) {
+    free(palette->row);
     free(palette);
 }
 
@@ -27,23 +27,138 @@
 #include <cairo/cairo.h>
 #include <png.h>
 
+#include <stdint.h>
+
+/**
+ * The maximum number of colors which may be stored within a palette.
+ */
+#define GUAC_PALETTE_MAX_COLORS 256
+
+/**
+ * The number of buckets within the hash table mapping colors to palette
+ * indices. This must be a power of two.
+ */
+#define GUAC_PALETTE_BUCKETS 0x1000
+
 typedef struct guac_palette_entry {
 
+    /**
+     * The palette index of the color stored in this bucket.
+     */
     int index;
+
+    /**
+     * The 24-bit RGB color stored in this bucket.
+     */
     int color;
 
+    /**
+     * The generation of the palette when this bucket was last written. The
+     * bucket is empty unless this matches the current generation of the
+     * palette, allowing the table to be cleared without touching every
+     * bucket.
+     */
+    unsigned int generation;
+
 } guac_palette_entry;
 
+/**
+ * A palette of up to 256 colors, along with storage for the palette indices
+ * of a single row of pixels. A single palette may be built repeatedly,
+ * reusing its storage each time.
+ */
 typedef struct guac_palette {
 
-    guac_palette_entry entries[0x1000];
-    png_color colors[256];
+    /**
+     * Hash table mapping colors to palette indices.
+     */
+    guac_palette_entry entries[GUAC_PALETTE_BUCKETS];
+
+    /**
+     * The color of each palette index.
+     */
+    png_color colors[GUAC_PALETTE_MAX_COLORS];
+
+    /**
+     * The number of colors within the palette.
+     */
     int size;
 
+    /**
+     * The current generation of the hash table. Only buckets of this
+     * generation are in use.
+     */
+    unsigned int generation;
+
+    /**
+     * The palette index of each pixel of the row most recently mapped with
+     * guac_palette_map_row(), one byte per pixel.
+     */
+    unsigned char* row;
+
+    /**
+     * The number of bytes allocated for row.
+     */
+    int row_size;
+
 } guac_palette;
 
-guac_palette* guac_palette_alloc(cairo_surface_t* surface);
-int guac_palette_find(guac_palette* palette, int color);
+/**
+ * Allocates a new, empty palette, which may be built from any number of
+ * surfaces using guac_palette_build().
+ *
+ * @return
+ *     A newly-allocated, empty palette, or NULL if the palette could not be
+ *     allocated.
+ */
+guac_palette* guac_palette_alloc();
+
+/**
+ * Rebuilds the given palette from the colors within the given RGB24 surface,
+ * ensuring enough storage exists to map any row of that surface to palette
+ * indices. Building stops as soon as the surface is found to contain more
+ * colors than a palette can hold.
+ *
+ * @param palette
+ *     The palette to rebuild. Any previous contents are discarded.
+ *
+ * @param surface
+ *     The surface to build the palette from.
+ *
+ * @return
+ *     Zero if the surface contains no more than GUAC_PALETTE_MAX_COLORS
+ *     colors and the palette was built successfully, non-zero otherwise,
+ *     including if storage for a row of indices could not be allocated.
+ */
+int guac_palette_build(guac_palette* palette, cairo_surface_t* surface);
+
+/**
+ * Maps the given row of pixels to palette indices, storing the results
+ * within the row storage of the given palette. The palette must have been
+ * built from the surface containing the row.
+ *
+ * @param palette
+ *     The palette to map pixels with.
+ *
+ * @param pixels
+ *     The first pixel of the row.
+ *
+ * @param width
+ *     The number of pixels in the row.
+ *
+ * @return
+ *     The palette index of each pixel of the row, one byte per pixel. This
+ *     storage is overwritten by the next call to guac_palette_map_row().
+ */
+unsigned char* guac_palette_map_row(guac_palette* palette,
+        const uint32_t* pixels, int width);
+
+/**
+ * Frees the given palette and all associated storage.
+ *
+ * @param palette
+ *     The palette to free.
+ */
 void guac_palette_free(guac_palette* palette);
 
 #endif
@@ -50,6 +50,11 @@ guac_client_plugin* guac_client_plugin_open(const char* protocol) {
         void* obj;
     } alias;
 
+    union {
+        guac_client_preload_handler* client_preload;
+        void* obj;
+    } preload_alias;
+
     /* Add protocol and .so suffix to protocol_lib */
     strncat(protocol_lib, protocol, GUAC_PROTOCOL_NAME_LIMIT-1);
     strcat(protocol_lib, GUAC_PROTOCOL_LIBRARY_SUFFIX);
@@ -84,6 +89,10 @@ guac_client_plugin* guac_client_plugin_open(const char* protocol) {
         return NULL;
     }
 
+    /* Get preload function, if any */
+    preload_alias.obj = dlsym(client_plugin_handle, "guac_client_preload");
+    dlerror(); /* Clear errors, as preload function is optional */
+
     /* Allocate plugin */
     plugin = malloc(sizeof(guac_client_plugin));
     if (plugin == NULL) {
@@ -95,6 +104,7 @@ guac_client_plugin* guac_client_plugin_open(const char* protocol) {
     /* Init and return plugin */
     plugin->__client_plugin_handle = client_plugin_handle;
     plugin->init_handler = alias.client_init;
+    plugin->preload_handler = preload_alias.client_preload;
     plugin->args = client_args;
     return plugin;
 
@@ -115,6 +125,16 @@ int guac_client_plugin_close(guac_client_plugin* plugin) {
 
 }
 
+int guac_client_plugin_preload(guac_client_plugin* plugin) {
+
+    /* Nothing to do if plugin has no shared state */
+    if (plugin->preload_handler == NULL)
+        return 0;
+
+    return plugin->preload_handler();
+
+}
+
 int guac_client_plugin_init_client(guac_client_plugin* plugin,
         guac_client* client, int argc, char** argv) {
 
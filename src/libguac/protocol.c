@@ -22,23 +22,17 @@
 
 #include "config.h"
 
+#include "encode.h"
 #include "error.h"
 #include "layer.h"
-#include "palette.h"
 #include "protocol.h"
 #include "socket.h"
 #include "stream.h"
 #include "unicode.h"
 
-#include <png.h>
 #include <cairo/cairo.h>
 
-#ifdef HAVE_PNGSTRUCT_H
-#include <pngstruct.h>
-#endif
-
 #include <inttypes.h>
-#include <setjmp.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -73,265 +67,61 @@ ssize_t __guac_socket_write_length_double(guac_socket* socket, double d) {
 
 }
 
-/* PNG output formatting */
-
-typedef struct __guac_socket_write_png_data {
-
-    guac_socket* socket;
-
-    char* buffer;
-    int buffer_size;
-    int data_size;
-
-} __guac_socket_write_png_data;
-
-cairo_status_t __guac_socket_write_png_cairo(void* closure, const unsigned char* data, unsigned int length) {
-
-    __guac_socket_write_png_data* png_data = (__guac_socket_write_png_data*) closure;
-
-    /* Calculate next buffer size */
-    int next_size = png_data->data_size + length;
-
-    /* If need resizing, double buffer size until big enough */
-    if (next_size > png_data->buffer_size) {
-
-        char* new_buffer;
-
-        do {
-            png_data->buffer_size <<= 1;
-        } while (next_size > png_data->buffer_size);
-
-        /* Resize buffer */
-        new_buffer = realloc(png_data->buffer, png_data->buffer_size);
-        png_data->buffer = new_buffer;
-
-    }
-
-    /* Append data to buffer */
-    memcpy(png_data->buffer + png_data->data_size, data, length);
-    png_data->data_size += length;
-
-    return CAIRO_STATUS_SUCCESS;
-
-}
+/* Image output formatting */
 
-int __guac_socket_write_length_png_cairo(guac_socket* socket, cairo_surface_t* surface) {
-
-    __guac_socket_write_png_data png_data;
-    int base64_length;
-
-    /* Write surface */
-
-    png_data.socket = socket;
-    png_data.buffer_size = 8192;
-    png_data.buffer = malloc(png_data.buffer_size);
-    png_data.data_size = 0;
-
-    if (cairo_surface_write_to_png_stream(surface, __guac_socket_write_png_cairo, &png_data) != CAIRO_STATUS_SUCCESS) {
-        guac_error = GUAC_STATUS_INTERNAL_ERROR;
-        guac_error_message = "Cairo PNG backend failed";
-        return -1;
-    }
+/**
+ * Writes the given encoded image to the given socket as a single
+ * length-prefixed, base64-encoded instruction element.
+ */
+static int __guac_socket_write_length_image(guac_socket* socket,
+        guac_encode_buffer* image) {
 
-    base64_length = (png_data.data_size + 2) / 3 * 4;
+    int base64_length = (image->length + 2) / 3 * 4;
 
-    /* Write length and data */
-    if (
+    return
            guac_socket_write_int(socket, base64_length)
         || guac_socket_write_string(socket, ".")
-        || guac_socket_write_base64(socket, png_data.buffer, png_data.data_size)
-        || guac_socket_flush_base64(socket)) {
-        free(png_data.buffer);
-        return -1;
-    }
-
-    free(png_data.buffer);
-    return 0;
+        || guac_socket_write_base64(socket, image->data, image->length)
+        || guac_socket_flush_base64(socket);
 
 }
 
-void __guac_socket_write_png(png_structp png,
-        png_bytep data, png_size_t length) {
-
-    /* Get png buffer structure */
-    __guac_socket_write_png_data* png_data;
-#ifdef HAVE_PNG_GET_IO_PTR
-    png_data = (__guac_socket_write_png_data*) png_get_io_ptr(png);
-#else
-    png_data = (__guac_socket_write_png_data*) png->io_ptr;
-#endif
-
-    /* Calculate next buffer size */
-    int next_size = png_data->data_size + length;
-
-    /* If need resizing, double buffer size until big enough */
-    if (next_size > png_data->buffer_size) {
-
-        char* new_buffer;
-
-        do {
-            png_data->buffer_size <<= 1;
-        } while (next_size > png_data->buffer_size);
-
-        /* Resize buffer */
-        new_buffer = realloc(png_data->buffer, png_data->buffer_size);
-        png_data->buffer = new_buffer;
-
-    }
-
-    /* Append data to buffer */
-    memcpy(png_data->buffer + png_data->data_size, data, length);
-    png_data->data_size += length;
-
-}
-
-void __guac_socket_flush_png(png_structp png) {
-    /* Dummy function */
-}
-
-int __guac_socket_write_length_png(guac_socket* socket, cairo_surface_t* surface) {
-
-    png_structp png;
-    png_infop png_info;
-    png_byte** png_rows;
-    int bpp;
-
-    int x, y;
-
-    __guac_socket_write_png_data png_data;
-    int base64_length;
-
-    /* Get image surface properties and data */
-    cairo_format_t format = cairo_image_surface_get_format(surface);
-    int width = cairo_image_surface_get_width(surface);
-    int height = cairo_image_surface_get_height(surface);
-    int stride = cairo_image_surface_get_stride(surface);
-    unsigned char* data = cairo_image_surface_get_data(surface);
-
-    /* If not RGB24, use Cairo PNG writer */
-    if (format != CAIRO_FORMAT_RGB24 || data == NULL)
-        return __guac_socket_write_length_png_cairo(socket, surface);
-
-    /* Flush pending operations to surface */
-    cairo_surface_flush(surface);
-
-    /* Attempt to build palette */
-    guac_palette* palette = guac_palette_alloc(surface);
-
-    /* If not possible, resort to Cairo PNG writer */
-    if (palette == NULL)
-        return __guac_socket_write_length_png_cairo(socket, surface);
-
-    /* Calculate BPP from palette size */
-    if      (palette->size <= 2)  bpp = 1;
-    else if (palette->size <= 4)  bpp = 2;
-    else if (palette->size <= 16) bpp = 4;
-    else                          bpp = 8;
-
-    /* Set up PNG writer */
-    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png) {
-        guac_error = GUAC_STATUS_INTERNAL_ERROR;
-        guac_error_message = "libpng failed to create write structure";
-        return -1;
-    }
+/**
+ * Encodes the given surface in the given format, and sends the result as an
+ * instruction with the given opcode, which must be an image instruction
+ * taking the same arguments as "png". The image is encoded in its entirety
+ * before the instruction is begun, such that no partial instruction is ever
+ * written should encoding fail.
+ */
+static int __guac_protocol_send_image(guac_socket* socket, const char* opcode,
+        guac_encode_format format, int quality, guac_composite_mode mode,
+        const guac_layer* layer, int x, int y, cairo_surface_t* surface) {
 
-    png_info = png_create_info_struct(png);
-    if (!png_info) {
-        png_destroy_write_struct(&png, NULL);
-        guac_error = GUAC_STATUS_INTERNAL_ERROR;
-        guac_error_message = "libpng failed to create info structure";
-        return -1;
-    }
+    guac_encode_buffer image;
+    int ret_val;
 
-    /* Set error handler */
-    if (setjmp(png_jmpbuf(png))) {
-        png_destroy_write_struct(&png, &png_info);
-        guac_error = GUAC_STATUS_IO_ERROR;
-        guac_error_message = "libpng output error";
+    /* Encode image, as its length must be known before sending */
+    if (guac_encode_buffer_surface(socket, &image, format, surface, quality))
         return -1;
-    }
-
-    /* Set up buffer structure */
-    png_data.socket = socket;
-    png_data.buffer_size = 8192;
-    png_data.buffer = malloc(png_data.buffer_size);
-    png_data.data_size = 0;
-
-    /* Set up writer */
-    png_set_write_fn(png, &png_data,
-            __guac_socket_write_png,
-            __guac_socket_flush_png);
-
-    /* Copy data from surface into PNG data */
-    png_rows = (png_byte**) malloc(sizeof(png_byte*) * height);
-    for (y=0; y<height; y++) {
-
-        /* Allocate new PNG row */
-        png_byte* row = (png_byte*) malloc(sizeof(png_byte) * width);
-        png_rows[y] = row;
-
-        /* Copy data from surface into current row */
-        for (x=0; x<width; x++) {
 
-            /* Get pixel color */
-            int color = ((uint32_t*) data)[x] & 0xFFFFFF;
-
-            /* Set index in row */
-            row[x] = guac_palette_find(palette, color);
-
-        }
-
-        /* Advance to next data row */
-        data += stride;
-
-    }
+    guac_socket_instruction_begin(socket);
+    ret_val =
+           guac_socket_write_string(socket, opcode)
+        || __guac_socket_write_length_int(socket, mode)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_int(socket, layer->index)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_int(socket, x)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_int(socket, y)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_image(socket, &image)
+        || guac_socket_write_string(socket, ";");
 
-    /* Write image info */
-    png_set_IHDR(
-        png,
-        png_info,
-        width,
-        height,
-        bpp,
-        PNG_COLOR_TYPE_PALETTE,
-        PNG_INTERLACE_NONE,
-        PNG_COMPRESSION_TYPE_DEFAULT,
-        PNG_FILTER_TYPE_DEFAULT
-    );
-
-    /* Write palette */
-    png_set_PLTE(png, png_info, palette->colors, palette->size);
-
-    /* Write image */
-    png_set_rows(png, png_info, png_rows);
-    png_write_png(png, png_info, PNG_TRANSFORM_PACKING, NULL);
-
-    /* Finish write */
-    png_destroy_write_struct(&png, &png_info);
-
-    /* Free palette */
-    guac_palette_free(palette);
-
-    /* Free PNG data */
-    for (y=0; y<height; y++)
-        free(png_rows[y]);
-    free(png_rows);
-
-    base64_length = (png_data.data_size + 2) / 3 * 4;
-
-    /* Write length and data */
-    if (
-           guac_socket_write_int(socket, base64_length)
-        || guac_socket_write_string(socket, ".")
-        || guac_socket_write_base64(socket, png_data.buffer, png_data.data_size)
-        || guac_socket_flush_base64(socket)) {
-        free(png_data.buffer);
-        return -1;
-    }
+    guac_socket_instruction_end(socket);
+    guac_encode_buffer_free(&image);
 
-    free(png_data.buffer);
-    return 0;
+    return ret_val;
 
 }
 
@@ -848,6 +638,42 @@ int guac_protocol_send_identity(guac_socket* socket, const guac_layer* layer) {
 
 }
 
+int guac_protocol_send_img(guac_socket* socket, const guac_stream* stream,
+        guac_composite_mode mode, const guac_layer* layer,
+        const char* mimetype, int x, int y) {
+
+    int ret_val;
+
+    guac_socket_instruction_begin(socket);
+    ret_val =
+           guac_socket_write_string(socket, "3.img,")
+        || __guac_socket_write_length_int(socket, stream->index)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_int(socket, mode)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_int(socket, layer->index)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_string(socket, mimetype)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_int(socket, x)
+        || guac_socket_write_string(socket, ",")
+        || __guac_socket_write_length_int(socket, y)
+        || guac_socket_write_string(socket, ";");
+
+    guac_socket_instruction_end(socket);
+    return ret_val;
+
+}
+
+int guac_protocol_send_jpeg(guac_socket* socket, guac_composite_mode mode,
+        const guac_layer* layer, int x, int y, cairo_surface_t* surface,
+        int quality) {
+
+    return __guac_protocol_send_image(socket, "4.jpeg,", GUAC_ENCODE_JPEG,
+            quality, mode, layer, x, y, surface);
+
+}
+
 int guac_protocol_send_lfill(guac_socket* socket,
         guac_composite_mode mode, const guac_layer* layer,
         const guac_layer* srcl) {
@@ -1009,24 +835,8 @@ int guac_protocol_send_pipe(guac_socket* socket, const guac_stream* stream,
 int guac_protocol_send_png(guac_socket* socket, guac_composite_mode mode,
         const guac_layer* layer, int x, int y, cairo_surface_t* surface) {
 
-    int ret_val;
-
-    guac_socket_instruction_begin(socket);
-    ret_val =
-           guac_socket_write_string(socket, "3.png,")
-        || __guac_socket_write_length_int(socket, mode)
-        || guac_socket_write_string(socket, ",")
-        || __guac_socket_write_length_int(socket, layer->index)
-        || guac_socket_write_string(socket, ",")
-        || __guac_socket_write_length_int(socket, x)
-        || guac_socket_write_string(socket, ",")
-        || __guac_socket_write_length_int(socket, y)
-        || guac_socket_write_string(socket, ",")
-        || __guac_socket_write_length_png(socket, surface)
-        || guac_socket_write_string(socket, ";");
-
-    guac_socket_instruction_end(socket);
-    return ret_val;
+    return __guac_protocol_send_image(socket, "3.png,", GUAC_ENCODE_PNG, 0,
+            mode, layer, x, y, surface);
 
 }
 
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "error.h"
+#include "socket.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The initial size of the memory buffer of each buffer socket, in bytes.
+ */
+#define GUAC_SOCKET_BUFFER_INITIAL_SIZE 65536
+
+typedef struct __guac_socket_buffer_data {
+
+    /**
+     * The socket which receives all buffered data upon commit.
+     */
+    guac_socket* parent;
+
+    /**
+     * All data written thus far.
+     */
+    char* buffer;
+
+    /**
+     * The number of bytes written thus far.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes allocated for the buffer.
+     */
+    size_t size;
+
+} __guac_socket_buffer_data;
+
+static ssize_t __guac_socket_buffer_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    __guac_socket_buffer_data* data = (__guac_socket_buffer_data*) socket->data;
+
+    /* Discard anything written after free */
+    if (data == NULL)
+        return count;
+
+    /* Grow buffer as necessary */
+    if (data->length + count > data->size) {
+
+        size_t size = data->size;
+        char* buffer;
+
+        while (data->length + count > size)
+            size *= 2;
+
+        buffer = realloc(data->buffer, size);
+        if (buffer == NULL) {
+            guac_error = GUAC_STATUS_NO_MEMORY;
+            guac_error_message = "Unable to grow socket buffer";
+            return -1;
+        }
+
+        data->buffer = buffer;
+        data->size = size;
+
+    }
+
+    memcpy(data->buffer + data->length, buf, count);
+    data->length += count;
+    return count;
+
+}
+
+static int __guac_socket_buffer_free_handler(guac_socket* socket) {
+
+    __guac_socket_buffer_data* data = (__guac_socket_buffer_data*) socket->data;
+
+    free(data->buffer);
+    free(data);
+
+    /* Any data written by the final flush is discarded */
+    socket->data = NULL;
+    return 0;
+
+}
+
+/**
+ * Adds the image statistics of the given socket to those of the given
+ * parent socket, resetting the statistics of the given socket.
+ *
+ * @param socket The socket whose statistics should be moved.
+ * @param parent The socket whose statistics should be updated.
+ */
+static void __guac_socket_buffer_merge_image_stats(guac_socket* socket,
+        guac_socket* parent) {
+
+    guac_socket_image_stats stats;
+    guac_socket_image_stats* total = &(parent->__image_stats);
+
+    pthread_mutex_lock(&(socket->__image_stats_lock));
+    stats = socket->__image_stats;
+    memset(&(socket->__image_stats), 0, sizeof(socket->__image_stats));
+    pthread_mutex_unlock(&(socket->__image_stats_lock));
+
+    pthread_mutex_lock(&(parent->__image_stats_lock));
+
+    total->png_images       += stats.png_images;
+    total->png_bytes        += stats.png_bytes;
+    total->png_time         += stats.png_time;
+    total->png_pixels       += stats.png_pixels;
+    total->jpeg_images      += stats.jpeg_images;
+    total->jpeg_bytes       += stats.jpeg_bytes;
+    total->jpeg_time        += stats.jpeg_time;
+    total->jpeg_pixels      += stats.jpeg_pixels;
+    total->streamed_images  += stats.streamed_images;
+    total->first_blob_time  += stats.first_blob_time;
+
+    if (stats.max_first_blob_time > total->max_first_blob_time)
+        total->max_first_blob_time = stats.max_first_blob_time;
+
+    pthread_mutex_unlock(&(parent->__image_stats_lock));
+
+}
+
+guac_socket* guac_socket_buffer(guac_socket* parent) {
+
+    __guac_socket_buffer_data* data;
+    guac_socket* socket = guac_socket_alloc();
+    if (socket == NULL)
+        return NULL;
+
+    data = malloc(sizeof(__guac_socket_buffer_data));
+    if (data == NULL) {
+        guac_error = GUAC_STATUS_NO_MEMORY;
+        guac_error_message = "Could not allocate socket buffer";
+        guac_socket_free(socket);
+        return NULL;
+    }
+
+    data->parent = parent;
+    data->length = 0;
+    data->size = GUAC_SOCKET_BUFFER_INITIAL_SIZE;
+    data->buffer = malloc(data->size);
+    if (data->buffer == NULL) {
+        guac_error = GUAC_STATUS_NO_MEMORY;
+        guac_error_message = "Could not allocate socket buffer";
+        free(data);
+        guac_socket_free(socket);
+        return NULL;
+    }
+
+    socket->data = data;
+    socket->write_handler = __guac_socket_buffer_write_handler;
+    socket->free_handler  = __guac_socket_buffer_free_handler;
+
+    return socket;
+
+}
+
+int guac_socket_buffer_commit(guac_socket* socket) {
+
+    __guac_socket_buffer_data* data = (__guac_socket_buffer_data*) socket->data;
+    int retval = 0;
+
+    /* Move any data within the socket's own output buffer into memory */
+    if (guac_socket_flush(socket))
+        return 1;
+
+    /* Write everything buffered as a single unit */
+    if (data->length > 0) {
+
+        guac_socket_instruction_begin(data->parent);
+        retval = guac_socket_write_bytes(data->parent, data->buffer,
+                data->length);
+        guac_socket_instruction_end(data->parent);
+
+        data->length = 0;
+
+    }
+
+    __guac_socket_buffer_merge_image_stats(socket, data->parent);
+    return retval;
+
+}
+
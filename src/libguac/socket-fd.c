@@ -35,6 +35,7 @@
 #include <winsock2.h>
 #else
 #include <sys/select.h>
+#include <sys/uio.h>
 #endif
 
 typedef struct __guac_socket_fd_data {
@@ -84,6 +85,25 @@ ssize_t __guac_socket_fd_write_handler(guac_socket* socket,
     return retval;
 }
 
+#ifndef __MINGW32__
+ssize_t __guac_socket_fd_writev_handler(guac_socket* socket,
+        const struct iovec* iov, int iovcnt) {
+
+    __guac_socket_fd_data* data = (__guac_socket_fd_data*) socket->data;
+
+    /* Write all segments with a single call, if possible */
+    ssize_t retval = writev(data->fd, iov, iovcnt);
+
+    /* Record errors in guac_error */
+    if (retval < 0) {
+        guac_error = GUAC_STATUS_SEE_ERRNO;
+        guac_error_message = "Error writing data to socket";
+    }
+
+    return retval;
+}
+#endif
+
 int __guac_socket_fd_select_handler(guac_socket* socket, int usec_timeout) {
 
     __guac_socket_fd_data* data = (__guac_socket_fd_data*) socket->data;
@@ -137,6 +157,11 @@ guac_socket* guac_socket_open(int fd) {
     socket->write_handler  = __guac_socket_fd_write_handler;
     socket->select_handler = __guac_socket_fd_select_handler;
 
+#ifndef __MINGW32__
+    /* Scatter-gather writes are not available via WINSOCK */
+    socket->writev_handler = __guac_socket_fd_writev_handler;
+#endif
+
     return socket;
 
 }
@@ -22,7 +22,10 @@
 
 #include "config.h"
 
+#include "base64.h"
 #include "error.h"
+#include "instruction.h"
+#include "keep-alive.h"
 #include "protocol.h"
 #include "socket.h"
 #include "timestamp.h"
@@ -33,6 +36,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -44,38 +48,6 @@ char __guac_socket_BASE64_CHARACTERS[64] = {
     '8', '9', '+', '/'
 };
 
-static void* __guac_socket_keep_alive_thread(void* data) {
-
-    /* Calculate sleep interval */
-    struct timespec interval;
-    interval.tv_sec  =  GUAC_SOCKET_KEEP_ALIVE_INTERVAL / 1000;
-    interval.tv_nsec = (GUAC_SOCKET_KEEP_ALIVE_INTERVAL % 1000) * 1000000L;
-
-    /* Socket keep-alive loop */
-    guac_socket* socket = (guac_socket*) data;
-    while (socket->state == GUAC_SOCKET_OPEN) {
-
-        /* Send NOP keep-alive if it's been a while since the last output */
-        guac_timestamp timestamp = guac_timestamp_current();
-        if (timestamp - socket->last_write_timestamp >
-                GUAC_SOCKET_KEEP_ALIVE_INTERVAL) {
-
-            /* Send NOP */
-            if (guac_protocol_send_nop(socket)
-                || guac_socket_flush(socket))
-                break;
-
-        }
-
-        /* Sleep until next keep-alive check */
-        nanosleep(&interval, NULL);
-
-    }
-
-    return NULL;
-
-}
-
 static ssize_t __guac_socket_write(guac_socket* socket,
         const void* buf, size_t count) {
 
@@ -83,10 +55,18 @@ static ssize_t __guac_socket_write(guac_socket* socket,
     socket->last_write_timestamp = guac_timestamp_current();
 
     /* If handler defined, call it. */
-    if (socket->write_handler)
-        return socket->write_handler(socket, buf, count);
+    if (socket->write_handler) {
+
+        ssize_t written = socket->write_handler(socket, buf, count);
+        if (written > 0)
+            socket->__bytes_written += written;
+
+        return written;
+
+    }
 
     /* Otherwise, pretend everything was written. */
+    socket->__bytes_written += count;
     return count;
 
 }
@@ -114,6 +94,185 @@ ssize_t guac_socket_write(guac_socket* socket,
 
 }
 
+/**
+ * Writes all data within the given segments, in order, using the writev
+ * handler of the given socket if defined, or its write handler otherwise.
+ * Partial writes are continued until all data has been written. The given
+ * segments are modified as data is written.
+ *
+ * @param socket The guac_socket to write to.
+ * @param iov The segments of data to write.
+ * @param iovcnt The number of segments in the iov array.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_writev(guac_socket* socket,
+        struct iovec* iov, int iovcnt) {
+
+    /* Write each segment separately if writev is not supported */
+    if (socket->writev_handler == NULL) {
+
+        int i;
+        for (i = 0; i < iovcnt; i++) {
+            if (guac_socket_write(socket, iov[i].iov_base, iov[i].iov_len))
+                return 1;
+        }
+
+        return 0;
+
+    }
+
+    /* Write until completely written */
+    while (iovcnt > 0) {
+
+        /* Update timestamp of last write */
+        socket->last_write_timestamp = guac_timestamp_current();
+
+        /* Attempt to write, return on error */
+        ssize_t written = socket->writev_handler(socket, iov, iovcnt);
+        if (written < 0)
+            return 1;
+
+        socket->__bytes_written += written;
+
+        /* Skip all completely-written segments */
+        while (iovcnt > 0 && written >= (ssize_t) iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        /* Advance within partially-written segment */
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Appends any data within the main write buffer which is not yet part of a
+ * pending segment to the output chain as a new segment. There must be room
+ * for at least one additional segment within the chain.
+ *
+ * @param socket The guac_socket whose output chain should be updated.
+ */
+static void __guac_socket_end_inline_segment(guac_socket* socket) {
+
+    int length = socket->__written - socket->__segment_start;
+
+    /* Add segment only if data is actually present */
+    if (length > 0) {
+
+        int index = socket->__segment_count++;
+        socket->__segments[index].iov_base =
+            socket->__out_buf + socket->__segment_start;
+        socket->__segments[index].iov_len = length;
+        socket->__segment_owned[index] = NULL;
+
+        socket->__segment_start = socket->__written;
+
+    }
+
+}
+
+/**
+ * Writes the contents of the main write buffer, preceded by all pending
+ * segments if scatter-gather output is enabled, resetting the buffer and
+ * output chain. The buffer lock must already be held if threadsafety is
+ * enabled.
+ *
+ * @param socket The guac_socket to flush.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_flush_buffer(guac_socket* socket) {
+
+    int i;
+    int retval;
+
+    /* Without scatter-gather output, simply write the buffer */
+    if (!socket->__writev_enabled) {
+
+        if (guac_socket_write(socket, socket->__out_buf, socket->__written))
+            return 1;
+
+        socket->__written = 0;
+        return 0;
+
+    }
+
+    /* Add remaining buffered data as final segment */
+    __guac_socket_end_inline_segment(socket);
+
+    retval = __guac_socket_writev(socket,
+            socket->__segments, socket->__segment_count);
+
+    /* Release all separately-allocated segments, even on error */
+    for (i = 0; i < socket->__segment_count; i++)
+        free(socket->__segment_owned[i]);
+
+    socket->__segment_count = 0;
+    socket->__segment_start = 0;
+    socket->__segment_bytes = 0;
+    socket->__written = 0;
+
+    return retval;
+
+}
+
+/**
+ * Encodes the given number of complete 3-byte groups as base64 into a newly
+ * allocated segment, appending that segment to the output chain of the given
+ * socket. Scatter-gather output must be enabled, and the buffer lock must
+ * already be held if threadsafety is enabled.
+ *
+ * @param socket The guac_socket to write to.
+ * @param buf The bytes to encode.
+ * @param groups The number of 3-byte groups to encode.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_write_base64_segment(guac_socket* socket,
+        const unsigned char* buf, size_t groups) {
+
+    int index;
+    size_t length = groups * 4;
+
+    /* Flush if there is no room for both the preceding inline segment and
+     * this segment, while still leaving room for a final inline segment */
+    if (socket->__segment_count > GUAC_SOCKET_MAX_SEGMENTS - 3
+            && __guac_socket_flush_buffer(socket))
+        return 1;
+
+    /* Allocate segment */
+    char* encoded = malloc(length);
+    if (encoded == NULL) {
+        guac_error = GUAC_STATUS_NO_MEMORY;
+        guac_error_message = "Could not allocate memory for output segment";
+        return 1;
+    }
+
+    guac_base64_encode_groups(encoded, buf, groups);
+
+    /* Append after any data already buffered */
+    __guac_socket_end_inline_segment(socket);
+
+    index = socket->__segment_count++;
+    socket->__segments[index].iov_base = encoded;
+    socket->__segments[index].iov_len = length;
+    socket->__segment_owned[index] = encoded;
+
+    /* Do not hold excessive amounts of data by reference */
+    socket->__segment_bytes += length;
+    if (socket->__segment_bytes >= GUAC_SOCKET_MAX_SEGMENT_BYTES)
+        return __guac_socket_flush_buffer(socket);
+
+    return 0;
+
+}
+
 ssize_t guac_socket_read(guac_socket* socket, void* buf, size_t count) {
 
     /* If handler defined, call it. */
@@ -157,19 +316,41 @@ guac_socket* guac_socket_alloc() {
     /* Init members */
     socket->__instructionbuf_unparsed_start = socket->__instructionbuf;
     socket->__instructionbuf_unparsed_end = socket->__instructionbuf;
+    socket->__instruction = NULL;
 
     /* Default to unsafe threading */
     socket->__threadsafe_instructions = 0;
+    socket->__staging_enabled = 0;
+    socket->__keep_alive_enabled = 0;
+    socket->__keep_alive_slot = -1;
+
+    /* No locks used yet */
+    memset(&(socket->__instruction_lock_stats), 0,
+            sizeof(socket->__instruction_lock_stats));
+    memset(&(socket->__buffer_lock_stats), 0,
+            sizeof(socket->__buffer_lock_stats));
+
+    /* No images sent yet */
+    memset(&(socket->__image_stats), 0, sizeof(socket->__image_stats));
+    socket->__bytes_written = 0;
+
+    /* Default to copying all output through the main write buffer */
+    socket->__writev_enabled = 0;
+    socket->__segment_count = 0;
+    socket->__segment_start = 0;
+    socket->__segment_bytes = 0;
 
     pthread_mutexattr_init(&lock_attributes);
     pthread_mutexattr_setpshared(&lock_attributes, PTHREAD_PROCESS_SHARED);
 
     pthread_mutex_init(&(socket->__instruction_write_lock), &lock_attributes);
     pthread_mutex_init(&(socket->__buffer_lock),            &lock_attributes);
+    pthread_mutex_init(&(socket->__image_stats_lock),       &lock_attributes);
     
     /* No handlers yet */
     socket->read_handler   = NULL;
     socket->write_handler  = NULL;
+    socket->writev_handler = NULL;
     socket->select_handler = NULL;
     socket->free_handler   = NULL;
 
@@ -186,99 +367,148 @@ void guac_socket_require_keep_alive(guac_socket* socket) {
     /* Keep-alive thread requires a threadsafe socket */
     guac_socket_require_threadsafe(socket);
 
-    /* Start keep-alive thread */
-    socket->__keep_alive_enabled = 1;
-    pthread_create(&(socket->__keep_alive_thread), NULL,
-                __guac_socket_keep_alive_thread, (void*) socket);
+    if (socket->__keep_alive_enabled)
+        return;
+
+    /* Ping from the shared keep-alive thread */
+    if (__guac_keep_alive_add(socket) == 0)
+        socket->__keep_alive_enabled = 1;
 
 }
 
-void guac_socket_instruction_begin(guac_socket* socket) {
+void guac_socket_require_staging(guac_socket* socket) {
 
-    /* Lock writes if threadsafety enabled */
-    if (socket->__threadsafe_instructions)
-        pthread_mutex_lock(&(socket->__instruction_write_lock));
+    /* Staged instructions are still published under lock */
+    guac_socket_require_threadsafe(socket);
+    socket->__staging_enabled = 1;
 
 }
 
-void guac_socket_instruction_end(guac_socket* socket) {
-
-    /* Unlock writes if threadsafety enabled */
-    if (socket->__threadsafe_instructions)
-        pthread_mutex_unlock(&(socket->__instruction_write_lock));
-
+void guac_socket_require_writev(guac_socket* socket) {
+    socket->__writev_enabled = 1;
 }
 
-void guac_socket_update_buffer_begin(guac_socket* socket) {
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds, for the
+ * sake of measuring lock hold times.
+ *
+ * @return The current value of the monotonic clock, in nanoseconds.
+ */
+static uint64_t __guac_socket_monotonic_ns() {
 
-    /* Lock if threadsafety enabled */
-    if (socket->__threadsafe_instructions)
-        pthread_mutex_lock(&(socket->__buffer_lock));
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+
+    return (uint64_t) current.tv_sec * 1000000000 + current.tv_nsec;
 
 }
 
-void guac_socket_update_buffer_end(guac_socket* socket) {
+/**
+ * Acquires the given lock, updating the given statistics accordingly. The
+ * acquisition is counted as contended if the lock was held by another thread
+ * at the time of the call.
+ *
+ * @param lock The lock to acquire.
+ * @param stats The statistics associated with the lock.
+ * @param acquired Storage for the time the lock was acquired, in nanoseconds.
+ */
+static void __guac_socket_lock(pthread_mutex_t* lock,
+        guac_socket_lock_stats* stats, uint64_t* acquired) {
 
-    /* Unlock if threadsafety enabled */
-    if (socket->__threadsafe_instructions)
-        pthread_mutex_unlock(&(socket->__buffer_lock));
+    int contended = 0;
 
-}
+    /* Wait only if the lock is not immediately available */
+    if (pthread_mutex_trylock(lock)) {
+        pthread_mutex_lock(lock);
+        contended = 1;
+    }
 
-void guac_socket_free(guac_socket* socket) {
+    /* Statistics are protected by the lock itself */
+    stats->acquisitions++;
+    stats->contended += contended;
+    *acquired = __guac_socket_monotonic_ns();
 
-    /* Call free handler if defined */
-    if (socket->free_handler)
-        socket->free_handler(socket);
+}
 
-    guac_socket_flush(socket);
+/**
+ * Acquires the given lock only if it is immediately available, updating the
+ * given statistics accordingly.
+ *
+ * @param lock The lock to acquire.
+ * @param stats The statistics associated with the lock.
+ * @param acquired Storage for the time the lock was acquired, in nanoseconds.
+ * @return Zero if the lock was acquired, non-zero if it is held by another
+ *         thread.
+ */
+static int __guac_socket_trylock(pthread_mutex_t* lock,
+        guac_socket_lock_stats* stats, uint64_t* acquired) {
 
-    /* Mark as closed */
-    socket->state = GUAC_SOCKET_CLOSED;
+    if (pthread_mutex_trylock(lock))
+        return 1;
 
-    /* Wait for keep-alive, if enabled */
-    if (socket->__keep_alive_enabled)
-        pthread_join(socket->__keep_alive_thread, NULL);
+    stats->acquisitions++;
+    *acquired = __guac_socket_monotonic_ns();
+    return 0;
 
-    pthread_mutex_destroy(&(socket->__instruction_write_lock));
-    free(socket);
 }
 
-ssize_t guac_socket_write_int(guac_socket* socket, int64_t i) {
+/**
+ * Releases the given lock, updating the given statistics with the length of
+ * time the lock was held.
+ *
+ * @param lock The lock to release.
+ * @param stats The statistics associated with the lock.
+ * @param acquired The time the lock was acquired, in nanoseconds.
+ */
+static void __guac_socket_unlock(pthread_mutex_t* lock,
+        guac_socket_lock_stats* stats, uint64_t acquired) {
 
-    char buffer[128];
-    snprintf(buffer, sizeof(buffer), "%"PRIi64, i);
-    return guac_socket_write_string(socket, buffer);
+    uint64_t held = __guac_socket_monotonic_ns() - acquired;
 
-}
+    stats->hold_time += held;
+    if (held > stats->max_hold_time)
+        stats->max_hold_time = held;
 
-ssize_t guac_socket_write_string(guac_socket* socket, const char* str) {
+    pthread_mutex_unlock(lock);
 
-    char* __out_buf = socket->__out_buf;
+}
 
-    guac_socket_update_buffer_begin(socket);
+/**
+ * Appends the given data to the main write buffer of the given socket,
+ * flushing as necessary. The buffer lock must already be held if
+ * threadsafety is enabled.
+ *
+ * @param socket The guac_socket to write to.
+ * @param buf The data to write.
+ * @param count The number of bytes to write.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_write_buffered(guac_socket* socket,
+        const char* buf, size_t count) {
+
+    while (count > 0) {
 
-    for (; *str != '\0'; str++) {
+        /* Copy as much as fits in the buffer */
+        size_t length = GUAC_SOCKET_OUTPUT_BUFFER_SIZE - socket->__written;
+        if (length > count)
+            length = count;
 
-        __out_buf[socket->__written++] = *str; 
+        memcpy(socket->__out_buf + socket->__written, buf, length);
+        socket->__written += length;
+        buf += length;
+        count -= length;
 
-        /* Flush when necessary, return on error. Note that we must flush within 4 bytes of boundary because
-         * __guac_socket_write_base64_triplet ALWAYS writes four bytes, and would otherwise potentially overflow
-         * the buffer. */
+        /* Flush when necessary, return on error. Note that we must flush
+         * within 4 bytes of boundary because
+         * __guac_socket_write_base64_triplet ALWAYS writes four bytes, and
+         * would otherwise potentially overflow the buffer. */
         if (socket->__written > GUAC_SOCKET_OUTPUT_BUFFER_SIZE - 4) {
-
-            if (guac_socket_write(socket, __out_buf, socket->__written)) {
-                guac_socket_update_buffer_end(socket);
+            if (__guac_socket_flush_buffer(socket))
                 return 1;
-            }
-
-            socket->__written = 0;
-
         }
 
     }
 
-    guac_socket_update_buffer_end(socket);
     return 0;
 
 }
@@ -313,10 +543,8 @@ ssize_t __guac_socket_write_base64_triplet(guac_socket* socket, int a, int b, in
     /* Flush when necessary, return on error */
     if (socket->__written > GUAC_SOCKET_OUTPUT_BUFFER_SIZE - 4) {
 
-        if (guac_socket_write(socket, __out_buf, socket->__written))
+        if (__guac_socket_flush_buffer(socket))
             return -1;
-
-        socket->__written = 0;
     }
 
     if (b < 0)
@@ -349,66 +577,853 @@ ssize_t __guac_socket_write_base64_byte(guac_socket* socket, int buf) {
     return 1;
 }
 
-ssize_t guac_socket_write_base64(guac_socket* socket, const void* buf, size_t count) {
+
+/**
+ * Writes the given binary data to the given socket as base64, exactly as
+ * guac_socket_write_base64(), but without acquiring the buffer lock. The
+ * buffer lock must already be held if threadsafety is enabled.
+ *
+ * @param socket The guac_socket to write to.
+ * @param buf The data to write.
+ * @param count The number of bytes to write.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static ssize_t __guac_socket_write_base64_unlocked(guac_socket* socket,
+        const void* buf, size_t count) {
 
     int retval;
 
     const unsigned char* char_buf = (const unsigned char*) buf;
     const unsigned char* end = char_buf + count;
 
-    guac_socket_update_buffer_begin(socket);
-    while (char_buf < end) {
+    /* Complete any partial triplet left over from a previous write */
+    while (socket->__ready > 0 && char_buf < end) {
 
         retval = __guac_socket_write_base64_byte(socket, *(char_buf++));
-        if (retval < 0) {
-            guac_socket_update_buffer_end(socket);
+        if (retval < 0)
             return retval;
-        }
 
     }
 
-    guac_socket_update_buffer_end(socket);
-    return 0;
+    /* Encode large payloads into a segment of their own, if possible */
+    if (socket->__writev_enabled
+            && end - char_buf >= GUAC_SOCKET_SEGMENT_THRESHOLD) {
 
-}
+        size_t groups = (end - char_buf) / 3;
+        if (__guac_socket_write_base64_segment(socket, char_buf, groups))
+            return -1;
 
-ssize_t guac_socket_flush(guac_socket* socket) {
+        char_buf += groups * 3;
 
-    /* Flush remaining bytes in buffer */
-    guac_socket_update_buffer_begin(socket);
-    if (socket->__written > 0) {
+    }
 
-        if (guac_socket_write(socket, socket->__out_buf, socket->__written)) {
-            guac_socket_update_buffer_end(socket);
-            return 1;
+    /* Encode all complete triplets directly into the output buffer */
+    while (end - char_buf >= 3) {
+
+        /* Encode as many triplets as will fit in the remaining space */
+        size_t groups = (GUAC_SOCKET_OUTPUT_BUFFER_SIZE - socket->__written) / 4;
+        size_t available = (end - char_buf) / 3;
+        if (groups > available)
+            groups = available;
+
+        socket->__written += guac_base64_encode_groups(
+                &(socket->__out_buf[socket->__written]), char_buf, groups);
+        char_buf += groups * 3;
+
+        /* Flush when necessary, return on error */
+        if (socket->__written > GUAC_SOCKET_OUTPUT_BUFFER_SIZE - 4) {
+            if (__guac_socket_flush_buffer(socket))
+                return -1;
         }
 
-        socket->__written = 0;
     }
 
-    guac_socket_update_buffer_end(socket);
+    /* Carry any remaining bytes as a partial triplet */
+    while (char_buf < end) {
+
+        retval = __guac_socket_write_base64_byte(socket, *(char_buf++));
+        if (retval < 0)
+            return retval;
+
+    }
+
     return 0;
 
 }
 
-ssize_t guac_socket_flush_base64(guac_socket* socket) {
+/**
+ * Flushes the base64 "ready" buffer of the given socket, exactly as
+ * guac_socket_flush_base64(), but without acquiring the buffer lock. The
+ * buffer lock must already be held if threadsafety is enabled.
+ *
+ * @param socket The guac_socket to flush.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static ssize_t __guac_socket_flush_base64_unlocked(guac_socket* socket) {
 
     int retval;
 
     /* Flush triplet to output buffer */
-    guac_socket_update_buffer_begin(socket);
     while (socket->__ready > 0) {
 
         retval = __guac_socket_write_base64_byte(socket, -1);
-        if (retval < 0) {
-            guac_socket_update_buffer_end(socket);
+        if (retval < 0)
             return retval;
-        }
 
     }
 
-    guac_socket_update_buffer_end(socket);
     return 0;
 
 }
 
+/**
+ * A buffer in which a single thread builds a complete instruction for a
+ * socket with instruction staging enabled, prior to publishing that
+ * instruction to the socket.
+ */
+typedef struct guac_socket_stage {
+
+    /**
+     * The socket that this stage is currently building an instruction for,
+     * or NULL if the stage is not in use.
+     */
+    guac_socket* socket;
+
+    /**
+     * The number of times guac_socket_instruction_begin() has been called
+     * for the current instruction without a corresponding call to
+     * guac_socket_instruction_end().
+     */
+    int depth;
+
+    /**
+     * Whether the current instruction outgrew the stage, in which case the
+     * socket buffer lock is held and all further data is written directly
+     * to the socket until the instruction ends.
+     */
+    int spilled;
+
+    /**
+     * The staged instruction data.
+     */
+    char* buffer;
+
+    /**
+     * The number of bytes of staged instruction data.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes allocated for the buffer.
+     */
+    size_t size;
+
+    /**
+     * The number of bytes present in the base64 "ready" buffer.
+     */
+    int ready;
+
+    /**
+     * The base64 "ready" buffer of this stage, equivalent to the __ready_buf
+     * of a guac_socket.
+     */
+    int ready_buf[3];
+
+    /**
+     * The next stage belonging to the same thread, or NULL if this is the
+     * last such stage.
+     */
+    struct guac_socket_stage* next;
+
+} guac_socket_stage;
+
+/**
+ * Key used to store the list of stages belonging to the current thread.
+ */
+static pthread_key_t __guac_socket_stage_key;
+
+/**
+ * Guard ensuring __guac_socket_stage_key is created only once.
+ */
+static pthread_once_t __guac_socket_stage_key_init = PTHREAD_ONCE_INIT;
+
+/**
+ * Frees the given list of stages. This function is invoked automatically
+ * for each thread upon that thread's exit.
+ *
+ * @param data The first stage in the list of stages to free.
+ */
+static void __guac_socket_free_stages(void* data) {
+
+    guac_socket_stage* stage = (guac_socket_stage*) data;
+
+    while (stage != NULL) {
+        guac_socket_stage* next = stage->next;
+        free(stage->buffer);
+        free(stage);
+        stage = next;
+    }
+
+}
+
+static void __guac_socket_stage_key_alloc() {
+    pthread_key_create(&__guac_socket_stage_key, __guac_socket_free_stages);
+}
+
+/**
+ * Returns the stage currently building an instruction for the given socket
+ * within the current thread, or NULL if no such instruction is in progress.
+ *
+ * @param socket The guac_socket to retrieve the stage of.
+ * @return The active stage of the given socket for the current thread, or
+ *         NULL if there is no such stage.
+ */
+static guac_socket_stage* __guac_socket_get_stage(guac_socket* socket) {
+
+    guac_socket_stage* stage;
+
+    if (!socket->__staging_enabled)
+        return NULL;
+
+    pthread_once(&__guac_socket_stage_key_init, __guac_socket_stage_key_alloc);
+
+    /* Search this thread's stages for one associated with the socket */
+    stage = (guac_socket_stage*) pthread_getspecific(__guac_socket_stage_key);
+    while (stage != NULL && stage->socket != socket)
+        stage = stage->next;
+
+    return stage;
+
+}
+
+/**
+ * Returns an unused stage of the current thread, associating that stage with
+ * the given socket. A new stage is allocated if all existing stages of the
+ * current thread are in use.
+ *
+ * @param socket The guac_socket to associate with the stage.
+ * @return A stage associated with the given socket, or NULL if no stage
+ *         could be allocated.
+ */
+static guac_socket_stage* __guac_socket_claim_stage(guac_socket* socket) {
+
+    guac_socket_stage* first;
+    guac_socket_stage* stage;
+
+    pthread_once(&__guac_socket_stage_key_init, __guac_socket_stage_key_alloc);
+
+    /* Reuse any unused stage of this thread */
+    first = (guac_socket_stage*) pthread_getspecific(__guac_socket_stage_key);
+    for (stage = first; stage != NULL; stage = stage->next) {
+        if (stage->socket == NULL)
+            break;
+    }
+
+    /* Otherwise, allocate a new stage */
+    if (stage == NULL) {
+
+        stage = calloc(1, sizeof(guac_socket_stage));
+        if (stage == NULL)
+            return NULL;
+
+        stage->next = first;
+        pthread_setspecific(__guac_socket_stage_key, stage);
+
+    }
+
+    stage->socket = socket;
+    stage->depth = 0;
+    stage->spilled = 0;
+    stage->length = 0;
+    stage->ready = 0;
+
+    return stage;
+
+}
+
+/**
+ * Appends any partial base64 triplet of the given stage to the partial
+ * triplet of its socket, writing a complete triplet if one results. The
+ * socket buffer lock must be held.
+ *
+ * @param stage The stage whose partial triplet should be appended.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_append_stage_ready(guac_socket_stage* stage) {
+
+    int i;
+
+    for (i = 0; i < stage->ready; i++) {
+        if (__guac_socket_write_base64_byte(stage->socket,
+                    stage->ready_buf[i]) < 0)
+            return 1;
+    }
+
+    stage->ready = 0;
+    return 0;
+
+}
+
+/**
+ * Writes the contents of the given stage to its socket as a single atomic
+ * unit, acquiring the socket buffer lock, and leaving that lock held such
+ * that the remainder of the current instruction can be written directly.
+ * This is used only for instructions too large to stage.
+ *
+ * @param stage The stage to spill.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_spill_stage(guac_socket_stage* stage) {
+
+    guac_socket* socket = stage->socket;
+
+    __guac_socket_lock(&(socket->__buffer_lock),
+            &(socket->__buffer_lock_stats), &(socket->__buffer_lock_acquired));
+
+    socket->__buffer_lock_stats.spilled_instructions++;
+    stage->spilled = 1;
+
+    /* Write all data staged thus far */
+    if (__guac_socket_write_buffered(socket, stage->buffer, stage->length))
+        return 1;
+
+    /* Continue any partial base64 triplet within the socket itself */
+    if (__guac_socket_append_stage_ready(stage))
+        return 1;
+
+    stage->length = 0;
+
+    return 0;
+
+}
+
+/**
+ * Ensures that the given stage can hold the given number of additional bytes,
+ * reallocating its buffer as necessary. If the stage would exceed
+ * GUAC_SOCKET_STAGING_LIMIT, the stage is spilled instead.
+ *
+ * @param stage The stage to reserve space within.
+ * @param count The number of additional bytes required.
+ * @return Zero on success, or non-zero if an error occurs while spilling.
+ */
+static int __guac_socket_stage_reserve(guac_socket_stage* stage,
+        size_t count) {
+
+    size_t required = stage->length + count;
+
+    /* Spill instructions which are too large to stage */
+    if (required > GUAC_SOCKET_STAGING_LIMIT)
+        return __guac_socket_spill_stage(stage);
+
+    /* Grow buffer as necessary */
+    if (required > stage->size) {
+
+        size_t size = stage->size ? stage->size : 1024;
+        while (size < required)
+            size *= 2;
+
+        char* buffer = realloc(stage->buffer, size);
+        if (buffer == NULL)
+            return __guac_socket_spill_stage(stage);
+
+        stage->buffer = buffer;
+        stage->size = size;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Appends the given data to the given stage.
+ *
+ * @param stage The stage to write to.
+ * @param buf The data to write.
+ * @param count The number of bytes to write.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_stage_write(guac_socket_stage* stage,
+        const char* buf, size_t count) {
+
+    if (!stage->spilled && __guac_socket_stage_reserve(stage, count))
+        return 1;
+
+    /* Write directly to socket if the stage was spilled */
+    if (stage->spilled)
+        return __guac_socket_write_buffered(stage->socket, buf, count);
+
+    memcpy(stage->buffer + stage->length, buf, count);
+    stage->length += count;
+    return 0;
+
+}
+
+/**
+ * Appends the given data to the given stage as base64, carrying any partial
+ * triplet within the stage, exactly as guac_socket_write_base64() carries
+ * partial triplets within the socket.
+ *
+ * @param stage The stage to write to.
+ * @param buf The data to write.
+ * @param count The number of bytes to write.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_stage_write_base64(guac_socket_stage* stage,
+        const unsigned char* buf, size_t count) {
+
+    size_t groups;
+
+    /* Reserve space for all data, including any completed carry */
+    if (!stage->spilled && __guac_socket_stage_reserve(stage,
+                (stage->ready + count) / 3 * 4))
+        return 1;
+
+    /* Write directly to socket if the stage was spilled */
+    if (stage->spilled)
+        return __guac_socket_write_base64_unlocked(stage->socket, buf, count);
+
+    /* Complete any partial triplet left over from a previous write */
+    while (stage->ready > 0 && count > 0) {
+
+        stage->ready_buf[stage->ready++] = *(buf++);
+        count--;
+
+        if (stage->ready == 3) {
+
+            unsigned char triplet[3] = {
+                stage->ready_buf[0],
+                stage->ready_buf[1],
+                stage->ready_buf[2]
+            };
+
+            stage->length += guac_base64_encode_groups(
+                    stage->buffer + stage->length, triplet, 1);
+            stage->ready = 0;
+
+        }
+
+    }
+
+    /* Encode all complete triplets */
+    groups = count / 3;
+    stage->length += guac_base64_encode_groups(
+            stage->buffer + stage->length, buf, groups);
+    buf += groups * 3;
+    count -= groups * 3;
+
+    /* Carry any remaining bytes as a partial triplet */
+    while (count > 0) {
+        stage->ready_buf[stage->ready++] = *(buf++);
+        count--;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Writes any partial triplet carried within the given stage as base64,
+ * including padding.
+ *
+ * @param stage The stage to flush.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_stage_flush_base64(guac_socket_stage* stage) {
+
+    char* output;
+    int a, b;
+
+    if (stage->spilled)
+        return __guac_socket_flush_base64_unlocked(stage->socket);
+
+    if (stage->ready == 0)
+        return 0;
+
+    if (__guac_socket_stage_reserve(stage, 4))
+        return 1;
+
+    /* Stage may have been spilled to make room */
+    if (stage->spilled)
+        return __guac_socket_flush_base64_unlocked(stage->socket);
+
+    a = stage->ready_buf[0];
+    b = stage->ready > 1 ? stage->ready_buf[1] : 0;
+
+    output = stage->buffer + stage->length;
+    output[0] = __guac_socket_BASE64_CHARACTERS[(a & 0xFC) >> 2];
+    output[1] = __guac_socket_BASE64_CHARACTERS[((a & 0x03) << 4) | ((b & 0xF0) >> 4)];
+    output[2] = stage->ready > 1 ? __guac_socket_BASE64_CHARACTERS[(b & 0x0F) << 2] : '=';
+    output[3] = '=';
+
+    stage->length += 4;
+    stage->ready = 0;
+    return 0;
+
+}
+
+void guac_socket_instruction_begin(guac_socket* socket) {
+
+    guac_socket_stage* stage;
+
+    /* Build instruction within stage if staging enabled */
+    if (socket->__staging_enabled) {
+
+        /* Continue existing stage, if any */
+        stage = __guac_socket_get_stage(socket);
+        if (stage == NULL)
+            stage = __guac_socket_claim_stage(socket);
+
+        /* Fall back to locking if no stage could be allocated */
+        if (stage != NULL) {
+            stage->depth++;
+            return;
+        }
+
+    }
+
+    /* Lock writes if threadsafety enabled */
+    if (socket->__threadsafe_instructions)
+        __guac_socket_lock(&(socket->__instruction_write_lock),
+                &(socket->__instruction_lock_stats),
+                &(socket->__instruction_lock_acquired));
+
+}
+
+void guac_socket_instruction_end(guac_socket* socket) {
+
+    guac_socket_stage* stage = __guac_socket_get_stage(socket);
+
+    /* Publish instruction if staged */
+    if (stage != NULL) {
+
+        /* Wait for outermost instruction */
+        if (--stage->depth > 0)
+            return;
+
+        /* Publish staged instruction atomically */
+        if (!stage->spilled) {
+
+            __guac_socket_lock(&(socket->__buffer_lock),
+                    &(socket->__buffer_lock_stats),
+                    &(socket->__buffer_lock_acquired));
+
+            socket->__buffer_lock_stats.staged_instructions++;
+
+            /* Errors will resurface upon the next write or flush */
+            __guac_socket_write_buffered(socket, stage->buffer, stage->length);
+
+            /* Retain any partial base64 triplet, as would the socket */
+            __guac_socket_append_stage_ready(stage);
+
+        }
+
+        /* Release stage, along with lock acquired by publish or spill */
+        stage->socket = NULL;
+        __guac_socket_unlock(&(socket->__buffer_lock),
+                &(socket->__buffer_lock_stats),
+                socket->__buffer_lock_acquired);
+
+        return;
+
+    }
+
+    /* Unlock writes if threadsafety enabled */
+    if (socket->__threadsafe_instructions)
+        __guac_socket_unlock(&(socket->__instruction_write_lock),
+                &(socket->__instruction_lock_stats),
+                socket->__instruction_lock_acquired);
+
+}
+
+void guac_socket_update_buffer_begin(guac_socket* socket) {
+
+    /* Lock if threadsafety enabled */
+    if (socket->__threadsafe_instructions)
+        __guac_socket_lock(&(socket->__buffer_lock),
+                &(socket->__buffer_lock_stats),
+                &(socket->__buffer_lock_acquired));
+
+}
+
+void guac_socket_update_buffer_end(guac_socket* socket) {
+
+    /* Unlock if threadsafety enabled */
+    if (socket->__threadsafe_instructions)
+        __guac_socket_unlock(&(socket->__buffer_lock),
+                &(socket->__buffer_lock_stats),
+                socket->__buffer_lock_acquired);
+
+}
+
+void guac_socket_get_lock_stats(guac_socket* socket,
+        guac_socket_lock_stats* stats) {
+
+    guac_socket_lock_stats* instruction_stats;
+    guac_socket_lock_stats* buffer_stats;
+
+    /* Snapshot buffer lock statistics */
+    guac_socket_update_buffer_begin(socket);
+    buffer_stats = &(socket->__buffer_lock_stats);
+    *stats = *buffer_stats;
+    guac_socket_update_buffer_end(socket);
+
+    /* Combine with snapshot of instruction lock statistics, taken without
+     * counting the snapshot itself as an acquisition */
+    if (socket->__threadsafe_instructions)
+        pthread_mutex_lock(&(socket->__instruction_write_lock));
+
+    instruction_stats = &(socket->__instruction_lock_stats);
+    stats->acquisitions += instruction_stats->acquisitions;
+    stats->contended    += instruction_stats->contended;
+    stats->hold_time    += instruction_stats->hold_time;
+
+    if (instruction_stats->max_hold_time > stats->max_hold_time)
+        stats->max_hold_time = instruction_stats->max_hold_time;
+
+    if (socket->__threadsafe_instructions)
+        pthread_mutex_unlock(&(socket->__instruction_write_lock));
+
+}
+
+void guac_socket_get_image_stats(guac_socket* socket,
+        guac_socket_image_stats* stats) {
+
+    pthread_mutex_lock(&(socket->__image_stats_lock));
+    *stats = socket->__image_stats;
+    pthread_mutex_unlock(&(socket->__image_stats_lock));
+
+    /* Estimate what JPEG images would have cost as PNG */
+    if (stats->png_pixels > 0)
+        stats->jpeg_bytes_saved = (int64_t) ((double) stats->png_bytes
+                * stats->jpeg_pixels / stats->png_pixels)
+            - (int64_t) stats->jpeg_bytes;
+
+}
+
+uint64_t guac_socket_get_bytes_written(guac_socket* socket) {
+
+    uint64_t bytes;
+
+    guac_socket_update_buffer_begin(socket);
+    bytes = socket->__bytes_written;
+    guac_socket_update_buffer_end(socket);
+
+    return bytes;
+
+}
+
+void guac_socket_free(guac_socket* socket) {
+
+    /* Stop keep-alive, if enabled, waiting for any ping in progress */
+    if (socket->__keep_alive_enabled)
+        __guac_keep_alive_remove(socket);
+
+    /* Call free handler if defined */
+    if (socket->free_handler)
+        socket->free_handler(socket);
+
+    guac_socket_flush(socket);
+
+    /* Mark as closed */
+    socket->state = GUAC_SOCKET_CLOSED;
+
+    pthread_mutex_destroy(&(socket->__instruction_write_lock));
+    pthread_mutex_destroy(&(socket->__image_stats_lock));
+
+    /* Free reusable instruction, if ever allocated */
+    if (socket->__instruction != NULL)
+        guac_instruction_free(socket->__instruction);
+
+    free(socket);
+}
+
+ssize_t guac_socket_write_int(guac_socket* socket, int64_t i) {
+
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%"PRIi64, i);
+    return guac_socket_write_string(socket, buffer);
+
+}
+
+ssize_t guac_socket_write_string(guac_socket* socket, const char* str) {
+
+    int retval;
+
+    /* Write to stage if building a staged instruction */
+    guac_socket_stage* stage = __guac_socket_get_stage(socket);
+    if (stage != NULL)
+        return __guac_socket_stage_write(stage, str, strlen(str));
+
+    guac_socket_update_buffer_begin(socket);
+    retval = __guac_socket_write_buffered(socket, str, strlen(str));
+    guac_socket_update_buffer_end(socket);
+
+    return retval;
+
+}
+
+/**
+ * Appends the given data to the output of the given socket, following any
+ * data already buffered. Data smaller than GUAC_SOCKET_SEGMENT_THRESHOLD is
+ * copied into the main write buffer, while larger data is written directly
+ * together with everything buffered before it. The buffer lock must already
+ * be held if threadsafety is enabled.
+ *
+ * @param socket The guac_socket to write to.
+ * @param buf The data to write.
+ * @param count The number of bytes to write.
+ * @return Zero on success, or non-zero if an error occurs while writing.
+ */
+static int __guac_socket_write_bytes_unlocked(guac_socket* socket,
+        const char* buf, size_t count) {
+
+    int index;
+
+    if (count < GUAC_SOCKET_SEGMENT_THRESHOLD)
+        return __guac_socket_write_buffered(socket, buf, count);
+
+    /* Without scatter-gather output, send buffered data first */
+    if (!socket->__writev_enabled) {
+
+        if (socket->__written > 0 && __guac_socket_flush_buffer(socket))
+            return 1;
+
+        return guac_socket_write(socket, buf, count);
+
+    }
+
+    /* Ensure room for the preceding inline segment and this segment */
+    if (socket->__segment_count > GUAC_SOCKET_MAX_SEGMENTS - 2
+            && __guac_socket_flush_buffer(socket))
+        return 1;
+
+    /* Reference data as its own segment, flushing immediately as the data
+     * is not owned by the socket */
+    __guac_socket_end_inline_segment(socket);
+
+    index = socket->__segment_count++;
+    socket->__segments[index].iov_base = (char*) buf;
+    socket->__segments[index].iov_len = count;
+    socket->__segment_owned[index] = NULL;
+
+    return __guac_socket_flush_buffer(socket);
+
+}
+
+ssize_t guac_socket_write_bytes(guac_socket* socket, const void* buf,
+        size_t count) {
+
+    int retval;
+
+    /* Stage data if building a staged instruction, unless the data would
+     * not fit within the stage */
+    guac_socket_stage* stage = __guac_socket_get_stage(socket);
+    if (stage != NULL) {
+
+        if (!stage->spilled
+                && stage->length + count <= GUAC_SOCKET_STAGING_LIMIT)
+            return __guac_socket_stage_write(stage, buf, count);
+
+        /* The buffer lock remains held once the stage is spilled */
+        if (!stage->spilled && __guac_socket_spill_stage(stage))
+            return 1;
+
+        return __guac_socket_write_bytes_unlocked(socket, buf, count);
+
+    }
+
+    guac_socket_update_buffer_begin(socket);
+    retval = __guac_socket_write_bytes_unlocked(socket, buf, count);
+    guac_socket_update_buffer_end(socket);
+
+    return retval;
+
+}
+
+ssize_t guac_socket_write_base64(guac_socket* socket, const void* buf, size_t count) {
+
+    int retval;
+
+    /* Write to stage if building a staged instruction */
+    guac_socket_stage* stage = __guac_socket_get_stage(socket);
+    if (stage != NULL)
+        return __guac_socket_stage_write_base64(stage, buf, count);
+
+    guac_socket_update_buffer_begin(socket);
+    retval = __guac_socket_write_base64_unlocked(socket, buf, count);
+    guac_socket_update_buffer_end(socket);
+
+    return retval;
+
+}
+
+ssize_t guac_socket_flush(guac_socket* socket) {
+
+    /* Flush remaining bytes in buffer */
+    guac_socket_update_buffer_begin(socket);
+    if (socket->__written > 0 || socket->__segment_count > 0) {
+
+        if (__guac_socket_flush_buffer(socket)) {
+            guac_socket_update_buffer_end(socket);
+            return 1;
+        }
+
+    }
+
+    guac_socket_update_buffer_end(socket);
+    return 0;
+
+}
+
+int __guac_socket_try_send_nop(guac_socket* socket) {
+
+    int retval;
+
+    /* Unstaged instructions hold the instruction lock throughout */
+    if (__guac_socket_trylock(&(socket->__instruction_write_lock),
+                &(socket->__instruction_lock_stats),
+                &(socket->__instruction_lock_acquired)))
+        return 1;
+
+    /* Staged instructions and writes in progress hold the buffer lock */
+    if (__guac_socket_trylock(&(socket->__buffer_lock),
+                &(socket->__buffer_lock_stats),
+                &(socket->__buffer_lock_acquired))) {
+        __guac_socket_unlock(&(socket->__instruction_write_lock),
+                &(socket->__instruction_lock_stats),
+                socket->__instruction_lock_acquired);
+        return 1;
+    }
+
+    retval = __guac_socket_write_buffered(socket, "3.nop;", 6)
+          || __guac_socket_flush_buffer(socket);
+
+    __guac_socket_unlock(&(socket->__buffer_lock),
+            &(socket->__buffer_lock_stats),
+            socket->__buffer_lock_acquired);
+
+    __guac_socket_unlock(&(socket->__instruction_write_lock),
+            &(socket->__instruction_lock_stats),
+            socket->__instruction_lock_acquired);
+
+    return retval ? -1 : 0;
+
+}
+
+ssize_t guac_socket_flush_base64(guac_socket* socket) {
+
+    int retval;
+
+    /* Flush triplet of stage if building a staged instruction */
+    guac_socket_stage* stage = __guac_socket_get_stage(socket);
+    if (stage != NULL)
+        return __guac_socket_stage_flush_base64(stage);
+
+    guac_socket_update_buffer_begin(socket);
+    retval = __guac_socket_flush_base64_unlocked(socket);
+    guac_socket_update_buffer_end(socket);
+
+    return retval;
+
+}
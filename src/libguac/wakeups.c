@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "timestamp.h"
+#include "wakeups.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Lock which is acquired while the wakeup counters are updated or read.
+ */
+static pthread_mutex_t __guac_wakeups_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Guards registration of the handler which resets all counters after fork().
+ */
+static pthread_once_t __guac_wakeups_once = PTHREAD_ONCE_INIT;
+
+/**
+ * The total number of wakeups recorded.
+ */
+static uint64_t __guac_wakeups_total = 0;
+
+/**
+ * The second during which the first wakeup was recorded.
+ */
+static guac_timestamp __guac_wakeups_first_second = 0;
+
+/**
+ * The number of wakeups recorded during each of the most recent seconds,
+ * indexed by second modulo GUAC_WAKEUPS_WINDOW.
+ */
+static int __guac_wakeups_counts[GUAC_WAKEUPS_WINDOW];
+
+/**
+ * The second which each entry of __guac_wakeups_counts describes.
+ */
+static guac_timestamp __guac_wakeups_seconds[GUAC_WAKEUPS_WINDOW];
+
+/**
+ * Resets all counters within the child after fork(), such that each process
+ * counts only its own wakeups.
+ */
+static void __guac_wakeups_child_fork() {
+
+    pthread_mutex_init(&__guac_wakeups_lock, NULL);
+
+    __guac_wakeups_total = 0;
+    __guac_wakeups_first_second = 0;
+    memset(__guac_wakeups_counts, 0, sizeof(__guac_wakeups_counts));
+    memset(__guac_wakeups_seconds, 0, sizeof(__guac_wakeups_seconds));
+
+}
+
+/**
+ * Registers the handler which resets all counters after fork().
+ */
+static void __guac_wakeups_init() {
+    pthread_atfork(NULL, NULL, __guac_wakeups_child_fork);
+}
+
+void guac_wakeups_record() {
+
+    guac_timestamp second = guac_timestamp_current() / 1000;
+    int index = second % GUAC_WAKEUPS_WINDOW;
+
+    pthread_once(&__guac_wakeups_once, __guac_wakeups_init);
+    pthread_mutex_lock(&__guac_wakeups_lock);
+
+    if (__guac_wakeups_total++ == 0)
+        __guac_wakeups_first_second = second;
+
+    /* Reuse entries of seconds which have left the window */
+    if (__guac_wakeups_seconds[index] != second) {
+        __guac_wakeups_seconds[index] = second;
+        __guac_wakeups_counts[index] = 0;
+    }
+
+    __guac_wakeups_counts[index]++;
+
+    pthread_mutex_unlock(&__guac_wakeups_lock);
+
+}
+
+uint64_t guac_wakeups_get_total() {
+
+    uint64_t total;
+
+    pthread_mutex_lock(&__guac_wakeups_lock);
+    total = __guac_wakeups_total;
+    pthread_mutex_unlock(&__guac_wakeups_lock);
+
+    return total;
+
+}
+
+double guac_wakeups_get_rate(int* seconds) {
+
+    guac_timestamp second = guac_timestamp_current() / 1000;
+    int window = 0;
+    int sum = 0;
+    int i;
+
+    pthread_mutex_lock(&__guac_wakeups_lock);
+
+    if (__guac_wakeups_total > 0) {
+
+        /* Average only over complete seconds */
+        window = second - __guac_wakeups_first_second;
+        if (window > GUAC_WAKEUPS_WINDOW)
+            window = GUAC_WAKEUPS_WINDOW;
+
+        for (i = 0; i < GUAC_WAKEUPS_WINDOW; i++) {
+            guac_timestamp age = second - __guac_wakeups_seconds[i];
+            if (age >= 1 && age <= window)
+                sum += __guac_wakeups_counts[i];
+        }
+
+    }
+
+    pthread_mutex_unlock(&__guac_wakeups_lock);
+
+    if (seconds != NULL)
+        *seconds = window;
+
+    if (window == 0)
+        return 0;
+
+    return (double) sum / window;
+
+}
+
@@ -26,6 +26,7 @@
 #include "guac_handlers.h"
 #include "guac_pointer_cursor.h"
 #include "guac_string.h"
+#include "guac_worker_pool.h"
 #include "rdp_bitmap.h"
 #include "rdp_gdi.h"
 #include "rdp_glyph.h"
@@ -84,7 +85,9 @@
 #include <freerdp/version.h>
 #endif
 
+#include <errno.h>
 #include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -115,6 +118,8 @@ const char* GUAC_CLIENT_ARGS[] = {
     "remote-app-dir",
     "remote-app-args",
     "static-channels",
+    "enable-image-streams",
+    GUAC_COMMON_SURFACE_OPTIONS_ARGS,
     NULL
 };
 
@@ -144,6 +149,10 @@ enum RDP_ARGS_IDX {
     IDX_REMOTE_APP_DIR,
     IDX_REMOTE_APP_ARGS,
     IDX_STATIC_CHANNELS,
+    IDX_ENABLE_IMAGE_STREAMS,
+    IDX_SURFACE_OPTIONS,
+    IDX_SURFACE_OPTIONS_END = IDX_SURFACE_OPTIONS
+        + GUAC_COMMON_SURFACE_OPTIONS_ARGS_COUNT - 1,
     RDP_ARGS_COUNT
 };
 
@@ -510,10 +519,49 @@ void __guac_rdp_client_load_keymap(guac_client* client,
 
 }
 
+/**
+ * Guards initialization of the global state of FreeRDP, which must happen
+ * exactly once per process, either by preloading or by the first client.
+ */
+static pthread_once_t __guac_rdp_global_init_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Initializes the global state of FreeRDP. This must only be invoked
+ * through pthread_once().
+ */
+static void __guac_rdp_global_init_once_handler() {
+#ifdef HAVE_FREERDP_CHANNELS_GLOBAL_INIT
+    freerdp_channels_global_init();
+#endif
+}
+
+/**
+ * Initializes the global state of FreeRDP, if not already initialized within
+ * this process. This function is threadsafe.
+ */
+static void __guac_rdp_global_init() {
+    pthread_once(&__guac_rdp_global_init_once,
+            __guac_rdp_global_init_once_handler);
+}
+
+int guac_client_preload() {
+
+    /* Initialize channel tables and register static add-ins ahead of time */
+    __guac_rdp_global_init();
+
+#ifdef HAVE_FREERDP_REGISTER_ADDIN_PROVIDER
+    freerdp_register_addin_provider(freerdp_channels_load_static_addin_entry, 0);
+#endif
+
+    return 0;
+
+}
+
 int guac_client_init(guac_client* client, int argc, char** argv) {
 
     rdp_guac_client_data* guac_client_data;
     guac_rdp_settings* settings;
+    guac_common_surface_options* options;
 
     freerdp* rdp_inst;
 
@@ -530,9 +578,7 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     srandom(time(NULL));
 
     /* Init client */
-#ifdef HAVE_FREERDP_CHANNELS_GLOBAL_INIT
-    freerdp_channels_global_init();
-#endif
+    __guac_rdp_global_init();
     rdp_inst = freerdp_new();
     rdp_inst->PreConnect = rdp_freerdp_pre_connect;
     rdp_inst->PostConnect = rdp_freerdp_post_connect;
@@ -691,6 +737,19 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     if (argv[IDX_STATIC_CHANNELS][0] != '\0')
         settings->svc_names = guac_split(argv[IDX_STATIC_CHANNELS], ',');
 
+    /* Image streams enable/disable */
+    settings->image_streams =
+        (strcmp(argv[IDX_ENABLE_IMAGE_STREAMS], "true") == 0);
+
+    /* Options controlling updates to the default surface */
+    options = &settings->surface_options;
+    if (guac_common_surface_options_parse(client, options,
+                &argv[IDX_SURFACE_OPTIONS])) {
+        guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                "Unable to allocate surface options.");
+        return 1;
+    }
+
     /* Session color depth */
     settings->color_depth = RDP_DEFAULT_DEPTH;
     if (argv[IDX_COLOR_DEPTH][0] != '\0')
@@ -763,8 +822,105 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     __guac_rdp_client_load_keymap(client, settings->server_layout);
 
     /* Create default surface */
-    guac_client_data->default_surface = guac_common_surface_alloc(client->socket, GUAC_DEFAULT_LAYER,
+    guac_client_data->default_surface = guac_common_surface_alloc(client, client->socket, GUAC_DEFAULT_LAYER,
                                                                   settings->width, settings->height);
+    guac_common_surface_set_image_streams(guac_client_data->default_surface,
+                                          settings->image_streams);
+    guac_common_surface_set_jpeg_quality(guac_client_data->default_surface,
+                                         options->jpeg_quality);
+
+    /* Track damage by tile, if requested */
+    if (options->damage_tiles)
+        guac_common_surface_set_damage_model(guac_client_data->default_surface,
+                                             GUAC_COMMON_SURFACE_DAMAGE_TILES);
+
+    /* Copy scrolled content rather than resending it, if requested */
+    guac_common_surface_set_motion_detection(guac_client_data->default_surface,
+                                             options->motion_detection);
+
+    /* Send slightly-changed updates as deltas, if requested */
+    guac_common_surface_set_delta_updates(guac_client_data->default_surface,
+                                          options->delta_updates);
+
+    /* Combine updates based on their measured cost, unless pinned */
+    guac_client_data->cost_model = guac_common_cost_model_alloc();
+    if (guac_client_data->cost_model == NULL) {
+        guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                "Unable to allocate cost model.");
+        return 1;
+    }
+
+    guac_common_cost_model_pin(guac_client_data->cost_model,
+                               options->update_cost, options->pixel_cost);
+    guac_common_surface_set_cost_model(guac_client_data->default_surface,
+                                       guac_client_data->cost_model);
+
+    /* Retain recently-sent images within client-side buffers, if requested */
+    guac_client_data->image_cache = NULL;
+    if (options->image_cache_size > 0) {
+        guac_client_data->image_cache = guac_common_image_cache_alloc(client,
+                (size_t) options->image_cache_size * 1024);
+        if (guac_client_data->image_cache == NULL) {
+            guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                    "Unable to allocate image cache.");
+            return 1;
+        }
+        guac_common_surface_set_image_cache(guac_client_data->default_surface,
+                                            guac_client_data->image_cache);
+    }
+
+    /* Encode updates in parallel, if requested */
+    guac_client_data->encoder_pool = NULL;
+    if (options->encoder_threads > 0) {
+        guac_client_data->encoder_pool =
+            guac_common_worker_pool_alloc(options->encoder_threads);
+        guac_common_surface_set_encoder_pool(guac_client_data->default_surface,
+                                             guac_client_data->encoder_pool);
+    }
+
+    /* Reduce update quality as bandwidth falls, if requested */
+    guac_client_data->profile = NULL;
+    if (options->adaptive_encoding) {
+        guac_client_data->profile = guac_common_profile_alloc();
+        if (guac_client_data->profile == NULL) {
+            guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                    "Unable to allocate encoding profile.");
+            return 1;
+        }
+        guac_common_profile_set_thresholds(guac_client_data->profile,
+                options->reduced_color_bandwidth, options->lossy_bandwidth,
+                options->reduced_rate_bandwidth);
+        guac_common_surface_set_profile(guac_client_data->default_surface,
+                                        guac_client_data->profile);
+    }
+
+    /* Record all drawing for later replay, if requested and allowed */
+    guac_client_data->trace = NULL;
+    if (options->surface_trace != NULL) {
+
+        if (client->trace_directory == NULL)
+            guac_client_log(client, GUAC_LOG_WARNING,
+                    "Surface traces are not allowed. Drawing will not be "
+                    "recorded.");
+
+        else {
+
+            guac_client_data->trace = guac_common_surface_trace_open(
+                    client->trace_directory, options->surface_trace);
+
+            if (guac_client_data->trace != NULL)
+                guac_common_surface_set_trace(
+                        guac_client_data->default_surface,
+                        guac_client_data->trace);
+            else
+                guac_client_log(client, GUAC_LOG_ERROR,
+                        "Unable to create surface trace \"%s\": %s",
+                        options->surface_trace, strerror(errno));
+
+        }
+
+    }
+
     guac_client_data->current_surface = guac_client_data->default_surface;
 
     /* Send connection name */
@@ -27,8 +27,13 @@
 #include "config.h"
 
 #include "guac_clipboard.h"
+#include "guac_cost_model.h"
+#include "guac_image_cache.h"
 #include "guac_list.h"
+#include "guac_profile.h"
 #include "guac_surface.h"
+#include "guac_surface_trace.h"
+#include "guac_worker_pool.h"
 #include "rdp_fs.h"
 #include "rdp_keymap.h"
 #include "rdp_settings.h"
@@ -112,6 +117,36 @@ typedef struct rdp_guac_client_data {
      */
     guac_common_surface* default_surface;
 
+    /**
+     * The worker pool used to encode image updates in parallel, or NULL if
+     * image updates are encoded serially.
+     */
+    guac_common_worker_pool* encoder_pool;
+
+    /**
+     * Cache of images retained within client-side buffers, or NULL if images
+     * are not cached.
+     */
+    guac_common_image_cache* image_cache;
+
+    /**
+     * Model of the cost of image updates, used when deciding whether updates
+     * should be combined.
+     */
+    guac_common_cost_model* cost_model;
+
+    /**
+     * The trace recording all drawing to the default surface and to cached
+     * bitmaps, or NULL if drawing is not being recorded.
+     */
+    guac_common_surface_trace* trace;
+
+    /**
+     * The profile selecting the quality of updates to the default surface
+     * and to cached bitmaps, or NULL if adaptive encoding is disabled.
+     */
+    guac_common_profile* profile;
+
     /**
      * The surface that GDI operations should draw to. RDP messages exist which
      * change this surface to allow drawing to occur off-screen.
@@ -25,8 +25,13 @@
 #include "client.h"
 #include "guac_clipboard.h"
 #include "guac_handlers.h"
+#include "guac_cost_model.h"
+#include "guac_image_cache.h"
 #include "guac_list.h"
+#include "guac_profile.h"
 #include "guac_surface.h"
+#include "guac_surface_trace.h"
+#include "guac_worker_pool.h"
 #include "rdp_cliprdr.h"
 #include "rdp_keymap.h"
 #include "rdp_fs.h"
@@ -61,6 +66,7 @@
 #endif
 
 #include <errno.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <sys/select.h>
@@ -100,6 +106,58 @@ int rdp_guac_client_free_handler(guac_client* client) {
     /* Free client data */
     guac_common_clipboard_free(guac_client_data->clipboard);
     guac_common_surface_free(guac_client_data->default_surface);
+
+    /* Free image cache, if any */
+    if (guac_client_data->image_cache != NULL) {
+
+        guac_common_image_cache_stats stats;
+        guac_common_image_cache_get_stats(guac_client_data->image_cache, &stats);
+        guac_client_log(client, GUAC_LOG_INFO, "Image cache: %" PRIu64
+                " hits, %" PRIu64 " misses, %" PRIu64 " evictions.",
+                stats.hits, stats.misses, stats.evictions);
+
+        guac_common_image_cache_free(guac_client_data->image_cache);
+
+    }
+
+    /* Free cost model, noting the costs used */
+    if (guac_client_data->cost_model != NULL) {
+
+        guac_common_cost_model_stats stats;
+        guac_common_cost_model_get_stats(guac_client_data->cost_model, &stats);
+        guac_client_log(client, GUAC_LOG_INFO, "Cost model: %" PRIu64
+                " updates measured, %.0f ns per update, %.1f ns per pixel, "
+                "base cost of %i pixels%s.", stats.samples, stats.update_cost,
+                stats.pixel_cost, stats.base_cost,
+                stats.calibrated ? "" : " (default)");
+
+        guac_common_cost_model_free(guac_client_data->cost_model);
+
+    }
+
+    /* Finish surface trace, if any */
+    if (guac_client_data->trace != NULL) {
+        guac_client_log(client, GUAC_LOG_INFO, "Surface trace: %i records%s.",
+                guac_client_data->trace->records,
+                guac_client_data->trace->failed ? " (incomplete)" : "");
+        guac_common_surface_trace_free(guac_client_data->trace);
+    }
+
+    /* Free name of surface trace, if any */
+    free(guac_client_data->settings.surface_options.surface_trace);
+
+    /* Free encoding profile, noting the final level */
+    if (guac_client_data->profile != NULL) {
+        guac_client_log(client, GUAC_LOG_INFO, "Encoding profile: %s.",
+                guac_common_profile_name(
+                    guac_common_profile_get_level(guac_client_data->profile)));
+        guac_common_profile_free(guac_client_data->profile);
+    }
+
+    /* Stop encoder threads, if any */
+    if (guac_client_data->encoder_pool != NULL)
+        guac_common_worker_pool_free(guac_client_data->encoder_pool);
+
     free(guac_client_data);
 
     return 0;
@@ -200,8 +258,16 @@ int rdp_guac_client_handle_messages(guac_client* client) {
     pthread_mutex_unlock(&(guac_client_data->rdp_lock));
 #endif
 
-    /* Wait for messages */
-    int wait_result = rdp_guac_client_wait_for_messages(client, 250000);
+    /* Wait for messages, but no longer than any updates deferred by the
+     * previous flush may remain pending */
+    int timeout = 250000;
+    int delay = guac_common_surface_get_flush_delay(
+            guac_client_data->default_surface);
+
+    if (delay >= 0 && delay * 1000 < timeout)
+        timeout = delay * 1000;
+
+    int wait_result = rdp_guac_client_wait_for_messages(client, timeout);
     guac_timestamp frame_start = guac_timestamp_current();
     while (wait_result > 0) {
 
@@ -271,6 +337,10 @@ int rdp_guac_client_handle_messages(guac_client* client) {
     if (wait_result < 0)
         return 1;
 
+    /* Follow the current bandwidth, if adaptive encoding is enabled */
+    if (guac_client_data->profile != NULL)
+        guac_common_profile_update(guac_client_data->profile, client);
+
     /* Success */
     guac_common_surface_flush(guac_client_data->default_surface);
     return 0;
@@ -151,8 +151,9 @@ static int guac_rdpdr_create_print_process(guac_rdpdr_device* device) {
         else
             guac_client_log(device->rdpdr->client, GUAC_LOG_ERROR, "Unable to execute PDF filter command, but no error given");
 
-        /* Terminate child process */
-        exit(1);
+        /* Terminate child process without running the exit handlers of a
+         * parent which may be shared by many connections */
+        _exit(1);
 
     }
 
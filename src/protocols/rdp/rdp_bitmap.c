@@ -47,10 +47,19 @@ void guac_rdp_cache_bitmap(rdpContext* context, rdpBitmap* bitmap) {
 
     guac_client* client = ((rdp_freerdp_context*) context)->client;
     guac_socket* socket = client->socket; 
+    rdp_guac_client_data* client_data = (rdp_guac_client_data*) client->data;
 
     /* Allocate surface */
     guac_layer* buffer = guac_client_alloc_buffer(client);
-    guac_common_surface* surface = guac_common_surface_alloc(socket, buffer, bitmap->width, bitmap->height);
+    guac_common_surface* surface = guac_common_surface_alloc(client, socket, buffer, bitmap->width, bitmap->height);
+    guac_common_surface_set_image_streams(surface, client_data->settings.image_streams);
+    guac_common_surface_set_jpeg_quality(surface,
+            client_data->settings.surface_options.jpeg_quality);
+    guac_common_surface_set_encoder_pool(surface, client_data->encoder_pool);
+    guac_common_surface_set_image_cache(surface, client_data->image_cache);
+    guac_common_surface_set_cost_model(surface, client_data->cost_model);
+    guac_common_surface_set_trace(surface, client_data->trace);
+    guac_common_surface_set_profile(surface, client_data->profile);
 
     /* Cache image data if present */
     if (bitmap->data != NULL) {
@@ -26,6 +26,7 @@
 
 #include "config.h"
 
+#include "guac_surface_options.h"
 #include "rdp_keymap.h"
 
 #include <freerdp/freerdp.h>
@@ -207,6 +208,22 @@ typedef struct guac_rdp_settings {
      */
     char** svc_names;
 
+    /**
+     * Whether image updates should be streamed to the client using "img"
+     * instructions rather than sent as complete "png" instructions.
+     */
+    int image_streams;
+
+    /**
+     * Options controlling how updates to the default surface are tracked,
+     * encoded, and sent.
+     */
+    guac_common_surface_options surface_options;
+
+
+
+
+
 } guac_rdp_settings;
 
 /**
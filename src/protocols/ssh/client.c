@@ -116,6 +116,18 @@ enum __SSH_ARGS_IDX {
     SSH_ARGS_COUNT
 };
 
+int guac_client_preload() {
+
+    /* Initialize cryptographic libraries */
+    if (ssh_client_global_init())
+        return 1;
+
+    /* Initialize font caches for the default terminal font */
+    return guac_terminal_display_preload(GUAC_SSH_DEFAULT_FONT_NAME,
+            GUAC_SSH_DEFAULT_FONT_SIZE);
+
+}
+
 int guac_client_init(guac_client* client, int argc, char** argv) {
 
     guac_socket* socket = client->socket;
@@ -202,6 +214,14 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     client->free_handler      = ssh_guac_client_free_handler;
     client->clipboard_handler = guac_ssh_clipboard_handler;
 
+    /* Render terminal output as it arrives, where supported by guacd */
+    if (guac_client_add_fd(client,
+                guac_terminal_get_output_fd(client_data->term),
+                ssh_guac_client_handle_fd))
+        guac_client_log(client, GUAC_LOG_WARNING,
+                "Unable to register terminal output for event-driven "
+                "handling. Output will be polled.");
+
     /* Start client thread */
     if (pthread_create(&(client_data->client_thread), NULL, ssh_client_thread, (void*) client)) {
         guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR, "Unable to start SSH client thread");
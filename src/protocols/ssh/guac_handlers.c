@@ -42,6 +42,35 @@ int ssh_guac_client_handle_messages(guac_client* client) {
 
 }
 
+/**
+ * Completes the frame left open by ssh_guac_client_handle_fd(). This is invoked
+ * through the client timer once the duration of that frame has elapsed.
+ *
+ * @param client The guac_client whose terminal frame should be completed.
+ * @return Always zero.
+ */
+static int __ssh_guac_client_end_frame(guac_client* client) {
+
+    ssh_guac_client_data* client_data = (ssh_guac_client_data*) client->data;
+    guac_terminal_end_frame(client_data->term);
+    return 0;
+
+}
+
+int ssh_guac_client_handle_fd(guac_client* client, int fd) {
+
+    ssh_guac_client_data* client_data = (ssh_guac_client_data*) client->data;
+
+    /* Complete the frame through the client timer if left open */
+    int frame_remaining = guac_terminal_render_available(client_data->term);
+    if (frame_remaining <= 0)
+        return frame_remaining;
+
+    guac_client_set_timer(client, frame_remaining, __ssh_guac_client_end_frame);
+    return GUAC_CLIENT_FRAME_PENDING;
+
+}
+
 int ssh_guac_client_mouse_handler(guac_client* client, int x, int y, int mask) {
 
     ssh_guac_client_data* client_data = (ssh_guac_client_data*) client->data;
@@ -29,6 +29,7 @@
 #include <guacamole/client.h>
 
 int ssh_guac_client_handle_messages(guac_client* client);
+int ssh_guac_client_handle_fd(guac_client* client, int fd);
 int ssh_guac_client_key_handler(guac_client* client, int keysym, int pressed);
 int ssh_guac_client_mouse_handler(guac_client* client, int x, int y, int mask);
 int ssh_guac_client_size_handler(guac_client* client, int width, int height);
@@ -312,15 +312,50 @@ static void __openssl_init_locks(int count) {
 }
 
 /**
- * Frees the given number of mutexes.
+ * Guards initialization of the process-wide state of OpenSSL, libgcrypt and
+ * libssh2, which must happen exactly once regardless of how many SSH
+ * connections share the process.
  */
-static void __openssl_free_locks(int count) {
+static pthread_once_t __ssh_global_init_once = PTHREAD_ONCE_INIT;
 
-    int i;
+/**
+ * Whether process-wide initialization succeeded.
+ */
+static int __ssh_global_init_ok = 0;
 
-    for (i=0; i<count; i++)
-        pthread_mutex_destroy(&(__openssl_locks[i]));
+/**
+ * Initializes the process-wide state of OpenSSL, libgcrypt and libssh2. The
+ * OpenSSL locks created here are never freed, as they may be in use by any
+ * connection within the process.
+ */
+static void __ssh_global_init() {
+
+#ifdef LIBSSH2_USES_GCRYPT
+    /* Init threadsafety in libgcrypt */
+    gcry_control(GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
+    if (!gcry_check_version(GCRYPT_VERSION))
+        return;
+#endif
+
+    /* Init threadsafety in OpenSSL, unless the process already has */
+    if (CRYPTO_get_locking_callback() == NULL) {
+        __openssl_init_locks(CRYPTO_num_locks());
+        CRYPTO_set_id_callback(__openssl_id_callback);
+        CRYPTO_set_locking_callback(__openssl_locking_callback);
+    }
 
+    /* Init OpenSSL */
+    SSL_library_init();
+    ERR_load_crypto_strings();
+    libssh2_init(0);
+
+    __ssh_global_init_ok = 1;
+
+}
+
+int ssh_client_global_init() {
+    pthread_once(&__ssh_global_init_once, __ssh_global_init);
+    return !__ssh_global_init_ok;
 }
 
 void* ssh_client_thread(void* data) {
@@ -338,24 +373,11 @@ void* ssh_client_thread(void* data) {
 
     pthread_t input_thread;
 
-#ifdef LIBSSH2_USES_GCRYPT
-    /* Init threadsafety in libgcrypt */
-    gcry_control(GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
-    if (!gcry_check_version(GCRYPT_VERSION)) {
+    /* Init OpenSSL, libgcrypt and libssh2 once per process */
+    if (ssh_client_global_init()) {
         guac_client_log(client, GUAC_LOG_ERROR, "libgcrypt version mismatch.");
         return NULL;
     }
-#endif
-
-    /* Init threadsafety in OpenSSL */
-    __openssl_init_locks(CRYPTO_num_locks());
-    CRYPTO_set_id_callback(__openssl_id_callback);
-    CRYPTO_set_locking_callback(__openssl_locking_callback);
-
-    /* Init OpenSSL */
-    SSL_library_init();
-    ERR_load_crypto_strings();
-    libssh2_init(0);
 
     /* Get username */
     if (client_data->username[0] == 0)
@@ -571,7 +593,6 @@ void* ssh_client_thread(void* data) {
     guac_client_stop(client);
     pthread_join(input_thread, NULL);
 
-    __openssl_free_locks(CRYPTO_num_locks());
     pthread_mutex_destroy(&client_data->term_channel_lock);
 
     guac_client_log(client, GUAC_LOG_INFO, "SSH connection ended.");
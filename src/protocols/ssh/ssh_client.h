@@ -28,6 +28,15 @@
 
 #include <guacamole/client.h>
 
+/**
+ * Initializes the state of OpenSSL, libgcrypt and libssh2 shared by all SSH
+ * connections within the current process, if not already initialized. This
+ * function is threadsafe.
+ *
+ * @return Zero if initialization succeeded, non-zero otherwise.
+ */
+int ssh_client_global_init();
+
 /**
  * Main SSH client thread, handling transfer of SSH output to STDOUT.
  */
@@ -124,6 +124,14 @@ static regex_t* __guac_telnet_compile_regex(guac_client* client, char* pattern)
     return regex;
 }
 
+int guac_client_preload() {
+
+    /* Initialize font caches for the default terminal font */
+    return guac_terminal_display_preload(GUAC_TELNET_DEFAULT_FONT_NAME,
+            GUAC_TELNET_DEFAULT_FONT_SIZE);
+
+}
+
 int guac_client_init(guac_client* client, int argc, char** argv) {
 
     guac_socket* socket = client->socket;
@@ -221,6 +229,14 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     client->free_handler      = guac_telnet_client_free_handler;
     client->clipboard_handler = guac_telnet_clipboard_handler;
 
+    /* Render terminal output as it arrives, where supported by guacd */
+    if (guac_client_add_fd(client,
+                guac_terminal_get_output_fd(client_data->term),
+                guac_telnet_client_handle_fd))
+        guac_client_log(client, GUAC_LOG_WARNING,
+                "Unable to register terminal output for event-driven "
+                "handling. Output will be polled.");
+
     /* Start client thread */
     if (pthread_create(&(client_data->client_thread), NULL, guac_telnet_client_thread, (void*) client)) {
         guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR, "Unable to start telnet client thread");
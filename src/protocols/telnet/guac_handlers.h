@@ -34,6 +34,13 @@
  */
 int guac_telnet_client_handle_messages(guac_client* client);
 
+/**
+ * Handler for terminal output awaiting rendering. Called by guacd whenever
+ * the output file descriptor of the terminal becomes readable and the
+ * client is ready for more graphical updates.
+ */
+int guac_telnet_client_handle_fd(guac_client* client, int fd);
+
 /**
  * Handler for key events. Required by libguac and called whenever key events
  * are received.
@@ -28,6 +28,7 @@
 #include "guac_dot_cursor.h"
 #include "guac_handlers.h"
 #include "guac_pointer_cursor.h"
+#include "guac_worker_pool.h"
 #include "vnc_handlers.h"
 
 #ifdef ENABLE_PULSE
@@ -40,6 +41,8 @@
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -55,6 +58,8 @@ const char* GUAC_CLIENT_ARGS[] = {
     "color-depth",
     "cursor",
     "autoretry",
+    "enable-image-streams",
+    GUAC_COMMON_SURFACE_OPTIONS_ARGS,
 
 #ifdef ENABLE_VNC_REPEATER
     "dest-host",
@@ -85,6 +90,10 @@ enum VNC_ARGS_IDX {
     IDX_COLOR_DEPTH,
     IDX_CURSOR,
     IDX_AUTORETRY,
+    IDX_ENABLE_IMAGE_STREAMS,
+    IDX_SURFACE_OPTIONS,
+    IDX_SURFACE_OPTIONS_END = IDX_SURFACE_OPTIONS
+        + GUAC_COMMON_SURFACE_OPTIONS_ARGS_COUNT - 1,
 
 #ifdef ENABLE_VNC_REPEATER
     IDX_DEST_HOST,
@@ -198,6 +207,7 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     rfbClient* rfb_client;
 
     vnc_guac_client_data* guac_client_data;
+    guac_common_surface_options* options;
 
     int retries_remaining;
 
@@ -220,15 +230,31 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     guac_client_data->port = atoi(argv[IDX_PORT]);
     guac_client_data->password = strdup(argv[IDX_PASSWORD]); /* NOTE: freed by libvncclient */
     guac_client_data->default_surface = NULL;
+    guac_client_data->encoder_pool = NULL;
+    guac_client_data->image_cache = NULL;
+    guac_client_data->cost_model = NULL;
+    guac_client_data->trace = NULL;
+    guac_client_data->profile = NULL;
+    guac_client_data->frame_start = 0;
 
     /* Set flags */
     guac_client_data->remote_cursor = (strcmp(argv[IDX_CURSOR], "remote") == 0);
     guac_client_data->swap_red_blue = (strcmp(argv[IDX_SWAP_RED_BLUE], "true") == 0);
     guac_client_data->read_only     = (strcmp(argv[IDX_READ_ONLY], "true") == 0);
+    guac_client_data->image_streams = (strcmp(argv[IDX_ENABLE_IMAGE_STREAMS], "true") == 0);
 
     /* Parse color depth */
     guac_client_data->color_depth = atoi(argv[IDX_COLOR_DEPTH]);
 
+    /* Parse options controlling updates to the default surface */
+    options = &guac_client_data->surface_options;
+    if (guac_common_surface_options_parse(client, options,
+                &argv[IDX_SURFACE_OPTIONS])) {
+        guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                "Unable to allocate surface options.");
+        return 1;
+    }
+
 #ifdef ENABLE_VNC_REPEATER
     /* Set repeater parameters if specified */
     if (argv[IDX_DEST_HOST][0] != '\0')
@@ -344,6 +370,13 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
 
     /* Set handlers */
     client->handle_messages = vnc_guac_client_handle_messages;
+
+    /* Handle messages as they arrive, where supported by guacd */
+    if (guac_client_add_fd(client, rfb_client->sock,
+                vnc_guac_client_handle_fd))
+        guac_client_log(client, GUAC_LOG_WARNING,
+                "Unable to register VNC connection for event-driven "
+                "handling. Messages will be polled.");
     client->free_handler = vnc_guac_client_free_handler;
 
     /* If not read-only, set input handlers and pointer */
@@ -368,8 +401,102 @@ int guac_client_init(guac_client* client, int argc, char** argv) {
     guac_protocol_send_name(client->socket, rfb_client->desktopName);
 
     /* Create default surface */
-    guac_client_data->default_surface = guac_common_surface_alloc(client->socket, GUAC_DEFAULT_LAYER,
+    guac_client_data->default_surface = guac_common_surface_alloc(client, client->socket, GUAC_DEFAULT_LAYER,
                                                                   rfb_client->width, rfb_client->height);
+    guac_common_surface_set_image_streams(guac_client_data->default_surface,
+                                          guac_client_data->image_streams);
+    guac_common_surface_set_jpeg_quality(guac_client_data->default_surface,
+                                         options->jpeg_quality);
+
+    /* Track damage by tile, if requested */
+    if (options->damage_tiles)
+        guac_common_surface_set_damage_model(guac_client_data->default_surface,
+                                             GUAC_COMMON_SURFACE_DAMAGE_TILES);
+
+    /* Copy scrolled content rather than resending it, if requested */
+    guac_common_surface_set_motion_detection(guac_client_data->default_surface,
+                                             options->motion_detection);
+
+    /* Send slightly-changed updates as deltas, if requested */
+    guac_common_surface_set_delta_updates(guac_client_data->default_surface,
+                                          options->delta_updates);
+
+    /* Combine updates based on their measured cost, unless pinned */
+    guac_client_data->cost_model = guac_common_cost_model_alloc();
+    if (guac_client_data->cost_model == NULL) {
+        guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                "Unable to allocate cost model.");
+        return 1;
+    }
+
+    guac_common_cost_model_pin(guac_client_data->cost_model,
+                               options->update_cost, options->pixel_cost);
+    guac_common_surface_set_cost_model(guac_client_data->default_surface,
+                                       guac_client_data->cost_model);
+
+    /* Retain recently-sent images within client-side buffers, if requested */
+    if (options->image_cache_size > 0) {
+        guac_client_data->image_cache = guac_common_image_cache_alloc(client,
+                (size_t) options->image_cache_size * 1024);
+        if (guac_client_data->image_cache == NULL) {
+            guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                    "Unable to allocate image cache.");
+            return 1;
+        }
+        guac_common_surface_set_image_cache(guac_client_data->default_surface,
+                                            guac_client_data->image_cache);
+    }
+
+    /* Encode updates in parallel, if requested */
+    if (options->encoder_threads > 0) {
+        guac_client_data->encoder_pool =
+            guac_common_worker_pool_alloc(options->encoder_threads);
+        guac_common_surface_set_encoder_pool(guac_client_data->default_surface,
+                                             guac_client_data->encoder_pool);
+    }
+
+    /* Reduce update quality as bandwidth falls, if requested */
+    if (options->adaptive_encoding) {
+        guac_client_data->profile = guac_common_profile_alloc();
+        if (guac_client_data->profile == NULL) {
+            guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                    "Unable to allocate encoding profile.");
+            return 1;
+        }
+        guac_common_profile_set_thresholds(guac_client_data->profile,
+                options->reduced_color_bandwidth,
+                options->lossy_bandwidth,
+                options->reduced_rate_bandwidth);
+        guac_common_surface_set_profile(guac_client_data->default_surface,
+                                        guac_client_data->profile);
+    }
+
+    /* Record all drawing for later replay, if requested and allowed */
+    if (options->surface_trace != NULL) {
+
+        if (client->trace_directory == NULL)
+            guac_client_log(client, GUAC_LOG_WARNING,
+                    "Surface traces are not allowed. Drawing will not be "
+                    "recorded.");
+
+        else {
+
+            guac_client_data->trace = guac_common_surface_trace_open(
+                    client->trace_directory, options->surface_trace);
+
+            if (guac_client_data->trace != NULL)
+                guac_common_surface_set_trace(
+                        guac_client_data->default_surface,
+                        guac_client_data->trace);
+            else
+                guac_client_log(client, GUAC_LOG_ERROR,
+                        "Unable to create surface trace \"%s\": %s",
+                        options->surface_trace, strerror(errno));
+
+        }
+
+    }
+
     return 0;
 
 }
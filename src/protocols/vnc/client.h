@@ -26,10 +26,17 @@
 
 #include "config.h"
 #include "guac_clipboard.h"
+#include "guac_cost_model.h"
+#include "guac_image_cache.h"
+#include "guac_profile.h"
 #include "guac_surface.h"
+#include "guac_surface_options.h"
+#include "guac_surface_trace.h"
+#include "guac_worker_pool.h"
 
 #include <guacamole/audio.h>
 #include <guacamole/layer.h>
+#include <guacamole/timestamp.h>
 #include <rfb/rfbclient.h>
 
 #ifdef ENABLE_PULSE
@@ -186,6 +193,54 @@ typedef struct vnc_guac_client_data {
      */
     guac_common_surface* default_surface;
 
+    /**
+     * Whether image updates should be streamed to the client using "img"
+     * instructions rather than sent as complete "png" instructions.
+     */
+    int image_streams;
+
+    /**
+     * Options controlling how updates to the default surface are tracked,
+     * encoded, and sent.
+     */
+    guac_common_surface_options surface_options;
+
+    /**
+     * The worker pool used to encode image updates in parallel, or NULL if
+     * image updates are encoded serially.
+     */
+    guac_common_worker_pool* encoder_pool;
+
+    /**
+     * Cache of images retained within client-side buffers, or NULL if images
+     * are not cached.
+     */
+    guac_common_image_cache* image_cache;
+
+    /**
+     * Model of the cost of image updates, used when deciding whether updates
+     * should be combined.
+     */
+    guac_common_cost_model* cost_model;
+
+    /**
+     * The trace recording all drawing to the default surface, or NULL if
+     * drawing is not being recorded.
+     */
+    guac_common_surface_trace* trace;
+
+    /**
+     * The profile selecting the quality of updates to the default surface,
+     * or NULL if adaptive encoding is disabled.
+     */
+    guac_common_profile* profile;
+
+    /**
+     * The time at which the first server messages of the frame currently
+     * being accumulated were handled, or zero if no frame is in progress.
+     */
+    guac_timestamp frame_start;
+
 } vnc_guac_client_data;
 
 #endif
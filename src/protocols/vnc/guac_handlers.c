@@ -24,7 +24,12 @@
 
 #include "client.h"
 #include "guac_clipboard.h"
+#include "guac_cost_model.h"
+#include "guac_image_cache.h"
+#include "guac_profile.h"
 #include "guac_surface.h"
+#include "guac_surface_trace.h"
+#include "guac_worker_pool.h"
 
 #include <guacamole/client.h>
 #include <guacamole/protocol.h>
@@ -35,15 +40,64 @@
 #include "pulse.h"
 #endif
 
+#include <inttypes.h>
 #include <stdlib.h>
 
-int vnc_guac_client_handle_messages(guac_client* client) {
+static int __vnc_guac_client_handle_timer(guac_client* client);
+
+/**
+ * Flushes the display, following the current bandwidth if adaptive encoding
+ * is enabled. If the display must be flushed again later to send updates
+ * deferred due to a reduced frame rate, the client timer is armed to do so.
+ *
+ * @param client The guac_client associated with the VNC connection.
+ */
+static void __vnc_guac_client_flush(guac_client* client) {
+
+    vnc_guac_client_data* guac_client_data = (vnc_guac_client_data*) client->data;
+    guac_common_surface* surface = guac_client_data->default_surface;
+
+    /* Follow the current bandwidth, if adaptive encoding is enabled */
+    if (guac_client_data->profile != NULL)
+        guac_common_profile_update(guac_client_data->profile, client);
+
+    guac_common_surface_flush(surface);
+    guac_client_data->frame_start = 0;
+
+    /* Flush deferred updates even if the VNC server sends nothing further */
+    guac_client_set_timer(client, guac_common_surface_get_flush_delay(surface),
+            __vnc_guac_client_handle_timer);
+
+}
+
+/**
+ * Flushes the display once updates deferred by a previous flush may be
+ * sent. This is invoked through the client timer, which is armed by
+ * __vnc_guac_client_flush() as necessary.
+ *
+ * @param client The guac_client associated with the VNC connection.
+ * @return Always zero.
+ */
+static int __vnc_guac_client_handle_timer(guac_client* client) {
+    __vnc_guac_client_flush(client);
+    return 0;
+}
+
+/**
+ * Handles messages from the VNC server until none remain or the duration of
+ * the current frame has elapsed, then flushes the display.
+ *
+ * @param client The guac_client associated with the VNC connection.
+ * @param wait_result The result of waiting for the first message, as
+ *                    returned by WaitForMessage().
+ * @return Zero on success, non-zero if the connection has failed.
+ */
+static int __vnc_guac_client_handle_frame(guac_client* client,
+        int wait_result) {
 
     vnc_guac_client_data* guac_client_data = (vnc_guac_client_data*) client->data;
     rfbClient* rfb_client = guac_client_data->rfb_client;
 
-    /* Initially wait for messages */
-    int wait_result = WaitForMessage(rfb_client, 1000000);
     guac_timestamp frame_start = guac_timestamp_current();
     while (wait_result > 0) {
 
@@ -60,8 +114,13 @@ int vnc_guac_client_handle_messages(guac_client* client) {
         frame_end = guac_timestamp_current();
         frame_remaining = frame_start + GUAC_VNC_FRAME_DURATION - frame_end;
 
-        /* Wait again if frame remaining */
-        if (frame_remaining > 0)
+        /* Data already buffered by libvncclient is not signalled by the
+         * socket, and must be handled regardless of frame duration */
+        if (rfb_client->buffered > 0)
+            wait_result = 1;
+
+        /* Otherwise, wait again if frame remaining */
+        else if (frame_remaining > 0)
             wait_result = WaitForMessage(rfb_client,
                     GUAC_VNC_FRAME_TIMEOUT*1000);
         else
@@ -75,7 +134,62 @@ int vnc_guac_client_handle_messages(guac_client* client) {
         return 1;
     }
 
-    guac_common_surface_flush(guac_client_data->default_surface);
+    __vnc_guac_client_flush(client);
+    return 0;
+
+}
+
+int vnc_guac_client_handle_messages(guac_client* client) {
+
+    vnc_guac_client_data* guac_client_data = (vnc_guac_client_data*) client->data;
+
+    /* Wait no longer than any deferred updates may remain pending, as the
+     * client timer is not used if messages are handled here */
+    int timeout = 1000000;
+    int delay = guac_common_surface_get_flush_delay(
+            guac_client_data->default_surface);
+
+    if (delay >= 0 && delay * 1000 < timeout)
+        timeout = delay * 1000;
+
+    /* Initially wait for messages */
+    return __vnc_guac_client_handle_frame(client,
+            WaitForMessage(guac_client_data->rfb_client, timeout));
+
+}
+
+int vnc_guac_client_handle_fd(guac_client* client, int fd) {
+
+    vnc_guac_client_data* guac_client_data = (vnc_guac_client_data*) client->data;
+    rfbClient* rfb_client = guac_client_data->rfb_client;
+
+    int frame_remaining;
+
+    /* Handle the message known to be waiting, along with any data already
+     * buffered by libvncclient, which the socket does not signal */
+    do {
+        if (!HandleRFBServerMessage(rfb_client)) {
+            guac_client_abort(client, GUAC_PROTOCOL_STATUS_UPSTREAM_ERROR, "Error handling message from VNC server.");
+            return -1;
+        }
+    } while (rfb_client->buffered > 0);
+
+    /* The first batch handled begins the frame */
+    if (guac_client_data->frame_start == 0)
+        guac_client_data->frame_start = guac_timestamp_current();
+
+    frame_remaining = guac_client_data->frame_start + GUAC_VNC_FRAME_DURATION
+        - guac_timestamp_current();
+
+    /* If more messages are already waiting, leave the frame open for them,
+     * flushing through the client timer once the frame duration elapses */
+    if (frame_remaining > 0 && WaitForMessage(rfb_client, 0) > 0) {
+        guac_client_set_timer(client, frame_remaining,
+                __vnc_guac_client_handle_timer);
+        return GUAC_CLIENT_FRAME_PENDING;
+    }
+
+    __vnc_guac_client_flush(client);
     return 0;
 
 }
@@ -119,6 +233,57 @@ int vnc_guac_client_free_handler(guac_client* client) {
     /* Free surface */
     guac_common_surface_free(guac_client_data->default_surface);
 
+    /* Free image cache, if any */
+    if (guac_client_data->image_cache != NULL) {
+
+        guac_common_image_cache_stats stats;
+        guac_common_image_cache_get_stats(guac_client_data->image_cache, &stats);
+        guac_client_log(client, GUAC_LOG_INFO, "Image cache: %" PRIu64
+                " hits, %" PRIu64 " misses, %" PRIu64 " evictions.",
+                stats.hits, stats.misses, stats.evictions);
+
+        guac_common_image_cache_free(guac_client_data->image_cache);
+
+    }
+
+    /* Free cost model, noting the costs used */
+    if (guac_client_data->cost_model != NULL) {
+
+        guac_common_cost_model_stats stats;
+        guac_common_cost_model_get_stats(guac_client_data->cost_model, &stats);
+        guac_client_log(client, GUAC_LOG_INFO, "Cost model: %" PRIu64
+                " updates measured, %.0f ns per update, %.1f ns per pixel, "
+                "base cost of %i pixels%s.", stats.samples, stats.update_cost,
+                stats.pixel_cost, stats.base_cost,
+                stats.calibrated ? "" : " (default)");
+
+        guac_common_cost_model_free(guac_client_data->cost_model);
+
+    }
+
+    /* Finish surface trace, if any */
+    if (guac_client_data->trace != NULL) {
+        guac_client_log(client, GUAC_LOG_INFO, "Surface trace: %i records%s.",
+                guac_client_data->trace->records,
+                guac_client_data->trace->failed ? " (incomplete)" : "");
+        guac_common_surface_trace_free(guac_client_data->trace);
+    }
+
+    /* Free name of surface trace, if any */
+    free(guac_client_data->surface_options.surface_trace);
+
+    /* Free encoding profile, noting the final level */
+    if (guac_client_data->profile != NULL) {
+        guac_client_log(client, GUAC_LOG_INFO, "Encoding profile: %s.",
+                guac_common_profile_name(
+                    guac_common_profile_get_level(guac_client_data->profile)));
+        guac_common_profile_free(guac_client_data->profile);
+    }
+
+    /* Stop encoder threads, if any */
+    if (guac_client_data->encoder_pool != NULL)
+        guac_common_worker_pool_free(guac_client_data->encoder_pool);
+
     /* Free generic data struct */
     free(client->data);
 
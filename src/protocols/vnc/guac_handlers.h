@@ -29,6 +29,7 @@
 #include <guacamole/client.h>
 
 int vnc_guac_client_handle_messages(guac_client* client);
+int vnc_guac_client_handle_fd(guac_client* client, int fd);
 int vnc_guac_client_mouse_handler(guac_client* client, int x, int y, int mask);
 int vnc_guac_client_key_handler(guac_client* client, int keysym, int pressed);
 int vnc_guac_client_free_handler(guac_client* client);
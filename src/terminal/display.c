@@ -260,6 +260,43 @@ int __guac_terminal_set(guac_terminal_display* display, int row, int col, int co
 
 }
 
+int guac_terminal_display_preload(const char* font_name, int font_size) {
+
+    PangoFontDescription* font_desc;
+    PangoFontMap* font_map;
+    PangoFont* font;
+    PangoFontMetrics* metrics;
+    PangoContext* context;
+
+    font_desc = pango_font_description_new();
+    pango_font_description_set_family(font_desc, font_name);
+    pango_font_description_set_weight(font_desc, PANGO_WEIGHT_NORMAL);
+    pango_font_description_set_size(font_desc, font_size*PANGO_SCALE);
+
+    /* Loading the font scans and caches the fontconfig configuration */
+    font_map = pango_cairo_font_map_get_default();
+    context = pango_font_map_create_context(font_map);
+
+    font = pango_font_map_load_font(font_map, context, font_desc);
+    pango_font_description_free(font_desc);
+
+    if (font == NULL) {
+        g_object_unref(context);
+        return 1;
+    }
+
+    /* Metrics require the coverage of the font */
+    metrics = pango_font_get_metrics(font, NULL);
+    if (metrics != NULL)
+        pango_font_metrics_unref(metrics);
+
+    g_object_unref(font);
+    g_object_unref(context);
+
+    return 0;
+
+}
+
 guac_terminal_display* guac_terminal_display_alloc(guac_client* client,
         const char* font_name, int font_size, int dpi,
         int foreground, int background) {
@@ -276,8 +313,8 @@ guac_terminal_display* guac_terminal_display_alloc(guac_client* client,
     /* Create default surface */
     display->display_layer = guac_client_alloc_layer(client);
     display->select_layer = guac_client_alloc_layer(client);
-    display->display_surface = guac_common_surface_alloc(client->socket,
-            display->display_layer, 0, 0);
+    display->display_surface = guac_common_surface_alloc(client,
+            client->socket, display->display_layer, 0, 0);
 
     /* Select layer is a child of the display layer */
     guac_protocol_send_move(client->socket, display->select_layer,
@@ -198,6 +198,15 @@ typedef struct guac_terminal_display {
 
 } guac_terminal_display;
 
+/**
+ * Loads the given font through the default Pango font map, such that the
+ * fontconfig configuration and font caches are initialized before any display
+ * is allocated. Processes forked afterwards inherit this state rather than
+ * rebuilding it. Returns zero on success, non-zero if the font could not be
+ * loaded.
+ */
+int guac_terminal_display_preload(const char* font_name, int font_size);
+
 /**
  * Allocates a new display having the given default foreground and background
  * colors.
@@ -238,6 +238,8 @@ guac_terminal* guac_terminal_create(guac_client* client,
     term->term_width   = available_width / term->display->char_width;
     term->term_height  = height / term->display->char_height;
 
+    term->frame_start = 0;
+
     /* Open STDOUT pipe */
     if (pipe(term->stdout_pipe_fd)) {
         guac_error = GUAC_STATUS_SEE_ERRNO;
@@ -354,16 +356,22 @@ static int guac_terminal_wait_for_data(int fd, int msec_timeout) {
 
 }
 
-int guac_terminal_render_frame(guac_terminal* terminal) {
+/**
+ * Renders a single frame of terminal data, handling data until none remains
+ * or the duration of the frame has elapsed.
+ *
+ * @param terminal The terminal to render.
+ * @param wait_result The result of waiting for the first data, as returned
+ *                    by guac_terminal_wait_for_data().
+ * @return Zero on success, non-zero if an error occurs.
+ */
+static int guac_terminal_render(guac_terminal* terminal, int wait_result) {
 
     guac_client* client = terminal->client;
     char buffer[GUAC_TERMINAL_PACKET_SIZE];
 
-    int wait_result;
     int fd = terminal->stdout_pipe_fd[0];
 
-    /* Wait for data to be available */
-    wait_result = guac_terminal_wait_for_data(fd, 1000);
     if (wait_result > 0) {
 
         guac_terminal_lock(terminal);
@@ -429,6 +437,75 @@ int guac_terminal_render_frame(guac_terminal* terminal) {
 
 }
 
+int guac_terminal_render_frame(guac_terminal* terminal) {
+
+    /* Wait for data to be available */
+    return guac_terminal_render(terminal,
+            guac_terminal_wait_for_data(terminal->stdout_pipe_fd[0], 1000));
+
+}
+
+int guac_terminal_render_available(guac_terminal* terminal) {
+
+    guac_client* client = terminal->client;
+    char buffer[GUAC_TERMINAL_PACKET_SIZE];
+
+    int fd = terminal->stdout_pipe_fd[0];
+    int bytes_read;
+    int frame_remaining;
+
+    guac_terminal_lock(terminal);
+
+    /* The first data handled begins the frame */
+    if (terminal->frame_start == 0)
+        terminal->frame_start = guac_timestamp_current();
+
+    /* Write the packet known to be waiting to the terminal */
+    bytes_read = guac_terminal_packet_read(fd, buffer, sizeof(buffer));
+    if (bytes_read < 0) {
+        guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                "Error reading data");
+        guac_terminal_unlock(terminal);
+        return -1;
+    }
+
+    if (bytes_read > 0 && guac_terminal_write(terminal, buffer, bytes_read)) {
+        guac_client_abort(client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
+                "Error writing data");
+        guac_terminal_unlock(terminal);
+        return -1;
+    }
+
+    frame_remaining = terminal->frame_start + GUAC_TERMINAL_FRAME_DURATION
+                    - guac_timestamp_current();
+
+    /* Leave the frame open if more data is already waiting */
+    if (frame_remaining > 0 && guac_terminal_wait_for_data(fd, 0) > 0) {
+        guac_terminal_unlock(terminal);
+        return frame_remaining;
+    }
+
+    guac_terminal_flush(terminal);
+    terminal->frame_start = 0;
+    guac_terminal_unlock(terminal);
+
+    return 0;
+
+}
+
+void guac_terminal_end_frame(guac_terminal* terminal) {
+
+    guac_terminal_lock(terminal);
+    guac_terminal_flush(terminal);
+    terminal->frame_start = 0;
+    guac_terminal_unlock(terminal);
+
+}
+
+int guac_terminal_get_output_fd(guac_terminal* terminal) {
+    return terminal->stdout_pipe_fd[0];
+}
+
 int guac_terminal_read_stdin(guac_terminal* terminal, char* c, int size) {
     int stdin_fd = terminal->stdin_pipe_fd[0];
     return read(stdin_fd, c, size);
@@ -38,6 +38,7 @@
 
 #include <guacamole/client.h>
 #include <guacamole/stream.h>
+#include <guacamole/timestamp.h>
 
 /**
  * The maximum duration of a single frame, in milliseconds.
@@ -122,6 +123,13 @@ struct guac_terminal {
      */
     int stdout_pipe_fd[2];
 
+    /**
+     * The time at which the first data of the frame currently being
+     * rendered by guac_terminal_render_available() was handled, or zero if
+     * no such frame is in progress.
+     */
+    guac_timestamp frame_start;
+
     /**
      * Pipe which will be the source of user input. When a terminal code
      * generates synthesized user input, that data will be written to
@@ -364,6 +372,36 @@ void guac_terminal_free(guac_terminal* term);
  */
 int guac_terminal_render_frame(guac_terminal* terminal);
 
+/**
+ * Renders the terminal data which is already known to be available, as
+ * signalled by the file descriptor returned by guac_terminal_get_output_fd()
+ * becoming readable. Unlike guac_terminal_render_frame(), this function does
+ * not block waiting for data. If more data is already waiting and the
+ * duration of the current frame has not yet elapsed, the frame is left open
+ * for that data, and must be completed with guac_terminal_end_frame() if no
+ * later call completes it first.
+ *
+ * @param terminal The terminal to render.
+ * @return Zero if the frame has been completed, the number of milliseconds
+ *         remaining in the frame if the frame has been left open, or a
+ *         negative value if an error occurs.
+ */
+int guac_terminal_render_available(guac_terminal* terminal);
+
+/**
+ * Completes any frame left open by guac_terminal_render_available(),
+ * flushing the terminal.
+ *
+ * @param terminal The terminal whose frame should be completed.
+ */
+void guac_terminal_end_frame(guac_terminal* terminal);
+
+/**
+ * Returns the file descriptor which becomes readable whenever data has been
+ * written to this terminal's STDOUT and is awaiting rendering.
+ */
+int guac_terminal_get_output_fd(guac_terminal* terminal);
+
 /**
  * Reads from this terminal's STDIN. Input comes from key and mouse events
  * supplied by calls to guac_terminal_send_key() and
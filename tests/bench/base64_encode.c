@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Microbenchmark comparing the throughput of guac_socket_write_base64()
+ * against the previous byte-at-a-time implementation, which is reproduced
+ * below. Both write into a socket whose write handler discards all data, such
+ * that only the encoding and buffering cost is measured.
+ *
+ * Usage: bench_base64 [MEGABYTES]
+ */
+
+#include "config.h"
+
+#include <guacamole/socket.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The amount of data to encode for each measurement, in megabytes, if not
+ * overridden on the command line.
+ */
+#define BENCH_BASE64_DEFAULT_MEGABYTES 256
+
+/**
+ * State of the reproduced byte-at-a-time encoder.
+ */
+typedef struct bench_base64_legacy {
+
+    int ready;
+    int ready_buf[3];
+    int written;
+    char out_buf[GUAC_SOCKET_OUTPUT_BUFFER_SIZE];
+
+} bench_base64_legacy;
+
+static const char bench_base64_characters[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Sink for data "written" by the legacy encoder, preventing the compiler from
+ * optimizing away the encoding itself.
+ */
+static volatile unsigned char bench_base64_sink;
+
+static void bench_base64_legacy_triplet(bench_base64_legacy* state,
+        int a, int b, int c) {
+
+    char* out_buf = state->out_buf;
+
+    out_buf[state->written++] = bench_base64_characters[(a & 0xFC) >> 2];
+
+    if (b >= 0) {
+        out_buf[state->written++] = bench_base64_characters[((a & 0x03) << 4) | ((b & 0xF0) >> 4)];
+
+        if (c >= 0) {
+            out_buf[state->written++] = bench_base64_characters[((b & 0x0F) << 2) | ((c & 0xC0) >> 6)];
+            out_buf[state->written++] = bench_base64_characters[c & 0x3F];
+        }
+        else {
+            out_buf[state->written++] = bench_base64_characters[((b & 0x0F) << 2)];
+            out_buf[state->written++] = '=';
+        }
+    }
+    else {
+        out_buf[state->written++] = bench_base64_characters[((a & 0x03) << 4)];
+        out_buf[state->written++] = '=';
+        out_buf[state->written++] = '=';
+    }
+
+    if (state->written > GUAC_SOCKET_OUTPUT_BUFFER_SIZE - 4) {
+        bench_base64_sink = out_buf[state->written - 1];
+        state->written = 0;
+    }
+
+}
+
+static void bench_base64_legacy_write(bench_base64_legacy* state,
+        const unsigned char* buf, size_t count) {
+
+    const unsigned char* end = buf + count;
+
+    while (buf < end) {
+
+        state->ready_buf[state->ready++] = *(buf++);
+
+        if (state->ready == 3) {
+            bench_base64_legacy_triplet(state, state->ready_buf[0],
+                    state->ready_buf[1], state->ready_buf[2]);
+            state->ready = 0;
+        }
+
+    }
+
+}
+
+/**
+ * Write handler which discards all data.
+ */
+static ssize_t bench_base64_discard(guac_socket* socket,
+        const void* buf, size_t count) {
+    bench_base64_sink = ((const unsigned char*) buf)[count - 1];
+    return count;
+}
+
+/**
+ * Returns the current value of a monotonic clock, in seconds.
+ */
+static double bench_base64_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+/**
+ * Encodes the given total number of bytes from the given buffer, in chunks
+ * of the given size, using either the legacy or current encoder, returning
+ * the resulting throughput in MB/s.
+ */
+static double bench_base64_run(const unsigned char* data, size_t chunk_size,
+        size_t total, int legacy) {
+
+    static bench_base64_legacy state;
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->write_handler = bench_base64_discard;
+
+    size_t encoded;
+    double start = bench_base64_now();
+
+    for (encoded = 0; encoded < total; encoded += chunk_size) {
+        if (legacy)
+            bench_base64_legacy_write(&state, data, chunk_size);
+        else
+            guac_socket_write_base64(socket, data, chunk_size);
+    }
+
+    double elapsed = bench_base64_now() - start;
+
+    guac_socket_flush_base64(socket);
+    guac_socket_free(socket);
+
+    return encoded / elapsed / 1048576.0;
+
+}
+
+int main(int argc, char** argv) {
+
+    size_t chunk_sizes[] = { 57, 1024, 6048, 65536, 1048576 };
+    size_t total = BENCH_BASE64_DEFAULT_MEGABYTES;
+    size_t max_chunk = 1048576;
+    unsigned int i;
+
+    /* Allow amount of data to be overridden */
+    if (argc > 1)
+        total = strtoul(argv[1], NULL, 10);
+
+    total *= 1048576;
+
+    /* Arbitrary, incompressible input */
+    unsigned char* data = malloc(max_chunk);
+    srand(12345);
+    for (i = 0; i < max_chunk; i++)
+        data[i] = rand() & 0xFF;
+
+    printf("%10s %14s %14s %8s\n", "chunk", "legacy MB/s", "current MB/s",
+            "speedup");
+
+    for (i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+
+        size_t chunk_size = chunk_sizes[i];
+
+        double legacy = bench_base64_run(data, chunk_size, total, 1);
+        double current = bench_base64_run(data, chunk_size, total, 0);
+
+        printf("%10zu %14.1f %14.1f %7.2fx\n", chunk_size, legacy, current,
+                current / legacy);
+
+    }
+
+    free(data);
+    return 0;
+
+}
+
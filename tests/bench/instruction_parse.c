@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Microbenchmark comparing the throughput of the instruction parser against
+ * the previous implementation, which is reproduced below. The previous
+ * implementation allocated a new instruction for each instruction read, and
+ * examined element content one character at a time. Both parse the same
+ * in-memory stream, built from the instructions of the tests/protocol cases
+ * and from blob instructions of the given size, which dominate real inbound
+ * traffic during file transfer.
+ *
+ * Usage: bench_instruction [MEGABYTES]
+ */
+
+#include "config.h"
+
+#include <guacamole/instruction.h>
+#include <guacamole/unicode.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The amount of data to parse for each measurement, in megabytes, if not
+ * overridden on the command line.
+ */
+#define BENCH_INSTRUCTION_DEFAULT_MEGABYTES 256
+
+/**
+ * The size of the stream of instructions parsed repeatedly.
+ */
+#define BENCH_INSTRUCTION_STREAM_SIZE 65536
+
+/**
+ * Instructions used by the tests/protocol cases. These are repeated to fill
+ * the stream, interleaved with blob instructions.
+ */
+static const char* bench_instruction_cases[] = {
+    "4.test,8.testdata,5.zxcvb,13.guacamoletest;",
+    "4.test,6.a\xe7\x8a\xac\xf0\x90\xac\x80z\xc3\xa1" "b,5.12345,"
+        "10.a\xe7\x8a\xac\xf0\x90\xac\x80z\xc3\xa1\xe7\x8a\xac\xf0\x90\xac\x80z\xc3\xa1" "c;",
+    "5.test2,10.hellohello,15.worldworldworld;",
+    "5.mouse,3.123,3.456,1.1;",
+    "3.key,5.65307,1.1;"
+};
+
+/**
+ * Sink for parsed data, preventing the compiler from optimizing away the
+ * parse itself.
+ */
+static volatile int bench_instruction_sink;
+
+/**
+ * Reproduction of the previous guac_instruction_append(), which parsed at
+ * most one element per call, examining each character of its content.
+ */
+static int bench_instruction_legacy_append(guac_instruction* instr,
+        void* buffer, int length) {
+
+    char* char_buffer = (char*) buffer;
+    int bytes_parsed = 0;
+
+    /* Do not exceed maximum number of elements */
+    if (instr->__elementc == GUAC_INSTRUCTION_MAX_ELEMENTS
+            && instr->state != GUAC_INSTRUCTION_PARSE_COMPLETE) {
+        instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
+        return 0;
+    }
+
+    /* Parse element length */
+    if (instr->state == GUAC_INSTRUCTION_PARSE_LENGTH) {
+
+        int parsed_length = instr->__element_length;
+        while (bytes_parsed < length) {
+
+            /* Pull next character */
+            char c = *(char_buffer++);
+            bytes_parsed++;
+
+            /* If digit, add to length */
+            if (c >= '0' && c <= '9')
+                parsed_length = parsed_length*10 + c - '0';
+
+            /* If period, switch to parsing content */
+            else if (c == '.') {
+                instr->__elementv[instr->__elementc++] = char_buffer;
+                instr->state = GUAC_INSTRUCTION_PARSE_CONTENT;
+                break;
+            }
+
+            /* If not digit, parse error */
+            else {
+                instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
+                return 0;
+            }
+
+        }
+
+        /* If too long, parse error */
+        if (parsed_length > GUAC_INSTRUCTION_MAX_LENGTH) {
+            instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
+            return 0;
+        }
+
+        /* Save length */
+        instr->__element_length = parsed_length;
+
+    } /* end parse length */
+
+    /* Parse element content */
+    if (instr->state == GUAC_INSTRUCTION_PARSE_CONTENT) {
+
+        while (bytes_parsed < length && instr->__element_length >= 0) {
+
+            /* Get length of current character */
+            char c = *char_buffer;
+            int char_length = guac_utf8_charsize((unsigned char) c);
+
+            /* If full character not present in buffer, stop now */
+            if (char_length + bytes_parsed > length)
+                break;
+
+            /* Record character as parsed */
+            bytes_parsed += char_length;
+
+            /* If end of element, handle terminator */
+            if (instr->__element_length == 0) {
+
+                *char_buffer = '\0';
+
+                /* If semicolon, store end-of-instruction */
+                if (c == ';') {
+                    instr->state = GUAC_INSTRUCTION_PARSE_COMPLETE;
+                    instr->opcode = instr->__elementv[0];
+                    instr->argv = &(instr->__elementv[1]);
+                    instr->argc = instr->__elementc - 1;
+                    break;
+                }
+
+                /* If comma, move on to next element */
+                else if (c == ',') {
+                    instr->state = GUAC_INSTRUCTION_PARSE_LENGTH;
+                    break;
+                }
+
+                /* Otherwise, parse error */
+                else {
+                    instr->state = GUAC_INSTRUCTION_PARSE_ERROR;
+                    return 0;
+                }
+
+            } /* end if end of element */
+
+            /* Advance to next character */
+            instr->__element_length--;
+            char_buffer += char_length;
+
+        }
+
+    } /* end parse content */
+
+    return bytes_parsed;
+
+}
+
+/**
+ * Returns the current value of a monotonic clock, in seconds.
+ */
+static double bench_instruction_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+/**
+ * Fills the given stream with the test cases, interleaved with blob
+ * instructions containing the given number of base64 characters, returning
+ * the number of bytes used. The stream always ends on an instruction
+ * boundary.
+ */
+static int bench_instruction_build(char* stream, int blob_size) {
+
+    const char* base64 =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    char instruction[GUAC_INSTRUCTION_MAX_LENGTH + 64];
+    int length = 0;
+    int n = 0;
+
+    for (;;) {
+
+        int size;
+
+        /* Alternate between test cases and blobs */
+        if (blob_size > 0 && n % 2 == 1) {
+
+            int i;
+
+            size = sprintf(instruction, "4.blob,1.1,%i.", blob_size);
+            for (i = 0; i < blob_size; i++)
+                instruction[size++] = base64[(i * 7 + n) % 64];
+            instruction[size++] = ';';
+
+        }
+        else {
+            const char* test_case = bench_instruction_cases[(n / 2)
+                % (sizeof(bench_instruction_cases) / sizeof(bench_instruction_cases[0]))];
+            size = strlen(test_case);
+            memcpy(instruction, test_case, size);
+        }
+
+        if (length + size > BENCH_INSTRUCTION_STREAM_SIZE)
+            break;
+
+        memcpy(stream + length, instruction, size);
+        length += size;
+        n++;
+
+    }
+
+    return length;
+
+}
+
+/**
+ * Parses the given stream repeatedly until the given total number of bytes
+ * has been parsed, using either the legacy or current parser, returning the
+ * resulting throughput in MB/s. As parsing modifies the stream, the stream is
+ * copied into a working buffer prior to each pass for both parsers.
+ */
+static double bench_instruction_run(const char* stream, int length,
+        size_t total, int legacy) {
+
+    static char buffer[BENCH_INSTRUCTION_STREAM_SIZE];
+
+    guac_instruction* reused = guac_instruction_alloc();
+    size_t parsed_total;
+    double start = bench_instruction_now();
+
+    for (parsed_total = 0; parsed_total < total; parsed_total += length) {
+
+        char* current = buffer;
+        int remaining = length;
+
+        memcpy(buffer, stream, length);
+
+        while (remaining > 0) {
+
+            guac_instruction* instruction;
+
+            /* Previous implementation allocated each instruction */
+            if (legacy)
+                instruction = guac_instruction_alloc();
+            else {
+                instruction = reused;
+                guac_instruction_reset(instruction);
+            }
+
+            /* Parse until instruction is complete */
+            while (instruction->state != GUAC_INSTRUCTION_PARSE_COMPLETE) {
+
+                int parsed;
+                if (legacy)
+                    parsed = bench_instruction_legacy_append(instruction,
+                            current, remaining);
+                else
+                    parsed = guac_instruction_append(instruction,
+                            current, remaining);
+
+                if (parsed == 0) {
+                    fprintf(stderr, "Parse error\n");
+                    exit(1);
+                }
+
+                current += parsed;
+                remaining -= parsed;
+
+            }
+
+            bench_instruction_sink = instruction->argc;
+
+            if (legacy)
+                guac_instruction_free(instruction);
+
+        }
+
+    }
+
+    double elapsed = bench_instruction_now() - start;
+    guac_instruction_free(reused);
+
+    return parsed_total / elapsed / 1048576.0;
+
+}
+
+int main(int argc, char** argv) {
+
+    int blob_sizes[] = { 0, 64, 1024, 4096, 8192 };
+    size_t total = BENCH_INSTRUCTION_DEFAULT_MEGABYTES;
+    char* stream = malloc(BENCH_INSTRUCTION_STREAM_SIZE);
+    unsigned int i;
+
+    /* Allow amount of data to be overridden */
+    if (argc > 1)
+        total = strtoul(argv[1], NULL, 10);
+
+    total *= 1048576;
+
+    printf("%10s %14s %14s %8s\n", "blob", "legacy MB/s", "current MB/s",
+            "speedup");
+
+    for (i = 0; i < sizeof(blob_sizes) / sizeof(blob_sizes[0]); i++) {
+
+        int length = bench_instruction_build(stream, blob_sizes[i]);
+
+        double legacy = bench_instruction_run(stream, length, total, 1);
+        double current = bench_instruction_run(stream, length, total, 0);
+
+        printf("%10i %14.1f %14.1f %7.2fx\n", blob_sizes[i], legacy, current,
+                current / legacy);
+
+    }
+
+    free(stream);
+    return 0;
+
+}
+
@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Benchmark replaying patterns of damage against a surface, reporting the
+ * number of instructions and bytes sent and the CPU time taken to draw and
+ * flush each pattern, once for each damage model. Synthetic patterns
+ * resembling typing, terminal output, scattered small updates, dragging a
+ * window and opening nested menus are built in. A recorded pattern may be
+ * replayed instead by giving a file containing one "X Y WIDTH HEIGHT" line
+ * per damaged rectangle, with frames separated by blank lines or lines
+ * containing only "flush".
+ *
+ * Usage: bench_surface_flush [FILE]
+ */
+
+#include "config.h"
+
+#include "guac_rect.h"
+#include "guac_surface.h"
+
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/socket.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The width of the surface to which damage is applied.
+ */
+#define BENCH_SURFACE_WIDTH 1024
+
+/**
+ * The height of the surface to which damage is applied.
+ */
+#define BENCH_SURFACE_HEIGHT 768
+
+/**
+ * The number of frames in each synthetic pattern.
+ */
+#define BENCH_SURFACE_FRAMES 200
+
+/**
+ * The width and height of a single character of synthetic text.
+ */
+#define BENCH_SURFACE_CHAR_WIDTH  8
+#define BENCH_SURFACE_CHAR_HEIGHT 16
+
+/**
+ * A pattern of damage, being a list of rectangles divided into frames.
+ */
+typedef struct bench_surface_pattern {
+
+    /**
+     * The name of this pattern, as printed in the results.
+     */
+    const char* name;
+
+    /**
+     * All damaged rectangles, in order.
+     */
+    guac_common_rect* rects;
+
+    /**
+     * The number of rectangles in the pattern.
+     */
+    int count;
+
+    /**
+     * The number of rectangles for which space has been allocated.
+     */
+    int size;
+
+    /**
+     * For each rectangle, non-zero if the surface should be flushed after
+     * that rectangle is drawn.
+     */
+    char* flush;
+
+} bench_surface_pattern;
+
+/**
+ * Everything counted while writing to the benchmark socket.
+ */
+typedef struct bench_surface_output {
+
+    /**
+     * The number of bytes written.
+     */
+    size_t bytes;
+
+    /**
+     * The number of instructions written.
+     */
+    int instructions;
+
+} bench_surface_output;
+
+/**
+ * Write handler which discards all data, counting the bytes and
+ * instructions written within the bench_surface_output associated with the
+ * socket. As base64 contains no semicolons, each semicolon ends an
+ * instruction.
+ */
+static ssize_t bench_surface_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    bench_surface_output* output = (bench_surface_output*) socket->data;
+    const char* data = (const char*) buf;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (data[i] == ';')
+            output->instructions++;
+    }
+
+    output->bytes += count;
+    return count;
+
+}
+
+/**
+ * Returns the CPU time consumed by this process, in seconds.
+ */
+static double bench_surface_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+/**
+ * Initializes the given pattern as empty.
+ */
+static void bench_surface_pattern_init(bench_surface_pattern* pattern,
+        const char* name) {
+    pattern->name = name;
+    pattern->rects = NULL;
+    pattern->flush = NULL;
+    pattern->count = 0;
+    pattern->size = 0;
+}
+
+/**
+ * Adds the given rectangle to the current frame of the given pattern,
+ * constrained within the bounds of the surface.
+ */
+static void bench_surface_pattern_add(bench_surface_pattern* pattern,
+        int x, int y, int width, int height) {
+
+    guac_common_rect bounds;
+    guac_common_rect* rect;
+
+    /* Grow if out of space */
+    if (pattern->count == pattern->size) {
+        pattern->size = pattern->size > 0 ? pattern->size * 2 : 256;
+        pattern->rects = realloc(pattern->rects,
+                sizeof(guac_common_rect) * pattern->size);
+        pattern->flush = realloc(pattern->flush, pattern->size);
+    }
+
+    rect = &(pattern->rects[pattern->count]);
+    guac_common_rect_init(rect, x, y, width, height);
+    guac_common_rect_init(&bounds, 0, 0,
+            BENCH_SURFACE_WIDTH, BENCH_SURFACE_HEIGHT);
+    guac_common_rect_constrain(rect, &bounds);
+
+    /* Ignore rectangles entirely outside the surface */
+    if (rect->width <= 0 || rect->height <= 0)
+        return;
+
+    pattern->flush[pattern->count++] = 0;
+
+}
+
+/**
+ * Ends the current frame of the given pattern, such that the surface is
+ * flushed after the last rectangle added.
+ */
+static void bench_surface_pattern_flush(bench_surface_pattern* pattern) {
+    if (pattern->count > 0)
+        pattern->flush[pattern->count - 1] = 1;
+}
+
+/**
+ * Builds the given synthetic pattern of damage.
+ */
+static void bench_surface_pattern_build(bench_surface_pattern* pattern,
+        const char* name) {
+
+    int frame, i;
+
+    bench_surface_pattern_init(pattern, name);
+    srand(0x5F1);
+
+    for (frame = 0; frame < BENCH_SURFACE_FRAMES; frame++) {
+
+        /* One character typed per frame, with the cursor moved after it */
+        if (strcmp(name, "typing") == 0) {
+            int column = frame % 100;
+            int row = frame / 100;
+            bench_surface_pattern_add(pattern,
+                    column * BENCH_SURFACE_CHAR_WIDTH,
+                    row * BENCH_SURFACE_CHAR_HEIGHT,
+                    BENCH_SURFACE_CHAR_WIDTH, BENCH_SURFACE_CHAR_HEIGHT);
+            bench_surface_pattern_add(pattern,
+                    (column + 1) * BENCH_SURFACE_CHAR_WIDTH,
+                    row * BENCH_SURFACE_CHAR_HEIGHT,
+                    2, BENCH_SURFACE_CHAR_HEIGHT);
+        }
+
+        /* Runs of characters drawn one at a time across several lines */
+        else if (strcmp(name, "terminal") == 0) {
+            int line;
+            for (line = 0; line < 4; line++) {
+                int row = rand() % (BENCH_SURFACE_HEIGHT / BENCH_SURFACE_CHAR_HEIGHT);
+                int length = 10 + rand() % 60;
+                for (i = 0; i < length; i++)
+                    bench_surface_pattern_add(pattern,
+                            i * BENCH_SURFACE_CHAR_WIDTH,
+                            row * BENCH_SURFACE_CHAR_HEIGHT,
+                            BENCH_SURFACE_CHAR_WIDTH,
+                            BENCH_SURFACE_CHAR_HEIGHT);
+            }
+        }
+
+        /* Small updates scattered across the whole surface */
+        else if (strcmp(name, "scattered") == 0) {
+            for (i = 0; i < 40; i++)
+                bench_surface_pattern_add(pattern,
+                        rand() % BENCH_SURFACE_WIDTH,
+                        rand() % BENCH_SURFACE_HEIGHT,
+                        4 + rand() % 28, 4 + rand() % 28);
+        }
+
+        /* A window dragged diagonally, exposing what was beneath it */
+        else if (strcmp(name, "drag") == 0) {
+            int x = (frame * 3) % (BENCH_SURFACE_WIDTH - 300);
+            int y = (frame * 2) % (BENCH_SURFACE_HEIGHT - 200);
+            bench_surface_pattern_add(pattern, x, y, 300, 200);
+            bench_surface_pattern_add(pattern, x + 3, y + 2, 300, 200);
+        }
+
+        /* Nested menus opened in turn, each overlapping its parent */
+        else if (strcmp(name, "menus") == 0) {
+            int x = (frame * 37) % 400;
+            int y = (frame * 23) % 300;
+            for (i = 0; i < 4; i++)
+                bench_surface_pattern_add(pattern, x + i * 140, y + i * 24,
+                        160, 60 + (i * 53) % 120);
+        }
+
+        bench_surface_pattern_flush(pattern);
+
+    }
+
+}
+
+/**
+ * Reads a recorded pattern of damage from the given file, returning zero on
+ * success and non-zero on failure.
+ */
+static int bench_surface_pattern_read(bench_surface_pattern* pattern,
+        const char* filename) {
+
+    char line[256];
+    FILE* file = fopen(filename, "r");
+
+    if (file == NULL) {
+        perror(filename);
+        return 1;
+    }
+
+    bench_surface_pattern_init(pattern, filename);
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+
+        int x, y, width, height;
+
+        if (sscanf(line, "%i %i %i %i", &x, &y, &width, &height) == 4)
+            bench_surface_pattern_add(pattern, x, y, width, height);
+
+        /* Anything else ends the current frame */
+        else
+            bench_surface_pattern_flush(pattern);
+
+    }
+
+    bench_surface_pattern_flush(pattern);
+    fclose(file);
+    return 0;
+
+}
+
+/**
+ * Fills the given image with content resembling text, varying with the
+ * given seed such that redrawn content always differs from what it
+ * replaces.
+ */
+static void bench_surface_fill(cairo_surface_t* image, int seed) {
+
+    unsigned char* data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int width = cairo_image_surface_get_width(image);
+    int height = cairo_image_surface_get_height(image);
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+
+        uint32_t* row = (uint32_t*) (data + y * stride);
+
+        for (x = 0; x < width; x++) {
+            int ink = ((x * 7 + y * 3 + seed) % 11) < 3;
+            row[x] = ink ? 0x202020 + (seed & 0x3F) : 0xF0F0F0;
+        }
+
+    }
+
+    cairo_surface_mark_dirty(image);
+
+}
+
+/**
+ * Replays the given pattern against a new surface using the given damage
+ * model, printing the instructions and bytes sent and the CPU time taken.
+ */
+static void bench_surface_run(const bench_surface_pattern* pattern,
+        guac_common_surface_damage_model model, const char* model_name) {
+
+    bench_surface_output output = { 0, 0 };
+    guac_client* client = guac_client_alloc();
+    guac_socket* socket = guac_socket_alloc();
+    guac_common_surface* surface;
+    cairo_surface_t* image;
+    double start, elapsed;
+    int i;
+
+    socket->data = &output;
+    socket->write_handler = bench_surface_write_handler;
+
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            BENCH_SURFACE_WIDTH, BENCH_SURFACE_HEIGHT);
+    guac_common_surface_set_damage_model(surface, model);
+
+    image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            BENCH_SURFACE_WIDTH, BENCH_SURFACE_HEIGHT);
+
+    /* Exclude allocation from measurement */
+    guac_socket_flush(socket);
+    output.bytes = 0;
+    output.instructions = 0;
+
+    start = bench_surface_now();
+
+    for (i = 0; i < pattern->count; i++) {
+
+        const guac_common_rect* rect = &(pattern->rects[i]);
+        cairo_surface_t* content = cairo_image_surface_create_for_data(
+                cairo_image_surface_get_data(image), CAIRO_FORMAT_RGB24,
+                rect->width, rect->height,
+                cairo_image_surface_get_stride(image));
+
+        bench_surface_fill(content, i);
+        guac_common_surface_draw(surface, rect->x, rect->y, content);
+        cairo_surface_destroy(content);
+
+        if (pattern->flush[i]) {
+            guac_common_surface_flush(surface);
+            guac_socket_flush(socket);
+        }
+
+    }
+
+    elapsed = bench_surface_now() - start;
+
+    printf("%-12s %-8s %12i %12zu %10.1f\n", pattern->name, model_name,
+            output.instructions, output.bytes, elapsed * 1000.0);
+
+    cairo_surface_destroy(image);
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    guac_client_free(client);
+
+}
+
+int main(int argc, char** argv) {
+
+    const char* names[] = { "typing", "terminal", "scattered", "drag",
+                            "menus" };
+
+    bench_surface_pattern patterns[sizeof(names) / sizeof(names[0])];
+    int count = 0;
+    int i;
+
+    /* Replay recorded damage if given, synthetic damage otherwise */
+    if (argc > 1) {
+        if (bench_surface_pattern_read(&patterns[0], argv[1]))
+            return 1;
+        count = 1;
+    }
+
+    else {
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            bench_surface_pattern_build(&patterns[count++], names[i]);
+    }
+
+    printf("%-12s %-8s %12s %12s %10s\n", "pattern", "damage",
+            "instructions", "bytes", "CPU ms");
+
+    for (i = 0; i < count; i++) {
+
+        bench_surface_run(&patterns[i], GUAC_COMMON_SURFACE_DAMAGE_QUEUE,
+                "queue");
+        bench_surface_run(&patterns[i], GUAC_COMMON_SURFACE_DAMAGE_TILES,
+                "tiles");
+
+        free(patterns[i].rects);
+        free(patterns[i].flush);
+
+    }
+
+    return 0;
+
+}
+
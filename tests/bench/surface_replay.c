@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Benchmark replaying a trace of surface operations, as recorded by a
+ * running connection using the "surface-trace" parameter, against a socket
+ * which counts everything written. The replay runs as fast as possible,
+ * ignoring the timing of the original connection, and reports the frames
+ * per second achieved (each flush of the default layer ending a frame), the
+ * number of instructions and bytes written for each opcode, and the time
+ * spent reading the trace, performing each type of operation, and writing
+ * to the socket.
+ *
+ * Usage: bench_surface_replay [-o FILE] [-j QUALITY] [-p THREADS] [-m] [-d]
+ *                             [-t] TRACE
+ *
+ *     -o FILE     Additionally write all output to FILE, such as /dev/null.
+ *     -j QUALITY  Send photographic updates as JPEG of the given quality.
+ *     -p THREADS  Encode images using a pool of the given number of threads.
+ *     -m          Enable motion detection.
+ *     -d          Enable delta updates.
+ *     -t          Track damage by tile rather than by queue.
+ */
+
+#include "config.h"
+
+#include "guac_surface.h"
+#include "guac_surface_trace.h"
+#include "guac_worker_pool.h"
+
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * The maximum number of distinct opcodes counted. Any further opcodes are
+ * counted together.
+ */
+#define BENCH_REPLAY_MAX_OPCODES 32
+
+/**
+ * The maximum length of a counted opcode, including null terminator. Longer
+ * opcodes are truncated.
+ */
+#define BENCH_REPLAY_OPCODE_LENGTH 16
+
+/**
+ * Totals for all instructions written having the same opcode.
+ */
+typedef struct bench_replay_opcode {
+
+    /**
+     * The opcode of the instructions counted.
+     */
+    char name[BENCH_REPLAY_OPCODE_LENGTH];
+
+    /**
+     * The number of instructions written.
+     */
+    int instructions;
+
+    /**
+     * The number of bytes written.
+     */
+    size_t bytes;
+
+} bench_replay_opcode;
+
+/**
+ * Everything counted while writing to the benchmark socket, along with the
+ * state of the parser which divides written data into instructions.
+ */
+typedef struct bench_replay_output {
+
+    /**
+     * File receiving a copy of all output, or NULL if output is only
+     * counted.
+     */
+    FILE* file;
+
+    /**
+     * Totals for each opcode written, in order of first appearance.
+     */
+    bench_replay_opcode opcodes[BENCH_REPLAY_MAX_OPCODES + 1];
+
+    /**
+     * The number of entries of opcodes in use, excluding the final entry
+     * which counts all opcodes beyond the maximum.
+     */
+    int count;
+
+    /**
+     * The opcode of the instruction currently being parsed.
+     */
+    char opcode[BENCH_REPLAY_OPCODE_LENGTH];
+
+    /**
+     * The number of characters of the current opcode parsed thus far.
+     */
+    int opcode_length;
+
+    /**
+     * The number of bytes of the current instruction parsed thus far.
+     */
+    size_t bytes;
+
+    /**
+     * The number of elements of the current instruction parsed thus far,
+     * including the element being parsed.
+     */
+    int element;
+
+    /**
+     * The length of the element being parsed, as read thus far, or -1 if
+     * the value of the element is being parsed.
+     */
+    int length;
+
+    /**
+     * The number of characters of the value of the current element which
+     * remain to be parsed.
+     */
+    int remaining;
+
+    /**
+     * The time spent within the write handler, in seconds.
+     */
+    double write_time;
+
+} bench_replay_output;
+
+/**
+ * A surface created while replaying, along with the index of the layer it
+ * was recorded for.
+ */
+typedef struct bench_replay_surface {
+
+    /**
+     * The index of the layer associated with the surface when recorded.
+     */
+    int index;
+
+    /**
+     * The layer allocated for the surface during replay.
+     */
+    guac_layer* layer;
+
+    /**
+     * The surface itself.
+     */
+    guac_common_surface* surface;
+
+} bench_replay_surface;
+
+/**
+ * The state of a replay.
+ */
+typedef struct bench_replay {
+
+    /**
+     * The client owning all layers.
+     */
+    guac_client* client;
+
+    /**
+     * The socket receiving all output.
+     */
+    guac_socket* socket;
+
+    /**
+     * All surfaces which currently exist.
+     */
+    bench_replay_surface* surfaces;
+
+    /**
+     * The number of surfaces which currently exist.
+     */
+    int count;
+
+    /**
+     * The number of surfaces for which space has been allocated.
+     */
+    int size;
+
+    /**
+     * The JPEG quality to use, or zero if JPEG is disabled.
+     */
+    int jpeg_quality;
+
+    /**
+     * The pool of threads to encode images with, or NULL to encode images
+     * within the replaying thread.
+     */
+    guac_common_worker_pool* pool;
+
+    /**
+     * Whether motion detection is enabled.
+     */
+    int motion_detection;
+
+    /**
+     * Whether delta updates are enabled.
+     */
+    int delta_updates;
+
+    /**
+     * The damage model to use.
+     */
+    guac_common_surface_damage_model damage_model;
+
+} bench_replay;
+
+/**
+ * The name of each type of record, indexed by opcode.
+ */
+static const char* bench_replay_record_names[] = {
+    "(invalid)",
+    "surface",
+    "free",
+    "resize",
+    "draw",
+    "paint",
+    "copy",
+    "transfer",
+    "rect",
+    "clip",
+    "reset-clip",
+    "flush",
+    "flush-deferred"
+};
+
+/**
+ * The number of distinct record types, including the invalid type.
+ */
+#define BENCH_REPLAY_RECORD_TYPES \
+    (sizeof(bench_replay_record_names) / sizeof(bench_replay_record_names[0]))
+
+/**
+ * Returns the current time in seconds, measured by a monotonic clock.
+ */
+static double bench_replay_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+/**
+ * Adds the instruction just parsed to the totals of its opcode.
+ */
+static void bench_replay_count_instruction(bench_replay_output* output) {
+
+    bench_replay_opcode* opcode;
+    int i;
+
+    output->opcode[output->opcode_length] = '\0';
+
+    /* Find existing totals for opcode */
+    for (i = 0; i < output->count; i++) {
+        if (strcmp(output->opcodes[i].name, output->opcode) == 0)
+            break;
+    }
+
+    /* Add new totals if not found and space remains */
+    if (i == output->count) {
+        if (output->count < BENCH_REPLAY_MAX_OPCODES) {
+            strcpy(output->opcodes[i].name, output->opcode);
+            output->count++;
+        }
+        else
+            i = BENCH_REPLAY_MAX_OPCODES;
+    }
+
+    opcode = &(output->opcodes[i]);
+    opcode->instructions++;
+    opcode->bytes += output->bytes;
+
+}
+
+/**
+ * Parses the given data as the next part of the Guacamole protocol data
+ * written to the benchmark socket, counting each instruction as it ends.
+ * Element lengths are assumed to be in bytes, as all instructions sent by
+ * surfaces contain only ASCII.
+ */
+static void bench_replay_parse(bench_replay_output* output,
+        const char* data, size_t count) {
+
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+
+        char c = data[i];
+        output->bytes++;
+
+        /* Skip or record the value of the current element */
+        if (output->length == -1 && output->remaining > 0) {
+            if (output->element == 1
+                    && output->opcode_length < BENCH_REPLAY_OPCODE_LENGTH - 1)
+                output->opcode[output->opcode_length++] = c;
+            output->remaining--;
+        }
+
+        /* Value ends with the instruction or the start of another element */
+        else if (output->length == -1) {
+
+            output->length = 0;
+
+            if (c == ';') {
+                bench_replay_count_instruction(output);
+                output->bytes = 0;
+                output->element = 1;
+                output->opcode_length = 0;
+            }
+            else
+                output->element++;
+
+        }
+
+        /* Length ends with a period, after which the value begins */
+        else if (c == '.') {
+            output->remaining = output->length;
+            output->length = -1;
+        }
+
+        else
+            output->length = output->length * 10 + c - '0';
+
+    }
+
+}
+
+/**
+ * Write handler which counts all data written within the
+ * bench_replay_output associated with the socket, copying that data to a
+ * file if requested.
+ */
+static ssize_t bench_replay_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    bench_replay_output* output = (bench_replay_output*) socket->data;
+    double start = bench_replay_now();
+
+    bench_replay_parse(output, (const char*) buf, count);
+
+    if (output->file != NULL
+            && fwrite(buf, 1, count, output->file) != count)
+        return -1;
+
+    output->write_time += bench_replay_now() - start;
+    return count;
+
+}
+
+/**
+ * Returns the replayed surface recorded for the layer having the given
+ * index, or NULL if there is no such surface. This function is suitable
+ * for use as a guac_common_surface_trace_lookup.
+ */
+static guac_common_surface* bench_replay_lookup(int index, void* data) {
+
+    bench_replay* replay = (bench_replay*) data;
+    int i;
+
+    for (i = 0; i < replay->count; i++) {
+        if (replay->surfaces[i].index == index)
+            return replay->surfaces[i].surface;
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Frees the replayed surface recorded for the layer having the given index,
+ * along with its layer, if such a surface exists.
+ */
+static void bench_replay_free_surface(bench_replay* replay, int index) {
+
+    int i;
+
+    for (i = 0; i < replay->count; i++) {
+
+        bench_replay_surface* current = &(replay->surfaces[i]);
+        if (current->index != index)
+            continue;
+
+        guac_common_surface_free(current->surface);
+
+        if (index > 0)
+            guac_client_free_layer(replay->client, current->layer);
+        else if (index < 0)
+            guac_client_free_buffer(replay->client, current->layer);
+
+        /* Fill gap with last surface */
+        *current = replay->surfaces[--replay->count];
+        return;
+
+    }
+
+}
+
+/**
+ * Creates a surface for the layer having the given recorded index, replacing
+ * any existing surface for that layer, and configuring the new surface as
+ * requested for the replay.
+ */
+static void bench_replay_alloc_surface(bench_replay* replay, int index,
+        int width, int height) {
+
+    bench_replay_surface* current;
+    guac_common_surface* surface;
+    guac_layer* layer;
+
+    bench_replay_free_surface(replay, index);
+
+    /* Allocate a layer of the same kind as was recorded */
+    if (index == 0)
+        layer = (guac_layer*) GUAC_DEFAULT_LAYER;
+    else if (index > 0)
+        layer = guac_client_alloc_layer(replay->client);
+    else
+        layer = guac_client_alloc_buffer(replay->client);
+
+    surface = guac_common_surface_alloc(replay->client, replay->socket,
+            layer, width, height);
+
+    guac_common_surface_set_jpeg_quality(surface, replay->jpeg_quality);
+    guac_common_surface_set_encoder_pool(surface, replay->pool);
+    guac_common_surface_set_motion_detection(surface,
+            replay->motion_detection);
+    guac_common_surface_set_delta_updates(surface, replay->delta_updates);
+    guac_common_surface_set_damage_model(surface, replay->damage_model);
+
+    /* Grow storage as necessary */
+    if (replay->count == replay->size) {
+        replay->size = replay->size * 2 + 16;
+        replay->surfaces = realloc(replay->surfaces,
+                replay->size * sizeof(bench_replay_surface));
+    }
+
+    current = &(replay->surfaces[replay->count++]);
+    current->index = index;
+    current->layer = layer;
+    current->surface = surface;
+
+}
+
+int main(int argc, char** argv) {
+
+    static bench_replay_output output;
+
+    double record_time[BENCH_REPLAY_RECORD_TYPES] = { 0 };
+    int records[BENCH_REPLAY_RECORD_TYPES] = { 0 };
+
+    bench_replay replay = { 0 };
+    guac_common_surface_trace_record record = { 0 };
+    const char* output_path = NULL;
+    FILE* file;
+
+    double read_time = 0;
+    double start, elapsed, now;
+    size_t total_bytes = 0;
+    int total_instructions = 0;
+    int frames = 0;
+    int skipped = 0;
+    int threads = 0;
+    int result;
+    int opt;
+    int i;
+
+    replay.damage_model = GUAC_COMMON_SURFACE_DAMAGE_QUEUE;
+
+    while ((opt = getopt(argc, argv, "o:j:p:mdt")) != -1) {
+        switch (opt) {
+            case 'o': output_path = optarg; break;
+            case 'j': replay.jpeg_quality = atoi(optarg); break;
+            case 'p': threads = atoi(optarg); break;
+            case 'm': replay.motion_detection = 1; break;
+            case 'd': replay.delta_updates = 1; break;
+            case 't': replay.damage_model = GUAC_COMMON_SURFACE_DAMAGE_TILES; break;
+            default:
+                fprintf(stderr, "Usage: %s [-o FILE] [-j QUALITY] "
+                        "[-p THREADS] [-m] [-d] [-t] TRACE\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-o FILE] [-j QUALITY] [-p THREADS] "
+                "[-m] [-d] [-t] TRACE\n", argv[0]);
+        return 1;
+    }
+
+    file = fopen(argv[optind], "rb");
+    if (file == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (guac_common_surface_trace_read_header(file)) {
+        fprintf(stderr, "%s: Not a surface trace.\n", argv[optind]);
+        fclose(file);
+        return 1;
+    }
+
+    if (output_path != NULL) {
+        output.file = fopen(output_path, "wb");
+        if (output.file == NULL) {
+            perror(output_path);
+            fclose(file);
+            return 1;
+        }
+    }
+
+    output.element = 1;
+
+    replay.client = guac_client_alloc();
+    replay.socket = guac_socket_alloc();
+    replay.socket->data = &output;
+    replay.socket->write_handler = bench_replay_write_handler;
+
+    if (threads > 0)
+        replay.pool = guac_common_worker_pool_alloc(threads);
+
+    start = now = bench_replay_now();
+
+    for (;;) {
+
+        double read_start = now;
+
+        result = guac_common_surface_trace_read(file, &record);
+        now = bench_replay_now();
+        read_time += now - read_start;
+
+        if (result <= 0)
+            break;
+
+        /* Surfaces are created and freed by the replay */
+        if (record.opcode == GUAC_COMMON_SURFACE_TRACE_SURFACE
+                && record.argc == 3)
+            bench_replay_alloc_surface(&replay, record.argv[0],
+                    record.argv[1], record.argv[2]);
+
+        else if (record.opcode == GUAC_COMMON_SURFACE_TRACE_FREE
+                && record.argc == 1)
+            bench_replay_free_surface(&replay, record.argv[0]);
+
+        else if (guac_common_surface_trace_apply(&record,
+                    bench_replay_lookup, &replay)) {
+            skipped++;
+            continue;
+        }
+
+        /* Each flush of the default layer ends a frame */
+        if (record.opcode == GUAC_COMMON_SURFACE_TRACE_FLUSH
+                && record.argv[0] == 0) {
+            guac_socket_flush(replay.socket);
+            frames++;
+        }
+
+        records[record.opcode]++;
+        record_time[record.opcode] += bench_replay_now() - now;
+        now = bench_replay_now();
+
+    }
+
+    /* Free all remaining surfaces */
+    while (replay.count > 0)
+        bench_replay_free_surface(&replay, replay.surfaces[0].index);
+
+    guac_socket_flush(replay.socket);
+    elapsed = bench_replay_now() - start;
+
+    if (result < 0)
+        fprintf(stderr, "%s: Trace is truncated or malformed.\n",
+                argv[optind]);
+
+    if (skipped > 0)
+        fprintf(stderr, "%s: %i records could not be replayed.\n",
+                argv[optind], skipped);
+
+    /* Overall throughput */
+    printf("%i frames in %.1f ms (%.1f frames/s)\n\n", frames,
+            elapsed * 1000.0, elapsed > 0 ? frames / elapsed : 0.0);
+
+    /* Output by opcode */
+    printf("%-16s %12s %14s %12s\n", "instruction", "count", "bytes",
+            "bytes/each");
+    for (i = 0; i <= BENCH_REPLAY_MAX_OPCODES; i++) {
+
+        bench_replay_opcode* opcode = &(output.opcodes[i]);
+        if (opcode->instructions == 0)
+            continue;
+
+        printf("%-16s %12i %14zu %12zu\n",
+                i < BENCH_REPLAY_MAX_OPCODES ? opcode->name : "(other)",
+                opcode->instructions, opcode->bytes,
+                opcode->bytes / opcode->instructions);
+
+        total_instructions += opcode->instructions;
+        total_bytes += opcode->bytes;
+
+    }
+    printf("%-16s %12i %14zu\n\n", "total", total_instructions, total_bytes);
+
+    /* Time by stage */
+    printf("%-16s %12s %14s\n", "stage", "count", "ms");
+    printf("%-16s %12s %14.1f\n", "trace read", "", read_time * 1000.0);
+    for (i = 1; i < BENCH_REPLAY_RECORD_TYPES; i++) {
+        if (records[i] > 0)
+            printf("%-16s %12i %14.1f\n", bench_replay_record_names[i],
+                    records[i], record_time[i] * 1000.0);
+    }
+    printf("%-16s %12s %14.1f\n", "socket write", "",
+            output.write_time * 1000.0);
+
+    if (replay.pool != NULL)
+        guac_common_worker_pool_free(replay.pool);
+
+    guac_socket_free(replay.socket);
+    guac_client_free(replay.client);
+    free(replay.surfaces);
+    free(record.data);
+    fclose(file);
+
+    if (output.file != NULL)
+        fclose(output.file);
+
+    return 0;
+
+}
+
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "capture_socket.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <guacamole/socket.h>
+
+/**
+ * The initial number of bytes allocated for captured data.
+ */
+#define TEST_CAPTURE_INITIAL_SIZE 65536
+
+/**
+ * The maximum number of bytes written by each call to the writev handler.
+ */
+#define TEST_CAPTURE_MAX_WRITEV 1000
+
+/**
+ * Write handler which appends all data to the test_capture associated with
+ * the socket.
+ */
+static ssize_t __test_capture_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_capture* capture = (test_capture*) socket->data;
+
+    /* Grow as necessary, leaving room for null terminator */
+    if (capture->length + count >= capture->size) {
+
+        size_t size = capture->size;
+        char* data;
+
+        while (capture->length + count >= size)
+            size *= 2;
+
+        data = realloc(capture->data, size);
+        if (data == NULL)
+            return -1;
+
+        capture->data = data;
+        capture->size = size;
+
+    }
+
+    memcpy(capture->data + capture->length, buf, count);
+    capture->length += count;
+    capture->data[capture->length] = '\0';
+    return count;
+
+}
+
+/**
+ * Scatter-gather write handler which appends data from the given segments to
+ * the test_capture associated with the socket, writing no more than
+ * TEST_CAPTURE_MAX_WRITEV bytes per call.
+ */
+static ssize_t __test_capture_writev_handler(guac_socket* socket,
+        const struct iovec* iov, int iovcnt) {
+
+    ssize_t total = 0;
+    int i;
+
+    for (i = 0; i < iovcnt && total < TEST_CAPTURE_MAX_WRITEV; i++) {
+
+        size_t count = iov[i].iov_len;
+        if (count > TEST_CAPTURE_MAX_WRITEV - total)
+            count = TEST_CAPTURE_MAX_WRITEV - total;
+
+        if (__test_capture_write_handler(socket, iov[i].iov_base, count) < 0)
+            return -1;
+
+        total += count;
+
+    }
+
+    return total;
+
+}
+
+guac_socket* test_capture_socket_alloc(test_capture* capture) {
+
+    guac_socket* socket;
+
+    capture->length = 0;
+    capture->size = TEST_CAPTURE_INITIAL_SIZE;
+    capture->data = malloc(capture->size);
+    if (capture->data == NULL)
+        return NULL;
+
+    capture->data[0] = '\0';
+
+    socket = guac_socket_alloc();
+    if (socket == NULL) {
+        free(capture->data);
+        capture->data = NULL;
+        return NULL;
+    }
+
+    socket->data = capture;
+    socket->write_handler = __test_capture_write_handler;
+
+    return socket;
+
+}
+
+void test_capture_socket_require_writev(guac_socket* socket) {
+    socket->writev_handler = __test_capture_writev_handler;
+    guac_socket_require_writev(socket);
+}
+
+void test_capture_reset(test_capture* capture) {
+    capture->length = 0;
+    capture->data[0] = '\0';
+}
+
+int test_capture_count(const test_capture* capture, const char* str) {
+
+    const char* current;
+    int count = 0;
+
+    for (current = capture->data; (current = strstr(current, str)) != NULL;
+            current++)
+        count++;
+
+    return count;
+
+}
+
+void test_capture_free(test_capture* capture) {
+    free(capture->data);
+    capture->data = NULL;
+}
+
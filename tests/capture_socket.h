@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef _GUAC_TEST_CAPTURE_SOCKET_H
+#define _GUAC_TEST_CAPTURE_SOCKET_H
+
+/**
+ * Socket which captures everything written to it in memory, for use by unit
+ * tests which verify the protocol data produced by libguac or the common
+ * library.
+ *
+ * @file capture_socket.h
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+
+#include <guacamole/socket.h>
+
+/**
+ * Everything written to a capture socket since it was last reset.
+ */
+typedef struct test_capture {
+
+    /**
+     * All data written thus far, always null-terminated.
+     */
+    char* data;
+
+    /**
+     * The number of bytes written thus far, excluding the null terminator.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes allocated for data.
+     */
+    size_t size;
+
+} test_capture;
+
+/**
+ * Allocates a new guac_socket which appends everything written to it to the
+ * given test_capture, initializing that test_capture as empty. The
+ * test_capture must remain valid until the socket is freed, and must be
+ * freed separately with test_capture_free().
+ *
+ * @param capture The test_capture which should receive all data written.
+ * @return A newly-allocated guac_socket, or NULL if allocation fails.
+ */
+guac_socket* test_capture_socket_alloc(test_capture* capture);
+
+/**
+ * Enables scatter-gather output on the given capture socket. The writev
+ * handler installed deliberately writes no more than 1000 bytes per call,
+ * such that handling of partial writes is exercised.
+ *
+ * @param socket The capture socket to enable scatter-gather output on.
+ */
+void test_capture_socket_require_writev(guac_socket* socket);
+
+/**
+ * Discards everything captured thus far.
+ *
+ * @param capture The test_capture to reset.
+ */
+void test_capture_reset(test_capture* capture);
+
+/**
+ * Returns the number of occurrences of the given string within everything
+ * captured thus far.
+ *
+ * @param capture The test_capture to search.
+ * @param str The string to search for.
+ * @return The number of occurrences of the given string.
+ */
+int test_capture_count(const test_capture* capture, const char* str);
+
+/**
+ * Frees all memory associated with the given test_capture. The capture
+ * socket writing to the test_capture must already have been freed.
+ *
+ * @param capture The test_capture to free.
+ */
+void test_capture_free(test_capture* capture);
+
+#endif
+
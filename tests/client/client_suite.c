@@ -48,6 +48,10 @@ int register_client_suite() {
     if (
         CU_add_test(suite, "layer-pool", test_layer_pool) == NULL
      || CU_add_test(suite, "buffer-pool", test_buffer_pool) == NULL
+     || CU_add_test(suite, "instruction-handlers", test_instruction_handlers) == NULL
+     || CU_add_test(suite, "link-stats", test_link_stats) == NULL
+     || CU_add_test(suite, "frame-window", test_frame_window) == NULL
+     || CU_add_test(suite, "fd-handlers", test_fd_handlers) == NULL
        ) {
         CU_cleanup_registry();
         return CU_get_error();
@@ -30,6 +30,10 @@ int register_client_suite();
 
 void test_layer_pool();
 void test_buffer_pool();
+void test_instruction_handlers();
+void test_link_stats();
+void test_frame_window();
+void test_fd_handlers();
 
 #endif
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "config.h"
+
+#include "client_suite.h"
+
+#include <CUnit/Basic.h>
+#include <guacamole/client.h>
+#include <guacamole/error.h>
+
+/**
+ * Handler which does nothing, registered for each file descriptor.
+ */
+static int __test_fd_handler(guac_client* client, int fd) {
+    return 0;
+}
+
+/**
+ * The number of times __test_timer_handler() has been invoked.
+ */
+static int __test_timer_calls;
+
+/**
+ * Timer handler which counts its invocations, re-arming the timer on the
+ * first.
+ */
+static int __test_timer_handler(guac_client* client) {
+
+    if (++__test_timer_calls == 1)
+        guac_client_set_timer(client, 0, __test_timer_handler);
+
+    return 0;
+
+}
+
+void test_fd_handlers() {
+
+    guac_client* client = guac_client_alloc();
+    guac_client_fd fds[GUAC_CLIENT_MAX_FDS];
+    int i;
+
+    /* No file descriptors initially */
+    CU_ASSERT_EQUAL(guac_client_get_fds(client, fds, GUAC_CLIENT_MAX_FDS), 0);
+
+    /* Register as many file descriptors as allowed */
+    for (i = 0; i < GUAC_CLIENT_MAX_FDS; i++)
+        CU_ASSERT_EQUAL(guac_client_add_fd(client, 100 + i,
+                    __test_fd_handler), 0);
+
+    /* Further registrations fail */
+    CU_ASSERT_NOT_EQUAL(guac_client_add_fd(client, 200, __test_fd_handler), 0);
+    CU_ASSERT_EQUAL(guac_error, GUAC_STATUS_NO_SPACE);
+
+    /* All are retrieved in order of registration */
+    CU_ASSERT_EQUAL(guac_client_get_fds(client, fds, GUAC_CLIENT_MAX_FDS),
+            GUAC_CLIENT_MAX_FDS);
+
+    for (i = 0; i < GUAC_CLIENT_MAX_FDS; i++) {
+        CU_ASSERT_EQUAL(fds[i].fd, 100 + i);
+        CU_ASSERT(fds[i].handler == __test_fd_handler);
+    }
+
+    /* Retrieval is bounded by the size of the given array */
+    CU_ASSERT_EQUAL(guac_client_get_fds(client, fds, 2), 2);
+    CU_ASSERT_EQUAL(fds[1].fd, 101);
+
+    /* Timer is initially disarmed, and running it does nothing */
+    CU_ASSERT_EQUAL(guac_client_get_timer(client), -1);
+    CU_ASSERT_EQUAL(guac_client_run_timer(client), 0);
+    CU_ASSERT_EQUAL(__test_timer_calls, 0);
+
+    /* Armed timers report the time remaining */
+    guac_client_set_timer(client, 60000, __test_timer_handler);
+    CU_ASSERT(guac_client_get_timer(client) > 59000);
+    CU_ASSERT(guac_client_get_timer(client) <= 60000);
+
+    /* Timers are disarmed before their handler runs, which may re-arm */
+    CU_ASSERT_EQUAL(guac_client_run_timer(client), 0);
+    CU_ASSERT_EQUAL(__test_timer_calls, 1);
+    CU_ASSERT_EQUAL(guac_client_get_timer(client), 0);
+
+    CU_ASSERT_EQUAL(guac_client_run_timer(client), 0);
+    CU_ASSERT_EQUAL(__test_timer_calls, 2);
+    CU_ASSERT_EQUAL(guac_client_get_timer(client), -1);
+
+    /* Timers may be disarmed explicitly */
+    guac_client_set_timer(client, 100, __test_timer_handler);
+    guac_client_set_timer(client, -1, NULL);
+    CU_ASSERT_EQUAL(guac_client_get_timer(client), -1);
+
+    guac_client_free(client);
+
+}
+
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "client_suite.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/client.h>
+#include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+
+/**
+ * Write handler which discards all data.
+ */
+static ssize_t __test_window_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+    return count;
+}
+
+/**
+ * Thread which acknowledges the sync with timestamp 1 after a short delay.
+ */
+static void* __test_window_ack_thread(void* data) {
+
+    guac_client* client = (guac_client*) data;
+    struct timespec delay = { 0, 20000000 };
+
+    nanosleep(&delay, NULL);
+    __guac_client_sync_received(client, 1, 21);
+
+    return NULL;
+
+}
+
+/**
+ * Allocates a new client whose socket discards all data.
+ */
+static guac_client* __test_window_client_alloc() {
+
+    guac_client* client = guac_client_alloc();
+
+    client->socket = guac_socket_alloc();
+    client->socket->write_handler = __test_window_write_handler;
+
+    return client;
+
+}
+
+/**
+ * Frees the given client and its socket.
+ */
+static void __test_window_client_free(guac_client* client) {
+    guac_socket_free(client->socket);
+    guac_client_free(client);
+}
+
+void test_frame_window() {
+
+    guac_client* client = __test_window_client_alloc();
+    guac_client_link_stats stats;
+    guac_timestamp t;
+    pthread_t ack_thread;
+
+    /* Window is small until the connection has been measured */
+    CU_ASSERT(guac_client_can_send_frame(client));
+    guac_client_sync_sent(client, 1);
+    CU_ASSERT(guac_client_can_send_frame(client));
+    guac_client_sync_sent(client, 2);
+    CU_ASSERT_FALSE(guac_client_can_send_frame(client));
+
+    /* Waiting for a closed window times out */
+    CU_ASSERT_FALSE(guac_client_wait_for_frame_window(client, 10));
+
+    /* Waiting ends as soon as a frame is acknowledged */
+    pthread_create(&ack_thread, NULL, __test_window_ack_thread, client);
+    CU_ASSERT(guac_client_wait_for_frame_window(client, 5000));
+    pthread_join(ack_thread, NULL);
+
+    __test_window_client_free(client);
+    client = __test_window_client_alloc();
+
+    /* Isolated frames measure latency alone */
+    for (t = 1000; t < 5000; t += 1000) {
+        guac_client_sync_sent(client, t);
+        __guac_client_sync_received(client, t, t + 200);
+    }
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.min_rtt, 200);
+    CU_ASSERT_EQUAL(stats.frame_interval, 0);
+    CU_ASSERT_EQUAL(stats.frame_window, GUAC_CLIENT_MIN_FRAME_WINDOW);
+
+    /* Frames drained every 40 ms over a 200 ms round trip need a window of
+     * five frames to cover the round trip, plus the frame being drained */
+    guac_client_sync_sent(client, 10000);
+    guac_client_sync_sent(client, 10040);
+    __guac_client_sync_received(client, 10000, 10200);
+    __guac_client_sync_received(client, 10040, 10240);
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.frame_interval, 40);
+    CU_ASSERT_EQUAL(stats.frame_window, 6);
+
+    /* Window shrinks as frames drain more slowly */
+    for (t = 0; t < 6; t++)
+        guac_client_sync_sent(client, 20000 + t);
+
+    for (t = 0; t < 6; t++)
+        __guac_client_sync_received(client, 20000 + t, 20200 + t * 100);
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.min_rtt, 200);
+    CU_ASSERT_EQUAL(stats.frame_interval, 85);
+    CU_ASSERT_EQUAL(stats.frame_window, 4);
+
+    __test_window_client_free(client);
+
+}
+
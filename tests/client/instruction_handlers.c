@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "client_suite.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/client.h>
+#include <guacamole/error.h>
+#include <guacamole/instruction.h>
+
+/**
+ * The number of times each of the test handlers below has been invoked.
+ */
+static int test_handlers_custom_calls;
+static int test_handlers_mouse_calls;
+static int test_handlers_override_calls;
+
+/**
+ * Mouse handler which is invoked by the core "mouse" handler.
+ */
+static int __test_handlers_mouse(guac_client* client, int x, int y,
+        int mask) {
+    CU_ASSERT_EQUAL(x, 12);
+    CU_ASSERT_EQUAL(y, 34);
+    CU_ASSERT_EQUAL(mask, 1);
+    test_handlers_mouse_calls++;
+    return 0;
+}
+
+/**
+ * Handler for a custom opcode.
+ */
+static int __test_handlers_custom(guac_client* client,
+        guac_instruction* instruction) {
+    CU_ASSERT_STRING_EQUAL(instruction->opcode, "custom");
+    CU_ASSERT_EQUAL(instruction->argc, 1);
+    test_handlers_custom_calls++;
+    return 0;
+}
+
+/**
+ * Handler which replaces the core "key" handler, and which fails.
+ */
+static int __test_handlers_override(guac_client* client,
+        guac_instruction* instruction) {
+    test_handlers_override_calls++;
+    return -1;
+}
+
+/**
+ * Parses the given instruction and passes it to the given client, returning
+ * the result of handling that instruction.
+ */
+static int __test_handlers_handle(guac_client* client, const char* data) {
+
+    char buffer[256];
+    int result;
+
+    guac_instruction* instruction = guac_instruction_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(instruction);
+
+    strcpy(buffer, data);
+    guac_instruction_append(instruction, buffer, strlen(buffer));
+    CU_ASSERT_EQUAL_FATAL(instruction->state, GUAC_INSTRUCTION_PARSE_COMPLETE);
+
+    result = guac_client_handle_instruction(client, instruction);
+    guac_instruction_free(instruction);
+    return result;
+
+}
+
+void test_instruction_handlers() {
+
+    static char opcodes[GUAC_CLIENT_INSTRUCTION_HANDLERS][16];
+
+    guac_client_handler_stats stats[GUAC_CLIENT_INSTRUCTION_HANDLERS];
+    int count;
+    int i;
+
+    test_handlers_custom_calls = 0;
+    test_handlers_mouse_calls = 0;
+    test_handlers_override_calls = 0;
+
+    guac_client* client = guac_client_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(client);
+    client->mouse_handler = __test_handlers_mouse;
+
+    /* Core opcodes are handled, unknown opcodes are ignored */
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "5.mouse,2.12,2.34,1.1;"), 0);
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "6.custom,1.x;"), 0);
+    CU_ASSERT_EQUAL(test_handlers_mouse_calls, 1);
+    CU_ASSERT_EQUAL(test_handlers_custom_calls, 0);
+
+    /* Nothing is recorded while timing is disabled */
+    CU_ASSERT_EQUAL(guac_client_get_handler_stats(client, stats,
+                GUAC_CLIENT_INSTRUCTION_HANDLERS), 0);
+
+    /* Custom opcodes and overrides are dispatched */
+    guac_client_set_handler_timing(client, 1);
+    CU_ASSERT_EQUAL(guac_client_set_instruction_handler(client, "custom",
+                __test_handlers_custom), 0);
+    CU_ASSERT_EQUAL(guac_client_set_instruction_handler(client, "key",
+                __test_handlers_override), 0);
+
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "6.custom,1.x;"), 0);
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "6.custom,1.y;"), 0);
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "3.key,5.65307,1.1;"), -1);
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "5.mouse,2.12,2.34,1.1;"), 0);
+    CU_ASSERT_EQUAL(test_handlers_custom_calls, 2);
+    CU_ASSERT_EQUAL(test_handlers_override_calls, 1);
+    CU_ASSERT_EQUAL(test_handlers_mouse_calls, 2);
+
+    /* Each handled opcode is counted */
+    count = guac_client_get_handler_stats(client, stats,
+            GUAC_CLIENT_INSTRUCTION_HANDLERS);
+    CU_ASSERT_EQUAL_FATAL(count, 3);
+
+    for (i = 0; i < count; i++) {
+
+        if (strcmp(stats[i].opcode, "custom") == 0) {
+            CU_ASSERT_EQUAL(stats[i].count, 2);
+        }
+        else if (strcmp(stats[i].opcode, "key") == 0
+              || strcmp(stats[i].opcode, "mouse") == 0) {
+            CU_ASSERT_EQUAL(stats[i].count, 1);
+        }
+        else {
+            CU_FAIL("Unexpected opcode");
+        }
+
+        CU_ASSERT(stats[i].max_time <= stats[i].total_time);
+
+    }
+
+    /* Output is limited to the given maximum */
+    CU_ASSERT_EQUAL(guac_client_get_handler_stats(client, stats, 2), 2);
+
+    /* Fill table until no room remains */
+    for (i = 0; i < GUAC_CLIENT_INSTRUCTION_HANDLERS; i++) {
+        sprintf(opcodes[i], "op%i", i);
+        if (guac_client_set_instruction_handler(client, opcodes[i],
+                    __test_handlers_custom))
+            break;
+    }
+
+    CU_ASSERT_EQUAL(guac_error, GUAC_STATUS_NO_SPACE);
+
+    /* 12 opcodes were already present: 11 core opcodes and "custom" */
+    CU_ASSERT_EQUAL(i, GUAC_CLIENT_INSTRUCTION_HANDLERS - 12);
+
+    /* Existing handlers remain reachable within a full table */
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "6.custom,1.x;"), 0);
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "5.mouse,2.12,2.34,1.1;"), 0);
+    CU_ASSERT_EQUAL(__test_handlers_handle(client, "7.unknown;"), 0);
+    CU_ASSERT_EQUAL(test_handlers_custom_calls, 3);
+    CU_ASSERT_EQUAL(test_handlers_mouse_calls, 3);
+
+    guac_client_free(client);
+
+}
+
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "client_suite.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/client.h>
+#include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+
+/**
+ * Write handler which discards all data.
+ */
+static ssize_t __test_link_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+    return count;
+}
+
+/**
+ * Writes a frame of the given size to the socket of the given client, then
+ * notes that a sync bearing the given timestamp was sent.
+ */
+static void __test_link_send_frame(guac_client* client, int size,
+        guac_timestamp timestamp) {
+
+    static char frame[65536];
+
+    while (size > 0) {
+        int length = size < (int) sizeof(frame) ? size : (int) sizeof(frame);
+        guac_socket_write(client->socket, frame, length);
+        size -= length;
+    }
+
+    guac_socket_flush(client->socket);
+    guac_client_sync_sent(client, timestamp);
+
+}
+
+void test_link_stats() {
+
+    guac_client* client = guac_client_alloc();
+    guac_client_link_stats stats;
+    guac_timestamp t;
+
+    client->socket = guac_socket_alloc();
+    client->socket->write_handler = __test_link_write_handler;
+
+    /* Nothing is known before any sync is acknowledged */
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.syncs, 0);
+    CU_ASSERT_EQUAL(stats.bandwidth, 0);
+
+    /* Small frames measure latency alone */
+    for (t = 1000; t < 5000; t += 1000) {
+        __test_link_send_frame(client, 100, t);
+        __guac_client_sync_received(client, t, t + 50);
+    }
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.syncs, 4);
+    CU_ASSERT_EQUAL(stats.rtt, 50);
+    CU_ASSERT_EQUAL(stats.min_rtt, 50);
+    CU_ASSERT_EQUAL(stats.bandwidth, 0);
+    CU_ASSERT_EQUAL(stats.bandwidth_samples, 0);
+
+    /* Latency beyond the minimum is the time taken to transfer large
+     * frames: 100000 bytes in 100 ms */
+    __test_link_send_frame(client, 100000, 10000);
+    __guac_client_sync_received(client, 10000, 10150);
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.min_rtt, 50);
+    CU_ASSERT_EQUAL(stats.bandwidth, 1000000);
+    CU_ASSERT_EQUAL(stats.bandwidth_samples, 1);
+
+    /* Frames sent while the link is busy transfer between
+     * acknowledgements: 200000 bytes in 200 ms */
+    __test_link_send_frame(client, 100000, 20000);
+    __test_link_send_frame(client, 200000, 20010);
+    __guac_client_sync_received(client, 20000, 20150);
+    __guac_client_sync_received(client, 20010, 20350);
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.bandwidth, 1000000);
+    CU_ASSERT_EQUAL(stats.bandwidth_samples, 3);
+
+    /* Unknown timestamps are ignored */
+    __guac_client_sync_received(client, 12345, 30000);
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.syncs, 7);
+
+    /* Acknowledgement of a later sync implies receipt of earlier syncs,
+     * while repeated timestamps extend the pending frame */
+    __test_link_send_frame(client, 100, 40000);
+    __test_link_send_frame(client, 100, 40001);
+    __test_link_send_frame(client, 100, 40001);
+    __guac_client_sync_received(client, 40001, 40051);
+    __guac_client_sync_received(client, 40000, 40060);
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.syncs, 8);
+    CU_ASSERT_EQUAL(client->__pending_sync_count, 0);
+
+    /* Frames transferred too quickly to time raise the estimate to a lower
+     * bound: 100000 bytes in under 10 ms */
+    __test_link_send_frame(client, 100000, 50000);
+    __guac_client_sync_received(client, 50000, 50050);
+
+    guac_client_get_link_stats(client, &stats);
+    CU_ASSERT_EQUAL(stats.bandwidth, 10000000);
+
+    /* Only a limited number of syncs are tracked */
+    for (t = 0; t < GUAC_CLIENT_MAX_PENDING_SYNCS * 2; t++)
+        __test_link_send_frame(client, 100, 60000 + t);
+
+    CU_ASSERT_EQUAL(client->__pending_sync_count,
+            GUAC_CLIENT_MAX_PENDING_SYNCS);
+
+    guac_socket_free(client->socket);
+    guac_client_free(client);
+
+}
+
@@ -47,7 +47,19 @@ int register_common_suite() {
     /* Add tests */
     if (
         CU_add_test(suite, "guac-iconv", test_guac_iconv)  == NULL
+     || CU_add_test(suite, "guac-image-cache", test_guac_image_cache) == NULL
      || CU_add_test(suite, "guac-string", test_guac_string) == NULL
+     || CU_add_test(suite, "guac-surface-parallel", test_guac_surface_parallel) == NULL
+     || CU_add_test(suite, "guac-surface-tiles", test_guac_surface_tiles) == NULL
+     || CU_add_test(suite, "guac-surface-kernels", test_guac_surface_kernels) == NULL
+     || CU_add_test(suite, "guac-surface-motion", test_guac_surface_motion) == NULL
+     || CU_add_test(suite, "guac-surface-delta", test_guac_surface_delta) == NULL
+     || CU_add_test(suite, "guac-cost-model", test_guac_cost_model) == NULL
+     || CU_add_test(suite, "guac-region", test_guac_region) == NULL
+     || CU_add_test(suite, "guac-surface-trace", test_guac_surface_trace) == NULL
+     || CU_add_test(suite, "guac-profile", test_guac_profile) == NULL
+     || CU_add_test(suite, "guac-surface-coalesce", test_guac_surface_coalesce) == NULL
+     || CU_add_test(suite, "guac-surface-options", test_guac_surface_options) == NULL
        ) {
         CU_cleanup_registry();
         return CU_get_error();
@@ -49,5 +49,66 @@ void test_guac_string();
  */
 void test_guac_iconv();
 
+/**
+ * Unit test for the cache of images retained by the client.
+ */
+void test_guac_image_cache();
+
+/**
+ * Unit test for parallel encoding of surface updates.
+ */
+void test_guac_surface_parallel();
+
+/**
+ * Unit test for tile-based damage tracking of surfaces.
+ */
+void test_guac_surface_tiles();
+
+/**
+ * Unit test for the pixel kernels used to update the backing store of
+ * surfaces.
+ */
+void test_guac_surface_kernels();
+
+/**
+ * Unit test for detection of moved content within images drawn to surfaces.
+ */
+void test_guac_surface_motion();
+
+/**
+ * Unit test for delta updates, sent as the XOR of old and new content.
+ */
+void test_guac_surface_delta();
+
+/**
+ * Unit test for the measured cost model used when combining updates.
+ */
+void test_guac_cost_model();
+
+/**
+ * Unit test for the regions into which queued updates are merged.
+ */
+void test_guac_region();
+
+/**
+ * Unit test for recording and replaying traces of surface operations.
+ */
+void test_guac_surface_trace();
+
+/**
+ * Unit test for the encoding profiles which follow estimated bandwidth.
+ */
+void test_guac_profile();
+
+/**
+ * Unit test for coalescing of damage which exceeds the update queue.
+ */
+void test_guac_surface_coalesce();
+
+/**
+ * Unit test for parsing of the connection parameters controlling surfaces.
+ */
+void test_guac_surface_options();
+
 #endif
 
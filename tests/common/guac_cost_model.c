@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "common_suite.h"
+#include "guac_cost_model.h"
+#include "guac_surface.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+/**
+ * Records the given number of synthetic measurements, such that each update
+ * of N pixels takes 50 + N/100 microseconds to encode and is encoded as
+ * 100 + N/2 bytes. The areas of the updates vary unless a fixed area is
+ * given.
+ */
+static void __test_cost_model_record(guac_common_cost_model* model,
+        int count, int fixed_area) {
+
+    int i;
+    for (i = 0; i < count; i++) {
+        int area = fixed_area ? fixed_area : 1000 + (i * 7919) % 50000;
+        guac_common_cost_model_record(model, area, 100 + area / 2,
+                50 + area / 100);
+    }
+
+}
+
+/**
+ * Draws two small squares of the given solid color far apart from each other
+ * on the given surface, returning the number of "png" instructions sent when
+ * the surface is flushed. The surface must be large enough to contain both.
+ */
+static int __test_cost_model_updates(guac_common_surface* surface,
+        int color, test_capture* output) {
+
+    cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            48, 48);
+    memset(cairo_image_surface_get_data(image), color,
+            cairo_image_surface_get_stride(image) * 48);
+    cairo_surface_mark_dirty(image);
+
+    test_capture_reset(output);
+    guac_common_surface_draw(surface, 0, 0, image);
+    guac_common_surface_draw(surface, 200, 200, image);
+    guac_common_surface_flush(surface);
+    guac_socket_flush(surface->socket);
+
+    cairo_surface_destroy(image);
+
+    return test_capture_count(output, "3.png,");
+
+}
+
+void test_guac_cost_model() {
+
+    guac_common_cost_model_stats stats;
+    test_capture output;
+    guac_common_cost_model* model = guac_common_cost_model_alloc();
+
+    guac_client* client;
+    guac_socket* socket;
+    guac_common_surface* surface;
+
+    /* Default base cost is used until enough is measured */
+    CU_ASSERT_EQUAL(guac_common_cost_model_get_base_cost(model),
+            GUAC_COMMON_COST_MODEL_DEFAULT_BASE_COST);
+
+    __test_cost_model_record(model, GUAC_COMMON_COST_MODEL_MIN_SAMPLES - 1, 0);
+    guac_common_cost_model_get_stats(model, &stats);
+    CU_ASSERT_FALSE(stats.calibrated);
+    CU_ASSERT_EQUAL(stats.base_cost, GUAC_COMMON_COST_MODEL_DEFAULT_BASE_COST);
+
+    /* Costs are fitted once enough is measured. At 1000000 bytes per second,
+     * each byte costs 1000 ns, thus each update costs 50000 + 100000 ns and
+     * each pixel costs 10 + 500 ns. */
+    guac_common_cost_model_set_bandwidth(model, 1000000);
+    __test_cost_model_record(model, 100, 0);
+    guac_common_cost_model_get_stats(model, &stats);
+    CU_ASSERT(stats.calibrated);
+    CU_ASSERT_EQUAL(stats.samples, GUAC_COMMON_COST_MODEL_MIN_SAMPLES - 1 + 100);
+    CU_ASSERT(stats.update_cost > 145000 && stats.update_cost < 155000);
+    CU_ASSERT(stats.pixel_cost > 505 && stats.pixel_cost < 515);
+    CU_ASSERT(stats.base_cost > 280 && stats.base_cost < 310);
+
+    /* Slower networks make pixels relatively more costly */
+    guac_common_cost_model_set_bandwidth(model, 100000);
+    CU_ASSERT(guac_common_cost_model_get_base_cost(model) < 250);
+
+    /* Pinned costs take priority */
+    guac_common_cost_model_pin(model, 0, 10);
+    guac_common_cost_model_get_stats(model, &stats);
+    CU_ASSERT_EQUAL(stats.pixel_cost, 10);
+    CU_ASSERT_EQUAL(stats.base_cost, (int) (stats.update_cost / 10));
+
+    guac_common_cost_model_pin(model, 204800, 100);
+    CU_ASSERT_EQUAL(guac_common_cost_model_get_base_cost(model), 2048);
+
+    guac_common_cost_model_free(model);
+
+    /* Nothing can be fitted if all updates are the same size */
+    model = guac_common_cost_model_alloc();
+    __test_cost_model_record(model, 100, 4096);
+    guac_common_cost_model_get_stats(model, &stats);
+    CU_ASSERT_FALSE(stats.calibrated);
+
+    /* Surfaces combine distant updates only if updates are costly, using the
+     * costs of the model as of their last flush */
+    client = guac_client_alloc();
+    socket = test_capture_socket_alloc(&output);
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            256, 256);
+    guac_common_surface_set_cost_model(surface, model);
+
+    guac_common_cost_model_pin(model, 1000000000, 1);
+    guac_common_surface_flush(surface);
+    CU_ASSERT_EQUAL(__test_cost_model_updates(surface, 0x40, &output), 1);
+
+    guac_common_cost_model_pin(model, 100, 1);
+    guac_common_surface_flush(surface);
+    CU_ASSERT_EQUAL(__test_cost_model_updates(surface, 0x80, &output), 2);
+
+    /* Sent updates are measured */
+    guac_common_cost_model_get_stats(model, &stats);
+    CU_ASSERT_EQUAL(stats.samples, 100 + 3);
+
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    test_capture_free(&output);
+    guac_client_free(client);
+    guac_common_cost_model_free(model);
+
+}
+
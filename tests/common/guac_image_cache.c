@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "common_suite.h"
+#include "guac_image_cache.h"
+#include "guac_surface.h"
+#include "guac_worker_pool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+/**
+ * The width and height of each test image, in pixels.
+ */
+#define TEST_CACHE_IMAGE_SIZE 32
+
+/**
+ * The budget of the test cache, sufficient for exactly four test images.
+ */
+#define TEST_CACHE_BUDGET (4 * TEST_CACHE_IMAGE_SIZE * TEST_CACHE_IMAGE_SIZE * 4)
+
+/**
+ * Draws a test image filled with noise generated from the given seed at the
+ * given location, without flushing.
+ */
+static void __test_cache_paint(guac_common_surface* surface, int x, int y,
+        unsigned int seed) {
+
+    cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            TEST_CACHE_IMAGE_SIZE, TEST_CACHE_IMAGE_SIZE);
+
+    unsigned char* data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int i, j;
+
+    srand(seed);
+    for (i = 0; i < TEST_CACHE_IMAGE_SIZE; i++) {
+        uint32_t* pixels = (uint32_t*) (data + i * stride);
+        for (j = 0; j < TEST_CACHE_IMAGE_SIZE; j++)
+            pixels[j] = rand() & 0xFFFFFF;
+    }
+
+    cairo_surface_mark_dirty(image);
+    guac_common_surface_draw(surface, x, y, image);
+    cairo_surface_destroy(image);
+
+}
+
+/**
+ * Draws a test image as with __test_cache_paint(), then flushes the surface,
+ * replacing any previous output with the output of the flush.
+ */
+static void __test_cache_draw(guac_common_surface* surface,
+        test_capture* output, int x, int y, unsigned int seed) {
+
+    test_capture_reset(output);
+
+    __test_cache_paint(surface, x, y, seed);
+    guac_common_surface_flush(surface);
+    guac_socket_flush(surface->socket);
+
+}
+
+void test_guac_image_cache() {
+
+    test_capture output;
+
+    guac_client* client = guac_client_alloc();
+    guac_socket* socket = test_capture_socket_alloc(&output);
+    guac_common_image_cache* cache;
+    guac_common_image_cache_stats stats;
+    guac_common_surface* surface;
+    guac_common_worker_pool* pool;
+    int i;
+
+    cache = guac_common_image_cache_alloc(client, TEST_CACHE_BUDGET);
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            1024, 768);
+    guac_common_surface_set_image_cache(surface, cache);
+
+    /* Tiny and oversized images are never cached */
+    CU_ASSERT(!guac_common_image_cache_accepts(cache, 8, 8));
+    CU_ASSERT(!guac_common_image_cache_accepts(cache, 64, 64));
+    CU_ASSERT(guac_common_image_cache_accepts(cache,
+                TEST_CACHE_IMAGE_SIZE, TEST_CACHE_IMAGE_SIZE));
+
+    /* New images are sent, then copied into a buffer */
+    __test_cache_draw(surface, &output, 0, 0, 1);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 1);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "4.copy,1.0,"), 1);
+
+    /* Repeated images are copied from that buffer, even elsewhere */
+    __test_cache_draw(surface, &output, 500, 300, 1);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 0);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "4.copy,2.-1,"), 1);
+
+    guac_common_image_cache_get_stats(cache, &stats);
+    CU_ASSERT_EQUAL(stats.hits, 1);
+    CU_ASSERT_EQUAL(stats.misses, 1);
+    CU_ASSERT_EQUAL(stats.entries, 1);
+    CU_ASSERT_EQUAL(stats.bytes, TEST_CACHE_BUDGET / 4);
+
+    /* Fill the cache with three more images */
+    for (i = 2; i <= 4; i++) {
+        __test_cache_draw(surface, &output, 100 * i, 0, i);
+        CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 1);
+        CU_ASSERT_EQUAL(test_capture_count(&output, "7.dispose,"), 0);
+    }
+
+    /* Use the first image, such that the second is least recently used */
+    __test_cache_draw(surface, &output, 0, 100, 1);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 0);
+
+    /* Exceeding the budget evicts the least recently used image */
+    __test_cache_draw(surface, &output, 0, 200, 5);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 1);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "7.dispose,"), 1);
+
+    __test_cache_draw(surface, &output, 0, 300, 2);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 1);
+
+    __test_cache_draw(surface, &output, 0, 400, 1);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 0);
+
+    guac_common_image_cache_get_stats(cache, &stats);
+    CU_ASSERT_EQUAL(stats.hits, 3);
+    CU_ASSERT_EQUAL(stats.misses, 6);
+    CU_ASSERT_EQUAL(stats.evictions, 2);
+    CU_ASSERT_EQUAL(stats.entries, 4);
+    CU_ASSERT(stats.bytes <= TEST_CACHE_BUDGET);
+
+    /* Cached and new images flushed together are handled in order when
+     * encoded in parallel */
+    pool = guac_common_worker_pool_alloc(2);
+    guac_common_surface_set_encoder_pool(surface, pool);
+
+    test_capture_reset(&output);
+    __test_cache_paint(surface, 600, 600, 1);
+    __test_cache_paint(surface, 900, 0, 6);
+    __test_cache_paint(surface, 0, 700, 5);
+    guac_common_surface_flush(surface);
+    guac_socket_flush(socket);
+
+    CU_ASSERT_EQUAL(test_capture_count(&output, "3.png,"), 1);
+    CU_ASSERT_EQUAL(test_capture_count(&output, "4.copy,2.-"), 2);
+    CU_ASSERT(strstr(output.data, "3.png,") < strstr(output.data, "4.copy,1.0,"));
+
+    guac_common_image_cache_get_stats(cache, &stats);
+    CU_ASSERT_EQUAL(stats.hits, 5);
+    CU_ASSERT_EQUAL(stats.misses, 7);
+
+    guac_common_surface_free(surface);
+    guac_common_worker_pool_free(pool);
+    guac_common_image_cache_free(cache);
+    guac_socket_free(socket);
+    test_capture_free(&output);
+    guac_client_free(client);
+
+}
+
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "common_suite.h"
+#include "guac_profile.h"
+#include "guac_surface.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+
+/**
+ * The width of the test surface, in pixels.
+ */
+#define TEST_PROFILE_WIDTH 128
+
+/**
+ * The height of the test surface, in pixels.
+ */
+#define TEST_PROFILE_HEIGHT 128
+
+/**
+ * Selects the level of the given profile for the given bandwidth at the
+ * given time, returning the resulting level.
+ */
+static guac_common_profile_level __test_profile_select(
+        guac_common_profile* profile, int bandwidth, guac_timestamp now) {
+
+    guac_client_link_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.bandwidth = bandwidth;
+
+    guac_common_profile_select(profile, &stats, now);
+    return guac_common_profile_get_level(profile);
+
+}
+
+/**
+ * Draws noise containing many colors to the entire test surface, then
+ * flushes the surface, replacing any previous output with the output of the
+ * flush.
+ */
+static void __test_profile_draw(guac_common_surface* surface,
+        test_capture* output, int seed) {
+
+    cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            TEST_PROFILE_WIDTH, TEST_PROFILE_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int x, y;
+
+    for (y = 0; y < TEST_PROFILE_HEIGHT; y++) {
+        uint32_t* pixels = (uint32_t*) (data + y * stride);
+        for (x = 0; x < TEST_PROFILE_WIDTH; x++) {
+            uint32_t value = (uint32_t) x * 0x9E3779B1u
+                           ^ (uint32_t) y * 0x85EBCA77u
+                           ^ (uint32_t) seed * 0x27D4EB2Fu;
+            value ^= value >> 15;
+            value *= 0xC2B2AE3Du;
+            value ^= value >> 13;
+            pixels[x] = value & 0xFFFFFF;
+        }
+    }
+
+    cairo_surface_mark_dirty(image);
+
+    test_capture_reset(output);
+
+    guac_common_surface_draw(surface, 0, 0, image);
+    guac_common_surface_flush(surface);
+    guac_socket_flush(surface->socket);
+
+    cairo_surface_destroy(image);
+
+}
+
+void test_guac_profile() {
+
+    test_capture output;
+
+    guac_common_profile* profile = guac_common_profile_alloc();
+    guac_client* client;
+    guac_socket* socket;
+    guac_common_surface* surface;
+    size_t full_length;
+
+    /* Nothing is reduced until thresholds are set */
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 1, 1000),
+            GUAC_COMMON_PROFILE_LOSSLESS);
+
+    guac_common_profile_set_thresholds(profile, 10000, 5000, 1000);
+
+    /* Level is unchanged while bandwidth is unknown */
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 0, 1000),
+            GUAC_COMMON_PROFILE_LOSSLESS);
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 20000, 1000),
+            GUAC_COMMON_PROFILE_LOSSLESS);
+
+    /* Quality is reduced immediately, skipping levels as necessary */
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 8000, 1000),
+            GUAC_COMMON_PROFILE_REDUCED_COLOR);
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 500, 1100),
+            GUAC_COMMON_PROFILE_REDUCED_RATE);
+
+    /* Quality is not raised until the level has held */
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 20000, 2000),
+            GUAC_COMMON_PROFILE_REDUCED_RATE);
+
+    /* Quality is raised one level at a time */
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 20000, 3100),
+            GUAC_COMMON_PROFILE_LOSSY);
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 20000, 3200),
+            GUAC_COMMON_PROFILE_LOSSY);
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 20000, 5100),
+            GUAC_COMMON_PROFILE_REDUCED_COLOR);
+
+    /* Quality is raised only once bandwidth comfortably exceeds the
+     * threshold of the current level */
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 11000, 8000),
+            GUAC_COMMON_PROFILE_REDUCED_COLOR);
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 13000, 8000),
+            GUAC_COMMON_PROFILE_LOSSLESS);
+
+    /* Disabled reductions are skipped */
+    guac_common_profile_set_thresholds(profile, 0, 5000, 0);
+    CU_ASSERT_EQUAL(__test_profile_select(profile, 10, 9000),
+            GUAC_COMMON_PROFILE_LOSSY);
+
+    /* Verify effect of each level on updates sent by a surface */
+    client = guac_client_alloc();
+    socket = test_capture_socket_alloc(&output);
+
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            TEST_PROFILE_WIDTH, TEST_PROFILE_HEIGHT);
+
+    /* Lossless updates are sent as PNG */
+    __test_profile_draw(surface, &output, 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data, "3.png,"));
+    full_length = output.length;
+
+    guac_common_profile_set_thresholds(profile, 10000, 5000, 1000);
+    guac_common_surface_set_profile(surface, profile);
+
+    /* Updates with reduced color are far smaller */
+    __test_profile_select(profile, 8000, 20000);
+    __test_profile_draw(surface, &output, 1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data, "3.png,"));
+    CU_ASSERT(output.length < full_length / 2);
+
+    /* Lossy updates are sent as JPEG, even if JPEG is otherwise disabled */
+    __test_profile_select(profile, 2000, 20000);
+    __test_profile_draw(surface, &output, 2);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data, "4.jpeg,"));
+
+    /* At a reduced frame rate, frames sent in quick succession are
+     * deferred */
+    __test_profile_select(profile, 500, 20000);
+    surface->last_flush = guac_timestamp_current();
+    __test_profile_draw(surface, &output, 3);
+    CU_ASSERT_EQUAL(output.length, 0);
+
+    /* Deferred updates require another flush once the interval passes */
+    CU_ASSERT(guac_common_surface_get_flush_delay(surface) > 0);
+    CU_ASSERT(guac_common_surface_get_flush_delay(surface) <= 250);
+
+    /* Deferred updates remain pending until the next frame */
+    guac_common_surface_set_profile(surface, NULL);
+    guac_common_surface_flush(surface);
+    guac_socket_flush(socket);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data, "3.png,"));
+    CU_ASSERT_EQUAL(guac_common_surface_get_flush_delay(surface), -1);
+
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    test_capture_free(&output);
+    guac_client_free(client);
+    guac_common_profile_free(profile);
+
+}
+
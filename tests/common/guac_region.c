@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "common_suite.h"
+#include "guac_rect.h"
+#include "guac_region.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+
+/**
+ * The width and height of the area within which random rectangles are
+ * generated.
+ */
+#define TEST_REGION_SIZE 128
+
+/**
+ * Marks each pixel covered by the given rectangles within the given map,
+ * returning the number of pixels which were covered by more than one
+ * rectangle.
+ */
+static int __test_region_paint(unsigned char* map,
+        const guac_common_rect* rects, int count) {
+
+    int overlapped = 0;
+    int i, x, y;
+
+    for (i = 0; i < count; i++) {
+        for (y = rects[i].y; y < rects[i].y + rects[i].height; y++) {
+            for (x = rects[i].x; x < rects[i].x + rects[i].width; x++) {
+                if (map[y * TEST_REGION_SIZE + x])
+                    overlapped++;
+                map[y * TEST_REGION_SIZE + x] = 1;
+            }
+        }
+    }
+
+    return overlapped;
+
+}
+
+/**
+ * Verifies that the given region, built from the given rectangles, covers
+ * every pixel of those rectangles, and does so without overlap unless
+ * overlap is allowed.
+ */
+static void __test_region_verify(guac_common_region* region,
+        const guac_common_rect* rects, int count, int allow_overlap) {
+
+    int overlapped;
+
+    static unsigned char expected[TEST_REGION_SIZE * TEST_REGION_SIZE];
+    static unsigned char actual[TEST_REGION_SIZE * TEST_REGION_SIZE];
+
+    int i;
+
+    memset(expected, 0, sizeof(expected));
+    __test_region_paint(expected, rects, count);
+
+    memset(actual, 0, sizeof(actual));
+    overlapped = __test_region_paint(actual, region->rects, region->count);
+    if (!allow_overlap)
+        CU_ASSERT_EQUAL(overlapped, 0);
+
+    for (i = 0; i < TEST_REGION_SIZE * TEST_REGION_SIZE; i++) {
+        if (expected[i] && !actual[i]) {
+            CU_FAIL("Region does not cover all rectangles");
+            break;
+        }
+    }
+
+    /* Rectangles must be sorted top to bottom */
+    for (i = 1; i < region->count; i++)
+        CU_ASSERT(region->rects[i - 1].y <= region->rects[i].y);
+
+}
+
+void test_guac_region() {
+
+    guac_common_region* region = guac_common_region_alloc();
+    guac_common_rect rects[64];
+    int i, j;
+
+    /* Empty and zero-size rectangles produce empty regions */
+    guac_common_rect_init(&rects[0], 10, 10, 0, 5);
+    guac_common_region_set_rects(region, rects, 1, 4096);
+    CU_ASSERT_EQUAL(region->count, 0);
+
+    guac_common_region_set_rects(region, rects, 0, 4096);
+    CU_ASSERT_EQUAL(region->count, 0);
+
+    /* Duplicate and contained rectangles collapse to one */
+    guac_common_rect_init(&rects[0], 10, 10, 20, 20);
+    guac_common_rect_init(&rects[1], 10, 10, 20, 20);
+    guac_common_rect_init(&rects[2], 15, 15, 5, 5);
+    guac_common_region_set_rects(region, rects, 3, 0);
+    CU_ASSERT_EQUAL_FATAL(region->count, 1);
+    CU_ASSERT_EQUAL(region->rects[0].x, 10);
+    CU_ASSERT_EQUAL(region->rects[0].y, 10);
+    CU_ASSERT_EQUAL(region->rects[0].width, 20);
+    CU_ASSERT_EQUAL(region->rects[0].height, 20);
+
+    /* Distant rectangles are joined only if cheaper */
+    guac_common_rect_init(&rects[0], 0, 0, 8, 16);
+    guac_common_rect_init(&rects[1], 100, 0, 8, 16);
+    guac_common_region_set_rects(region, rects, 2, 64);
+    CU_ASSERT_EQUAL(region->count, 2);
+
+    guac_common_region_set_rects(region, rects, 2, 4096);
+    CU_ASSERT_EQUAL_FATAL(region->count, 1);
+    CU_ASSERT_EQUAL(region->rects[0].width, 108);
+
+    /* Overlapping rectangles which are too costly to join are split such
+     * that only the first covers the overlap */
+    guac_common_rect_init(&rects[0], 0, 0, 60, 60);
+    guac_common_rect_init(&rects[1], 40, 40, 60, 60);
+    guac_common_region_set_rects(region, rects, 2, 64);
+    CU_ASSERT_EQUAL_FATAL(region->count, 3);
+    CU_ASSERT_EQUAL(region->rects[0].width, 60);
+    CU_ASSERT_EQUAL(region->rects[0].height, 60);
+    __test_region_verify(region, rects, 2, 0);
+
+    /* Overlap is kept if splitting would cost more than sending it twice */
+    guac_common_rect_init(&rects[0], 0, 0, 60, 20);
+    guac_common_rect_init(&rects[1], 50, 10, 60, 20);
+    guac_common_region_set_rects(region, rects, 2, 500);
+    CU_ASSERT_EQUAL_FATAL(region->count, 2);
+    CU_ASSERT_EQUAL(region->rects[1].width, 60);
+    CU_ASSERT_EQUAL(region->rects[1].height, 20);
+
+    guac_common_region_set_rects(region, rects, 2, 50);
+    CU_ASSERT_EQUAL(region->count, 3);
+    __test_region_verify(region, rects, 2, 0);
+
+    /* Two columns of lines are covered by one rectangle per column */
+    for (i = 0; i < 8; i++) {
+        guac_common_rect_init(&rects[i * 2],     0, i * 10, 40 - i, 8);
+        guac_common_rect_init(&rects[i * 2 + 1], 80, i * 10, 30 + i, 8);
+    }
+
+    guac_common_region_set_rects(region, rects, 16, 256);
+    CU_ASSERT_EQUAL_FATAL(region->count, 2);
+    CU_ASSERT_EQUAL(region->rects[0].height, 78);
+    CU_ASSERT_EQUAL(region->rects[1].height, 78);
+
+    /* Consecutive lines sharing a left edge are joined as a fill pattern,
+     * even where somewhat more costly */
+    guac_common_rect_init(&rects[0], 0, 0, 112, 16);
+    guac_common_rect_init(&rects[1], 0, 16, 376, 16);
+    guac_common_region_set_rects(region, rects, 2, 4096);
+    CU_ASSERT_EQUAL_FATAL(region->count, 1);
+    CU_ASSERT_EQUAL(region->rects[0].width, 376);
+    CU_ASSERT_EQUAL(region->rects[0].height, 32);
+
+    guac_common_rect_init(&rects[1], 8, 16, 376, 16);
+    guac_common_region_set_rects(region, rects, 2, 4096);
+    CU_ASSERT_EQUAL(region->count, 2);
+
+    /* Random rectangles at a range of base costs */
+    srand(0x4E6);
+    for (i = 0; i < 500; i++) {
+
+        int count = 1 + rand() % 64;
+        int base_cost = (rand() % 4) * (rand() % 2048);
+
+        for (j = 0; j < count; j++) {
+            int x = rand() % TEST_REGION_SIZE;
+            int y = rand() % TEST_REGION_SIZE;
+            guac_common_rect_init(&rects[j], x, y,
+                    rand() % (TEST_REGION_SIZE - x + 1),
+                    rand() % (TEST_REGION_SIZE - y + 1));
+        }
+
+        CU_ASSERT_EQUAL(guac_common_region_set_rects(region, rects, count,
+                    base_cost), 0);
+        __test_region_verify(region, rects, count, base_cost > 0);
+
+    }
+
+    guac_common_region_free(region);
+
+}
+
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "common_suite.h"
+#include "guac_surface.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+/**
+ * The width and height of the test surface, in pixels.
+ */
+#define TEST_COALESCE_SIZE 1024
+
+/**
+ * The number of separate images drawn to the test surface, more than the
+ * PNG queue of a surface can hold.
+ */
+#define TEST_COALESCE_DRAWS (GUAC_COMMON_SURFACE_QUEUE_SIZE * 2)
+
+/**
+ * The number of bytes written to the test socket.
+ */
+static size_t test_coalesce_written;
+
+/**
+ * Write handler which counts and discards all data.
+ */
+static ssize_t __test_coalesce_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+    test_coalesce_written += count;
+    return count;
+}
+
+void test_guac_surface_coalesce() {
+
+    guac_client* client = guac_client_alloc();
+    guac_socket* socket = guac_socket_alloc();
+    guac_common_surface* surface;
+    cairo_surface_t* image;
+    int i;
+
+    socket->write_handler = __test_coalesce_write_handler;
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            TEST_COALESCE_SIZE, TEST_COALESCE_SIZE);
+
+    image = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 2, 2);
+    memset(cairo_image_surface_get_data(image), 0xFF,
+            cairo_image_surface_get_stride(image) * 2);
+    cairo_surface_mark_dirty(image);
+
+    /* Ignore anything sent upon allocation of the surface */
+    guac_socket_flush(socket);
+    test_coalesce_written = 0;
+
+    /* Draw many small, widely-separated images, none of which should be
+     * combined with the last */
+    for (i = 0; i < TEST_COALESCE_DRAWS; i++)
+        guac_common_surface_draw(surface,
+                (i * 397) % (TEST_COALESCE_SIZE - 2),
+                (i * 211) % (TEST_COALESCE_SIZE - 2), image);
+
+    /* Nothing is sent before the surface is flushed, however much damage
+     * has accumulated */
+    guac_socket_flush(socket);
+    CU_ASSERT_EQUAL(test_coalesce_written, 0);
+    CU_ASSERT(surface->png_queue_length < GUAC_COMMON_SURFACE_QUEUE_SIZE);
+
+    /* All damage is sent once flushed */
+    guac_common_surface_flush(surface);
+    guac_socket_flush(socket);
+    CU_ASSERT(test_coalesce_written > 0);
+    CU_ASSERT_EQUAL(surface->png_queue_length, 0);
+    CU_ASSERT_FALSE(surface->dirty);
+
+    cairo_surface_destroy(image);
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    guac_client_free(client);
+
+}
+
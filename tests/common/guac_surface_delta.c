@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "common_suite.h"
+#include "guac_surface.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+/**
+ * The width of the test surface, in pixels.
+ */
+#define TEST_DELTA_WIDTH 256
+
+/**
+ * The height of the test surface, in pixels.
+ */
+#define TEST_DELTA_HEIGHT 128
+
+/**
+ * Returns the color of the given point of the given variant of the test
+ * image. Variants with the same seed differ only in a sparse grid of pixels,
+ * which are inverted in odd variants, while variants with different seeds
+ * are entirely unrelated.
+ */
+static uint32_t __test_delta_pixel(int x, int y, int seed, int variant) {
+
+    uint32_t value = (uint32_t) x * 0x9E3779B1u ^ (uint32_t) y * 0x85EBCA77u
+                   ^ (uint32_t) seed * 0x27D4EB2Fu;
+    value ^= value >> 15;
+    value *= 0xC2B2AE3Du;
+    value ^= value >> 13;
+
+    /* Alter a few scattered pixels */
+    if ((variant & 1) && (x + y * TEST_DELTA_WIDTH) % 211 == 0)
+        value = ~value;
+
+    return value & 0xFFFFFF;
+
+}
+
+/**
+ * Draws the given variant of the test image to the entire test surface, then
+ * flushes the surface, replacing any previous output with the output of the
+ * flush.
+ */
+static void __test_delta_draw(guac_common_surface* surface,
+        test_capture* output, int seed, int variant) {
+
+    cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            TEST_DELTA_WIDTH, TEST_DELTA_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int x, y;
+
+    for (y = 0; y < TEST_DELTA_HEIGHT; y++) {
+        uint32_t* pixels = (uint32_t*) (data + y * stride);
+        for (x = 0; x < TEST_DELTA_WIDTH; x++)
+            pixels[x] = __test_delta_pixel(x, y, seed, variant);
+    }
+
+    cairo_surface_mark_dirty(image);
+
+    test_capture_reset(output);
+
+    guac_common_surface_draw(surface, 0, 0, image);
+    guac_common_surface_flush(surface);
+    guac_socket_flush(surface->socket);
+
+    cairo_surface_destroy(image);
+
+}
+
+/**
+ * Returns whether the most recent output applied an XOR image to the entire
+ * default layer.
+ */
+static int __test_delta_sent(test_capture* output) {
+    return strstr(output->data, "8.transfer,") != NULL
+        && strstr(output->data, ",1.6,1.0,1.0,1.0;") != NULL;
+}
+
+void test_guac_surface_delta() {
+
+    test_capture output;
+
+    guac_client* client = guac_client_alloc();
+    guac_socket* socket = test_capture_socket_alloc(&output);
+    guac_common_surface* surface;
+    size_t full_length;
+
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            TEST_DELTA_WIDTH, TEST_DELTA_HEIGHT);
+
+    /* Without delta updates, small changes are sent in full */
+    __test_delta_draw(surface, &output, 0, 0);
+    __test_delta_draw(surface, &output, 0, 1);
+    CU_ASSERT_FALSE(__test_delta_sent(&output));
+    full_length = output.length;
+
+    guac_common_surface_set_delta_updates(surface, 1);
+
+    /* Nothing is known of content sent before delta updates were enabled */
+    __test_delta_draw(surface, &output, 0, 0);
+    CU_ASSERT_FALSE(__test_delta_sent(&output));
+
+    /* Unrelated content is sent in full */
+    __test_delta_draw(surface, &output, 1, 0);
+    CU_ASSERT_FALSE(__test_delta_sent(&output));
+
+    __test_delta_draw(surface, &output, 0, 0);
+    CU_ASSERT_FALSE(__test_delta_sent(&output));
+
+    /* Small changes are sent as far smaller deltas */
+    __test_delta_draw(surface, &output, 0, 1);
+    CU_ASSERT(__test_delta_sent(&output));
+    CU_ASSERT(output.length < full_length / 4);
+
+    __test_delta_draw(surface, &output, 0, 0);
+    CU_ASSERT(__test_delta_sent(&output));
+
+    /* Content drawn directly by the client is not known */
+    guac_common_surface_rect(surface, 0, 0,
+            TEST_DELTA_WIDTH, TEST_DELTA_HEIGHT, 0x12, 0x34, 0x56);
+    __test_delta_draw(surface, &output, 1, 1);
+    CU_ASSERT_FALSE(__test_delta_sent(&output));
+
+    __test_delta_draw(surface, &output, 1, 0);
+    CU_ASSERT(__test_delta_sent(&output));
+
+    /* Content sent as JPEG does not match exactly */
+    guac_common_surface_set_jpeg_quality(surface, 90);
+    __test_delta_draw(surface, &output, 1, 1);
+    guac_common_surface_set_jpeg_quality(surface, 0);
+    __test_delta_draw(surface, &output, 1, 0);
+    CU_ASSERT_FALSE(__test_delta_sent(&output));
+
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    test_capture_free(&output);
+    guac_client_free(client);
+
+}
+
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "common_suite.h"
+#include "guac_surface.h"
+#include "guac_surface_kernels.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+/**
+ * The maximum width of any row processed by the kernels under test. This is
+ * chosen to cover several full vectors of every instruction set plus every
+ * possible remainder.
+ */
+#define TEST_KERNELS_MAX_WIDTH 71
+
+/**
+ * The number of random rows tested at each width.
+ */
+#define TEST_KERNELS_ROWS 64
+
+/**
+ * Returns a random pixel. Pixels are drawn from a small palette of colors,
+ * alpha values and bit patterns, such that random rows frequently contain
+ * identical pixels, transparent pixels, and pixels which are unchanged by
+ * each transfer function.
+ */
+static uint32_t __test_kernels_pixel() {
+
+    static const uint32_t alpha[] = { 0x00000000, 0x01000000, 0x80000000,
+                                      0xFF000000 };
+
+    static const uint32_t color[] = { 0x000000, 0xFFFFFF, 0x123456, 0x00FF00,
+                                      0xABCDEF };
+
+    /* Occasionally use completely arbitrary values */
+    if (rand() % 8 == 0)
+        return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+
+    return alpha[rand() % 4] | color[rand() % 5];
+
+}
+
+/**
+ * Fills the given row with random pixels.
+ */
+static void __test_kernels_fill(uint32_t* row, int width) {
+
+    int x;
+    for (x = 0; x < width; x++)
+        row[x] = __test_kernels_pixel();
+
+}
+
+/**
+ * Verifies that the given kernels produce exactly the same results as the
+ * scalar reference kernels for every operation at every row width up to
+ * TEST_KERNELS_MAX_WIDTH.
+ */
+static void __test_kernels_compare(const guac_common_surface_kernels* kernels,
+        const guac_common_surface_kernels* reference) {
+
+    uint32_t src[TEST_KERNELS_MAX_WIDTH];
+    uint32_t dst[TEST_KERNELS_MAX_WIDTH];
+    uint32_t expected[TEST_KERNELS_MAX_WIDTH];
+
+    int width, row, op;
+
+    for (width = 0; width <= TEST_KERNELS_MAX_WIDTH; width++) {
+        for (row = 0; row < TEST_KERNELS_ROWS; row++) {
+
+            int last = -1, expected_last = -1;
+            int first, expected_first;
+            uint32_t color = 0xFF000000 | (__test_kernels_pixel() & 0xFFFFFF);
+            int opaque = row & 1;
+
+            __test_kernels_fill(src, width);
+            __test_kernels_fill(dst, width);
+
+            /* Put */
+            memcpy(expected, dst, sizeof(dst));
+            first = kernels->put(dst, src, width, opaque, &last);
+            expected_first = reference->put(expected, src, width, opaque,
+                    &expected_last);
+
+            CU_ASSERT_EQUAL(first, expected_first);
+            if (first >= 0)
+                CU_ASSERT_EQUAL(last, expected_last);
+            CU_ASSERT(memcmp(dst, expected, sizeof(dst)) == 0);
+
+            /* Rect, leaving some pixels unchanged */
+            memcpy(dst, src, sizeof(dst));
+            memcpy(expected, src, sizeof(dst));
+            if (width > 0)
+                color = src[rand() % width] | 0xFF000000;
+
+            first = kernels->rect(dst, width, color, &last);
+            expected_first = reference->rect(expected, width, color,
+                    &expected_last);
+
+            CU_ASSERT_EQUAL(first, expected_first);
+            if (first >= 0)
+                CU_ASSERT_EQUAL(last, expected_last);
+            CU_ASSERT(memcmp(dst, expected, sizeof(dst)) == 0);
+
+            /* Fill mask */
+            __test_kernels_fill(dst, width);
+            memcpy(expected, dst, sizeof(dst));
+            kernels->fill_mask(dst, src, width, color);
+            reference->fill_mask(expected, src, width, color);
+            CU_ASSERT(memcmp(dst, expected, sizeof(dst)) == 0);
+
+            /* Every transfer function */
+            for (op = 0; op < GUAC_COMMON_SURFACE_TRANSFER_FUNCTIONS; op++) {
+
+                __test_kernels_fill(dst, width);
+                memcpy(expected, dst, sizeof(dst));
+
+                first = kernels->transfer[op](dst, src, width, &last);
+                expected_first = reference->transfer[op](expected, src, width,
+                        &expected_last);
+
+                CU_ASSERT_EQUAL(first, expected_first);
+                if (first >= 0)
+                    CU_ASSERT_EQUAL(last, expected_last);
+                CU_ASSERT(memcmp(dst, expected, sizeof(dst)) == 0);
+
+            }
+
+        }
+    }
+
+}
+
+/**
+ * Verifies that copying a rectangle within a surface to an overlapping
+ * location on the same rows behaves as if the source were first copied
+ * elsewhere.
+ */
+static void __test_kernels_overlap(int dx) {
+
+    guac_client* client = guac_client_alloc();
+    guac_socket* socket = guac_socket_alloc();
+    guac_common_surface* surface = guac_common_surface_alloc(client, socket,
+            GUAC_DEFAULT_LAYER, 128, 8);
+
+    uint32_t expected[8][128];
+    int x, y;
+
+    for (y = 0; y < 8; y++) {
+        uint32_t* row = (uint32_t*) (surface->buffer + y * surface->stride);
+        __test_kernels_fill(row, 128);
+        for (x = 0; x < 128; x++)
+            row[x] |= 0xFF000000;
+        memcpy(expected[y], row, sizeof(expected[y]));
+    }
+
+    /* Copy 100x4 block at (10, 2) horizontally by dx */
+    for (y = 2; y < 6; y++)
+        memmove(&expected[y][10 + dx], &expected[y][10], 100 * sizeof(uint32_t));
+
+    guac_common_surface_copy(surface, 10, 2, 100, 4, surface, 10 + dx, 2);
+
+    for (y = 0; y < 8; y++) {
+        uint32_t* row = (uint32_t*) (surface->buffer + y * surface->stride);
+        CU_ASSERT(memcmp(row, expected[y], sizeof(expected[y])) == 0);
+    }
+
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    guac_client_free(client);
+
+}
+
+void test_guac_surface_kernels() {
+
+    const guac_common_surface_kernels* reference =
+        guac_common_surface_get_kernels_for(GUAC_COMMON_SURFACE_ISA_SCALAR);
+
+    const guac_common_surface_kernels* kernels;
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(reference);
+    srand(0x5EED);
+
+    /* The best available kernels must always be available */
+    CU_ASSERT_PTR_NOT_NULL(guac_common_surface_get_kernels());
+
+    /* Compare every supported instruction set against the reference */
+    kernels = guac_common_surface_get_kernels_for(GUAC_COMMON_SURFACE_ISA_SSE2);
+    if (kernels != NULL)
+        __test_kernels_compare(kernels, reference);
+
+    kernels = guac_common_surface_get_kernels_for(GUAC_COMMON_SURFACE_ISA_AVX2);
+    if (kernels != NULL)
+        __test_kernels_compare(kernels, reference);
+
+    /* Overlapping copies within the same rows, in both directions */
+    __test_kernels_overlap(3);
+    __test_kernels_overlap(-3);
+    __test_kernels_overlap(9);
+    __test_kernels_overlap(-9);
+
+}
+
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "common_suite.h"
+#include "guac_surface.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+/**
+ * The width of the test surface, in pixels.
+ */
+#define TEST_MOTION_WIDTH 320
+
+/**
+ * The height of the test surface, in pixels.
+ */
+#define TEST_MOTION_HEIGHT 240
+
+/**
+ * Returns the color of the given point of an unbounded plane of noise. Each
+ * image drawn by this test is a window onto this plane, such that scrolling
+ * is simulated by moving the window.
+ */
+static uint32_t __test_motion_pixel(int x, int y) {
+
+    uint32_t value = (uint32_t) x * 0x9E3779B1u ^ (uint32_t) y * 0x85EBCA77u;
+    value ^= value >> 15;
+    value *= 0xC2B2AE3Du;
+    value ^= value >> 13;
+
+    return value & 0xFFFFFF;
+
+}
+
+/**
+ * Draws the window of the plane of noise at the given offset to the entire
+ * test surface, then flushes the surface, replacing any previous output with
+ * the output of the flush.
+ */
+static void __test_motion_draw(guac_common_surface* surface,
+        test_capture* output, int offset_x, int offset_y) {
+
+    cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            TEST_MOTION_WIDTH, TEST_MOTION_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int x, y;
+
+    for (y = 0; y < TEST_MOTION_HEIGHT; y++) {
+        uint32_t* pixels = (uint32_t*) (data + y * stride);
+        for (x = 0; x < TEST_MOTION_WIDTH; x++)
+            pixels[x] = __test_motion_pixel(x + offset_x, y + offset_y);
+    }
+
+    cairo_surface_mark_dirty(image);
+
+    test_capture_reset(output);
+
+    guac_common_surface_draw(surface, 0, 0, image);
+    guac_common_surface_flush(surface);
+    guac_socket_flush(surface->socket);
+
+    cairo_surface_destroy(image);
+
+}
+
+/**
+ * Returns whether the test surface contains exactly the window of the plane
+ * of noise at the given offset.
+ */
+static int __test_motion_verify(guac_common_surface* surface,
+        int offset_x, int offset_y) {
+
+    int x, y;
+
+    for (y = 0; y < TEST_MOTION_HEIGHT; y++) {
+        uint32_t* pixels = (uint32_t*) (surface->buffer + y * surface->stride);
+        for (x = 0; x < TEST_MOTION_WIDTH; x++) {
+            if ((pixels[x] & 0xFFFFFF)
+                    != __test_motion_pixel(x + offset_x, y + offset_y))
+                return 0;
+        }
+    }
+
+    return 1;
+
+}
+
+void test_guac_surface_motion() {
+
+    test_capture output;
+
+    guac_client* client = guac_client_alloc();
+    guac_socket* socket = test_capture_socket_alloc(&output);
+    guac_common_surface* surface;
+
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            TEST_MOTION_WIDTH, TEST_MOTION_HEIGHT);
+
+    /* Without motion detection, scrolled content is simply redrawn */
+    __test_motion_draw(surface, &output, 0, 0);
+    __test_motion_draw(surface, &output, 0, 24);
+    CU_ASSERT_PTR_NULL(strstr(output.data, "4.copy,"));
+    CU_ASSERT(__test_motion_verify(surface, 0, 24));
+
+    guac_common_surface_set_motion_detection(surface, 1);
+
+    /* Scrolling down copies the rows which remain visible */
+    __test_motion_draw(surface, &output, 0, 48);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data,
+                "4.copy,1.0,1.0,2.24,3.320,3.216,"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data, "3.png,"));
+    CU_ASSERT(__test_motion_verify(surface, 0, 48));
+
+    /* Scrolling up copies the rows which remain visible */
+    __test_motion_draw(surface, &output, 0, 18);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data,
+                "4.copy,1.0,1.0,1.0,3.320,3.210,"));
+    CU_ASSERT(__test_motion_verify(surface, 0, 18));
+
+    /* Scrolling horizontally copies the columns which remain visible */
+    __test_motion_draw(surface, &output, 40, 18);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data,
+                "4.copy,1.0,2.40,1.0,3.280,3.240,"));
+    CU_ASSERT(__test_motion_verify(surface, 40, 18));
+
+    /* Unrelated content is simply redrawn */
+    __test_motion_draw(surface, &output, 1000, 1000);
+    CU_ASSERT_PTR_NULL(strstr(output.data, "4.copy,"));
+    CU_ASSERT(__test_motion_verify(surface, 1000, 1000));
+
+    /* Moving too little of the content is not worth a copy */
+    __test_motion_draw(surface, &output, 1000, 1000 + TEST_MOTION_HEIGHT - 8);
+    CU_ASSERT_PTR_NULL(strstr(output.data, "4.copy,"));
+    CU_ASSERT(__test_motion_verify(surface, 1000, 1000 + TEST_MOTION_HEIGHT - 8));
+
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    test_capture_free(&output);
+    guac_client_free(client);
+
+}
+
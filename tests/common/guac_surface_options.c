@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include "config.h"
+
+#include "common_suite.h"
+#include "guac_profile.h"
+#include "guac_surface_options.h"
+
+#include <stdlib.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/client.h>
+
+void test_guac_surface_options() {
+
+    guac_client* client = guac_client_alloc();
+    guac_common_surface_options options;
+
+    char* blank[GUAC_COMMON_SURFACE_OPTIONS_ARGS_COUNT] = {
+        "", "", "", "", "", "", "", "", "", "", "", "", ""
+    };
+
+    char* valid[GUAC_COMMON_SURFACE_OPTIONS_ARGS_COUNT] = {
+        "85", "4", "true", "2048", "true", "true", "300", "2", "trace",
+        "true", "2000", "1000", "0"
+    };
+
+    char* invalid[GUAC_COMMON_SURFACE_OPTIONS_ARGS_COUNT] = {
+        "101", "65", "false", "", "no", "", "", "", "", "", "", "", ""
+    };
+
+    /* Blank parameters select the defaults */
+    CU_ASSERT_EQUAL(guac_common_surface_options_parse(client, &options,
+                blank), 0);
+    CU_ASSERT_EQUAL(options.jpeg_quality, 0);
+    CU_ASSERT_EQUAL(options.encoder_threads, 0);
+    CU_ASSERT_EQUAL(options.damage_tiles, 0);
+    CU_ASSERT_EQUAL(options.image_cache_size, 0);
+    CU_ASSERT_EQUAL(options.motion_detection, 0);
+    CU_ASSERT_EQUAL(options.delta_updates, 0);
+    CU_ASSERT_EQUAL(options.update_cost, 0);
+    CU_ASSERT_EQUAL(options.pixel_cost, 0);
+    CU_ASSERT_PTR_NULL(options.surface_trace);
+    CU_ASSERT_EQUAL(options.adaptive_encoding, 0);
+    CU_ASSERT_EQUAL(options.reduced_color_bandwidth,
+            GUAC_COMMON_PROFILE_DEFAULT_REDUCED_COLOR_BANDWIDTH);
+    CU_ASSERT_EQUAL(options.lossy_bandwidth,
+            GUAC_COMMON_PROFILE_DEFAULT_LOSSY_BANDWIDTH);
+    CU_ASSERT_EQUAL(options.reduced_rate_bandwidth,
+            GUAC_COMMON_PROFILE_DEFAULT_REDUCED_RATE_BANDWIDTH);
+
+    /* Each parameter is parsed from its own position */
+    CU_ASSERT_EQUAL(guac_common_surface_options_parse(client, &options,
+                valid), 0);
+    CU_ASSERT_EQUAL(options.jpeg_quality, 85);
+    CU_ASSERT_EQUAL(options.encoder_threads, 4);
+    CU_ASSERT_EQUAL(options.damage_tiles, 1);
+    CU_ASSERT_EQUAL(options.image_cache_size, 2048);
+    CU_ASSERT_EQUAL(options.motion_detection, 1);
+    CU_ASSERT_EQUAL(options.delta_updates, 1);
+    CU_ASSERT_EQUAL(options.update_cost, 300);
+    CU_ASSERT_EQUAL(options.pixel_cost, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(options.surface_trace);
+    CU_ASSERT_STRING_EQUAL(options.surface_trace, "trace");
+    CU_ASSERT_PTR_NOT_EQUAL(options.surface_trace,
+            valid[GUAC_COMMON_SURFACE_OPTIONS_IDX_SURFACE_TRACE]);
+    free(options.surface_trace);
+
+    /* Bandwidth thresholds are given in kbit/s but stored in bytes/s */
+    CU_ASSERT_EQUAL(options.adaptive_encoding, 1);
+    CU_ASSERT_EQUAL(options.reduced_color_bandwidth, 250000);
+    CU_ASSERT_EQUAL(options.lossy_bandwidth, 125000);
+    CU_ASSERT_EQUAL(options.reduced_rate_bandwidth, 0);
+
+    /* Out-of-range values are ignored in favor of the defaults */
+    CU_ASSERT_EQUAL(guac_common_surface_options_parse(client, &options,
+                invalid), 0);
+    CU_ASSERT_EQUAL(options.jpeg_quality, 0);
+    CU_ASSERT_EQUAL(options.encoder_threads, 0);
+    CU_ASSERT_EQUAL(options.damage_tiles, 0);
+    CU_ASSERT_EQUAL(options.motion_detection, 0);
+
+    guac_client_free(client);
+
+}
+
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "common_suite.h"
+#include "guac_surface.h"
+#include "guac_worker_pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+/**
+ * The number of separate regions drawn to the test surface before flushing.
+ */
+#define TEST_SURFACE_REGIONS 6
+
+/**
+ * The width and height of each region drawn to the test surface.
+ */
+#define TEST_SURFACE_REGION_SIZE 96
+
+/**
+ * The number of runs within each batch submitted by each submitting thread.
+ */
+#define TEST_POOL_RUNS 16
+
+/**
+ * The number of batches submitted by each submitting thread.
+ */
+#define TEST_POOL_BATCHES 200
+
+/**
+ * A thread submitting batches to a worker pool shared with other submitting
+ * threads.
+ */
+typedef struct test_pool_submitter {
+
+    /**
+     * The shared worker pool.
+     */
+    guac_common_worker_pool* pool;
+
+    /**
+     * The number of times each run of this submitter has been performed.
+     */
+    int counts[TEST_POOL_RUNS];
+
+} test_pool_submitter;
+
+/**
+ * Task which counts its own runs, yielding to other threads such that
+ * batches of different submitters have the chance to interleave.
+ */
+static void __test_pool_count(void* data) {
+    sched_yield();
+    (*((int*) data))++;
+}
+
+/**
+ * Submits TEST_POOL_BATCHES batches of counting tasks to the pool of the
+ * given test_pool_submitter.
+ */
+static void* __test_pool_submit(void* data) {
+
+    test_pool_submitter* submitter = (test_pool_submitter*) data;
+    void* runs[TEST_POOL_RUNS];
+    int i;
+
+    for (i = 0; i < TEST_POOL_RUNS; i++) {
+        submitter->counts[i] = 0;
+        runs[i] = &submitter->counts[i];
+    }
+
+    for (i = 0; i < TEST_POOL_BATCHES; i++)
+        guac_common_worker_pool_run(submitter->pool, __test_pool_count,
+                runs, TEST_POOL_RUNS);
+
+    return NULL;
+
+}
+
+/**
+ * Draws several well-separated regions of noise to a new surface and flushes
+ * the surface, using the given worker pool if not NULL, storing everything
+ * sent within the given output.
+ */
+static void __test_surface_flush(guac_client* client,
+        guac_common_worker_pool* pool, test_capture* output) {
+
+    guac_common_surface* surface;
+    guac_socket* socket;
+    int i, x, y;
+
+    socket = test_capture_socket_alloc(output);
+
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            1024, 768);
+    guac_common_surface_set_encoder_pool(surface, pool);
+
+    /* Draw the same regions of noise regardless of pool */
+    srand(0x5EED);
+    for (i = 0; i < TEST_SURFACE_REGIONS; i++) {
+
+        cairo_surface_t* region = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                TEST_SURFACE_REGION_SIZE, TEST_SURFACE_REGION_SIZE);
+
+        unsigned char* data = cairo_image_surface_get_data(region);
+        int stride = cairo_image_surface_get_stride(region);
+
+        for (y = 0; y < TEST_SURFACE_REGION_SIZE; y++) {
+            uint32_t* pixels = (uint32_t*) (data + y * stride);
+            for (x = 0; x < TEST_SURFACE_REGION_SIZE; x++)
+                pixels[x] = rand() & 0xFFFFFF;
+        }
+
+        cairo_surface_mark_dirty(region);
+
+        /* Spread regions across surface such that they are not combined */
+        guac_common_surface_draw(surface, (i % 3) * 400, (i / 3) * 500,
+                region);
+        cairo_surface_destroy(region);
+
+    }
+
+    guac_common_surface_flush(surface);
+    guac_common_surface_free(surface);
+
+    guac_socket_flush(socket);
+    guac_socket_free(socket);
+
+}
+
+void test_guac_surface_parallel() {
+
+    test_capture serial;
+    test_capture parallel;
+    guac_socket_image_stats stats;
+    int threads[] = { 1, 3, 8 };
+    unsigned int i;
+
+    guac_client* client = guac_client_alloc();
+
+    /* Reference output, encoded by flushing thread */
+    __test_surface_flush(client, NULL, &serial);
+
+    /* Each region must have been sent separately */
+    CU_ASSERT_EQUAL(test_capture_count(&serial, "3.png,"),
+            TEST_SURFACE_REGIONS);
+
+    /* Output must be identical regardless of pool size */
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+
+        guac_common_worker_pool* pool = guac_common_worker_pool_alloc(threads[i]);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+        __test_surface_flush(client, pool, &parallel);
+        guac_common_worker_pool_free(pool);
+
+        CU_ASSERT_EQUAL(parallel.length, serial.length);
+        CU_ASSERT_STRING_EQUAL(parallel.data, serial.data);
+        test_capture_free(&parallel);
+
+    }
+
+    test_capture_free(&serial);
+
+    /* Statistics of buffered images must reach the parent socket */
+    guac_socket* socket = guac_socket_alloc();
+    guac_socket* buffer = guac_socket_buffer(socket);
+    cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            16, 16);
+
+    guac_protocol_send_png(buffer, GUAC_COMP_OVER, GUAC_DEFAULT_LAYER, 0, 0,
+            image);
+
+    guac_socket_get_image_stats(socket, &stats);
+    CU_ASSERT_EQUAL(stats.png_images, 0);
+
+    CU_ASSERT_EQUAL(guac_socket_buffer_commit(buffer), 0);
+
+    guac_socket_get_image_stats(socket, &stats);
+    CU_ASSERT_EQUAL(stats.png_images, 1);
+
+    cairo_surface_destroy(image);
+    guac_socket_free(buffer);
+    guac_socket_free(socket);
+
+    guac_client_free(client);
+
+    /* Batches submitted concurrently must each run exactly once */
+    test_pool_submitter submitters[2];
+    pthread_t submitter_threads[2];
+    guac_common_worker_pool* pool = guac_common_worker_pool_alloc(3);
+    int j;
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+    for (i = 0; i < 2; i++) {
+        submitters[i].pool = pool;
+        CU_ASSERT_EQUAL_FATAL(pthread_create(&submitter_threads[i], NULL,
+                    __test_pool_submit, &submitters[i]), 0);
+    }
+
+    for (i = 0; i < 2; i++) {
+        pthread_join(submitter_threads[i], NULL);
+        for (j = 0; j < TEST_POOL_RUNS; j++)
+            CU_ASSERT_EQUAL(submitters[i].counts[j], TEST_POOL_BATCHES);
+    }
+
+    guac_common_worker_pool_free(pool);
+
+}
+
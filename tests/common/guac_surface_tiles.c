@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "common_suite.h"
+#include "guac_surface.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/socket.h>
+
+/**
+ * Flushes the given surface, returning the number of "png" instructions sent
+ * as a result.
+ */
+static int __test_tiles_flush(guac_common_surface* surface,
+        test_capture* output) {
+
+    test_capture_reset(output);
+
+    guac_common_surface_flush(surface);
+    guac_socket_flush(surface->socket);
+
+    return test_capture_count(output, "3.png,");
+
+}
+
+/**
+ * Creates a new image of the given size, filled with noise generated from
+ * the given seed, if non-zero, or black if zero. If an offset is given, the
+ * noise covers only a 16x16 square at that offset.
+ */
+static cairo_surface_t* __test_tiles_image(int width, int height,
+        unsigned int seed, int offset) {
+
+    cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            width, height);
+
+    unsigned char* data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int x, y;
+
+    srand(seed);
+    for (y = 0; y < height; y++) {
+        uint32_t* pixels = (uint32_t*) (data + y * stride);
+        for (x = 0; x < width; x++) {
+
+            int noisy = seed != 0 && (offset < 0
+                    || (x >= offset && x < offset + 16
+                     && y >= offset && y < offset + 16));
+
+            pixels[x] = noisy ? rand() & 0xFFFFFF : 0;
+
+        }
+    }
+
+    cairo_surface_mark_dirty(image);
+    return image;
+
+}
+
+/**
+ * Draws the image described by the given parameters, as accepted by
+ * __test_tiles_image(), to the given surface.
+ */
+static void __test_tiles_draw(guac_common_surface* surface, int x, int y,
+        int width, int height, unsigned int seed, int offset) {
+
+    cairo_surface_t* image = __test_tiles_image(width, height, seed, offset);
+    guac_common_surface_draw(surface, x, y, image);
+    cairo_surface_destroy(image);
+
+}
+
+void test_guac_surface_tiles() {
+
+    test_capture output;
+
+    guac_client* client = guac_client_alloc();
+    guac_socket* socket = test_capture_socket_alloc(&output);
+    guac_common_surface* surface;
+
+    surface = guac_common_surface_alloc(client, socket, GUAC_DEFAULT_LAYER,
+            1024, 768);
+
+    /* Damage tracked by the queue is flushed when switching to tiles */
+    __test_tiles_draw(surface, 0, 0, 32, 32, 1, -1);
+    test_capture_reset(&output);
+    guac_common_surface_set_damage_model(surface,
+            GUAC_COMMON_SURFACE_DAMAGE_TILES);
+    guac_socket_flush(socket);
+    CU_ASSERT_PTR_NOT_NULL(strstr(output.data, "3.png,"));
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 0);
+
+    /* Distant updates are sent separately */
+    __test_tiles_draw(surface, 0, 0, 64, 64, 2, 10);
+    __test_tiles_draw(surface, 900, 700, 16, 16, 3, -1);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 2);
+
+    /* Redrawing identical content sends nothing */
+    __test_tiles_draw(surface, 0, 0, 64, 64, 2, 10);
+    __test_tiles_draw(surface, 900, 700, 16, 16, 3, -1);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 0);
+
+    /* Changed content is sent */
+    __test_tiles_draw(surface, 900, 700, 16, 16, 4, -1);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 1);
+
+    /* Updates spanning a block of tiles are coalesced into one rectangle */
+    __test_tiles_draw(surface, 64, 128, 200, 100, 5, -1);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 1);
+
+    /* Updates spanning a ragged set of tiles still need few rectangles */
+    __test_tiles_draw(surface, 640, 0, 10, 200, 6, -1);
+    __test_tiles_draw(surface, 640, 0, 200, 10, 7, -1);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 2);
+
+    /* Content drawn directly by the client must not be trusted to match the
+     * hash of previously-sent content */
+    guac_common_surface_rect(surface, 0, 0, 256, 256, 0x12, 0x34, 0x56);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 0);
+    __test_tiles_draw(surface, 0, 0, 64, 64, 2, 10);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 1);
+
+    /* Tiles remain tracked across resize */
+    guac_common_surface_resize(surface, 100, 100);
+    __test_tiles_draw(surface, 90, 90, 16, 16, 8, -1);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 1);
+    __test_tiles_draw(surface, 0, 0, 64, 64, 2, 10);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 0);
+
+    /* Switching back to the queue continues to send updates */
+    guac_common_surface_set_damage_model(surface,
+            GUAC_COMMON_SURFACE_DAMAGE_QUEUE);
+    __test_tiles_draw(surface, 0, 0, 64, 64, 9, -1);
+    CU_ASSERT_EQUAL(__test_tiles_flush(surface, &output), 1);
+
+    guac_common_surface_free(surface);
+    guac_socket_free(socket);
+    test_capture_free(&output);
+    guac_client_free(client);
+
+}
+
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "common_suite.h"
+#include "guac_surface.h"
+#include "guac_surface_trace.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/layer.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+/**
+ * The width of the test surfaces, in pixels.
+ */
+#define TEST_TRACE_WIDTH 160
+
+/**
+ * The height of the test surfaces, in pixels.
+ */
+#define TEST_TRACE_HEIGHT 120
+
+/**
+ * Everything written to a test socket.
+ */
+typedef struct test_trace_output {
+
+    char* data;
+    size_t length;
+    size_t size;
+
+} test_trace_output;
+
+/**
+ * The surfaces of a single test connection, which are looked up by layer
+ * index while replaying.
+ */
+typedef struct test_trace_connection {
+
+    guac_client* client;
+    guac_socket* socket;
+    test_trace_output output;
+
+    guac_layer* buffer;
+    guac_common_surface* surface;
+    guac_common_surface* buffer_surface;
+
+} test_trace_connection;
+
+/**
+ * Write handler which appends all data to the test_trace_output associated
+ * with the socket.
+ */
+static ssize_t __test_trace_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_trace_output* output = (test_trace_output*) socket->data;
+
+    /* Grow as necessary */
+    while (output->length + count >= output->size) {
+        output->size *= 2;
+        output->data = realloc(output->data, output->size);
+    }
+
+    memcpy(output->data + output->length, buf, count);
+    output->length += count;
+    return count;
+
+}
+
+/**
+ * Initializes the given connection with a surface for the default layer
+ * and a surface for a buffer, both with motion detection enabled.
+ */
+static void __test_trace_connect(test_trace_connection* conn) {
+
+    conn->output.length = 0;
+    conn->output.size = 65536;
+    conn->output.data = malloc(conn->output.size);
+
+    conn->client = guac_client_alloc();
+    conn->socket = guac_socket_alloc();
+    conn->socket->data = &conn->output;
+    conn->socket->write_handler = __test_trace_write_handler;
+
+    conn->buffer = guac_client_alloc_buffer(conn->client);
+
+    conn->surface = guac_common_surface_alloc(conn->client, conn->socket,
+            GUAC_DEFAULT_LAYER, TEST_TRACE_WIDTH, TEST_TRACE_HEIGHT);
+    conn->buffer_surface = guac_common_surface_alloc(conn->client,
+            conn->socket, conn->buffer, TEST_TRACE_WIDTH, TEST_TRACE_HEIGHT);
+
+    guac_common_surface_set_motion_detection(conn->surface, 1);
+    guac_common_surface_set_motion_detection(conn->buffer_surface, 1);
+
+}
+
+/**
+ * Frees all surfaces of the given connection, along with the connection
+ * itself.
+ */
+static void __test_trace_disconnect(test_trace_connection* conn) {
+
+    guac_common_surface_free(conn->surface);
+    guac_common_surface_free(conn->buffer_surface);
+    guac_client_free_buffer(conn->client, conn->buffer);
+    guac_socket_free(conn->socket);
+    guac_client_free(conn->client);
+    free(conn->output.data);
+
+}
+
+/**
+ * Returns the surface of the given test_trace_connection having the given
+ * layer index.
+ */
+static guac_common_surface* __test_trace_lookup(int index, void* data) {
+
+    test_trace_connection* conn = (test_trace_connection*) data;
+
+    if (index == conn->surface->layer->index)
+        return conn->surface;
+
+    if (index == conn->buffer_surface->layer->index)
+        return conn->buffer_surface;
+
+    return NULL;
+
+}
+
+/**
+ * Creates an image of the given format filled with repeatable noise.
+ */
+static cairo_surface_t* __test_trace_image(cairo_format_t format,
+        int width, int height, uint32_t seed) {
+
+    cairo_surface_t* image = cairo_image_surface_create(format, width, height);
+    unsigned char* data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        uint32_t* pixels = (uint32_t*) (data + y * stride);
+        for (x = 0; x < width; x++) {
+            seed = seed * 1103515245u + 12345u;
+            pixels[x] = seed >> 8;
+            if (format == CAIRO_FORMAT_ARGB32)
+                pixels[x] |= (seed & 0x80) ? 0xFF000000 : 0;
+        }
+    }
+
+    cairo_surface_mark_dirty(image);
+    return image;
+
+}
+
+/**
+ * Performs a series of operations involving every traced operation on the
+ * surfaces of the given connection.
+ */
+static void __test_trace_draw(test_trace_connection* conn) {
+
+    guac_common_surface* surface = conn->surface;
+    guac_common_surface* buffer = conn->buffer_surface;
+
+    cairo_surface_t* opaque = __test_trace_image(CAIRO_FORMAT_RGB24,
+            TEST_TRACE_WIDTH, TEST_TRACE_HEIGHT, 1);
+    cairo_surface_t* scrolled = __test_trace_image(CAIRO_FORMAT_RGB24,
+            TEST_TRACE_WIDTH, TEST_TRACE_HEIGHT, 1);
+    cairo_surface_t* alpha = __test_trace_image(CAIRO_FORMAT_ARGB32,
+            37, 23, 2);
+
+    unsigned char* data = cairo_image_surface_get_data(scrolled);
+    int stride = cairo_image_surface_get_stride(scrolled);
+
+    /* Scroll content up by 16 rows, such that motion is detected */
+    memmove(data, data + 16 * stride, (TEST_TRACE_HEIGHT - 16) * stride);
+    cairo_surface_mark_dirty(scrolled);
+
+    guac_common_surface_draw(surface, 0, 0, opaque);
+    guac_common_surface_flush(surface);
+    guac_common_surface_draw(surface, 0, 0, scrolled);
+
+    guac_common_surface_draw(buffer, 10, 5, alpha);
+    guac_common_surface_paint(buffer, 50, 40, alpha, 0x12, 0x34, 0x56);
+    guac_common_surface_rect(buffer, 0, 100, 160, 20, 0xAB, 0xCD, 0xEF);
+    guac_common_surface_flush_deferred(buffer);
+
+    guac_common_surface_clip(surface, 20, 20, 100, 60);
+    guac_common_surface_copy(buffer, 0, 0, 80, 80, surface, 0, 0);
+    guac_common_surface_transfer(buffer, 40, 40, 80, 80,
+            GUAC_TRANSFER_BINARY_XOR, surface, 60, 30);
+    guac_common_surface_reset_clip(surface);
+
+    guac_common_surface_resize(buffer, 100, 100);
+    guac_common_surface_copy(buffer, 0, 90, 100, 10, surface, 10, 110);
+
+    guac_common_surface_flush(buffer);
+    guac_common_surface_flush(surface);
+
+    cairo_surface_destroy(opaque);
+    cairo_surface_destroy(scrolled);
+    cairo_surface_destroy(alpha);
+
+}
+
+/**
+ * Returns whether the given surfaces have identical size and content.
+ */
+static int __test_trace_compare(guac_common_surface* a,
+        guac_common_surface* b) {
+
+    int y;
+
+    if (a->width != b->width || a->height != b->height)
+        return 0;
+
+    for (y = 0; y < a->height; y++) {
+        if (memcmp(a->buffer + y * a->stride, b->buffer + y * b->stride,
+                    a->width * 4) != 0)
+            return 0;
+    }
+
+    return 1;
+
+}
+
+void test_guac_surface_trace() {
+
+    char directory[] = "/tmp/guac-surface-trace-XXXXXX";
+    char path[64];
+    char link[64];
+    int counts[GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED + 1] = { 0 };
+
+    test_trace_connection original;
+    test_trace_connection replay;
+    guac_common_surface_trace* trace;
+    guac_common_surface_trace_record record;
+    FILE* file;
+    int applied;
+    int result;
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(directory));
+    snprintf(path, sizeof(path), "%s/trace", directory);
+    snprintf(link, sizeof(link), "%s/link", directory);
+
+    /* Only plain file names within the directory are accepted */
+    CU_ASSERT_PTR_NULL(guac_common_surface_trace_open(directory, ""));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    CU_ASSERT_PTR_NULL(guac_common_surface_trace_open(directory, ".."));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    CU_ASSERT_PTR_NULL(guac_common_surface_trace_open(directory, "../trace"));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+
+    /* Links are never followed */
+    CU_ASSERT_EQUAL_FATAL(symlink(path, link), 0);
+    CU_ASSERT_PTR_NULL(guac_common_surface_trace_open(directory, "link"));
+    CU_ASSERT_NOT_EQUAL(access(path, F_OK), 0);
+
+    /* Record operations of the original connection */
+    __test_trace_connect(&original);
+    trace = guac_common_surface_trace_open(directory, "trace");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(trace);
+    guac_common_surface_set_trace(original.surface, trace);
+    guac_common_surface_set_trace(original.buffer_surface, trace);
+    __test_trace_draw(&original);
+    guac_socket_flush(original.socket);
+
+    CU_ASSERT_EQUAL(trace->failed, 0);
+    CU_ASSERT(trace->records > 0);
+
+    guac_common_surface_set_trace(original.surface, NULL);
+    guac_common_surface_set_trace(original.buffer_surface, NULL);
+    guac_common_surface_trace_free(trace);
+
+    /* Replay those operations against a new connection */
+    __test_trace_connect(&replay);
+    memset(&record, 0, sizeof(record));
+
+    file = fopen(path, "rb");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+    CU_ASSERT_EQUAL(guac_common_surface_trace_read_header(file), 0);
+
+    while ((result = guac_common_surface_trace_read(file, &record)) > 0) {
+
+        CU_ASSERT_FATAL(record.opcode >= GUAC_COMMON_SURFACE_TRACE_SURFACE
+                && record.opcode <= GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED);
+        counts[record.opcode]++;
+
+        /* Only the beginning of each surface's trace is not applied */
+        applied = guac_common_surface_trace_apply(&record,
+                __test_trace_lookup, &replay) == 0;
+        CU_ASSERT_EQUAL(applied,
+                record.opcode != GUAC_COMMON_SURFACE_TRACE_SURFACE);
+
+    }
+
+    CU_ASSERT_EQUAL(result, 0);
+    guac_socket_flush(replay.socket);
+    fclose(file);
+
+    /* Each public operation is recorded once, excluding the copies and
+     * flushes performed internally */
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_SURFACE], 2);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_DRAW], 3);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_PAINT], 1);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_RECT], 1);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_COPY], 2);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_TRANSFER], 1);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_CLIP], 1);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_RESET_CLIP], 1);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_RESIZE], 1);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_FLUSH], 3);
+    CU_ASSERT_EQUAL(counts[GUAC_COMMON_SURFACE_TRACE_FLUSH_DEFERRED], 1);
+
+    /* Replay must reproduce both content and output exactly */
+    CU_ASSERT(__test_trace_compare(original.surface, replay.surface));
+    CU_ASSERT(__test_trace_compare(original.buffer_surface,
+                replay.buffer_surface));
+    CU_ASSERT_EQUAL_FATAL(original.output.length, replay.output.length);
+    CU_ASSERT(memcmp(original.output.data, replay.output.data,
+                original.output.length) == 0);
+
+    /* Existing files are never replaced */
+    CU_ASSERT_PTR_NULL(guac_common_surface_trace_open(directory, "trace"));
+    CU_ASSERT_EQUAL(errno, EEXIST);
+
+    /* Records longer than the largest image are malformed */
+    file = fopen(path, "wb");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+    fwrite(GUAC_COMMON_SURFACE_TRACE_MAGIC "\x04\0\0\0\0\0\0\0\0\0\0\0"
+            "\x04\0\0\x40", GUAC_COMMON_SURFACE_TRACE_MAGIC_LENGTH + 16, 1,
+            file);
+    fclose(file);
+
+    file = fopen(path, "rb");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+    CU_ASSERT_EQUAL(guac_common_surface_trace_read_header(file), 0);
+    CU_ASSERT(guac_common_surface_trace_read(file, &record) < 0);
+    fclose(file);
+
+    /* Truncated traces are malformed */
+    file = fopen(path, "rb");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+    CU_ASSERT_EQUAL(truncate(path, GUAC_COMMON_SURFACE_TRACE_MAGIC_LENGTH + 6), 0);
+    CU_ASSERT_EQUAL(guac_common_surface_trace_read_header(file), 0);
+    CU_ASSERT(guac_common_surface_trace_read(file, &record) < 0);
+    fclose(file);
+
+    /* Files which are not traces are rejected */
+    file = fopen(path, "rb");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+    CU_ASSERT_EQUAL(truncate(path, 4), 0);
+    CU_ASSERT_NOT_EQUAL(guac_common_surface_trace_read_header(file), 0);
+    fclose(file);
+
+    free(record.data);
+    unlink(path);
+    unlink(link);
+    rmdir(directory);
+
+    __test_trace_disconnect(&original);
+    __test_trace_disconnect(&replay);
+
+}
+
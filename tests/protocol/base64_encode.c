@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "capture_socket.h"
+#include "suite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/socket.h>
+
+/**
+ * The maximum number of input bytes encoded by any single test case.
+ */
+#define TEST_BASE64_MAX_LENGTH 50000
+
+/**
+ * Straightforward reference base64 encoder, including padding.
+ */
+static void __test_base64_reference(const unsigned char* input, int length,
+        char* output) {
+
+    const char* alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    int i;
+    for (i = 0; i < length; i += 3) {
+
+        int remaining = length - i;
+        int a = input[i];
+        int b = remaining > 1 ? input[i+1] : 0;
+        int c = remaining > 2 ? input[i+2] : 0;
+
+        *(output++) = alphabet[a >> 2];
+        *(output++) = alphabet[((a & 0x03) << 4) | (b >> 4)];
+        *(output++) = remaining > 1 ? alphabet[((b & 0x0F) << 2) | (c >> 6)] : '=';
+        *(output++) = remaining > 2 ? alphabet[c & 0x3F] : '=';
+
+    }
+
+    *output = '\0';
+
+}
+
+/**
+ * Encodes the given data using guac_socket_write_base64(), split into chunks
+ * of at most the given size, verifying the result against the reference
+ * encoder. If requested, scatter-gather output is enabled on the socket.
+ */
+static void __test_base64_encode(const unsigned char* input, int length,
+        int chunk_size, int use_writev) {
+
+    static char expected[(TEST_BASE64_MAX_LENGTH / 3 + 1) * 4 + 1];
+
+    test_capture output;
+    int offset;
+
+    guac_socket* socket = test_capture_socket_alloc(&output);
+
+    /* Exercise partial writes of scatter-gather output if requested */
+    if (use_writev)
+        test_capture_socket_require_writev(socket);
+
+    /* Write data in chunks, leaving partial triplets between calls */
+    for (offset = 0; offset < length; offset += chunk_size) {
+
+        int size = length - offset;
+        if (size > chunk_size)
+            size = chunk_size;
+
+        CU_ASSERT_EQUAL(guac_socket_write_base64(socket, input + offset, size), 0);
+
+    }
+
+    CU_ASSERT_EQUAL(guac_socket_flush_base64(socket), 0);
+    CU_ASSERT_EQUAL(guac_socket_flush(socket), 0);
+    guac_socket_free(socket);
+
+    /* Compare against reference */
+    __test_base64_reference(input, length, expected);
+    CU_ASSERT_STRING_EQUAL(output.data, expected);
+
+    test_capture_free(&output);
+
+}
+
+void test_base64_encode() {
+
+    static unsigned char input[TEST_BASE64_MAX_LENGTH];
+
+    int lengths[] = { 0, 1, 2, 3, 4, 5, 11, 12, 13, 29, 30, 31, 47, 48, 49,
+                      6141, 6144, 8189, 12345, 16384, 16386,
+                      TEST_BASE64_MAX_LENGTH };
+    int chunk_sizes[] = { 1, 2, 7, 64, 1000, 20000, TEST_BASE64_MAX_LENGTH };
+
+    unsigned int i, j, use_writev;
+
+    /* Fill input with arbitrary but repeatable data */
+    srand(0xB64);
+    for (i = 0; i < sizeof(input); i++)
+        input[i] = rand() & 0xFF;
+
+    /* Verify all lengths at all chunk sizes, with and without writev */
+    for (use_writev = 0; use_writev <= 1; use_writev++) {
+        for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            for (j = 0; j < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); j++)
+                __test_base64_encode(input, lengths[i], chunk_sizes[j],
+                        use_writev);
+        }
+    }
+
+}
+
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "suite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/error.h>
+#include <guacamole/instruction.h>
+#include <guacamole/socket.h>
+
+/**
+ * The number of instructions written to the test socket.
+ */
+#define TEST_NEXT_INSTRUCTIONS 200
+
+/**
+ * The maximum number of characters in any element of any test instruction.
+ */
+#define TEST_NEXT_MAX_CHARS 300
+
+/**
+ * Characters of various UTF-8 lengths, from which element values are built.
+ */
+static const char* test_next_chars[] = {
+    "a", "z", "0", UTF8_1, "\xf0\x90\xac\x80", "\xc3\xa1", "_", "Q"
+};
+
+/**
+ * Data read from the test socket, delivered in chunks of a fixed size.
+ */
+typedef struct test_next_input {
+
+    const char* data;
+    size_t length;
+    size_t offset;
+    size_t chunk_size;
+
+    /**
+     * Number of calls to the select handler thus far, used to simulate
+     * periodic timeouts.
+     */
+    int selects;
+
+} test_next_input;
+
+/**
+ * Read handler which delivers at most chunk_size bytes per call.
+ */
+static ssize_t __test_next_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    test_next_input* input = (test_next_input*) socket->data;
+    size_t remaining = input->length - input->offset;
+
+    if (count > input->chunk_size)
+        count = input->chunk_size;
+
+    if (count > remaining)
+        count = remaining;
+
+    memcpy(buf, input->data + input->offset, count);
+    input->offset += count;
+    return count;
+
+}
+
+/**
+ * Select handler which times out on every third call.
+ */
+static int __test_next_select_handler(guac_socket* socket, int usec_timeout) {
+
+    test_next_input* input = (test_next_input*) socket->data;
+
+    if (++input->selects % 3 == 0) {
+        guac_error = GUAC_STATUS_TIMEOUT;
+        guac_error_message = "Simulated timeout";
+        return 0;
+    }
+
+    return 1;
+
+}
+
+/**
+ * Returns the number of characters in the given element of the given
+ * instruction.
+ */
+static int __test_next_element_chars(int n, int element) {
+    return (n * 37 + element * 101) % TEST_NEXT_MAX_CHARS;
+}
+
+/**
+ * Builds the expected value of the given element of the given instruction,
+ * returning the number of bytes written.
+ */
+static int __test_next_element(int n, int element, char* buffer) {
+
+    int chars = __test_next_element_chars(n, element);
+    int length = 0;
+    int i;
+
+    for (i = 0; i < chars; i++) {
+
+        /* Favor ASCII, with occasional multibyte characters */
+        const char* c = test_next_chars[((n + i) * (element + 3)) % 16 < 13
+                ? (n + i) % 3
+                : 3 + (n + i) % 3];
+
+        strcpy(buffer + length, c);
+        length += strlen(c);
+
+    }
+
+    buffer[length] = '\0';
+    return length;
+
+}
+
+/**
+ * Reads all test instructions from a socket which delivers data in chunks of
+ * the given size, verifying that each is parsed correctly despite periodic
+ * timeouts, and that the same instruction object is reused throughout.
+ */
+static void __test_instruction_next(const char* data, size_t length,
+        size_t chunk_size) {
+
+    char expected[TEST_NEXT_MAX_CHARS * 4 + 1];
+    guac_instruction* reused = NULL;
+    test_next_input input;
+    int n = 0;
+
+    input.data = data;
+    input.length = length;
+    input.offset = 0;
+    input.chunk_size = chunk_size;
+    input.selects = 0;
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &input;
+    socket->read_handler = __test_next_read_handler;
+    socket->select_handler = __test_next_select_handler;
+
+    while (n < TEST_NEXT_INSTRUCTIONS) {
+
+        guac_instruction* instruction = guac_instruction_next(socket, 0);
+
+        /* Retry on timeout, continuing the partial instruction */
+        if (instruction == NULL) {
+            CU_ASSERT_EQUAL_FATAL(guac_error, GUAC_STATUS_TIMEOUT);
+            continue;
+        }
+
+        /* Instruction must be reused */
+        if (reused == NULL)
+            reused = instruction;
+        CU_ASSERT_PTR_EQUAL_FATAL(instruction, reused);
+
+        CU_ASSERT_STRING_EQUAL(instruction->opcode, "test");
+        CU_ASSERT_EQUAL_FATAL(instruction->argc, 2);
+
+        __test_next_element(n, 0, expected);
+        CU_ASSERT_STRING_EQUAL(instruction->argv[0], expected);
+
+        __test_next_element(n, 1, expected);
+        CU_ASSERT_STRING_EQUAL(instruction->argv[1], expected);
+
+        n++;
+
+    }
+
+    /* Nothing should remain */
+    CU_ASSERT_EQUAL(input.offset, length);
+    guac_socket_free(socket);
+
+}
+
+void test_instruction_next() {
+
+    size_t chunk_sizes[] = { 1, 2, 3, 7, 15, 16, 17, 1000, 65536 };
+    char element[TEST_NEXT_MAX_CHARS * 4 + 1];
+
+    size_t size = TEST_NEXT_INSTRUCTIONS * (sizeof(element) * 2 + 32);
+    char* data = malloc(size);
+    size_t length = 0;
+    unsigned int i;
+    int n;
+
+    /* Build stream of instructions well exceeding the socket buffer */
+    for (n = 0; n < TEST_NEXT_INSTRUCTIONS; n++) {
+
+        __test_next_element(n, 0, element);
+        length += sprintf(data + length, "4.test,%i.%s,",
+                __test_next_element_chars(n, 0), element);
+
+        __test_next_element(n, 1, element);
+        length += sprintf(data + length, "%i.%s;",
+                __test_next_element_chars(n, 1), element);
+
+    }
+
+    for (i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++)
+        __test_instruction_next(data, length, chunk_sizes[i]);
+
+    free(data);
+
+}
+
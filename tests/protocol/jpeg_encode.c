@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "suite.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/error.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+#ifdef ENABLE_JPEG
+#include <jpeglib.h>
+#endif
+
+/**
+ * The width of the test image, in pixels.
+ */
+#define TEST_JPEG_WIDTH 203
+
+/**
+ * The height of the test image, in pixels.
+ */
+#define TEST_JPEG_HEIGHT 117
+
+/**
+ * The maximum average difference allowed between each original and decoded
+ * color component at the highest quality tested.
+ */
+#define TEST_JPEG_MAX_ERROR 4
+
+/**
+ * Everything written to the test socket.
+ */
+typedef struct test_jpeg_output {
+
+    char* data;
+    size_t length;
+    size_t size;
+
+} test_jpeg_output;
+
+/**
+ * Write handler which appends all data to the test_jpeg_output associated
+ * with the socket.
+ */
+static ssize_t __test_jpeg_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_jpeg_output* output = (test_jpeg_output*) socket->data;
+
+    /* Grow as necessary */
+    while (output->length + count >= output->size) {
+        output->size *= 2;
+        output->data = realloc(output->data, output->size);
+    }
+
+    memcpy(output->data + output->length, buf, count);
+    output->length += count;
+    output->data[output->length] = '\0';
+    return count;
+
+}
+
+/**
+ * Returns the color of the smooth, photograph-like test pattern at the given
+ * coordinates.
+ */
+static uint32_t __test_jpeg_color(int x, int y) {
+
+    int red   = x * 255 / TEST_JPEG_WIDTH;
+    int green = y * 255 / TEST_JPEG_HEIGHT;
+    int blue  = (x + y) * 255 / (TEST_JPEG_WIDTH + TEST_JPEG_HEIGHT);
+
+    return (red << 16) | (green << 8) | blue;
+
+}
+
+#ifdef ENABLE_JPEG
+/**
+ * Sends the given surface as a jpeg instruction at the given quality,
+ * returning the decoded length of the resulting JPEG data, which is stored
+ * within the given output. The socket image statistics are verified to
+ * account for exactly that one image.
+ */
+static int __test_jpeg_send(cairo_surface_t* surface, int quality,
+        test_jpeg_output* output, char** jpeg) {
+
+    guac_socket_image_stats stats;
+    char* value;
+    int length;
+
+    output->length = 0;
+    output->size = 1024;
+    output->data = malloc(output->size);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = output;
+    socket->write_handler = __test_jpeg_write_handler;
+
+    CU_ASSERT_EQUAL_FATAL(guac_protocol_send_jpeg(socket, GUAC_COMP_OVER,
+                GUAC_DEFAULT_LAYER, 0, 0, surface, quality), 0);
+
+    /* Verify statistics reflect only this JPEG */
+    guac_socket_get_image_stats(socket, &stats);
+    guac_socket_free(socket);
+
+    CU_ASSERT_EQUAL(stats.jpeg_images, 1);
+    CU_ASSERT_EQUAL(stats.png_images, 0);
+
+    /* Extract and decode final element */
+    CU_ASSERT_NSTRING_EQUAL_FATAL(output->data, "4.jpeg,", 7);
+    value = strrchr(output->data, ',');
+    CU_ASSERT_PTR_NOT_NULL_FATAL(value);
+    value = strchr(value, '.') + 1;
+    value[strlen(value) - 1] = '\0';
+    length = guac_protocol_decode_base64(value);
+
+    CU_ASSERT_EQUAL(stats.jpeg_bytes, length);
+
+    *jpeg = value;
+    return length;
+
+}
+#endif
+
+void test_jpeg_encode() {
+
+    int x, y;
+
+    /* Draw test pattern */
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            TEST_JPEG_WIDTH, TEST_JPEG_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (y = 0; y < TEST_JPEG_HEIGHT; y++) {
+        uint32_t* pixels = (uint32_t*) (data + y * stride);
+        for (x = 0; x < TEST_JPEG_WIDTH; x++)
+            pixels[x] = __test_jpeg_color(x, y);
+    }
+
+    cairo_surface_mark_dirty(surface);
+
+#ifdef ENABLE_JPEG
+
+    int qualities[] = { 10, 50, 95 };
+    int previous_length = 0;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(qualities) / sizeof(qualities[0]); i++) {
+
+        test_jpeg_output output;
+        struct jpeg_decompress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        unsigned char* row;
+        char* jpeg;
+        long error = 0;
+
+        int length = __test_jpeg_send(surface, qualities[i], &output, &jpeg);
+
+        /* Higher quality must not produce smaller images */
+        CU_ASSERT(length >= previous_length);
+        previous_length = length;
+
+        /* Decode JPEG */
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, (unsigned char*) jpeg, length);
+        CU_ASSERT_EQUAL_FATAL(jpeg_read_header(&cinfo, TRUE), JPEG_HEADER_OK);
+
+        cinfo.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&cinfo);
+
+        CU_ASSERT_EQUAL_FATAL(cinfo.output_width, TEST_JPEG_WIDTH);
+        CU_ASSERT_EQUAL_FATAL(cinfo.output_height, TEST_JPEG_HEIGHT);
+        CU_ASSERT_EQUAL_FATAL(cinfo.output_components, 3);
+
+        /* Sum difference from original across all components */
+        row = malloc(TEST_JPEG_WIDTH * 3);
+        while (cinfo.output_scanline < cinfo.output_height) {
+
+            y = cinfo.output_scanline;
+            jpeg_read_scanlines(&cinfo, &row, 1);
+
+            for (x = 0; x < TEST_JPEG_WIDTH; x++) {
+                uint32_t color = __test_jpeg_color(x, y);
+                error += abs(row[x*3]     - (int) ((color >> 16) & 0xFF))
+                       + abs(row[x*3 + 1] - (int) ((color >> 8)  & 0xFF))
+                       + abs(row[x*3 + 2] - (int) ( color        & 0xFF));
+            }
+
+        }
+
+        free(row);
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+
+        /* Image must closely resemble original at high quality */
+        if (qualities[i] >= 90)
+            CU_ASSERT(error / (TEST_JPEG_WIDTH * TEST_JPEG_HEIGHT * 3)
+                    <= TEST_JPEG_MAX_ERROR);
+
+        free(output.data);
+
+    }
+
+#else
+
+    /* Without JPEG support, nothing may be sent */
+    test_jpeg_output output;
+    output.length = 0;
+    output.size = 1024;
+    output.data = malloc(output.size);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &output;
+    socket->write_handler = __test_jpeg_write_handler;
+
+    CU_ASSERT_NOT_EQUAL(guac_protocol_send_jpeg(socket, GUAC_COMP_OVER,
+                GUAC_DEFAULT_LAYER, 0, 0, surface, 90), 0);
+    CU_ASSERT_EQUAL(guac_error, GUAC_STATUS_NOT_SUPPORTED);
+
+    guac_socket_free(socket);
+    CU_ASSERT_EQUAL(output.length, 0);
+    free(output.data);
+
+#endif
+
+    cairo_surface_destroy(surface);
+
+}
+
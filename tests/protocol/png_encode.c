@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "suite.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+#include <png.h>
+
+/**
+ * Everything written to the test socket.
+ */
+typedef struct test_png_output {
+
+    char* data;
+    size_t length;
+    size_t size;
+
+} test_png_output;
+
+/**
+ * PNG data being read by libpng.
+ */
+typedef struct test_png_input {
+
+    const unsigned char* data;
+    size_t length;
+
+} test_png_input;
+
+/**
+ * Write handler which appends all data to the test_png_output associated
+ * with the socket.
+ */
+static ssize_t __test_png_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_png_output* output = (test_png_output*) socket->data;
+
+    /* Grow as necessary */
+    while (output->length + count >= output->size) {
+        output->size *= 2;
+        output->data = realloc(output->data, output->size);
+    }
+
+    memcpy(output->data + output->length, buf, count);
+    output->length += count;
+    output->data[output->length] = '\0';
+    return count;
+
+}
+
+/**
+ * libpng read function which reads from the test_png_input associated with
+ * the given PNG read structure.
+ */
+static void __test_png_read_data(png_structp png, png_bytep data,
+        png_size_t length) {
+
+    test_png_input* input = (test_png_input*) png_get_io_ptr(png);
+
+    if (length > input->length)
+        png_error(png, "Unexpected end of PNG");
+
+    memcpy(data, input->data, length);
+    input->data += length;
+    input->length -= length;
+
+}
+
+/**
+ * Returns the color of the test pattern at the given coordinates, where the
+ * pattern contains exactly the given number of distinct colors.
+ */
+static uint32_t __test_png_color(int x, int y, int colors) {
+
+    int index = (x * 7 + y * 3) % colors;
+
+    /* Spread colors such that many share hash buckets */
+    return ((index * 0x1001) ^ (index << 16)) & 0xFFFFFF;
+
+}
+
+/**
+ * Returns the number of distinct colors actually present within the test
+ * pattern of the given dimensions, which may be fewer than requested for
+ * small images.
+ */
+static int __test_png_distinct(int width, int height, int colors) {
+
+    char* seen = calloc(colors, 1);
+    int distinct = 0;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            int index = (x * 7 + y * 3) % colors;
+            if (!seen[index]) {
+                seen[index] = 1;
+                distinct++;
+            }
+        }
+    }
+
+    free(seen);
+    return distinct;
+
+}
+
+/**
+ * Sends a test pattern drawn using the given number of colors as a png
+ * instruction, verifying that it decodes to exactly the original pixels, and
+ * that it was written as a palette image of the expected depth if the
+ * number of colors allows.
+ */
+static void __test_png_encode(int width, int height, int colors) {
+
+    test_png_output output;
+    test_png_input input;
+
+    png_structp png;
+    png_infop png_info;
+    png_byte* row;
+    int expected_depth;
+
+    int x, y;
+    char* base64;
+    int length;
+
+    int distinct = __test_png_distinct(width, height, colors);
+
+    /* Draw test pattern */
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            width, height);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (y = 0; y < height; y++) {
+        uint32_t* pixels = (uint32_t*) (data + y * stride);
+        for (x = 0; x < width; x++)
+            pixels[x] = __test_png_color(x, y, colors);
+    }
+
+    cairo_surface_mark_dirty(surface);
+
+    /* Send image */
+    output.length = 0;
+    output.size = 1024;
+    output.data = malloc(output.size);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &output;
+    socket->write_handler = __test_png_write_handler;
+
+    CU_ASSERT_EQUAL_FATAL(guac_protocol_send_png(socket, GUAC_COMP_OVER,
+                GUAC_DEFAULT_LAYER, 0, 0, surface), 0);
+    guac_socket_free(socket);
+
+    /* Extract and decode final element */
+    base64 = strrchr(output.data, ',');
+    CU_ASSERT_PTR_NOT_NULL_FATAL(base64);
+    base64 = strchr(base64, '.') + 1;
+    base64[strlen(base64) - 1] = '\0';
+    length = guac_protocol_decode_base64(base64);
+
+    input.data = (unsigned char*) base64;
+    input.length = length;
+
+    /* Read PNG, expanding any palette to RGB */
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_info = png_create_info_struct(png);
+    row = malloc(width * 4);
+
+    if (setjmp(png_jmpbuf(png))) {
+        CU_FAIL("PNG could not be decoded");
+        png_destroy_read_struct(&png, &png_info, NULL);
+        free(row);
+        free(output.data);
+        cairo_surface_destroy(surface);
+        return;
+    }
+
+    png_set_read_fn(png, &input, __test_png_read_data);
+    png_read_info(png, png_info);
+
+    /* Verify palette images are used whenever possible */
+    if (distinct <= 256) {
+
+        if      (distinct <= 2)  expected_depth = 1;
+        else if (distinct <= 4)  expected_depth = 2;
+        else if (distinct <= 16) expected_depth = 4;
+        else                   expected_depth = 8;
+
+        CU_ASSERT_EQUAL(png_get_color_type(png, png_info),
+                PNG_COLOR_TYPE_PALETTE);
+        CU_ASSERT_EQUAL(png_get_bit_depth(png, png_info), expected_depth);
+
+    }
+    else
+        CU_ASSERT_NOT_EQUAL(png_get_color_type(png, png_info),
+                PNG_COLOR_TYPE_PALETTE);
+
+    png_set_expand(png);
+    png_set_strip_alpha(png);
+    png_read_update_info(png, png_info);
+
+    CU_ASSERT_EQUAL_FATAL(png_get_image_width(png, png_info), width);
+    CU_ASSERT_EQUAL_FATAL(png_get_image_height(png, png_info), height);
+
+    /* Verify every pixel */
+    for (y = 0; y < height; y++) {
+
+        png_read_row(png, row, NULL);
+
+        for (x = 0; x < width; x++) {
+
+            uint32_t color = (row[x*3] << 16) | (row[x*3 + 1] << 8)
+                           | row[x*3 + 2];
+
+            if (color != __test_png_color(x, y, colors)) {
+                CU_FAIL("Decoded pixel does not match original");
+                y = height;
+                break;
+            }
+
+        }
+
+    }
+
+    png_destroy_read_struct(&png, &png_info, NULL);
+    free(row);
+    free(output.data);
+    cairo_surface_destroy(surface);
+
+}
+
+void test_png_encode() {
+
+    int widths[] = { 1, 3, 7, 8, 9, 33, 640 };
+    int colors[] = { 1, 2, 3, 4, 5, 16, 17, 255, 256, 257, 1000 };
+
+    unsigned int i, j;
+
+    /* Encode each combination, reusing encoder state between images */
+    for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        for (j = 0; j < sizeof(colors) / sizeof(colors[0]); j++)
+            __test_png_encode(widths[i], 17, colors[j]);
+    }
+
+}
+
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "config.h"
+
+#include "suite.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+#include <guacamole/wakeups.h>
+
+/**
+ * Everything written to a test socket.
+ */
+typedef struct test_keep_alive_output {
+
+    pthread_mutex_t lock;
+    char data[256];
+    size_t length;
+
+} test_keep_alive_output;
+
+/**
+ * Write handler which appends all data to the test_keep_alive_output
+ * associated with the socket, discarding anything which does not fit.
+ */
+static ssize_t __test_keep_alive_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_keep_alive_output* output = (test_keep_alive_output*) socket->data;
+    size_t length = count;
+
+    pthread_mutex_lock(&(output->lock));
+
+    if (length > sizeof(output->data) - 1 - output->length)
+        length = sizeof(output->data) - 1 - output->length;
+
+    memcpy(output->data + output->length, buf, length);
+    output->length += length;
+    output->data[output->length] = '\0';
+
+    pthread_mutex_unlock(&(output->lock));
+    return count;
+
+}
+
+/**
+ * Allocates a new socket which writes to the given output.
+ */
+static guac_socket* __test_keep_alive_socket_alloc(
+        test_keep_alive_output* output) {
+
+    guac_socket* socket = guac_socket_alloc();
+
+    memset(output, 0, sizeof(test_keep_alive_output));
+    pthread_mutex_init(&(output->lock), NULL);
+
+    socket->data = output;
+    socket->write_handler = __test_keep_alive_write_handler;
+
+    return socket;
+
+}
+
+void test_socket_keep_alive() {
+
+    test_keep_alive_output idle_output;
+    test_keep_alive_output active_output;
+    test_keep_alive_output busy_output;
+
+    guac_socket* busy = __test_keep_alive_socket_alloc(&busy_output);
+    guac_socket* idle = __test_keep_alive_socket_alloc(&idle_output);
+    guac_socket* active = __test_keep_alive_socket_alloc(&active_output);
+
+    /* Wait for more than two slots of the wheel */
+    struct timespec delay = { 0, 700000000 };
+
+    /* Only the idle and busy sockets are due a ping */
+    idle->last_write_timestamp = guac_timestamp_current()
+        - GUAC_SOCKET_KEEP_ALIVE_INTERVAL - 1000;
+    busy->last_write_timestamp = idle->last_write_timestamp;
+
+    /* Requiring keep-alive more than once has no further effect */
+    guac_socket_require_keep_alive(busy);
+    guac_socket_require_keep_alive(idle);
+    guac_socket_require_keep_alive(idle);
+    guac_socket_require_keep_alive(active);
+
+    /* Hold the busy socket within an instruction */
+    guac_socket_instruction_begin(busy);
+
+    nanosleep(&delay, NULL);
+
+    /* Sockets being written to are skipped without delaying others */
+    pthread_mutex_lock(&(busy_output.lock));
+    CU_ASSERT_EQUAL(busy_output.length, 0);
+    pthread_mutex_unlock(&(busy_output.lock));
+
+    pthread_mutex_lock(&(idle_output.lock));
+    CU_ASSERT_STRING_EQUAL(idle_output.data, "3.nop;");
+    pthread_mutex_unlock(&(idle_output.lock));
+
+    pthread_mutex_lock(&(active_output.lock));
+    CU_ASSERT_EQUAL(active_output.length, 0);
+    pthread_mutex_unlock(&(active_output.lock));
+
+    /* Skipped sockets are pinged once no longer busy */
+    guac_socket_instruction_end(busy);
+    nanosleep(&delay, NULL);
+
+    pthread_mutex_lock(&(busy_output.lock));
+    CU_ASSERT_STRING_EQUAL(busy_output.data, "3.nop;");
+    pthread_mutex_unlock(&(busy_output.lock));
+
+    /* The shared thread counts its wakeups */
+    CU_ASSERT(guac_wakeups_get_total() > 0);
+
+    guac_socket_free(busy);
+    guac_socket_free(idle);
+    guac_socket_free(active);
+
+    pthread_mutex_destroy(&(busy_output.lock));
+    pthread_mutex_destroy(&(idle_output.lock));
+    pthread_mutex_destroy(&(active_output.lock));
+
+}
+
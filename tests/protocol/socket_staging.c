@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "suite.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+#include <guacamole/stream.h>
+
+/**
+ * The number of threads writing to the socket concurrently.
+ */
+#define TEST_STAGING_THREADS 4
+
+/**
+ * The number of blob instructions written by each thread.
+ */
+#define TEST_STAGING_INSTRUCTIONS 200
+
+/**
+ * Everything written to the test socket.
+ */
+typedef struct test_staging_output {
+
+    char* data;
+    size_t length;
+    size_t size;
+
+} test_staging_output;
+
+/**
+ * Write handler which appends all data to the test_staging_output associated
+ * with the socket.
+ */
+static ssize_t __test_staging_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_staging_output* output = (test_staging_output*) socket->data;
+
+    /* Grow as necessary */
+    while (output->length + count >= output->size) {
+        output->size *= 2;
+        output->data = realloc(output->data, output->size);
+    }
+
+    memcpy(output->data + output->length, buf, count);
+    output->length += count;
+    return count;
+
+}
+
+/**
+ * Returns the length of the blob sent by the given thread as its Nth
+ * instruction. Lengths vary widely such that some instructions will exceed
+ * the staging limit and be spilled.
+ */
+static int __test_staging_blob_length(int thread, int n) {
+    return ((thread + 1) * 7919 * (n + 1)) % (GUAC_SOCKET_STAGING_LIMIT);
+}
+
+/**
+ * Returns the value of the given byte of the blob sent by the given thread as
+ * its Nth instruction.
+ */
+static unsigned char __test_staging_blob_byte(int thread, int n, int i) {
+    return (thread * 31 + n * 7 + i) & 0xFF;
+}
+
+/**
+ * Thread which writes a series of blob instructions to the given socket,
+ * using the stream index to identify the writing thread.
+ */
+static void* __test_staging_thread(void* data) {
+
+    static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+    static int next_index = 0;
+
+    guac_socket* socket = (guac_socket*) data;
+    guac_stream stream;
+    unsigned char* blob = malloc(GUAC_SOCKET_STAGING_LIMIT);
+    int n, i;
+
+    /* Identify thread by stream index */
+    pthread_mutex_lock(&index_lock);
+    stream.index = next_index++;
+    pthread_mutex_unlock(&index_lock);
+
+    for (n = 0; n < TEST_STAGING_INSTRUCTIONS; n++) {
+
+        int length = __test_staging_blob_length(stream.index, n);
+        for (i = 0; i < length; i++)
+            blob[i] = __test_staging_blob_byte(stream.index, n, i);
+
+        guac_protocol_send_blob(socket, &stream, blob, length);
+
+        /* Flush occasionally, as the output thread of guacd would */
+        if (n % 16 == 0)
+            guac_socket_flush(socket);
+
+    }
+
+    free(blob);
+    return NULL;
+
+}
+
+/**
+ * Parses a single length-prefixed element from the given string, returning a
+ * pointer to the element value and storing its length. The string pointer is
+ * advanced past the element and its terminator.
+ */
+static char* __test_staging_parse_element(char** str, int* length) {
+
+    char* value;
+
+    *length = strtol(*str, &value, 10);
+    CU_ASSERT_EQUAL_FATAL(*value, '.');
+
+    value++;
+    *str = value + *length + 1;
+    return value;
+
+}
+
+void test_socket_staging() {
+
+    pthread_t threads[TEST_STAGING_THREADS];
+    int next_blob[TEST_STAGING_THREADS] = { 0 };
+    guac_socket_lock_stats stats;
+
+    test_staging_output output;
+    char* current;
+    char* end;
+    int i;
+
+    output.length = 0;
+    output.size = 65536;
+    output.data = malloc(output.size);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &output;
+    socket->write_handler = __test_staging_write_handler;
+    guac_socket_require_staging(socket);
+
+    /* Write concurrently from several threads */
+    for (i = 0; i < TEST_STAGING_THREADS; i++)
+        pthread_create(&threads[i], NULL, __test_staging_thread, socket);
+
+    for (i = 0; i < TEST_STAGING_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    guac_socket_flush(socket);
+
+    /* Every instruction must have been staged or spilled */
+    guac_socket_get_lock_stats(socket, &stats);
+    CU_ASSERT_EQUAL(stats.staged_instructions + stats.spilled_instructions,
+            TEST_STAGING_THREADS * TEST_STAGING_INSTRUCTIONS);
+    CU_ASSERT(stats.spilled_instructions > 0);
+    CU_ASSERT(stats.acquisitions >= stats.contended);
+
+    guac_socket_free(socket);
+
+    /* Verify that all instructions were written intact and in order */
+    current = output.data;
+    end = output.data + output.length;
+    while (current < end) {
+
+        int length;
+        int thread;
+        char* opcode = __test_staging_parse_element(&current, &length);
+        char* index;
+        char* blob;
+
+        CU_ASSERT_NSTRING_EQUAL_FATAL(opcode, "blob", 4);
+
+        /* Verify stream index identifies a writing thread */
+        index = __test_staging_parse_element(&current, &length);
+        thread = atoi(index);
+        CU_ASSERT_FATAL(thread >= 0 && thread < TEST_STAGING_THREADS);
+
+        /* Verify blob contents are exactly as sent by that thread */
+        blob = __test_staging_parse_element(&current, &length);
+        CU_ASSERT_EQUAL_FATAL(*(current - 1), ';');
+
+        blob[length] = '\0';
+        length = guac_protocol_decode_base64(blob);
+
+        int n = next_blob[thread]++;
+        CU_ASSERT_EQUAL_FATAL(length, __test_staging_blob_length(thread, n));
+
+        for (i = 0; i < length; i++) {
+            if ((unsigned char) blob[i] != __test_staging_blob_byte(thread, n, i)) {
+                CU_FAIL("Blob contents corrupted");
+                break;
+            }
+        }
+
+    }
+
+    /* All instructions must have been received */
+    for (i = 0; i < TEST_STAGING_THREADS; i++)
+        CU_ASSERT_EQUAL(next_blob[i], TEST_STAGING_INSTRUCTIONS);
+
+    free(output.data);
+
+}
+
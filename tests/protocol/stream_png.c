@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include "suite.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/Basic.h>
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+/**
+ * The maximum number of base64 characters which may be sent within any single
+ * blob instruction of a streamed image.
+ */
+#define TEST_STREAM_PNG_MAX_BLOB 8064
+
+/**
+ * Everything written to a test socket.
+ */
+typedef struct test_stream_png_output {
+
+    char* data;
+    size_t length;
+    size_t size;
+
+} test_stream_png_output;
+
+/**
+ * Write handler which appends all data to the test_stream_png_output
+ * associated with the socket.
+ */
+static ssize_t __test_stream_png_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_stream_png_output* output = (test_stream_png_output*) socket->data;
+
+    /* Grow as necessary */
+    while (output->length + count >= output->size) {
+        output->size *= 2;
+        output->data = realloc(output->data, output->size);
+    }
+
+    memcpy(output->data + output->length, buf, count);
+    output->length += count;
+    output->data[output->length] = '\0';
+    return count;
+
+}
+
+/**
+ * Allocates a socket which writes all data to the given output.
+ */
+static guac_socket* __test_stream_png_socket(test_stream_png_output* output) {
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = output;
+    socket->write_handler = __test_stream_png_write_handler;
+
+    output->length = 0;
+    output->size = 65536;
+    output->data = malloc(output->size);
+
+    return socket;
+
+}
+
+/**
+ * Parses a single length-prefixed element from the given string, returning a
+ * pointer to the element value and storing its length. The string pointer is
+ * advanced past the element and its terminator, which is stored in the given
+ * character.
+ */
+static char* __test_stream_png_parse_element(char** str, int* length,
+        char* terminator) {
+
+    char* value;
+
+    *length = strtol(*str, &value, 10);
+    CU_ASSERT_EQUAL_FATAL(*value, '.');
+
+    value++;
+    *terminator = value[*length];
+    *str = value + *length + 1;
+    return value;
+
+}
+
+/**
+ * Skips the given number of elements, verifying that the last is followed
+ * by the given terminator.
+ */
+static void __test_stream_png_skip(char** str, int count, char terminator) {
+
+    int length;
+    char last = 0;
+
+    while (count-- > 0)
+        __test_stream_png_parse_element(str, &length, &last);
+
+    CU_ASSERT_EQUAL_FATAL(last, terminator);
+
+}
+
+/**
+ * Decodes the given base64 data in place, appending the result to the given
+ * buffer.
+ */
+static void __test_stream_png_append(char* base64, int length,
+        unsigned char* buffer, int* buffer_length) {
+
+    base64[length] = '\0';
+    length = guac_protocol_decode_base64(base64);
+
+    memcpy(buffer + *buffer_length, base64, length);
+    *buffer_length += length;
+
+}
+
+/**
+ * Sends the given surface both as a "png" instruction and as a streamed
+ * image, verifying that the streamed image is sent in bounded blobs which
+ * together contain exactly the same PNG as the "png" instruction.
+ */
+static void __test_stream_png(guac_client* client, cairo_surface_t* surface) {
+
+    test_stream_png_output reference;
+    test_stream_png_output streamed;
+
+    unsigned char* expected;
+    unsigned char* received;
+    int expected_length = 0;
+    int received_length = 0;
+    int blobs = 0;
+
+    char* current;
+    char* value;
+    char terminator;
+    int length;
+
+    guac_socket_image_stats stats;
+    uint64_t images = client->image_stats.images;
+
+    /* Send as png instruction */
+    guac_socket* socket = __test_stream_png_socket(&reference);
+    CU_ASSERT_EQUAL(guac_protocol_send_png(socket, GUAC_COMP_OVER,
+                GUAC_DEFAULT_LAYER, 0, 0, surface), 0);
+
+    guac_socket_get_image_stats(socket, &stats);
+    CU_ASSERT_EQUAL(stats.png_images, 1);
+    CU_ASSERT_EQUAL(stats.streamed_images, 0);
+    guac_socket_free(socket);
+
+    /* Send as streamed image */
+    socket = __test_stream_png_socket(&streamed);
+    CU_ASSERT_EQUAL(guac_client_stream_png(client, socket, GUAC_COMP_OVER,
+                GUAC_DEFAULT_LAYER, 0, 0, surface), 0);
+
+    guac_socket_get_image_stats(socket, &stats);
+    CU_ASSERT_EQUAL(stats.png_images, 1);
+    CU_ASSERT_EQUAL(stats.streamed_images, 1);
+    guac_socket_free(socket);
+
+    CU_ASSERT_EQUAL(client->image_stats.images, images + 1);
+
+    expected = malloc(reference.length);
+    received = malloc(streamed.length);
+
+    /* Extract PNG from png instruction */
+    current = reference.data;
+    value = __test_stream_png_parse_element(&current, &length, &terminator);
+    CU_ASSERT_NSTRING_EQUAL_FATAL(value, "png", 3);
+    __test_stream_png_skip(&current, 4, ',');
+    value = __test_stream_png_parse_element(&current, &length, &terminator);
+    CU_ASSERT_EQUAL_FATAL(terminator, ';');
+    __test_stream_png_append(value, length, expected, &expected_length);
+
+    /* Verify img instruction */
+    current = streamed.data;
+    value = __test_stream_png_parse_element(&current, &length, &terminator);
+    CU_ASSERT_NSTRING_EQUAL_FATAL(value, "img", 3);
+    __test_stream_png_skip(&current, 3, ',');
+    value = __test_stream_png_parse_element(&current, &length, &terminator);
+    CU_ASSERT_NSTRING_EQUAL_FATAL(value, "image/png", 9);
+    __test_stream_png_skip(&current, 2, ';');
+
+    /* Extract PNG from blobs, verifying each is bounded */
+    for (;;) {
+
+        value = __test_stream_png_parse_element(&current, &length, &terminator);
+        if (strncmp(value, "end", 3) == 0)
+            break;
+
+        CU_ASSERT_NSTRING_EQUAL_FATAL(value, "blob", 4);
+        __test_stream_png_skip(&current, 1, ',');
+
+        value = __test_stream_png_parse_element(&current, &length, &terminator);
+        CU_ASSERT_EQUAL_FATAL(terminator, ';');
+        CU_ASSERT(length <= TEST_STREAM_PNG_MAX_BLOB);
+        __test_stream_png_append(value, length, received, &received_length);
+        blobs++;
+
+    }
+
+    /* Stream must be ended, and nothing may follow */
+    __test_stream_png_skip(&current, 1, ';');
+    CU_ASSERT_PTR_EQUAL(current, streamed.data + streamed.length);
+
+    /* Streamed image must be identical */
+    CU_ASSERT(blobs > 0);
+    CU_ASSERT_EQUAL_FATAL(received_length, expected_length);
+    CU_ASSERT(memcmp(received, expected, expected_length) == 0);
+
+    free(expected);
+    free(received);
+    free(reference.data);
+    free(streamed.data);
+
+}
+
+void test_stream_png() {
+
+    int x, y;
+
+    guac_client* client = guac_client_alloc();
+
+    /* Image with few colors, written as a palette PNG */
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            640, 480);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (y = 0; y < 480; y++) {
+        uint32_t* row = (uint32_t*) (data + y * stride);
+        for (x = 0; x < 640; x++)
+            row[x] = ((x / 16 + y / 16) % 3) * 0x404040;
+    }
+
+    cairo_surface_mark_dirty(surface);
+    __test_stream_png(client, surface);
+
+    /* Image with many colors, written by Cairo */
+    srand(0x504E47);
+    for (y = 0; y < 480; y++) {
+        uint32_t* row = (uint32_t*) (data + y * stride);
+        for (x = 0; x < 640; x++)
+            row[x] = rand() & 0xFFFFFF;
+    }
+
+    cairo_surface_mark_dirty(surface);
+    __test_stream_png(client, surface);
+
+    /* Tiny image, requiring only a single blob */
+    cairo_surface_destroy(surface);
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+    __test_stream_png(client, surface);
+
+    cairo_surface_destroy(surface);
+    guac_client_free(client);
+
+}
+
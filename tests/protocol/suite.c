@@ -47,10 +47,17 @@ int register_protocol_suite() {
     /* Add tests */
     if (
         CU_add_test(suite, "base64-decode", test_base64_decode) == NULL
+     || CU_add_test(suite, "base64-encode", test_base64_encode) == NULL
+     || CU_add_test(suite, "instruction-next", test_instruction_next) == NULL
      || CU_add_test(suite, "instruction-parse", test_instruction_parse) == NULL
      || CU_add_test(suite, "instruction-read", test_instruction_read) == NULL
      || CU_add_test(suite, "instruction-write", test_instruction_write) == NULL
+     || CU_add_test(suite, "jpeg-encode", test_jpeg_encode) == NULL
      || CU_add_test(suite, "nest-write", test_nest_write) == NULL
+     || CU_add_test(suite, "png-encode", test_png_encode) == NULL
+     || CU_add_test(suite, "socket-keep-alive", test_socket_keep_alive) == NULL
+     || CU_add_test(suite, "socket-staging", test_socket_staging) == NULL
+     || CU_add_test(suite, "stream-png", test_stream_png) == NULL
        ) {
         CU_cleanup_registry();
         return CU_get_error();
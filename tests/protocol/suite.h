@@ -37,10 +37,17 @@
 int register_protocol_suite();
 
 void test_base64_decode();
+void test_base64_encode();
+void test_instruction_next();
 void test_instruction_parse();
 void test_instruction_read();
 void test_instruction_write();
+void test_jpeg_encode();
 void test_nest_write();
+void test_png_encode();
+void test_socket_keep_alive();
+void test_socket_staging();
+void test_stream_png();
 
 #endif
 